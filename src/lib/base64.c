@@ -0,0 +1,122 @@
+/*
+ * Copyright (C) 2015-2021 IoT.bzh Company
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ *
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+*/
+
+#include <stdint.h>
+#include <string.h>
+
+#include "base64.h"
+
+static const char base64_alphabet[64] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+// encode the complete groups of 3 bytes, returns the count of bytes encoded
+static size_t base64_encode_groups(const unsigned char *in, size_t length, char *out)
+{
+	const unsigned char *start = in;
+	uint64_t value;
+
+	// 6 bytes give 8 characters at each step
+	for (; length >= 6; length -= 6, in += 6, out += 8) {
+		value = (uint64_t)in[0] << 40 | (uint64_t)in[1] << 32 | (uint64_t)in[2] << 24 | (uint64_t)in[3] << 16
+			| (uint64_t)in[4] << 8 | in[5];
+		out[0] = base64_alphabet[value >> 42];
+		out[1] = base64_alphabet[(value >> 36) & 63];
+		out[2] = base64_alphabet[(value >> 30) & 63];
+		out[3] = base64_alphabet[(value >> 24) & 63];
+		out[4] = base64_alphabet[(value >> 18) & 63];
+		out[5] = base64_alphabet[(value >> 12) & 63];
+		out[6] = base64_alphabet[(value >> 6) & 63];
+		out[7] = base64_alphabet[value & 63];
+	}
+	if (length >= 3) {
+		value = (uint64_t)in[0] << 16 | (uint64_t)in[1] << 8 | in[2];
+		out[0] = base64_alphabet[value >> 18];
+		out[1] = base64_alphabet[(value >> 12) & 63];
+		out[2] = base64_alphabet[(value >> 6) & 63];
+		out[3] = base64_alphabet[value & 63];
+		in += 3;
+	}
+	return (size_t)(in - start);
+}
+
+// encode the last 1 or 2 bytes with padding
+static void base64_encode_last(const unsigned char *in, size_t length, char *out)
+{
+	unsigned value = (unsigned)in[0] << 16 | (length > 1 ? (unsigned)in[1] << 8 : 0);
+
+	out[0] = base64_alphabet[value >> 18];
+	out[1] = base64_alphabet[(value >> 12) & 63];
+	out[2] = length > 1 ? base64_alphabet[(value >> 6) & 63] : '=';
+	out[3] = '=';
+}
+
+size_t base64_encode(const char *data, size_t length, char *buffer)
+{
+	size_t done = base64_encode_groups((const unsigned char *)data, length, buffer);
+	char *out = &buffer[done / 3 * 4];
+
+	if (done < length) {
+		base64_encode_last((const unsigned char *)&data[done], length - done, out);
+		out += 4;
+	}
+	*out = 0;
+	return (size_t)(out - buffer);
+}
+
+size_t base64_encode_stream(base64_stream_t *stream, const char *data, size_t length, char *buffer)
+{
+	const unsigned char *in = (const unsigned char *)data;
+	unsigned char group[3];
+	size_t out = 0, done;
+
+	// complete the pending group
+	if (stream->npending) {
+		if (stream->npending + length < 3) {
+			memcpy(&stream->pending[stream->npending], in, length);
+			stream->npending += length;
+			return 0;
+		}
+		memcpy(group, stream->pending, stream->npending);
+		memcpy(&group[stream->npending], in, 3 - stream->npending);
+		in += 3 - stream->npending;
+		length -= 3 - stream->npending;
+		stream->npending = 0;
+		out = base64_encode_groups(group, 3, buffer) / 3 * 4;
+	}
+
+	// keep the incomplete group
+	done = base64_encode_groups(in, length, &buffer[out]);
+	out += done / 3 * 4;
+	stream->npending = length - done;
+	memcpy(stream->pending, &in[done], stream->npending);
+	return out;
+}
+
+size_t base64_encode_stream_end(base64_stream_t *stream, char *buffer)
+{
+	size_t length = stream->npending;
+
+	stream->npending = 0;
+	if (length == 0)
+		return 0;
+	base64_encode_last(stream->pending, length, buffer);
+	return 4;
+}
@@ -0,0 +1,59 @@
+/*
+ * Copyright (C) 2015-2021 IoT.bzh Company
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ *
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+*/
+
+#pragma once
+
+#include <stddef.h>
+
+// length of the base64 encoding of length bytes, not counting the terminating nul
+static inline size_t base64_encoded_length(size_t length)
+{
+	return 4 * ((length + 2) / 3);
+}
+
+// encode the length bytes of data in buffer using the standard alphabet with padding
+// the buffer must be able to hold base64_encoded_length(length) + 1 bytes
+// returns the length of the encoded string
+extern size_t base64_encode(const char *data, size_t length, char *buffer);
+
+// state of an encoding of data given in several parts
+typedef struct {
+	unsigned char pending[2];
+	size_t npending;
+} base64_stream_t;
+
+// start an encoding in several parts
+static inline void base64_stream_init(base64_stream_t *stream)
+{
+	stream->npending = 0;
+}
+
+// encode the length bytes of data following the previous parts, without padding nor terminating nul,
+// the bytes of an incomplete group are kept for the next part
+// the buffer must be able to hold base64_encoded_length(length + 2) bytes
+// returns the length of the encoded string
+extern size_t base64_encode_stream(base64_stream_t *stream, const char *data, size_t length, char *buffer);
+
+// encode the kept bytes with padding, without terminating nul
+// the buffer must be able to hold 4 bytes
+// returns the length of the encoded string
+extern size_t base64_encode_stream_end(base64_stream_t *stream, char *buffer);
@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2015-2021 IoT.bzh Company
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ *
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+*/
+
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "block-pool.h"
+
+// free blocks are linked through their first bytes
+typedef struct free_block_s {
+	struct free_block_s *next;
+} free_block_t;
+
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static free_block_t *free_blocks = NULL;
+static int free_count = 0;
+
+void *block_pool_get(void)
+{
+	free_block_t *block;
+
+	pthread_mutex_lock(&mutex);
+	block = free_blocks;
+	if (block != NULL) {
+		free_blocks = block->next;
+		free_count--;
+	}
+	pthread_mutex_unlock(&mutex);
+	return block != NULL ? (void *)block : malloc(BLOCK_POOL_SIZE);
+}
+
+void block_pool_put(void *block)
+{
+	free_block_t *fblock = block;
+
+	if (fblock == NULL)
+		return;
+	pthread_mutex_lock(&mutex);
+	if (free_count < BLOCK_POOL_KEEP) {
+		fblock->next = free_blocks;
+		free_blocks = fblock;
+		free_count++;
+		fblock = NULL;
+	}
+	pthread_mutex_unlock(&mutex);
+	free(fblock);
+}
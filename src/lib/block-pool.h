@@ -0,0 +1,45 @@
+/*
+ * Copyright (C) 2015-2021 IoT.bzh Company
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ *
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+*/
+
+
+#pragma once
+
+#include <stddef.h>
+
+// Pool of fixed size blocks of memory, recycled instead of being freed.
+// The pool is shared by all threads.
+
+#ifndef BLOCK_POOL_SIZE
+#define BLOCK_POOL_SIZE 16384
+#endif
+
+#ifndef BLOCK_POOL_KEEP
+#define BLOCK_POOL_KEEP 64
+#endif
+
+// get a block of BLOCK_POOL_SIZE bytes
+// returns NULL when out of memory
+extern void *block_pool_get(void);
+
+// give back a block got from block_pool_get, NULL is accepted
+// at most BLOCK_POOL_KEEP blocks are kept for recycling
+extern void block_pool_put(void *block);
@@ -0,0 +1,491 @@
+/*
+ * Copyright (C) 2015-2021 IoT.bzh Company
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ *
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "cbor.h"
+#include "base64.h"
+
+// major types
+#define CBOR_UINT 0
+#define CBOR_NINT 1
+#define CBOR_BYTES 2
+#define CBOR_TEXT 3
+#define CBOR_ARRAY 4
+#define CBOR_MAP 5
+#define CBOR_TAG 6
+#define CBOR_SIMPLE 7
+
+// additional information of indefinite length
+#define CBOR_INDEFINITE 31
+// the break stop code
+#define CBOR_BREAK 0xff
+
+typedef struct {
+	const unsigned char *scan;
+	const unsigned char *end;
+} cbor_reader_t;
+
+typedef struct {
+	int major;
+	int info;
+	uint64_t value;
+} cbor_head_t;
+
+// read the head of an item, returns 1 on success, 0 when more data are needed, -1 when invalid
+static int read_head(cbor_reader_t *reader, cbor_head_t *head)
+{
+	const unsigned char *scan = reader->scan;
+	int idx, count;
+
+	if (scan == reader->end)
+		return 0;
+	head->major = *scan >> 5;
+	head->info = *scan++ & 31;
+	if (head->info < 24) {
+		head->value = (uint64_t)head->info;
+	} else if (head->info < 28) {
+		count = 1 << (head->info - 24);
+		if (reader->end - scan < count)
+			return 0;
+		for (head->value = 0, idx = 0; idx < count; idx++)
+			head->value = (head->value << 8) | *scan++;
+	} else if (head->info == CBOR_INDEFINITE) {
+		if (head->major == CBOR_UINT || head->major == CBOR_NINT || head->major == CBOR_TAG)
+			return -1;
+		head->value = 0;
+	} else
+		return -1;
+	reader->scan = scan;
+	return 1;
+}
+
+// skip the item, returns 1 on success, 0 when more data are needed, -1 when invalid
+static int skip_item(cbor_reader_t *reader, int depth)
+{
+	cbor_head_t head;
+	uint64_t count;
+	int rc;
+
+	if (depth > CBOR_MAX_DEPTH)
+		return -1;
+	rc = read_head(reader, &head);
+	if (rc <= 0)
+		return rc;
+
+	switch (head.major) {
+	case CBOR_BYTES:
+	case CBOR_TEXT:
+		if (head.info != CBOR_INDEFINITE) {
+			if ((uint64_t)(reader->end - reader->scan) < head.value)
+				return 0;
+			reader->scan += head.value;
+			return 1;
+		}
+		// chunks of definite length until break
+		for (;;) {
+			if (reader->scan == reader->end)
+				return 0;
+			if (*reader->scan == CBOR_BREAK) {
+				reader->scan++;
+				return 1;
+			}
+			if ((*reader->scan >> 5) != head.major || (*reader->scan & 31) == CBOR_INDEFINITE)
+				return -1;
+			rc = skip_item(reader, depth + 1);
+			if (rc <= 0)
+				return rc;
+		}
+	case CBOR_ARRAY:
+	case CBOR_MAP:
+		if (head.info == CBOR_INDEFINITE) {
+			for (count = 0;; count++) {
+				if (reader->scan == reader->end)
+					return 0;
+				if (*reader->scan == CBOR_BREAK) {
+					reader->scan++;
+					return head.major == CBOR_MAP && (count & 1) ? -1 : 1;
+				}
+				rc = skip_item(reader, depth + 1);
+				if (rc <= 0)
+					return rc;
+			}
+		}
+		count = head.major == CBOR_MAP ? 2 * head.value : head.value;
+		for (; count; count--) {
+			rc = skip_item(reader, depth + 1);
+			if (rc <= 0)
+				return rc;
+		}
+		return 1;
+	case CBOR_TAG:
+		return skip_item(reader, depth + 1);
+	case CBOR_SIMPLE:
+		// a break is only valid in indefinite items
+		return head.info == CBOR_INDEFINITE ? -1 : 1;
+	default:
+		return 1;
+	}
+}
+
+int cbor_item_size(const unsigned char *data, size_t length, size_t *size)
+{
+	cbor_reader_t reader = { .scan = data, .end = data + length };
+	int rc = skip_item(&reader, 0);
+	if (rc > 0)
+		*size = (size_t)(reader.scan - data);
+	return rc;
+}
+
+/***************************************************************************************/
+
+static double half_to_double(unsigned half)
+{
+	int exp = (half >> 10) & 0x1f;
+	unsigned mant = half & 0x3ff;
+	double value;
+
+	if (exp == 0)
+		value = ldexp(mant, -24);
+	else if (exp != 31)
+		value = ldexp(mant + 1024, exp - 25);
+	else
+		value = mant == 0 ? INFINITY : NAN;
+	return half & 0x8000 ? -value : value;
+}
+
+static json_object *decode_item(cbor_reader_t *reader);
+
+// decode a string, gathering the chunks of indefinite strings
+static char *decode_string(cbor_reader_t *reader, cbor_head_t *head, size_t *length)
+{
+	cbor_head_t chunk;
+	char *buffer, *grown;
+	size_t size = 0;
+
+	if (head->info != CBOR_INDEFINITE) {
+		buffer = malloc((size_t)head->value + 1);
+		if (buffer != NULL) {
+			memcpy(buffer, reader->scan, (size_t)head->value);
+			reader->scan += head->value;
+			size = (size_t)head->value;
+		}
+	} else {
+		buffer = malloc(1);
+		while (buffer != NULL && *reader->scan != CBOR_BREAK) {
+			read_head(reader, &chunk);
+			grown = realloc(buffer, size + (size_t)chunk.value + 1);
+			if (grown == NULL) {
+				free(buffer);
+				return NULL;
+			}
+			buffer = grown;
+			memcpy(&buffer[size], reader->scan, (size_t)chunk.value);
+			reader->scan += chunk.value;
+			size += (size_t)chunk.value;
+		}
+		reader->scan++;
+	}
+	if (buffer != NULL)
+		buffer[size] = 0;
+	*length = size;
+	return buffer;
+}
+
+static json_object *decode_bytes(cbor_reader_t *reader, cbor_head_t *head)
+{
+	json_object *result = NULL;
+	size_t length;
+	char *bytes, *text;
+
+	bytes = decode_string(reader, head, &length);
+	if (bytes != NULL) {
+		text = malloc(base64_encoded_length(length) + 1);
+		if (text != NULL) {
+			length = base64_encode(bytes, length, text);
+			result = json_object_new_string_len(text, (int)length);
+			free(text);
+		}
+		free(bytes);
+	}
+	return result;
+}
+
+static json_object *decode_text(cbor_reader_t *reader, cbor_head_t *head)
+{
+	json_object *result = NULL;
+	size_t length;
+	char *text = decode_string(reader, head, &length);
+
+	if (text != NULL) {
+		result = json_object_new_string_len(text, (int)length);
+		free(text);
+	}
+	return result;
+}
+
+// at end of the items of a container
+static bool at_end(cbor_reader_t *reader, cbor_head_t *head, uint64_t *count)
+{
+	if (head->info != CBOR_INDEFINITE)
+		return (*count)-- == 0;
+	if (*reader->scan != CBOR_BREAK)
+		return false;
+	reader->scan++;
+	return true;
+}
+
+static json_object *decode_array(cbor_reader_t *reader, cbor_head_t *head)
+{
+	json_object *array = json_object_new_array();
+	uint64_t count = head->value;
+
+	while (!at_end(reader, head, &count))
+		json_object_array_add(array, decode_item(reader));
+	return array;
+}
+
+static json_object *decode_map(cbor_reader_t *reader, cbor_head_t *head)
+{
+	json_object *object = json_object_new_object(), *key;
+	uint64_t count = head->value;
+	cbor_head_t khead;
+	cbor_reader_t peek;
+	char *name;
+	size_t length;
+
+	while (!at_end(reader, head, &count)) {
+		peek = *reader;
+		read_head(&peek, &khead);
+		if (khead.major == CBOR_TEXT) {
+			*reader = peek;
+			name = decode_string(reader, &khead, &length);
+		} else {
+			key = decode_item(reader);
+			name = strdup(json_object_to_json_string_ext(key, JSON_C_TO_STRING_PLAIN));
+			json_object_put(key);
+		}
+		if (name == NULL) {
+			skip_item(reader, 0);
+			continue;
+		}
+		json_object_object_add(object, name, decode_item(reader));
+		free(name);
+	}
+	return object;
+}
+
+static json_object *decode_simple(cbor_head_t *head)
+{
+	union {
+		uint32_t u;
+		float f;
+	} single;
+	union {
+		uint64_t u;
+		double d;
+	} twice;
+
+	switch (head->info) {
+	case 20:
+		return json_object_new_boolean(0);
+	case 21:
+		return json_object_new_boolean(1);
+	case 25:
+		return json_object_new_double(half_to_double((unsigned)head->value));
+	case 26:
+		single.u = (uint32_t)head->value;
+		return json_object_new_double((double)single.f);
+	case 27:
+		twice.u = head->value;
+		return json_object_new_double(twice.d);
+	default:
+		// null, undefined and other simple values
+		return NULL;
+	}
+}
+
+static json_object *decode_item(cbor_reader_t *reader)
+{
+	cbor_head_t head;
+
+	read_head(reader, &head);
+	switch (head.major) {
+	case CBOR_UINT:
+		if (head.value > INT64_MAX)
+			return json_object_new_double((double)head.value);
+		return json_object_new_int64((int64_t)head.value);
+	case CBOR_NINT:
+		if (head.value > INT64_MAX)
+			return json_object_new_double(-1.0 - (double)head.value);
+		return json_object_new_int64(-1 - (int64_t)head.value);
+	case CBOR_BYTES:
+		return decode_bytes(reader, &head);
+	case CBOR_TEXT:
+		return decode_text(reader, &head);
+	case CBOR_ARRAY:
+		return decode_array(reader, &head);
+	case CBOR_MAP:
+		return decode_map(reader, &head);
+	case CBOR_TAG:
+		return decode_item(reader);
+	default:
+		return decode_simple(&head);
+	}
+}
+
+json_object *cbor_to_json(const unsigned char *data, size_t size)
+{
+	cbor_reader_t reader = { .scan = data, .end = data + size };
+	size_t check;
+
+	// the item is validated before decoding
+	if (cbor_item_size(data, size, &check) <= 0 || check != size)
+		return NULL;
+	return decode_item(&reader);
+}
+
+typedef struct {
+	unsigned char *buffer;
+	size_t size;
+	size_t length;
+} cbor_writer_t;
+
+// put a byte, counting it even when the buffer is full
+static void put_byte(cbor_writer_t *writer, unsigned char byte)
+{
+	if (writer->length < writer->size)
+		writer->buffer[writer->length] = byte;
+	writer->length++;
+}
+
+static void put_bytes(cbor_writer_t *writer, const void *data, size_t length)
+{
+	if (writer->length < writer->size)
+		memcpy(&writer->buffer[writer->length], data,
+		       length < writer->size - writer->length ? length : writer->size - writer->length);
+	writer->length += length;
+}
+
+// put the head of major type with the shortest encoding of value
+static void put_head(cbor_writer_t *writer, int major, uint64_t value)
+{
+	int count, info;
+
+	if (value < 24) {
+		put_byte(writer, (unsigned char)((major << 5) | (int)value));
+		return;
+	}
+	if (value <= UINT8_MAX)
+		info = 24, count = 1;
+	else if (value <= UINT16_MAX)
+		info = 25, count = 2;
+	else if (value <= UINT32_MAX)
+		info = 26, count = 4;
+	else
+		info = 27, count = 8;
+	put_byte(writer, (unsigned char)((major << 5) | info));
+	while (count)
+		put_byte(writer, (unsigned char)(value >> (8 * --count)));
+}
+
+// doubles are written as single precision floats when it is lossless
+static void put_double(cbor_writer_t *writer, double value)
+{
+	union {
+		float f;
+		uint32_t u;
+	} single;
+	union {
+		double d;
+		uint64_t u;
+	} dual;
+	int count;
+
+	single.f = (float)value;
+	if ((double)single.f == value || isnan(value)) {
+		put_byte(writer, (CBOR_SIMPLE << 5) | 26);
+		for (count = 4; count;)
+			put_byte(writer, (unsigned char)(single.u >> (8 * --count)));
+	} else {
+		dual.d = value;
+		put_byte(writer, (CBOR_SIMPLE << 5) | 27);
+		for (count = 8; count;)
+			put_byte(writer, (unsigned char)(dual.u >> (8 * --count)));
+	}
+}
+
+static void encode_item(cbor_writer_t *writer, json_object *object)
+{
+	int64_t integer;
+	size_t idx, count;
+
+	switch (json_object_get_type(object)) {
+	case json_type_boolean:
+		put_byte(writer, json_object_get_boolean(object) ? 0xf5 : 0xf4);
+		break;
+	case json_type_int:
+		integer = json_object_get_int64(object);
+		if (integer >= 0)
+			put_head(writer, CBOR_UINT, (uint64_t)integer);
+		else
+			put_head(writer, CBOR_NINT, (uint64_t)(-1 - integer));
+		break;
+	case json_type_double:
+		put_double(writer, json_object_get_double(object));
+		break;
+	case json_type_string:
+		count = (size_t)json_object_get_string_len(object);
+		put_head(writer, CBOR_TEXT, count);
+		put_bytes(writer, json_object_get_string(object), count);
+		break;
+	case json_type_array:
+		count = json_object_array_length(object);
+		put_head(writer, CBOR_ARRAY, count);
+		for (idx = 0; idx < count; idx++)
+			encode_item(writer, json_object_array_get_idx(object, idx));
+		break;
+	case json_type_object:
+		put_head(writer, CBOR_MAP, (uint64_t)json_object_object_length(object));
+		json_object_object_foreach(object, key, value) {
+			count = strlen(key);
+			put_head(writer, CBOR_TEXT, count);
+			put_bytes(writer, key, count);
+			encode_item(writer, value);
+		}
+		break;
+	default:
+		put_byte(writer, 0xf6);
+		break;
+	}
+}
+
+size_t cbor_from_json(json_object *object, unsigned char *buffer, size_t size)
+{
+	cbor_writer_t writer = { .buffer = buffer, .size = size, .length = 0 };
+	encode_item(&writer, object);
+	return writer.length;
+}
@@ -0,0 +1,46 @@
+/*
+ * Copyright (C) 2015-2021 IoT.bzh Company
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ *
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+*/
+
+#pragma once
+
+#include <stddef.h>
+
+#include <json-c/json.h>
+
+// Decoding and encoding of CBOR (RFC 8949) data items
+
+// maximum nesting depth of items
+#define CBOR_MAX_DEPTH 64
+
+// get in size the size of the item at the beginning of data
+// returns 1 when the item is complete, 0 when more data are needed or -1 when invalid
+extern int cbor_item_size(const unsigned char *data, size_t length, size_t *size);
+
+// decode the complete item of size to a JSON object
+// byte strings are base64 encoded, map keys that aren't text are written as JSON,
+// tags are dropped, undefined and simple values are null
+// returns the object or NULL on error or for null
+extern json_object *cbor_to_json(const unsigned char *data, size_t size);
+
+// encode the object in the buffer of size, the output is truncated when the buffer is too small
+// returns the size of the complete encoding, so that a first call with a size of 0 measures it
+extern size_t cbor_from_json(json_object *object, unsigned char *buffer, size_t size);
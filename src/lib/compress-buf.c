@@ -0,0 +1,240 @@
+/*
+ * Copyright (C) 2015-2021 IoT.bzh Company
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ *
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+*/
+
+#include <stdlib.h>
+#include <strings.h>
+
+#if defined(WITH_ZLIB)
+#include <zlib.h>
+#endif
+#if defined(WITH_ZSTD)
+#include <zstd.h>
+#endif
+
+#include "compress-buf.h"
+
+#define COMPRESS_BUF_BLOCK 16384
+
+struct compress_buf_s {
+	compress_method_t method;
+	union {
+#if defined(WITH_ZLIB)
+		z_stream zs;
+#endif
+#if defined(WITH_ZSTD)
+		ZSTD_CCtx *zstd;
+#endif
+		int none;
+	};
+	char block[COMPRESS_BUF_BLOCK];
+};
+
+int compress_buf_method(const char *name, compress_method_t *method)
+{
+	if (!strcasecmp(name, "none"))
+		*method = compress_none;
+#if defined(WITH_ZLIB)
+	else if (!strcasecmp(name, "gzip"))
+		*method = compress_gzip;
+#endif
+#if defined(WITH_ZSTD)
+	else if (!strcasecmp(name, "zstd"))
+		*method = compress_zstd;
+#endif
+	else
+		return -1;
+	return 0;
+}
+
+const char *compress_buf_method_name(compress_method_t method)
+{
+	switch (method) {
+	case compress_gzip:
+		return "gzip";
+	case compress_zstd:
+		return "zstd";
+	default:
+		return "none";
+	}
+}
+
+bool compress_buf_check_level(compress_method_t method, int level)
+{
+	if (level == COMPRESS_BUF_LEVEL_DEFAULT)
+		return true;
+	switch (method) {
+#if defined(WITH_ZLIB)
+	case compress_gzip:
+		return level >= Z_NO_COMPRESSION && level <= Z_BEST_COMPRESSION;
+#endif
+#if defined(WITH_ZSTD)
+	case compress_zstd:
+		return level >= ZSTD_minCLevel() && level <= ZSTD_maxCLevel();
+#endif
+	default:
+		return false;
+	}
+}
+
+compress_buf_t *compress_buf_create(compress_method_t method, int level)
+{
+	compress_buf_t *cbuf = malloc(sizeof *cbuf);
+	if (cbuf == NULL)
+		return NULL;
+
+	cbuf->method = method;
+	switch (method) {
+#if defined(WITH_ZLIB)
+	case compress_gzip:
+		cbuf->zs.zalloc = Z_NULL;
+		cbuf->zs.zfree = Z_NULL;
+		cbuf->zs.opaque = Z_NULL;
+		// 16 + MAX_WBITS selects the gzip wrapper
+		if (level == COMPRESS_BUF_LEVEL_DEFAULT)
+			level = Z_DEFAULT_COMPRESSION;
+		if (deflateInit2(&cbuf->zs, level, Z_DEFLATED, 16 + MAX_WBITS, 8, Z_DEFAULT_STRATEGY) == Z_OK)
+			return cbuf;
+		break;
+#endif
+#if defined(WITH_ZSTD)
+	case compress_zstd:
+		cbuf->zstd = ZSTD_createCCtx();
+		if (cbuf->zstd != NULL) {
+			if (level == COMPRESS_BUF_LEVEL_DEFAULT)
+				level = ZSTD_CLEVEL_DEFAULT;
+			if (!ZSTD_isError(ZSTD_CCtx_setParameter(cbuf->zstd, ZSTD_c_compressionLevel, level)))
+				return cbuf;
+			ZSTD_freeCCtx(cbuf->zstd);
+		}
+		break;
+#endif
+	default:
+		break;
+	}
+	free(cbuf);
+	return NULL;
+}
+
+void compress_buf_free(compress_buf_t *cbuf)
+{
+	if (cbuf != NULL) {
+		switch (cbuf->method) {
+#if defined(WITH_ZLIB)
+		case compress_gzip:
+			deflateEnd(&cbuf->zs);
+			break;
+#endif
+#if defined(WITH_ZSTD)
+		case compress_zstd:
+			ZSTD_freeCCtx(cbuf->zstd);
+			break;
+#endif
+		default:
+			break;
+		}
+		free(cbuf);
+	}
+}
+
+#if defined(WITH_ZLIB)
+static int gzip_process(compress_buf_t *cbuf, const char *data, size_t length, int flush, compress_buf_cb push,
+			void *closure)
+{
+	int rc;
+	size_t produced;
+
+	cbuf->zs.next_in = (Bytef *)data;
+	cbuf->zs.avail_in = (uInt)length;
+	do {
+		cbuf->zs.next_out = (Bytef *)cbuf->block;
+		cbuf->zs.avail_out = (uInt)sizeof cbuf->block;
+		rc = deflate(&cbuf->zs, flush);
+		if (rc == Z_STREAM_ERROR)
+			return -1;
+		produced = sizeof cbuf->block - cbuf->zs.avail_out;
+		if (produced)
+			push(closure, cbuf->block, produced);
+	} while (cbuf->zs.avail_out == 0 || cbuf->zs.avail_in != 0);
+	return 0;
+}
+#endif
+
+#if defined(WITH_ZSTD)
+static int zstd_process(compress_buf_t *cbuf, const char *data, size_t length, ZSTD_EndDirective mode,
+			compress_buf_cb push, void *closure)
+{
+	size_t remaining;
+	ZSTD_inBuffer in = { .src = data, .size = length, .pos = 0 };
+	ZSTD_outBuffer out;
+
+	do {
+		out.dst = cbuf->block;
+		out.size = sizeof cbuf->block;
+		out.pos = 0;
+		remaining = ZSTD_compressStream2(cbuf->zstd, &out, &in, mode);
+		if (ZSTD_isError(remaining))
+			return -1;
+		if (out.pos)
+			push(closure, cbuf->block, out.pos);
+	} while (mode == ZSTD_e_continue ? in.pos < in.size : remaining != 0);
+	return 0;
+}
+#endif
+
+int compress_buf_process(compress_buf_t *cbuf, const char *data, size_t length, bool flush, compress_buf_cb push,
+			 void *closure)
+{
+	switch (cbuf->method) {
+#if defined(WITH_ZLIB)
+	case compress_gzip:
+		return gzip_process(cbuf, data, length, flush ? Z_SYNC_FLUSH : Z_NO_FLUSH, push, closure);
+#endif
+#if defined(WITH_ZSTD)
+	case compress_zstd:
+		if (zstd_process(cbuf, data, length, ZSTD_e_continue, push, closure) < 0)
+			return -1;
+		return flush ? zstd_process(cbuf, NULL, 0, ZSTD_e_flush, push, closure) : 0;
+#endif
+	default:
+		if (length)
+			push(closure, data, length);
+		return 0;
+	}
+}
+
+int compress_buf_end(compress_buf_t *cbuf, compress_buf_cb push, void *closure)
+{
+	switch (cbuf->method) {
+#if defined(WITH_ZLIB)
+	case compress_gzip:
+		if (gzip_process(cbuf, NULL, 0, Z_FINISH, push, closure) < 0)
+			return -1;
+		return deflateReset(&cbuf->zs) == Z_OK ? 0 : -1;
+#endif
+#if defined(WITH_ZSTD)
+	case compress_zstd:
+		return zstd_process(cbuf, NULL, 0, ZSTD_e_end, push, closure);
+#endif
+	default:
+		return 0;
+	}
+}
@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2015-2021 IoT.bzh Company
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ *
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <limits.h>
+
+// value of the level for using the default level of the method
+#define COMPRESS_BUF_LEVEL_DEFAULT INT_MIN
+
+typedef enum {
+	compress_none = 0,
+	compress_gzip,
+	compress_zstd
+} compress_method_t;
+
+typedef struct compress_buf_s compress_buf_t;
+
+typedef void (*compress_buf_cb)(void *closure, const char *data, size_t length);
+
+// get the method of the given name
+// returns 0 on success or -1 when the method is unknown or not available
+extern int compress_buf_method(const char *name, compress_method_t *method);
+
+// get the name of the method
+extern const char *compress_buf_method_name(compress_method_t method);
+
+// check if the level is valid for the method
+extern bool compress_buf_check_level(compress_method_t method, int level);
+
+// create a compressor for the method and the level
+extern compress_buf_t *compress_buf_create(compress_method_t method, int level);
+
+// free the memory used by the compressor
+extern void compress_buf_free(compress_buf_t *cbuf);
+
+// compress the data and push the produced bytes
+// when flush is true, the bytes needed to decode all the data given until now are pushed
+// returns 0 on success or -1 on error
+extern int compress_buf_process(compress_buf_t *cbuf, const char *data, size_t length, bool flush,
+				compress_buf_cb push, void *closure);
+
+// terminate the compressed stream and push the last bytes
+// the compressor then starts a new stream (gzip member or zstd frame) with the next data
+// returns 0 on success or -1 on error
+extern int compress_buf_end(compress_buf_t *cbuf, compress_buf_cb push, void *closure);
@@ -0,0 +1,177 @@
+/*
+ * Copyright (C) 2015-2021 IoT.bzh Company
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ *
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+*/
+
+
+#include <float.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ddsketch.h"
+
+// bins start with that count and double as needed
+#define DDSKETCH_INITIAL_BINS 64
+
+void ddsketch_init(ddsketch_t *sketch, double accuracy, int maxbins)
+{
+	memset(sketch, 0, sizeof *sketch);
+	sketch->gamma = (1 + accuracy) / (1 - accuracy);
+	sketch->lngamma = log(sketch->gamma);
+	sketch->maxbins = maxbins;
+}
+
+void ddsketch_clear(ddsketch_t *sketch)
+{
+	free(sketch->positives.bins);
+	free(sketch->negatives.bins);
+	memset(&sketch->positives, 0, sizeof sketch->positives);
+	memset(&sketch->negatives, 0, sizeof sketch->negatives);
+	sketch->count = sketch->zeros = 0;
+}
+
+static void ddsketch_store_reset(ddsketch_store_t *store)
+{
+	store->nbins = 0;
+}
+
+void ddsketch_reset(ddsketch_t *sketch)
+{
+	sketch->count = sketch->zeros = 0;
+	ddsketch_store_reset(&sketch->positives);
+	ddsketch_store_reset(&sketch->negatives);
+}
+
+// count the key in the store, merging the lowest bins when there are too many
+static int ddsketch_store_add(ddsketch_store_t *store, int key, int maxbins)
+{
+	int low, high, count, drop, shift, alloc, idx;
+	uint64_t *bins, merged;
+
+	if (store->nbins == 0)
+		low = high = store->offset = key;
+	else {
+		low = store->offset;
+		high = low + store->nbins - 1;
+		if (key > high)
+			high = key;
+		// the keys below the bounded range are counted in its lowest bin
+		if (key < high - maxbins + 1)
+			key = high - maxbins + 1;
+		if (key < low)
+			low = key;
+	}
+
+	// the range grew above, the lowest bins are merged
+	if (high - low + 1 > maxbins) {
+		low = high - maxbins + 1;
+		drop = low - store->offset;
+		for (merged = 0, idx = 0; idx <= drop && idx < store->nbins; idx++)
+			merged += store->bins[idx];
+		if (drop < store->nbins) {
+			memmove(store->bins, &store->bins[drop], (size_t)(store->nbins - drop) * sizeof *store->bins);
+			store->nbins -= drop;
+		} else
+			store->nbins = 1;
+		store->bins[0] = merged;
+		store->offset = low;
+	}
+
+	// grow
+	count = high - low + 1;
+	if (count > store->alloc) {
+		for (alloc = store->alloc ? store->alloc : DDSKETCH_INITIAL_BINS; alloc < count; alloc *= 2)
+			;
+		bins = realloc(store->bins, (size_t)alloc * sizeof *bins);
+		if (bins == NULL)
+			return -1;
+		store->bins = bins;
+		store->alloc = alloc;
+	}
+
+	// extend the bins below and above
+	shift = store->offset - low;
+	if (shift) {
+		memmove(&store->bins[shift], store->bins, (size_t)store->nbins * sizeof *store->bins);
+		memset(store->bins, 0, (size_t)shift * sizeof *store->bins);
+		store->offset = low;
+		store->nbins += shift;
+	}
+	if (count > store->nbins) {
+		memset(&store->bins[store->nbins], 0, (size_t)(count - store->nbins) * sizeof *store->bins);
+		store->nbins = count;
+	}
+	store->bins[key - low]++;
+	return 0;
+}
+
+int ddsketch_add(ddsketch_t *sketch, double value)
+{
+	double magnitude = fabs(value);
+	int rc = 0;
+
+	if (isnan(value))
+		return 0;
+	if (magnitude < DBL_MIN)
+		sketch->zeros++;
+	else {
+		int key = magnitude >= DBL_MAX ? INT32_MAX / 2 : (int)ceil(log(magnitude) / sketch->lngamma);
+		rc = ddsketch_store_add(value > 0 ? &sketch->positives : &sketch->negatives, key, sketch->maxbins);
+	}
+	if (rc == 0)
+		sketch->count++;
+	return rc;
+}
+
+// value represented by the bin of key
+static double ddsketch_value(const ddsketch_t *sketch, int key)
+{
+	return 2 * pow(sketch->gamma, key) / (sketch->gamma + 1);
+}
+
+double ddsketch_quantile(const ddsketch_t *sketch, double q)
+{
+	const ddsketch_store_t *store;
+	uint64_t rank, seen = 0;
+	int idx;
+
+	if (sketch->count == 0)
+		return 0;
+	rank = (uint64_t)(q * (double)(sketch->count - 1));
+
+	// negative values from the largest magnitude
+	store = &sketch->negatives;
+	for (idx = store->nbins - 1; idx >= 0; idx--) {
+		seen += store->bins[idx];
+		if (seen > rank)
+			return -ddsketch_value(sketch, store->offset + idx);
+	}
+	seen += sketch->zeros;
+	if (seen > rank)
+		return 0;
+	store = &sketch->positives;
+	for (idx = 0; idx < store->nbins; idx++) {
+		seen += store->bins[idx];
+		if (seen > rank)
+			return ddsketch_value(sketch, store->offset + idx);
+	}
+	return ddsketch_value(sketch, store->offset + store->nbins - 1);
+}
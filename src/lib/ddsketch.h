@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2015-2021 IoT.bzh Company
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ *
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+*/
+
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// DDSketch: quantiles of a stream of values with a bounded relative error.
+// Values are counted in bins of logarithmic width, the bins of lowest
+// magnitude are merged when their count exceeds the maximum.
+
+typedef struct {
+	// key of the first bin
+	int offset;
+	// count of bins and allocated bins
+	int nbins;
+	int alloc;
+	uint64_t *bins;
+} ddsketch_store_t;
+
+typedef struct ddsketch_s ddsketch_t;
+
+struct ddsketch_s {
+	double gamma;
+	double lngamma;
+	int maxbins;
+	uint64_t count;
+	uint64_t zeros;
+	ddsketch_store_t positives;
+	ddsketch_store_t negatives;
+};
+
+// initialize the sketch for the relative accuracy (0 < accuracy < 1) and the maximum count of bins of each sign
+extern void ddsketch_init(ddsketch_t *sketch, double accuracy, int maxbins);
+
+// free the memory used by the sketch
+extern void ddsketch_clear(ddsketch_t *sketch);
+
+// remove the values, keeping the memory and the parameters
+extern void ddsketch_reset(ddsketch_t *sketch);
+
+// add a value, returns 0 on success or -1 when out of memory
+extern int ddsketch_add(ddsketch_t *sketch, double value);
+
+// get the approximate value of the quantile q (0 <= q <= 1), 0 when empty
+extern double ddsketch_quantile(const ddsketch_t *sketch, double q);
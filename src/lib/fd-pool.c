@@ -0,0 +1,257 @@
+/*
+ * Copyright (C) 2015-2021 IoT.bzh Company
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ *
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+*/
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include "fd-pool.h"
+
+// maximum count of descriptors of a set
+#define FD_WATCH_FDS 4
+
+struct fd_watch_s {
+	fd_pool_t *pool;
+	fd_watch_cb callback;
+	void *closure;
+	// epoll of the descriptors of the set, itself polled one shot by the pool
+	int epfd;
+	int nfds;
+	int fds[FD_WATCH_FDS];
+	// registered in the pool and owning the descriptors
+	bool started;
+	// dispatched by the threads of the pool
+	bool enabled;
+	bool released;
+	// not armed again after its dispatch, then left disarmed until resumed
+	bool paused;
+	bool parked;
+	// protects released, paused and parked
+	pthread_mutex_t mutex;
+};
+
+struct fd_pool_s {
+	int epfd;
+	// signaled to stop, never consumed so that every thread wakes up
+	int stopfd;
+	int nthreads;
+	pthread_t threads[];
+};
+
+static int fd_watch_arm(fd_watch_t *watch, int op, uint32_t events)
+{
+	struct epoll_event event = { .events = events, .data.ptr = watch };
+
+	return epoll_ctl(watch->pool->epfd, op, watch->epfd, &event);
+}
+
+static void fd_watch_free(fd_watch_t *watch)
+{
+	int idx;
+
+	if (watch->started) {
+		epoll_ctl(watch->pool->epfd, EPOLL_CTL_DEL, watch->epfd, NULL);
+		for (idx = 0; idx < watch->nfds; idx++)
+			close(watch->fds[idx]);
+	}
+	close(watch->epfd);
+	pthread_mutex_destroy(&watch->mutex);
+	free(watch);
+}
+
+static bool fd_watch_dispatching(fd_watch_t *watch)
+{
+	bool dispatching;
+
+	pthread_mutex_lock(&watch->mutex);
+	dispatching = !watch->released && !watch->paused;
+	pthread_mutex_unlock(&watch->mutex);
+	return dispatching;
+}
+
+// the set is disarmed until dispatched, no other thread can enter it
+static void fd_watch_dispatch(fd_watch_t *watch)
+{
+	struct epoll_event events[FD_WATCH_FDS];
+	int idx, count;
+	uint64_t data;
+
+	// a paused set gets no more callbacks, its closure may be released by another thread
+	count = epoll_wait(watch->epfd, events, FD_WATCH_FDS, 0);
+	for (idx = 0; idx < count && fd_watch_dispatching(watch); idx++) {
+		data = events[idx].data.u64;
+		watch->callback(watch, (int)(uint32_t)data, events[idx].events, (int)(uint32_t)(data >> 32),
+				watch->closure);
+	}
+	pthread_mutex_lock(&watch->mutex);
+	if (watch->released) {
+		pthread_mutex_unlock(&watch->mutex);
+		fd_watch_free(watch);
+		return;
+	}
+	if (watch->paused)
+		watch->parked = true;
+	else
+		fd_watch_arm(watch, EPOLL_CTL_MOD, EPOLLIN | EPOLLONESHOT);
+	pthread_mutex_unlock(&watch->mutex);
+}
+
+static void *fd_pool_run(void *arg)
+{
+	fd_pool_t *pool = arg;
+	struct epoll_event event;
+	int rc;
+
+	for (;;) {
+		rc = epoll_wait(pool->epfd, &event, 1, -1);
+		if (rc < 0 && errno != EINTR)
+			break;
+		if (rc <= 0)
+			continue;
+		if (event.data.ptr == NULL)
+			break;
+		fd_watch_dispatch(event.data.ptr);
+	}
+	return NULL;
+}
+
+fd_pool_t *fd_pool_create(int nthreads)
+{
+	struct epoll_event event = { .events = EPOLLIN, .data.ptr = NULL };
+	fd_pool_t *pool = calloc(1, sizeof *pool + (size_t)nthreads * sizeof(pthread_t));
+
+	if (pool == NULL)
+		return NULL;
+	pool->epfd = epoll_create1(EPOLL_CLOEXEC);
+	pool->stopfd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (pool->epfd < 0 || pool->stopfd < 0 || epoll_ctl(pool->epfd, EPOLL_CTL_ADD, pool->stopfd, &event) < 0) {
+		fd_pool_destroy(pool);
+		return NULL;
+	}
+	for (pool->nthreads = 0; pool->nthreads < nthreads; pool->nthreads++)
+		if (pthread_create(&pool->threads[pool->nthreads], NULL, fd_pool_run, pool) != 0)
+			break;
+	if (pool->nthreads == 0) {
+		fd_pool_destroy(pool);
+		pool = NULL;
+	}
+	return pool;
+}
+
+void fd_pool_destroy(fd_pool_t *pool)
+{
+	uint64_t one = 1;
+	int idx;
+
+	if (pool->nthreads > 0 && write(pool->stopfd, &one, sizeof one) < 0)
+		return;
+	for (idx = 0; idx < pool->nthreads; idx++)
+		pthread_join(pool->threads[idx], NULL);
+	if (pool->stopfd >= 0)
+		close(pool->stopfd);
+	if (pool->epfd >= 0)
+		close(pool->epfd);
+	free(pool);
+}
+
+fd_watch_t *fd_watch_create(fd_pool_t *pool, fd_watch_cb callback, void *closure)
+{
+	fd_watch_t *watch = calloc(1, sizeof *watch);
+
+	if (watch == NULL)
+		return NULL;
+	watch->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (watch->epfd < 0) {
+		free(watch);
+		return NULL;
+	}
+	watch->pool = pool;
+	watch->callback = callback;
+	watch->closure = closure;
+	pthread_mutex_init(&watch->mutex, NULL);
+	return watch;
+}
+
+int fd_watch_add(fd_watch_t *watch, int fd, uint32_t events, int tag)
+{
+	struct epoll_event event = { .events = events, .data.u64 = (uint64_t)(uint32_t)tag << 32 | (uint32_t)fd };
+
+	if (watch->nfds == FD_WATCH_FDS) {
+		errno = ENOSPC;
+		return -1;
+	}
+	if (epoll_ctl(watch->epfd, EPOLL_CTL_ADD, fd, &event) < 0)
+		return -1;
+	watch->fds[watch->nfds++] = fd;
+	return 0;
+}
+
+int fd_watch_start(fd_watch_t *watch)
+{
+	// registered without events, nothing is dispatched until enabled
+	if (fd_watch_arm(watch, EPOLL_CTL_ADD, 0) < 0)
+		return -1;
+	watch->started = true;
+	return 0;
+}
+
+void fd_watch_enable(fd_watch_t *watch)
+{
+	// set before arming, a callback may release the set at once
+	watch->enabled = true;
+	fd_watch_arm(watch, EPOLL_CTL_MOD, EPOLLIN | EPOLLONESHOT);
+}
+
+void fd_watch_pause(fd_watch_t *watch)
+{
+	pthread_mutex_lock(&watch->mutex);
+	watch->paused = true;
+	pthread_mutex_unlock(&watch->mutex);
+}
+
+void fd_watch_resume(fd_watch_t *watch)
+{
+	pthread_mutex_lock(&watch->mutex);
+	watch->paused = false;
+	if (watch->parked) {
+		watch->parked = false;
+		fd_watch_arm(watch, EPOLL_CTL_MOD, EPOLLIN | EPOLLONESHOT);
+	}
+	pthread_mutex_unlock(&watch->mutex);
+}
+
+void fd_watch_release(fd_watch_t *watch)
+{
+	bool dispatching;
+
+	// a parked set is out of the threads, else the end of its dispatch frees it
+	pthread_mutex_lock(&watch->mutex);
+	dispatching = watch->enabled && !watch->parked;
+	watch->released = dispatching;
+	pthread_mutex_unlock(&watch->mutex);
+	if (!dispatching)
+		fd_watch_free(watch);
+}
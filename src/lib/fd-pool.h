@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) 2015-2021 IoT.bzh Company
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ *
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+// Pool of threads waiting for the readiness of sets of file descriptors.
+// The callbacks of a set never run concurrently, keeping the order of its
+// input, while distinct sets are processed in parallel by the threads.
+// Descriptors are level triggered: input left after a callback fires again.
+
+typedef struct fd_pool_s fd_pool_t;
+typedef struct fd_watch_s fd_watch_t;
+
+// callback receiving the tag given at fd_watch_add and the events of fd
+typedef void (*fd_watch_cb)(fd_watch_t *watch, int fd, uint32_t revents, int tag, void *closure);
+
+// create a pool of nthreads threads
+extern fd_pool_t *fd_pool_create(int nthreads);
+
+// stop the threads and free the pool, watches must have been released
+extern void fd_pool_destroy(fd_pool_t *pool);
+
+// create an empty set of descriptors
+// returns NULL when out of resources
+extern fd_watch_t *fd_watch_create(fd_pool_t *pool, fd_watch_cb callback, void *closure);
+
+// add fd to the set, it is closed with the set once started
+// returns 0 on success or -1 with errno set
+extern int fd_watch_add(fd_watch_t *watch, int fd, uint32_t events, int tag);
+
+// register the set in the pool, it then owns its descriptors
+// returns 0 on success or -1 with errno set
+extern int fd_watch_start(fd_watch_t *watch);
+
+// start dispatching the events of the started set to the threads of the pool
+extern void fd_watch_enable(fd_watch_t *watch);
+
+// stop dispatching the events of the set after the current callback, called from a callback of the set
+// the remaining events of the dispatch are not given to the callback
+extern void fd_watch_pause(fd_watch_t *watch);
+
+// dispatch the events of the paused set again, from any thread
+extern void fd_watch_resume(fd_watch_t *watch);
+
+// free the set, closing its descriptors when started
+// once enabled, it must be called from a callback of the set or after it was paused
+extern void fd_watch_release(fd_watch_t *watch);
@@ -0,0 +1,151 @@
+/*
+ * Copyright (C) 2015-2021 IoT.bzh Company
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ *
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+*/
+
+#include <string.h>
+
+#include "hash64.h"
+
+#define PRIME1 0x9E3779B185EBCA87ULL
+#define PRIME2 0xC2B2AE3D27D4EB4FULL
+#define PRIME3 0x165667B19E3779F9ULL
+#define PRIME4 0x85EBCA77C2B2AE63ULL
+#define PRIME5 0x27D4EB2F165667C5ULL
+
+static inline uint64_t rotl(uint64_t value, int count)
+{
+	return (value << count) | (value >> (64 - count));
+}
+
+// little endian reads, whatever the alignment
+static inline uint64_t read64(const unsigned char *data)
+{
+	return (uint64_t)data[0] | ((uint64_t)data[1] << 8) | ((uint64_t)data[2] << 16) | ((uint64_t)data[3] << 24)
+	       | ((uint64_t)data[4] << 32) | ((uint64_t)data[5] << 40) | ((uint64_t)data[6] << 48)
+	       | ((uint64_t)data[7] << 56);
+}
+
+static inline uint32_t read32(const unsigned char *data)
+{
+	return (uint32_t)data[0] | ((uint32_t)data[1] << 8) | ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+static inline uint64_t round64(uint64_t acc, uint64_t input)
+{
+	return rotl(acc + input * PRIME2, 31) * PRIME1;
+}
+
+static inline uint64_t merge64(uint64_t acc, uint64_t value)
+{
+	return (acc ^ round64(0, value)) * PRIME1 + PRIME4;
+}
+
+// process stripes of 32 bytes, returns the count of bytes processed
+static size_t stripes(uint64_t acc[4], const unsigned char *data, size_t length)
+{
+	size_t offset;
+
+	for (offset = 0; offset + 32 <= length; offset += 32) {
+		acc[0] = round64(acc[0], read64(&data[offset]));
+		acc[1] = round64(acc[1], read64(&data[offset + 8]));
+		acc[2] = round64(acc[2], read64(&data[offset + 16]));
+		acc[3] = round64(acc[3], read64(&data[offset + 24]));
+	}
+	return offset;
+}
+
+void hash64_init(hash64_t *state, uint64_t seed)
+{
+	state->acc[0] = seed + PRIME1 + PRIME2;
+	state->acc[1] = seed + PRIME2;
+	state->acc[2] = seed;
+	state->acc[3] = seed - PRIME1;
+	state->total = 0;
+	state->seed = seed;
+	state->npending = 0;
+}
+
+void hash64_update(hash64_t *state, const void *data, size_t length)
+{
+	const unsigned char *bytes = data;
+	size_t count;
+
+	state->total += length;
+	if (state->npending) {
+		count = 32 - state->npending;
+		if (count > length)
+			count = length;
+		memcpy(&state->pending[state->npending], bytes, count);
+		state->npending += count;
+		bytes += count;
+		length -= count;
+		if (state->npending < 32)
+			return;
+		stripes(state->acc, state->pending, 32);
+		state->npending = 0;
+	}
+	count = stripes(state->acc, bytes, length);
+	state->npending = length - count;
+	memcpy(state->pending, &bytes[count], state->npending);
+}
+
+uint64_t hash64_digest(const hash64_t *state)
+{
+	const unsigned char *data = state->pending;
+	size_t length = state->npending;
+	uint64_t hash;
+
+	if (state->total >= 32) {
+		hash = rotl(state->acc[0], 1) + rotl(state->acc[1], 7) + rotl(state->acc[2], 12) + rotl(state->acc[3], 18);
+		hash = merge64(hash, state->acc[0]);
+		hash = merge64(hash, state->acc[1]);
+		hash = merge64(hash, state->acc[2]);
+		hash = merge64(hash, state->acc[3]);
+	} else
+		hash = state->seed + PRIME5;
+	hash += state->total;
+
+	for (; length >= 8; data += 8, length -= 8)
+		hash = rotl(hash ^ round64(0, read64(data)), 27) * PRIME1 + PRIME4;
+	if (length >= 4) {
+		hash = rotl(hash ^ ((uint64_t)read32(data) * PRIME1), 23) * PRIME2 + PRIME3;
+		data += 4;
+		length -= 4;
+	}
+	for (; length; data++, length--)
+		hash = rotl(hash ^ (*data * PRIME5), 11) * PRIME1;
+
+	hash ^= hash >> 33;
+	hash *= PRIME2;
+	hash ^= hash >> 29;
+	hash *= PRIME3;
+	hash ^= hash >> 32;
+	return hash;
+}
+
+uint64_t hash64(const void *data, size_t length, uint64_t seed)
+{
+	hash64_t state;
+
+	hash64_init(&state, seed);
+	hash64_update(&state, data, length);
+	return hash64_digest(&state);
+}
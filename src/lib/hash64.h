@@ -0,0 +1,50 @@
+/*
+ * Copyright (C) 2015-2021 IoT.bzh Company
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ *
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// 64 bits hashing of data using the XXH64 algorithm
+
+typedef struct hash64_s hash64_t;
+
+struct hash64_s {
+	uint64_t acc[4];
+	uint64_t total;
+	uint64_t seed;
+	unsigned char pending[32];
+	size_t npending;
+};
+
+// initialize the state for hashing data
+extern void hash64_init(hash64_t *state, uint64_t seed);
+
+// add length bytes of data to the hashed data
+extern void hash64_update(hash64_t *state, const void *data, size_t length);
+
+// get the hash of the added data
+extern uint64_t hash64_digest(const hash64_t *state);
+
+// get the hash of length bytes of data
+extern uint64_t hash64(const void *data, size_t length, uint64_t seed);
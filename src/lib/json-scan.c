@@ -0,0 +1,363 @@
+/*
+ * Copyright (C) 2015-2021 IoT.bzh Company
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ *
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+*/
+
+#include <string.h>
+
+#include "json-scan.h"
+
+enum {
+	S_IDLE, // top level, before a document
+	S_VALUE, // expecting a value in a container
+	S_ARRAY_FIRST, // after '['
+	S_OBJECT_FIRST, // after '{'
+	S_KEY, // expecting a key after ','
+	S_COLON, // after a key
+	S_NEXT, // after a value in a container
+	S_STRING, // in a string value
+	S_KEY_STRING, // in a key
+	S_ESCAPE, // after a backslash in a string
+	S_UNICODE, // in the hexadecimal digits of \u
+	S_LITERAL, // in true, false or null
+	S_MINUS, // number after '-'
+	S_ZERO, // number after a leading '0'
+	S_INT, // in integer part
+	S_DOT, // after '.'
+	S_FRAC, // in fractional part
+	S_EXP, // after 'e'
+	S_EXP_SIGN, // after the sign of the exponent
+	S_EXP_DIGITS // in the digits of the exponent
+};
+
+static inline bool is_space(char c)
+{
+	return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+}
+
+static inline bool is_digit(char c)
+{
+	return c >= '0' && c <= '9';
+}
+
+static inline bool is_xdigit(char c)
+{
+	return is_digit(c) || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F');
+}
+
+static inline bool in_object(const json_scan_t *scan)
+{
+	int level = scan->depth - 1;
+	return (scan->stack[level >> 3] >> (level & 7)) & 1;
+}
+
+static inline bool push(json_scan_t *scan, bool object)
+{
+	int level = scan->depth;
+	if (level == scan->maxdepth)
+		return false;
+	if (object)
+		scan->stack[level >> 3] |= (unsigned char)(1 << (level & 7));
+	else
+		scan->stack[level >> 3] &= (unsigned char)~(1 << (level & 7));
+	scan->depth = level + 1;
+	return true;
+}
+
+void json_scan_init(json_scan_t *scan, int maxdepth)
+{
+	scan->maxdepth = maxdepth <= 0 || maxdepth > JSON_SCAN_MAX_DEPTH ? JSON_SCAN_MAX_DEPTH : maxdepth;
+	scan->split = false;
+	json_scan_reset(scan);
+}
+
+void json_scan_split(json_scan_t *scan, bool split)
+{
+	scan->split = split;
+}
+
+void json_scan_reset(json_scan_t *scan)
+{
+	scan->state = S_IDLE;
+	scan->depth = 0;
+	scan->level = 0;
+	scan->count = 0;
+	scan->literal = NULL;
+}
+
+bool json_scan_idle(const json_scan_t *scan)
+{
+	return scan->state == S_IDLE
+	       || (scan->level != 0 && scan->depth == scan->level
+		   && (scan->state == S_VALUE || scan->state == S_ARRAY_FIRST || scan->state == S_NEXT));
+}
+
+// closes the current container, returns true when it is a split array
+static inline bool pop(json_scan_t *scan)
+{
+	if (--scan->depth >= scan->level)
+		return false;
+	scan->level = 0;
+	return true;
+}
+
+int json_scan(json_scan_t *scan, const char *data, size_t length, size_t *consumed)
+{
+	size_t pos;
+	char c;
+	int state = scan->state;
+
+	scan->begun = false;
+	for (pos = 0; pos < length; pos++) {
+		c = data[pos];
+	again:
+		switch (state) {
+		case S_IDLE:
+		case S_VALUE:
+		case S_ARRAY_FIRST:
+			if (is_space(c))
+				continue;
+			if (c == ']' && state == S_ARRAY_FIRST) {
+				if (pop(scan)) {
+					state = S_IDLE;
+					continue;
+				}
+				goto value_done;
+			}
+			if (c == '[' && state == S_IDLE && scan->split) {
+				push(scan, false);
+				scan->level = 1;
+				state = S_ARRAY_FIRST;
+				continue;
+			}
+			if (scan->depth == scan->level) {
+				scan->begun = true;
+				scan->begin = pos;
+			}
+			switch (c) {
+			case '{':
+				if (!push(scan, true))
+					goto error;
+				state = S_OBJECT_FIRST;
+				continue;
+			case '[':
+				if (!push(scan, false))
+					goto error;
+				state = S_ARRAY_FIRST;
+				continue;
+			case '"':
+				state = S_STRING;
+				continue;
+			case 't':
+				scan->literal = "rue";
+				state = S_LITERAL;
+				continue;
+			case 'f':
+				scan->literal = "alse";
+				state = S_LITERAL;
+				continue;
+			case 'n':
+				scan->literal = "ull";
+				state = S_LITERAL;
+				continue;
+			case '-':
+				state = S_MINUS;
+				continue;
+			case '0':
+				state = S_ZERO;
+				continue;
+			default:
+				if (c < '1' || c > '9')
+					goto error;
+				state = S_INT;
+				continue;
+			}
+		case S_OBJECT_FIRST:
+		case S_KEY:
+			if (is_space(c))
+				continue;
+			if (c == '"')
+				state = S_KEY_STRING;
+			else if (c == '}' && state == S_OBJECT_FIRST) {
+				pop(scan);
+				goto value_done;
+			} else
+				goto error;
+			continue;
+		case S_COLON:
+			if (is_space(c))
+				continue;
+			if (c != ':')
+				goto error;
+			state = S_VALUE;
+			continue;
+		case S_NEXT:
+			if (is_space(c))
+				continue;
+			if (c == ',')
+				state = in_object(scan) ? S_KEY : S_VALUE;
+			else if (c == (in_object(scan) ? '}' : ']')) {
+				if (pop(scan)) {
+					state = S_IDLE;
+					continue;
+				}
+				goto value_done;
+			} else
+				goto error;
+			continue;
+		case S_STRING:
+		case S_KEY_STRING:
+			// fast path over the plain characters
+			while (c != '"' && c != '\\' && (unsigned char)c >= 0x20) {
+				if (++pos == length)
+					goto more;
+				c = data[pos];
+			}
+			if (c == '\\') {
+				scan->count = state; // remind the kind of string
+				state = S_ESCAPE;
+			} else if (c != '"')
+				goto error;
+			else if (state == S_KEY_STRING)
+				state = S_COLON;
+			else
+				goto value_done;
+			continue;
+		case S_ESCAPE:
+			if (c == 'u') {
+				state = S_UNICODE;
+				scan->count = (scan->count << 4) | 4;
+			} else if (c && strchr("\"\\/bfnrt", c))
+				state = scan->count;
+			else
+				goto error;
+			continue;
+		case S_UNICODE:
+			if (!is_xdigit(c))
+				goto error;
+			if ((--scan->count & 15) == 0)
+				state = scan->count >> 4;
+			continue;
+		case S_LITERAL:
+			if (c != *scan->literal)
+				goto error;
+			if (*++scan->literal)
+				continue;
+			goto value_done;
+		case S_MINUS:
+			if (c == '0')
+				state = S_ZERO;
+			else if (is_digit(c))
+				state = S_INT;
+			else
+				goto error;
+			continue;
+		case S_INT:
+			if (is_digit(c))
+				continue;
+			/*@fallthrough@*/
+		case S_ZERO:
+			if (c == '.')
+				state = S_DOT;
+			else if (c == 'e' || c == 'E')
+				state = S_EXP;
+			else
+				goto number_done;
+			continue;
+		case S_DOT:
+			if (!is_digit(c))
+				goto error;
+			state = S_FRAC;
+			continue;
+		case S_FRAC:
+			if (is_digit(c))
+				continue;
+			if (c != 'e' && c != 'E')
+				goto number_done;
+			state = S_EXP;
+			continue;
+		case S_EXP:
+			if (c == '+' || c == '-') {
+				state = S_EXP_SIGN;
+				continue;
+			}
+			/*@fallthrough@*/
+		case S_EXP_SIGN:
+			if (!is_digit(c))
+				goto error;
+			state = S_EXP_DIGITS;
+			continue;
+		case S_EXP_DIGITS:
+			if (is_digit(c))
+				continue;
+			goto number_done;
+		default:
+			goto error;
+		}
+
+	value_done:
+		// the value ends with the current character
+		if (scan->depth == scan->level) {
+			scan->state = scan->level ? S_NEXT : S_IDLE;
+			*consumed = pos + 1;
+			return JSON_SCAN_DONE;
+		}
+		state = S_NEXT;
+		continue;
+
+	number_done:
+		// the number ends before the current character
+		if (scan->depth == scan->level) {
+			scan->state = scan->level ? S_NEXT : S_IDLE;
+			*consumed = pos;
+			return JSON_SCAN_DONE;
+		}
+		state = S_NEXT;
+		goto again;
+	}
+more:
+	scan->state = state;
+	*consumed = length;
+	return JSON_SCAN_MORE;
+
+error:
+	scan->state = state;
+	*consumed = pos;
+	return JSON_SCAN_ERROR;
+}
+
+int json_scan_end(json_scan_t *scan)
+{
+	switch (scan->state) {
+	case S_IDLE:
+		return JSON_SCAN_MORE;
+	case S_ZERO:
+	case S_INT:
+	case S_FRAC:
+	case S_EXP_DIGITS:
+		if (scan->depth == 0) {
+			scan->state = S_IDLE;
+			return JSON_SCAN_DONE;
+		}
+		/*@fallthrough@*/
+	default:
+		return JSON_SCAN_ERROR;
+	}
+}
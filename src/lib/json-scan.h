@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2015-2021 IoT.bzh Company
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ *
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdbool.h>
+
+// Streaming validator of JSON texts finding the boundaries of successive
+// documents without building them. Scanning can be suspended at any byte.
+// When splitting, the elements of top level arrays are the documents.
+
+// maximum nesting depth
+#define JSON_SCAN_MAX_DEPTH 1024
+
+// status of json_scan
+#define JSON_SCAN_ERROR -1 // invalid text at the returned offset
+#define JSON_SCAN_MORE 0 // the data are scanned, the document isn't complete
+#define JSON_SCAN_DONE 1 // a document ends at the returned offset
+
+typedef struct json_scan_s json_scan_t;
+
+struct json_scan_s {
+	int state;
+	int depth;
+	int maxdepth;
+	int count;
+	// depth of the documents, 1 in a split top level array
+	int level;
+	bool split;
+	// set by json_scan when a document starts at offset begin of the data
+	bool begun;
+	size_t begin;
+	const char *literal;
+	unsigned char stack[JSON_SCAN_MAX_DEPTH / 8];
+};
+
+// initialize the scanner for the given maximum depth
+extern void json_scan_init(json_scan_t *scan, int maxdepth);
+
+// reset the scanner to start a new document
+extern void json_scan_reset(json_scan_t *scan);
+
+// set if the elements of top level arrays are scanned as documents
+extern void json_scan_split(json_scan_t *scan, bool split);
+
+// scan the data, set consumed to the count of bytes processed and returns
+// JSON_SCAN_DONE when a document ends, JSON_SCAN_MORE when all the data are
+// processed without completing a document, or JSON_SCAN_ERROR when the byte at
+// offset consumed is invalid. When a document starts in the data, the field
+// begun is set and the field begin is its offset.
+extern int json_scan(json_scan_t *scan, const char *data, size_t length, size_t *consumed);
+
+// terminate the scan at end of input, returns JSON_SCAN_DONE when it completes
+// a document (a top level number), JSON_SCAN_MORE when no document is pending
+// or JSON_SCAN_ERROR when a document is truncated
+extern int json_scan_end(json_scan_t *scan);
+
+// returns true when the scanner is between documents (or between elements)
+extern bool json_scan_idle(const json_scan_t *scan);
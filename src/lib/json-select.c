@@ -0,0 +1,449 @@
+/*
+ * Copyright (C) 2015-2021 IoT.bzh Company
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ *
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "json-select.h"
+
+typedef enum {
+	op_none,
+	op_eq,
+	op_ne,
+	op_lt,
+	op_le,
+	op_gt,
+	op_ge
+} json_select_op_t;
+
+typedef struct {
+	// the path and its quoted form used as key of the result
+	char *path;
+	char *quoted;
+	// the segments of the path and their array index (or -1)
+	int nsegs;
+	char **segs;
+	size_t *seglens;
+	int *indexes;
+	// the predicate if any
+	json_select_op_t op;
+	json_object *value;
+	char *text;
+	bool numeric;
+	double number;
+} json_select_item_t;
+
+struct json_select_s {
+	int count;
+	int nfields;
+	json_select_item_t *items;
+};
+
+json_select_t *json_select_create(void)
+{
+	return calloc(1, sizeof(json_select_t));
+}
+
+static void item_clear(json_select_item_t *item)
+{
+	int idx;
+
+	for (idx = 0; idx < item->nsegs; idx++)
+		free(item->segs[idx]);
+	free(item->segs);
+	free(item->seglens);
+	free(item->indexes);
+	free(item->path);
+	free(item->quoted);
+	free(item->text);
+	json_object_put(item->value);
+}
+
+void json_select_free(json_select_t *select)
+{
+	int idx;
+
+	if (select != NULL) {
+		for (idx = 0; idx < select->count; idx++)
+			item_clear(&select->items[idx]);
+		free(select->items);
+		free(select);
+	}
+}
+
+// JSON text of a string
+static char *quote(const char *string)
+{
+	json_object *object = json_object_new_string(string);
+	const char *text = json_object_to_json_string_ext(object, JSON_C_TO_STRING_PLAIN);
+	char *result = text == NULL ? NULL : strdup(text);
+	json_object_put(object);
+	return result;
+}
+
+static int item_path(json_select_item_t *item, const char *path, size_t length)
+{
+	const char *scan, *end = path + length, *dot;
+	char *endidx;
+	int idx;
+
+	item->path = strndup(path, length);
+	if (item->path == NULL || length == 0)
+		return -1;
+	for (item->nsegs = 1, scan = path; scan != end; scan++)
+		item->nsegs += *scan == '.';
+	item->segs = calloc((size_t)item->nsegs, sizeof *item->segs);
+	item->seglens = calloc((size_t)item->nsegs, sizeof *item->seglens);
+	item->indexes = calloc((size_t)item->nsegs, sizeof *item->indexes);
+	if (item->segs == NULL || item->seglens == NULL || item->indexes == NULL)
+		return -1;
+	for (idx = 0, scan = path; idx < item->nsegs; idx++, scan = dot + 1) {
+		dot = memchr(scan, '.', (size_t)(end - scan));
+		if (dot == NULL)
+			dot = end;
+		if (dot == scan)
+			return -1;
+		item->seglens[idx] = (size_t)(dot - scan);
+		item->segs[idx] = strndup(scan, item->seglens[idx]);
+		if (item->segs[idx] == NULL)
+			return -1;
+		item->indexes[idx] = (int)strtol(item->segs[idx], &endidx, 10);
+		if (*endidx || *item->segs[idx] < '0' || *item->segs[idx] > '9')
+			item->indexes[idx] = -1;
+	}
+	return 0;
+}
+
+static int item_value(json_select_item_t *item, const char *text)
+{
+	json_type type;
+
+	// numbers and literals are taken as is, anything else is a string
+	item->value = json_tokener_parse(text);
+	type = item->value == NULL ? json_type_null : json_object_get_type(item->value);
+	if (item->value != NULL && type != json_type_object && type != json_type_array && type != json_type_string) {
+		item->numeric = type == json_type_int || type == json_type_double;
+		item->number = json_object_get_double(item->value);
+		item->text = strdup(json_object_to_json_string_ext(item->value, JSON_C_TO_STRING_PLAIN));
+	} else if (item->value == NULL && !strcmp(text, "null")) {
+		item->text = strdup(text);
+	} else {
+		json_object_put(item->value);
+		item->value = json_object_new_string(text);
+		item->text = quote(text);
+	}
+	return item->text == NULL ? -1 : 0;
+}
+
+int json_select_add(json_select_t *select, const char *selector)
+{
+	static const struct {
+		const char *text;
+		json_select_op_t op;
+	} ops[] = { { "==", op_eq }, { "!=", op_ne }, { "<=", op_le }, { ">=", op_ge }, { "<", op_lt }, { ">", op_gt } };
+	json_select_item_t *items, *item;
+	size_t length;
+	unsigned iop;
+	int rc;
+
+	items = realloc(select->items, (size_t)(select->count + 1) * sizeof *items);
+	if (items == NULL)
+		return -1;
+	select->items = items;
+	item = memset(&items[select->count], 0, sizeof *item);
+
+	length = strcspn(selector, "=!<>");
+	if (selector[length] == 0)
+		rc = item_path(item, selector, length);
+	else {
+		for (iop = 0; iop < sizeof ops / sizeof *ops; iop++)
+			if (!strncmp(&selector[length], ops[iop].text, strlen(ops[iop].text)))
+				break;
+		if (iop == sizeof ops / sizeof *ops)
+			rc = -1;
+		else {
+			item->op = ops[iop].op;
+			rc = item_path(item, selector, length);
+			if (rc == 0)
+				rc = item_value(item, &selector[length + strlen(ops[iop].text)]);
+			if (rc == 0 && item->op != op_eq && item->op != op_ne && !item->numeric)
+				rc = -1; // ordering only applies to numbers
+		}
+	}
+	if (rc == 0 && item->op == op_none) {
+		item->quoted = quote(item->path);
+		if (item->quoted == NULL)
+			rc = -1;
+	}
+	if (rc < 0) {
+		item_clear(item);
+		return -1;
+	}
+	select->nfields += item->op == op_none;
+	select->count++;
+	return 0;
+}
+
+static bool compare(json_select_op_t op, double a, double b)
+{
+	switch (op) {
+	case op_eq:
+		return a == b;
+	case op_ne:
+		return a != b;
+	case op_lt:
+		return a < b;
+	case op_le:
+		return a <= b;
+	case op_gt:
+		return a > b;
+	case op_ge:
+		return a >= b;
+	default:
+		return false;
+	}
+}
+
+/***************************************************************************************/
+
+static json_object *object_find(const json_select_item_t *item, json_object *object)
+{
+	int idx;
+
+	for (idx = 0; object != NULL && idx < item->nsegs; idx++) {
+		if (json_object_is_type(object, json_type_array))
+			object = item->indexes[idx] < 0 ? NULL :
+							  json_object_array_get_idx(object, (size_t)item->indexes[idx]);
+		else if (!json_object_object_get_ex(object, item->segs[idx], &object))
+			object = NULL;
+	}
+	return object;
+}
+
+static bool object_check(const json_select_item_t *item, json_object *value)
+{
+	json_type type = value == NULL ? json_type_null : json_object_get_type(value);
+	bool isnum = type == json_type_int || type == json_type_double;
+
+	if (item->numeric && isnum)
+		return compare(item->op, json_object_get_double(value), item->number);
+	if (item->op == op_eq)
+		return json_object_equal(value, item->value);
+	if (item->op == op_ne)
+		return !json_object_equal(value, item->value);
+	return false;
+}
+
+json_object *json_select_object(const json_select_t *select, json_object *document)
+{
+	const json_select_item_t *item;
+	json_object *result, *value;
+	int idx;
+
+	for (idx = 0; idx < select->count; idx++) {
+		item = &select->items[idx];
+		if (item->op != op_none && !object_check(item, object_find(item, document)))
+			return NULL;
+	}
+	if (select->nfields == 0)
+		return json_object_get(document);
+
+	result = NULL;
+	for (idx = 0; idx < select->count; idx++) {
+		item = &select->items[idx];
+		if (item->op == op_none && (value = object_find(item, document)) != NULL) {
+			if (result == NULL && (result = json_object_new_object()) == NULL)
+				break;
+			json_object_object_add(result, item->path, json_object_get(value));
+		}
+	}
+	return result;
+}
+
+/***************************************************************************************/
+
+static const char *skip_space(const char *scan, const char *end)
+{
+	while (scan != end && (*scan == ' ' || *scan == '\n' || *scan == '\r' || *scan == '\t'))
+		scan++;
+	return scan;
+}
+
+// scan is just after the opening quote, returns the position of the closing quote
+static const char *skip_string(const char *scan, const char *end)
+{
+	while (scan != end && *scan != '"')
+		scan += 1 + (*scan == '\\' && scan + 1 != end);
+	return scan;
+}
+
+// skip the value at scan without looking at it
+static const char *skip_value(const char *scan, const char *end)
+{
+	int depth = 0;
+
+	for (; scan != end; scan++) {
+		switch (*scan) {
+		case '"':
+			scan = skip_string(scan + 1, end);
+			if (scan == end)
+				return end;
+			if (depth == 0)
+				return scan + 1;
+			break;
+		case '{':
+		case '[':
+			depth++;
+			break;
+		case '}':
+		case ']':
+			if (depth == 0)
+				return scan;
+			if (--depth == 0)
+				return scan + 1;
+			break;
+		case ',':
+		case ' ':
+		case '\n':
+		case '\r':
+		case '\t':
+			if (depth == 0)
+				return scan;
+			break;
+		default:
+			break;
+		}
+	}
+	return scan;
+}
+
+// get the value of the segment in the container at scan, NULL if none
+static const char *text_child(const json_select_item_t *item, int iseg, const char *scan, const char *end)
+{
+	const char *key, *keyend;
+	int index;
+
+	if (scan == end)
+		return NULL;
+	if (*scan == '{') {
+		for (scan = skip_space(scan + 1, end); scan != end && *scan == '"';) {
+			// keys are compared as written, escapes are not decoded
+			key = scan + 1;
+			keyend = skip_string(key, end);
+			if (keyend == end)
+				return NULL;
+			scan = skip_space(keyend + 1, end);
+			if (scan == end || *scan != ':')
+				return NULL;
+			scan = skip_space(scan + 1, end);
+			if ((size_t)(keyend - key) == item->seglens[iseg] && !memcmp(key, item->segs[iseg], item->seglens[iseg]))
+				return scan;
+			scan = skip_space(skip_value(scan, end), end);
+			if (scan == end || *scan != ',')
+				return NULL;
+			scan = skip_space(scan + 1, end);
+		}
+	} else if (*scan == '[' && item->indexes[iseg] >= 0) {
+		scan = skip_space(scan + 1, end);
+		for (index = 0; scan != end && *scan != ']'; index++) {
+			if (index == item->indexes[iseg])
+				return scan;
+			scan = skip_space(skip_value(scan, end), end);
+			if (scan == end || *scan != ',')
+				return NULL;
+			scan = skip_space(scan + 1, end);
+		}
+	}
+	return NULL;
+}
+
+// get the text of the value of the item, NULL if none
+static const char *text_find(const json_select_item_t *item, const char *json, const char *end, size_t *length)
+{
+	const char *scan = skip_space(json, end);
+	int iseg;
+
+	for (iseg = 0; scan != NULL && iseg < item->nsegs; iseg++)
+		scan = text_child(item, iseg, scan, end);
+	if (scan == NULL || scan == end)
+		return NULL;
+	*length = (size_t)(skip_value(scan, end) - scan);
+	return scan;
+}
+
+static bool text_check(const json_select_item_t *item, const char *value, size_t length)
+{
+	char number[64];
+
+	if (value == NULL)
+		return item->op == op_ne;
+	if (item->numeric && (*value == '-' || (*value >= '0' && *value <= '9')) && length < sizeof number) {
+		memcpy(number, value, length);
+		number[length] = 0;
+		return compare(item->op, strtod(number, NULL), item->number);
+	}
+	if (item->op == op_eq || item->op == op_ne)
+		return (length == strlen(item->text) && !memcmp(value, item->text, length)) == (item->op == op_eq);
+	return false;
+}
+
+static int append(stream_buf_t *out, const char *data, size_t length)
+{
+	if (stream_buf_ensure(out, length) == NULL)
+		return -1;
+	memcpy(&out->data[out->length], data, length);
+	out->length += length;
+	return 0;
+}
+
+int json_select_text(const json_select_t *select, const char *json, size_t length, stream_buf_t *out)
+{
+	const json_select_item_t *item;
+	const char *end = json + length, *value;
+	size_t vlen = 0;
+	int idx, rc = 0;
+
+	for (idx = 0; idx < select->count; idx++) {
+		item = &select->items[idx];
+		if (item->op != op_none && !text_check(item, text_find(item, json, end, &vlen), vlen))
+			return JSON_SELECT_DROP;
+	}
+	if (select->nfields == 0)
+		return JSON_SELECT_WHOLE;
+
+	out->length = 0;
+	for (idx = 0; idx < select->count && rc == 0; idx++) {
+		item = &select->items[idx];
+		if (item->op == op_none && (value = text_find(item, json, end, &vlen)) != NULL) {
+			rc = append(out, out->length ? "," : "{", 1);
+			if (rc == 0)
+				rc = append(out, item->quoted, strlen(item->quoted));
+			if (rc == 0)
+				rc = append(out, ":", 1);
+			if (rc == 0)
+				rc = append(out, value, vlen);
+		}
+	}
+	if (rc == 0 && out->length)
+		rc = append(out, "}", 1);
+	return rc < 0 ? -1 : out->length ? JSON_SELECT_FIELDS : JSON_SELECT_DROP;
+}
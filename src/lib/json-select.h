@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2015-2021 IoT.bzh Company
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ *
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include <json-c/json.h>
+
+#include "stream-buf.h"
+
+// Selection of the fields of JSON documents by dotted paths ("a.b.0.c"),
+// numeric segments also index arrays. A selector may be a predicate when its
+// path is followed by one of the operators ==, !=, <, <=, >, >= and a value.
+// Documents failing a predicate are dropped, the others are projected on the
+// paths that aren't predicates, keyed by the path.
+
+typedef struct json_select_s json_select_t;
+
+// status of json_select_text
+#define JSON_SELECT_DROP 0 // the document fails a predicate or has none of the fields
+#define JSON_SELECT_FIELDS 1 // the selected fields are in the output buffer
+#define JSON_SELECT_WHOLE 2 // no projection, the whole document is kept
+
+// create an empty selection
+extern json_select_t *json_select_create(void);
+
+// free the selection
+extern void json_select_free(json_select_t *select);
+
+// add the selector
+// returns 0 on success or -1 when out of memory or invalid
+extern int json_select_add(json_select_t *select, const char *selector);
+
+// apply the selection to a document tree
+// returns NULL when the document is dropped or a new reference to the result
+extern json_object *json_select_object(const json_select_t *select, json_object *document);
+
+// apply the selection to the text of a valid document without parsing it,
+// returns one of JSON_SELECT_* and, for JSON_SELECT_FIELDS, the text of the
+// result in the buffer that grows as needed (-1 when out of memory)
+extern int json_select_text(const json_select_t *select, const char *json, size_t length, stream_buf_t *out);
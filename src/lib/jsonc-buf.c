@@ -25,6 +25,7 @@
 #include <errno.h>
 
 #include "jsonc-buf.h"
+#include "read-budget.h"
 
 void jsonc_buf_process(json_tokener *tokener, const char *buffer, size_t count, jsonc_buf_cb push, void *closure,
 		       jsonc_buf_error_cb onerror)
@@ -63,12 +64,13 @@ void jsonc_buf_read(json_tokener *tokener, int fd, jsonc_buf_cb push, void *clos
 {
 	char buffer[4096];
 
-	for (;;) {
+	while (!read_budget_exhausted()) {
 		// read
 		ssize_t sts = read(fd, buffer, sizeof buffer);
-		if (sts > 0)
+		if (sts > 0) {
+			read_budget_spend((size_t)sts);
 			jsonc_buf_process(tokener, buffer, (size_t)sts, push, closure, onerror);
-		else if (sts == 0 || errno != EINTR)
+		} else if (sts == 0 || errno != EINTR)
 			break;
 	}
 }
@@ -21,6 +21,8 @@
  * $RP_END_LICENSE$
  */
 
+#include <string.h>
+
 #include "line-buf.h"
 
 void line_buf_process(stream_buf_t *sbuf, size_t offset, line_buf_cb push, void *closure)
@@ -72,6 +74,22 @@ void line_buf_read(stream_buf_t *sbuf, int fd, line_buf_cb push, void *closure)
 	}
 }
 
+void line_buf_write(stream_buf_t *sbuf, const char *data, size_t length, line_buf_cb push, void *closure)
+{
+	size_t offset, count;
+
+	// processing always leaves room unless lines are longer than the buffer
+	while (length > 0) {
+		offset = stream_buf_length(sbuf);
+		count = stream_buf_write(sbuf, data, length);
+		if (count == 0)
+			return;
+		data += count;
+		length -= count;
+		line_buf_process(sbuf, offset, push, closure);
+	}
+}
+
 void line_buf_end(stream_buf_t *sbuf, line_buf_cb push, void *closure)
 {
 	size_t length;
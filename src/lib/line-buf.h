@@ -31,4 +31,6 @@ extern void line_buf_process(stream_buf_t *sbuf, size_t offset, line_buf_cb push
 
 extern void line_buf_read(stream_buf_t *sbuf, int fd, line_buf_cb push, void *closure);
 
+extern void line_buf_write(stream_buf_t *sbuf, const char *data, size_t length, line_buf_cb push, void *closure);
+
 extern void line_buf_end(stream_buf_t *sbuf, line_buf_cb push, void *closure);
@@ -0,0 +1,243 @@
+/*
+ * Copyright (C) 2015-2021 IoT.bzh Company
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ *
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+*/
+
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <regex.h>
+
+#include "line-filter.h"
+
+// literals are matched in one pass by an Aho-Corasick automaton whose
+// transitions are completed, giving a DFA with one lookup per byte
+typedef uint32_t line_filter_row_t[256];
+
+struct line_filter_s {
+	int flags;
+	// kinds of patterns present
+	int kinds;
+	// literals
+	unsigned nlits;
+	char **lits;
+	unsigned char *litkinds;
+	// automaton
+	unsigned nstates;
+	line_filter_row_t *delta;
+	unsigned char *out;
+	// regular expressions
+	unsigned nregs;
+	regex_t *regs;
+	unsigned char *regkinds;
+};
+
+line_filter_t *line_filter_create(int flags)
+{
+	line_filter_t *filter = calloc(1, sizeof *filter);
+	if (filter != NULL)
+		filter->flags = flags;
+	return filter;
+}
+
+static void line_filter_reset(line_filter_t *filter)
+{
+	free(filter->delta);
+	free(filter->out);
+	filter->delta = NULL;
+	filter->out = NULL;
+	filter->nstates = 0;
+}
+
+void line_filter_free(line_filter_t *filter)
+{
+	unsigned idx;
+
+	if (filter != NULL) {
+		line_filter_reset(filter);
+		for (idx = 0; idx < filter->nlits; idx++)
+			free(filter->lits[idx]);
+		free(filter->lits);
+		free(filter->litkinds);
+		for (idx = 0; idx < filter->nregs; idx++)
+			regfree(&filter->regs[idx]);
+		free(filter->regs);
+		free(filter->regkinds);
+		free(filter);
+	}
+}
+
+int line_filter_add_literal(line_filter_t *filter, int kind, const char *pattern)
+{
+	char **lits, *lit;
+	unsigned char *kinds;
+
+	lits = realloc(filter->lits, (filter->nlits + 1) * sizeof *lits);
+	if (lits == NULL)
+		return -1;
+	filter->lits = lits;
+	kinds = realloc(filter->litkinds, filter->nlits + 1);
+	if (kinds == NULL)
+		return -1;
+	filter->litkinds = kinds;
+	lit = strdup(pattern);
+	if (lit == NULL)
+		return -1;
+	lits[filter->nlits] = lit;
+	kinds[filter->nlits++] = (unsigned char)kind;
+	filter->kinds |= kind;
+	return 0;
+}
+
+int line_filter_add_regex(line_filter_t *filter, int kind, const char *regex)
+{
+	regex_t *regs;
+	unsigned char *kinds;
+	int cflags = REG_EXTENDED | REG_NOSUB;
+
+	regs = realloc(filter->regs, (filter->nregs + 1) * sizeof *regs);
+	if (regs == NULL)
+		return -1;
+	filter->regs = regs;
+	kinds = realloc(filter->regkinds, filter->nregs + 1);
+	if (kinds == NULL)
+		return -1;
+	filter->regkinds = kinds;
+	if (filter->flags & LINE_FILTER_ICASE)
+		cflags |= REG_ICASE;
+	if (regcomp(&regs[filter->nregs], regex, cflags) != 0)
+		return -1;
+	kinds[filter->nregs++] = (unsigned char)kind;
+	filter->kinds |= kind;
+	return 0;
+}
+
+static inline unsigned char line_filter_fold(const line_filter_t *filter, unsigned char c)
+{
+	return (filter->flags & LINE_FILTER_ICASE) ? (unsigned char)tolower(c) : c;
+}
+
+int line_filter_compile(line_filter_t *filter)
+{
+	unsigned idx, count, state, next, head, tail, c;
+	const unsigned char *lit;
+	unsigned *fail, *queue;
+
+	line_filter_reset(filter);
+	if (filter->nlits == 0)
+		return 0;
+
+	// upper bound of the count of states
+	for (count = 1, idx = 0; idx < filter->nlits; idx++)
+		count += (unsigned)strlen(filter->lits[idx]);
+	filter->delta = calloc(count, sizeof *filter->delta);
+	filter->out = calloc(count, 1);
+	fail = calloc(count, sizeof *fail);
+	queue = malloc(count * sizeof *queue);
+	if (filter->delta == NULL || filter->out == NULL || fail == NULL || queue == NULL) {
+		free(fail);
+		free(queue);
+		line_filter_reset(filter);
+		return -1;
+	}
+
+	// build the trie, 0 being the root it also stands for no transition
+	filter->nstates = 1;
+	for (idx = 0; idx < filter->nlits; idx++) {
+		state = 0;
+		for (lit = (const unsigned char *)filter->lits[idx]; *lit; lit++) {
+			c = line_filter_fold(filter, *lit);
+			next = filter->delta[state][c];
+			if (next == 0)
+				filter->delta[state][c] = next = filter->nstates++;
+			state = next;
+		}
+		filter->out[state] |= filter->litkinds[idx];
+	}
+
+	// compute failures in breadth first order and complete the transitions
+	head = tail = 0;
+	for (c = 0; c < 256; c++) {
+		next = filter->delta[0][c];
+		if (next != 0) {
+			fail[next] = 0;
+			queue[tail++] = next;
+		}
+	}
+	while (head < tail) {
+		state = queue[head++];
+		filter->out[state] |= filter->out[fail[state]];
+		for (c = 0; c < 256; c++) {
+			next = filter->delta[state][c];
+			if (next != 0) {
+				fail[next] = filter->delta[fail[state]][c];
+				queue[tail++] = next;
+			} else
+				filter->delta[state][c] = filter->delta[fail[state]][c];
+		}
+	}
+	free(fail);
+	free(queue);
+	return 0;
+}
+
+static bool line_filter_regex(const line_filter_t *filter, int kind, const char *line, size_t length)
+{
+	unsigned idx;
+	regmatch_t match[1];
+	int eflags = 0;
+
+#if defined(REG_STARTEND)
+	match[0].rm_so = 0;
+	match[0].rm_eo = (regoff_t)length;
+	eflags = REG_STARTEND;
+#endif
+	for (idx = 0; idx < filter->nregs; idx++)
+		if (filter->regkinds[idx] == kind && regexec(&filter->regs[idx], line, 1, match, eflags) == 0)
+			return true;
+	return false;
+}
+
+bool line_filter_match(const line_filter_t *filter, const char *line, size_t length)
+{
+	const unsigned char *scan = (const unsigned char *)line, *end = scan + length;
+	unsigned state;
+	int found = 0;
+
+	// literals
+	if (filter->nstates) {
+		found = filter->out[0];
+		for (state = 0; scan != end && !(found & LINE_FILTER_EXCLUDE); scan++) {
+			state = filter->delta[state][line_filter_fold(filter, *scan)];
+			found |= filter->out[state];
+		}
+		if (found & LINE_FILTER_EXCLUDE)
+			return false;
+	}
+
+	// regular expressions
+	if ((filter->kinds & LINE_FILTER_INCLUDE) && !(found & LINE_FILTER_INCLUDE)
+	    && !line_filter_regex(filter, LINE_FILTER_INCLUDE, line, length))
+		return false;
+	return !line_filter_regex(filter, LINE_FILTER_EXCLUDE, line, length);
+}
@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) 2015-2021 IoT.bzh Company
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ *
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdbool.h>
+
+// kind of the patterns
+#define LINE_FILTER_INCLUDE 1
+#define LINE_FILTER_EXCLUDE 2
+
+// flag for case insensitive matching
+#define LINE_FILTER_ICASE 1
+
+typedef struct line_filter_s line_filter_t;
+
+// create an empty filter, flags being 0 or LINE_FILTER_ICASE
+extern line_filter_t *line_filter_create(int flags);
+
+// free the memory used by the filter
+extern void line_filter_free(line_filter_t *filter);
+
+// add a literal substring of the kind LINE_FILTER_INCLUDE or LINE_FILTER_EXCLUDE
+// returns 0 on success or -1 when out of memory
+extern int line_filter_add_literal(line_filter_t *filter, int kind, const char *pattern);
+
+// add a POSIX extended regular expression of the kind LINE_FILTER_INCLUDE or LINE_FILTER_EXCLUDE
+// returns 0 on success or -1 when out of memory or invalid
+extern int line_filter_add_regex(line_filter_t *filter, int kind, const char *regex);
+
+// compile the literals in one automaton, must be called after adding patterns
+// returns 0 on success or -1 when out of memory
+extern int line_filter_compile(line_filter_t *filter);
+
+// check if the filter keeps the line: it matches an include pattern (or
+// there is no include pattern) and matches no exclude pattern
+extern bool line_filter_match(const line_filter_t *filter, const char *line, size_t length);
@@ -0,0 +1,44 @@
+/*
+ * Copyright (C) 2015-2021 IoT.bzh Company
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ *
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+*/
+
+
+#pragma once
+
+#include <stddef.h>
+#include <stdbool.h>
+
+// Budget of bytes read at a wakeup by the reading loops of the thread.
+// When it is exhausted, the loops return as if no more input was available,
+// letting the event loop serve the other ready file descriptors first.
+// Input left is read at the next wakeup of the level triggered descriptor.
+
+// set the budget of the thread, 0 for no limit (the initial state)
+extern void read_budget_set(size_t budget);
+
+// account bytes read
+extern void read_budget_spend(size_t count);
+
+// true when the budget is exhausted
+extern bool read_budget_exhausted(void);
+
+// exhaust the budget, stopping the reading loops of the thread until the next set
+extern void read_budget_exhaust(void);
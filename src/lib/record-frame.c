@@ -0,0 +1,207 @@
+/*
+ * Copyright (C) 2015-2021 IoT.bzh Company
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ *
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+*/
+
+
+#define _GNU_SOURCE
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <regex.h>
+
+#include "record-frame.h"
+
+struct record_frame_s {
+	// delimiter of records or NULL when records start at lines matching start
+	char *delim;
+	size_t dlen;
+	regex_t start;
+};
+
+record_frame_t *record_frame_create_delimiter(const char *delimiter, size_t length)
+{
+	record_frame_t *frame;
+
+	if (length == 0)
+		return NULL;
+	frame = calloc(1, sizeof *frame);
+	if (frame != NULL) {
+		frame->delim = malloc(length);
+		if (frame->delim == NULL) {
+			free(frame);
+			return NULL;
+		}
+		memcpy(frame->delim, delimiter, length);
+		frame->dlen = length;
+	}
+	return frame;
+}
+
+record_frame_t *record_frame_create_start(const char *regex, int flags)
+{
+	int cflags = REG_EXTENDED | REG_NOSUB;
+	record_frame_t *frame = calloc(1, sizeof *frame);
+
+	if (frame != NULL) {
+		if (flags & RECORD_FRAME_ICASE)
+			cflags |= REG_ICASE;
+		if (regcomp(&frame->start, regex, cflags) != 0) {
+			free(frame);
+			frame = NULL;
+		}
+	}
+	return frame;
+}
+
+const char *record_frame_delimiter(const record_frame_t *frame, size_t *length)
+{
+	*length = frame->dlen;
+	return frame->delim;
+}
+
+void record_frame_free(record_frame_t *frame)
+{
+	if (frame != NULL) {
+		if (frame->delim != NULL)
+			free(frame->delim);
+		else
+			regfree(&frame->start);
+		free(frame);
+	}
+}
+
+// length of the record of lines ending at end, without its last newline
+static size_t record_frame_trim(const char *data, size_t base, size_t end)
+{
+	if (end > base && data[end - 1] == '\n')
+		end--;
+	if (end > base && data[end - 1] == '\r')
+		end--;
+	return end - base;
+}
+
+// check if the line of data, terminated by a newline at end, starts a record
+static bool record_frame_starts(const record_frame_t *frame, char *data, size_t line, size_t end)
+{
+	int sts;
+	size_t pz = end - (end > line && data[end - 1] == '\r');
+	char c = data[pz];
+
+	data[pz] = 0;
+	sts = regexec(&frame->start, &data[line], 0, NULL, 0);
+	data[pz] = c;
+	return sts == 0;
+}
+
+// records split at delimiters, a delimiter may straddle the offset
+static size_t record_frame_split(const record_frame_t *frame, char *data, size_t last, size_t offset,
+				 line_buf_cb push, void *closure)
+{
+	size_t base = 0, pos = offset >= frame->dlen ? offset - frame->dlen + 1 : 0;
+	char *found;
+
+	while ((found = memmem(&data[pos], last - pos, frame->delim, frame->dlen)) != NULL) {
+		pos = (size_t)(found - data);
+		data[pos] = 0;
+		push(closure, &data[base], pos - base);
+		base = pos += frame->dlen;
+	}
+	return base;
+}
+
+// records of lines, each record ends before the next line matching the start pattern
+static size_t record_frame_lines(const record_frame_t *frame, char *data, size_t last, size_t offset,
+				 line_buf_cb push, void *closure)
+{
+	size_t base = 0, line = offset, pos = offset;
+	char *found;
+
+	// the line being completed starts after the last newline before offset
+	while (line > 0 && data[line - 1] != '\n')
+		line--;
+	while ((found = memchr(&data[pos], '\n', last - pos)) != NULL) {
+		pos = (size_t)(found - data);
+		// the first line of a record is never tested
+		if (line > base && record_frame_starts(frame, data, line, pos)) {
+			push(closure, &data[base], record_frame_trim(data, base, line));
+			base = line;
+		}
+		line = ++pos;
+	}
+	return base;
+}
+
+void record_frame_process(const record_frame_t *frame, stream_buf_t *sbuf, size_t offset, line_buf_cb push,
+			  void *closure)
+{
+	char *data = stream_buf_data(sbuf);
+	size_t last = stream_buf_length(sbuf);
+	size_t base = frame->delim != NULL ? record_frame_split(frame, data, last, offset, push, closure) :
+					     record_frame_lines(frame, data, last, offset, push, closure);
+
+	// a record larger than the buffer is cut
+	if (base == 0 && last == stream_buf_capacity(sbuf)) {
+		push(closure, data, frame->delim != NULL ? last : record_frame_trim(data, 0, last));
+		base = last;
+	}
+	if (base)
+		stream_buf_consume(sbuf, base);
+}
+
+void record_frame_read(const record_frame_t *frame, stream_buf_t *sbuf, int fd, line_buf_cb push, void *closure)
+{
+	for (;;) {
+		size_t offset = stream_buf_length(sbuf);
+		int sts = stream_buf_read_fd(sbuf, fd);
+		if (sts <= 0)
+			return;
+		record_frame_process(frame, sbuf, offset, push, closure);
+	}
+}
+
+void record_frame_write(const record_frame_t *frame, stream_buf_t *sbuf, const char *data, size_t length,
+			line_buf_cb push, void *closure)
+{
+	size_t offset, count;
+
+	// processing always leaves room, cutting the records larger than the buffer
+	while (length > 0) {
+		offset = stream_buf_length(sbuf);
+		count = stream_buf_write(sbuf, data, length);
+		if (count == 0)
+			return;
+		data += count;
+		length -= count;
+		record_frame_process(frame, sbuf, offset, push, closure);
+	}
+}
+
+void record_frame_end(const record_frame_t *frame, stream_buf_t *sbuf, line_buf_cb push, void *closure)
+{
+	size_t length = stream_buf_length(sbuf);
+	char *data = stream_buf_data(sbuf);
+
+	if (length) {
+		push(closure, data, frame->delim != NULL ? length : record_frame_trim(data, 0, length));
+		stream_buf_consume(sbuf, length);
+	}
+}
@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2015-2021 IoT.bzh Company
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ *
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+*/
+
+
+#pragma once
+
+#include <stddef.h>
+
+#include "stream-buf.h"
+#include "line-buf.h"
+
+// flag for case insensitive matching of the start pattern
+#define RECORD_FRAME_ICASE 1
+
+typedef struct record_frame_s record_frame_t;
+
+// create a framing splitting records at each occurrence of the delimiter of length bytes
+// returns NULL when out of memory or when the delimiter is empty
+extern record_frame_t *record_frame_create_delimiter(const char *delimiter, size_t length);
+
+// create a framing of records made of lines, a record starting at each line
+// matching the POSIX extended regular expression, flags being 0 or RECORD_FRAME_ICASE
+// returns NULL when out of memory or when the expression is invalid
+extern record_frame_t *record_frame_create_start(const char *regex, int flags);
+
+// get the delimiter of the framing and its length, NULL for records of lines started by a pattern
+extern const char *record_frame_delimiter(const record_frame_t *frame, size_t *length);
+
+// free the memory used by the framing
+extern void record_frame_free(record_frame_t *frame);
+
+// push the complete records of the buffer, data before offset being already scanned,
+// a record filling the whole buffer is pushed as is
+extern void record_frame_process(const record_frame_t *frame, stream_buf_t *sbuf, size_t offset, line_buf_cb push,
+				 void *closure);
+
+extern void record_frame_read(const record_frame_t *frame, stream_buf_t *sbuf, int fd, line_buf_cb push,
+			      void *closure);
+
+// add the data to the buffer, pushing the complete records
+extern void record_frame_write(const record_frame_t *frame, stream_buf_t *sbuf, const char *data, size_t length,
+			       line_buf_cb push, void *closure);
+
+extern void record_frame_end(const record_frame_t *frame, stream_buf_t *sbuf, line_buf_cb push, void *closure);
@@ -0,0 +1,332 @@
+/*
+ * Copyright (C) 2015-2021 IoT.bzh Company
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ *
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "ring-buf.h"
+#include "read-budget.h"
+
+/*************************************************************************/
+
+byte_ring_t *byte_ring_init(byte_ring_t *ring, size_t capacity)
+{
+	ring->start = ring->length = ring->dropped = 0;
+	ring->data = malloc(capacity);
+	ring->capacity = ring->data == NULL ? 0 : capacity;
+	return ring->data == NULL ? NULL : ring;
+}
+
+void byte_ring_clear(byte_ring_t *ring)
+{
+	free(ring->data);
+	ring->data = NULL;
+	ring->capacity = ring->start = ring->length = 0;
+}
+
+void byte_ring_write(byte_ring_t *ring, const char *data, size_t length)
+{
+	size_t pos, count;
+
+	if (ring->capacity == 0) {
+		ring->dropped += length;
+		return;
+	}
+
+	// only the last capacity bytes can be kept
+	if (length > ring->capacity) {
+		ring->dropped += length - ring->capacity;
+		data += length - ring->capacity;
+		length = ring->capacity;
+	}
+
+	// drop the oldest bytes
+	if (ring->length + length > ring->capacity) {
+		count = ring->length + length - ring->capacity;
+		ring->dropped += count;
+		ring->start = (ring->start + count) % ring->capacity;
+		ring->length -= count;
+	}
+
+	// copy at the end, wrapping if needed
+	pos = (ring->start + ring->length) % ring->capacity;
+	count = ring->capacity - pos;
+	if (count > length)
+		count = length;
+	memcpy(&ring->data[pos], data, count);
+	memcpy(ring->data, &data[count], length - count);
+	ring->length += length;
+}
+
+int byte_ring_read_fd(byte_ring_t *ring, int fd)
+{
+	char buffer[4096];
+	int rc = 0;
+
+	for (;;) {
+		if (read_budget_exhausted())
+			return rc;
+		ssize_t sts = read(fd, buffer, sizeof buffer);
+		if (sts > 0) {
+			read_budget_spend((size_t)sts);
+			byte_ring_write(ring, buffer, (size_t)sts);
+			rc = 1;
+		} else if (sts == 0)
+			return rc;
+		else if (errno != EINTR)
+			return errno == EAGAIN ? rc : -1;
+	}
+}
+
+size_t byte_ring_copy(byte_ring_t *ring, char *buffer)
+{
+	size_t count = ring->capacity - ring->start;
+	if (count > ring->length)
+		count = ring->length;
+	memcpy(buffer, &ring->data[ring->start], count);
+	memcpy(&buffer[count], ring->data, ring->length - count);
+	return ring->length;
+}
+
+/*************************************************************************/
+
+line_ring_t *line_ring_init(line_ring_t *ring, size_t count, size_t slotsize)
+{
+	ring->first = ring->used = ring->dropped = 0;
+	ring->lengths = malloc(count * sizeof *ring->lengths);
+	ring->data = ring->lengths == NULL ? NULL : malloc(count * slotsize);
+	if (ring->data == NULL) {
+		free(ring->lengths);
+		ring->lengths = NULL;
+		ring->count = ring->slotsize = 0;
+		return NULL;
+	}
+	ring->count = count;
+	ring->slotsize = slotsize;
+	return ring;
+}
+
+void line_ring_clear(line_ring_t *ring)
+{
+	free(ring->lengths);
+	free(ring->data);
+	ring->lengths = NULL;
+	ring->data = NULL;
+	ring->count = ring->slotsize = ring->first = ring->used = 0;
+}
+
+void line_ring_push(line_ring_t *ring, const char *line, size_t length)
+{
+	size_t idx;
+
+	if (ring->count == 0) {
+		ring->dropped++;
+		return;
+	}
+	if (ring->used < ring->count)
+		idx = (ring->first + ring->used++) % ring->count;
+	else {
+		idx = ring->first;
+		ring->first = (ring->first + 1) % ring->count;
+		ring->dropped++;
+	}
+	if (length > ring->slotsize)
+		length = ring->slotsize;
+	memcpy(&ring->data[idx * ring->slotsize], line, length);
+	ring->lengths[idx] = length;
+}
+
+void line_ring_iter(line_ring_t *ring, line_ring_cb push, void *closure)
+{
+	size_t num, idx;
+
+	for (num = 0; num < ring->used; num++) {
+		idx = (ring->first + num) % ring->count;
+		push(closure, &ring->data[idx * ring->slotsize], ring->lengths[idx]);
+	}
+}
+
+/*************************************************************************/
+
+line_sample_t *line_sample_init(line_sample_t *sample, size_t count, size_t slotsize, uint64_t seed)
+{
+	sample->used = 0;
+	sample->seen = 0;
+	sample->random = seed | 1; // xorshift never leaves zero
+	sample->numbers = malloc(count * sizeof *sample->numbers);
+	sample->lengths = malloc(count * sizeof *sample->lengths);
+	sample->tags = malloc(count);
+	sample->data = malloc(count * slotsize);
+	if (sample->numbers == NULL || sample->lengths == NULL || sample->tags == NULL || sample->data == NULL) {
+		line_sample_clear(sample);
+		return NULL;
+	}
+	sample->count = count;
+	sample->slotsize = slotsize;
+	return sample;
+}
+
+void line_sample_clear(line_sample_t *sample)
+{
+	free(sample->numbers);
+	free(sample->lengths);
+	free(sample->tags);
+	free(sample->data);
+	sample->numbers = NULL;
+	sample->lengths = NULL;
+	sample->tags = NULL;
+	sample->data = NULL;
+	sample->count = sample->slotsize = sample->used = 0;
+}
+
+// next pseudo random number (xorshift64*)
+static uint64_t line_sample_random(line_sample_t *sample)
+{
+	uint64_t x = sample->random;
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	sample->random = x;
+	return x * UINT64_C(0x2545F4914F6CDD1D);
+}
+
+void line_sample_push(line_sample_t *sample, const char *line, size_t length, int tag)
+{
+	uint64_t idx;
+
+	// algorithm R: the nth line replaces a random slot with the probability count/n
+	sample->seen++;
+	if (sample->used < sample->count)
+		idx = sample->used++;
+	else {
+		idx = line_sample_random(sample) % sample->seen;
+		if (idx >= sample->count)
+			return;
+	}
+	if (length > sample->slotsize)
+		length = sample->slotsize;
+	memcpy(&sample->data[idx * sample->slotsize], line, length);
+	sample->lengths[idx] = length;
+	sample->tags[idx] = (unsigned char)tag;
+	sample->numbers[idx] = sample->seen;
+}
+
+static int line_sample_compare(const void *a, const void *b)
+{
+	uint64_t na = **(const uint64_t *const *)a, nb = **(const uint64_t *const *)b;
+	return na < nb ? -1 : na > nb;
+}
+
+void line_sample_iter(line_sample_t *sample, line_sample_cb push, void *closure)
+{
+	const uint64_t **order;
+	size_t num, idx;
+
+	// the slots are sorted by number of line, or taken as is when out of memory
+	order = malloc(sample->used * sizeof *order);
+	if (order != NULL) {
+		for (num = 0; num < sample->used; num++)
+			order[num] = &sample->numbers[num];
+		qsort(order, sample->used, sizeof *order, line_sample_compare);
+	}
+	for (num = 0; num < sample->used; num++) {
+		idx = order == NULL ? num : (size_t)(order[num] - sample->numbers);
+		push(closure, &sample->data[idx * sample->slotsize], sample->lengths[idx], sample->tags[idx]);
+	}
+	free(order);
+}
+
+/*************************************************************************/
+
+struct text_ring_item_s {
+	uint64_t time;
+	size_t length;
+	char text[];
+};
+
+text_ring_t *text_ring_init(text_ring_t *ring, size_t count, size_t maxlength, uint64_t maxage)
+{
+	ring->first = ring->used = ring->length = ring->dropped = 0;
+	ring->maxlength = maxlength;
+	ring->maxage = maxage;
+	ring->items = malloc(count * sizeof *ring->items);
+	ring->count = ring->items == NULL ? 0 : count;
+	return ring->items == NULL ? NULL : ring;
+}
+
+// drop the oldest text
+static void text_ring_drop(text_ring_t *ring)
+{
+	struct text_ring_item_s *item = ring->items[ring->first];
+
+	ring->length -= item->length;
+	ring->first = (ring->first + 1) % ring->count;
+	ring->used--;
+	ring->dropped++;
+	free(item);
+}
+
+void text_ring_clear(text_ring_t *ring)
+{
+	while (ring->used > 0)
+		text_ring_drop(ring);
+	free(ring->items);
+	ring->items = NULL;
+	ring->count = ring->first = ring->length = 0;
+}
+
+int text_ring_push(text_ring_t *ring, uint64_t now, const char *text, size_t length)
+{
+	struct text_ring_item_s *item;
+
+	if (ring->count == 0 || length > ring->maxlength) {
+		ring->dropped++;
+		return 0;
+	}
+	item = malloc(sizeof *item + length);
+	if (item == NULL)
+		return -1;
+	item->time = now;
+	item->length = length;
+	memcpy(item->text, text, length);
+
+	while (ring->used == ring->count || ring->length + length > ring->maxlength)
+		text_ring_drop(ring);
+	ring->items[(ring->first + ring->used++) % ring->count] = item;
+	ring->length += length;
+	return 0;
+}
+
+void text_ring_iter(text_ring_t *ring, uint64_t now, text_ring_cb push, void *closure)
+{
+	struct text_ring_item_s *item;
+	size_t num;
+
+	while (ring->maxage != 0 && ring->used > 0 && now - ring->items[ring->first]->time > ring->maxage)
+		text_ring_drop(ring);
+	for (num = 0; num < ring->used; num++) {
+		item = ring->items[(ring->first + num) % ring->count];
+		push(closure, item->text, item->length);
+	}
+}
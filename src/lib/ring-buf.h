@@ -0,0 +1,154 @@
+/*
+ * Copyright (C) 2015-2021 IoT.bzh Company
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ *
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * ring of bytes: keeps the last written bytes
+ */
+typedef struct byte_ring_s byte_ring_t;
+
+struct byte_ring_s {
+	size_t capacity;
+	size_t start;
+	size_t length;
+	size_t dropped;
+	char *data;
+};
+
+// allocate the ring, returns NULL on error
+extern byte_ring_t *byte_ring_init(byte_ring_t *ring, size_t capacity);
+
+// free the memory used by the ring
+extern void byte_ring_clear(byte_ring_t *ring);
+
+// add the bytes to the ring, dropping the oldest ones when full
+extern void byte_ring_write(byte_ring_t *ring, const char *data, size_t length);
+
+// read data from fd in the ring until end or EAGAIN
+// returns a negative on error, zero if nothing is read, or a positive if something was read
+extern int byte_ring_read_fd(byte_ring_t *ring, int fd);
+
+// copy the bytes of the ring, oldest first, to buffer that must hold at least length bytes
+// returns the count of bytes copied
+extern size_t byte_ring_copy(byte_ring_t *ring, char *buffer);
+
+/*
+ * ring of lines: keeps the last pushed lines in slots of fixed size
+ */
+typedef struct line_ring_s line_ring_t;
+
+typedef void (*line_ring_cb)(void *closure, const char *line, size_t length);
+
+struct line_ring_s {
+	size_t count;
+	size_t slotsize;
+	size_t first;
+	size_t used;
+	size_t dropped;
+	size_t *lengths;
+	char *data;
+};
+
+// allocate a ring of count lines of at most slotsize bytes, returns NULL on error
+extern line_ring_t *line_ring_init(line_ring_t *ring, size_t count, size_t slotsize);
+
+// free the memory used by the ring
+extern void line_ring_clear(line_ring_t *ring);
+
+// add a line, truncated to the slot size, dropping the oldest one when full
+extern void line_ring_push(line_ring_t *ring, const char *line, size_t length);
+
+// call the callback for the lines in the ring, oldest first
+extern void line_ring_iter(line_ring_t *ring, line_ring_cb push, void *closure);
+
+static inline bool line_ring_is_allocated(line_ring_t *ring)
+{
+	return ring->data != NULL;
+}
+
+/*
+ * reservoir of lines: keeps a uniform sample of the pushed lines in slots of fixed size
+ */
+typedef struct line_sample_s line_sample_t;
+
+typedef void (*line_sample_cb)(void *closure, const char *line, size_t length, int tag);
+
+struct line_sample_s {
+	size_t count;
+	size_t slotsize;
+	size_t used;
+	uint64_t seen;
+	uint64_t random;
+	uint64_t *numbers;
+	size_t *lengths;
+	unsigned char *tags;
+	char *data;
+};
+
+// allocate a reservoir of count lines of at most slotsize bytes, returns NULL on error
+extern line_sample_t *line_sample_init(line_sample_t *sample, size_t count, size_t slotsize, uint64_t seed);
+
+// free the memory used by the reservoir
+extern void line_sample_clear(line_sample_t *sample);
+
+// add a line of the tag (0..255), truncated to the slot size, replacing a random one when full
+extern void line_sample_push(line_sample_t *sample, const char *line, size_t length, int tag);
+
+// call the callback for the lines in the reservoir, in the order they were pushed
+extern void line_sample_iter(line_sample_t *sample, line_sample_cb push, void *closure);
+
+/*
+ * ring of texts: keeps the last pushed texts within a count, a total length and an age
+ */
+typedef struct text_ring_s text_ring_t;
+
+typedef void (*text_ring_cb)(void *closure, const char *text, size_t length);
+
+struct text_ring_s {
+	size_t count;
+	size_t maxlength;
+	uint64_t maxage;
+	size_t first;
+	size_t used;
+	size_t length;
+	size_t dropped;
+	struct text_ring_item_s **items;
+};
+
+// allocate a ring of count texts of at most maxlength bytes in total, kept maxage (0 for ever),
+// returns NULL on error
+extern text_ring_t *text_ring_init(text_ring_t *ring, size_t count, size_t maxlength, uint64_t maxage);
+
+// free the memory used by the ring
+extern void text_ring_clear(text_ring_t *ring);
+
+// add a copy of the text pushed at the time now, dropping the oldest ones to fit
+// returns 0 on success or -1 when out of memory
+extern int text_ring_push(text_ring_t *ring, uint64_t now, const char *text, size_t length);
+
+// drop the texts older than maxage at the time now and call the callback for the others, oldest first
+extern void text_ring_iter(text_ring_t *ring, uint64_t now, text_ring_cb push, void *closure);
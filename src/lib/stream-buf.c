@@ -27,12 +27,14 @@
 #include <errno.h>
 
 #include "stream-buf.h"
+#include "read-budget.h"
 
 // free the memory used by the stream buffer
 void stream_buf_clear(stream_buf_t *sbuf)
 {
 	sbuf->capacity = 0;
 	sbuf->length = 0;
+	sbuf->consumed = 0;
 	free(sbuf->data);
 	sbuf->data = NULL;
 }
@@ -41,6 +43,7 @@ void stream_buf_clear(stream_buf_t *sbuf)
 stream_buf_t *stream_buf_init(stream_buf_t *sbuf, size_t capacity)
 {
 	sbuf->length = 0;
+	sbuf->consumed = 0;
 	sbuf->data = malloc(capacity);
 	sbuf->capacity = sbuf->data == NULL ? 0 : capacity;
 	return sbuf->data == NULL ? NULL : sbuf;
@@ -92,7 +95,7 @@ int stream_buf_read_fd(stream_buf_t *sbuf, int fd)
 {
 	int rc = 0;
 	for (;; rc = 1) {
-		size_t avail = sbuf->capacity - sbuf->length;
+		size_t avail = read_budget_exhausted() ? 0 : sbuf->capacity - sbuf->length;
 		ssize_t sts = avail ? read(fd, &sbuf->data[sbuf->length], avail) : 0;
 		if (sts < 0) {
 			if (errno != EINTR)
@@ -100,6 +103,7 @@ int stream_buf_read_fd(stream_buf_t *sbuf, int fd)
 		} else {
 			if (sts > 0)
 				rc = 1;
+			read_budget_spend((size_t)sts);
 			sbuf->length += (size_t)sts;
 			if (sts == 0 || avail == (size_t)sts)
 				return rc;
@@ -107,12 +111,26 @@ int stream_buf_read_fd(stream_buf_t *sbuf, int fd)
 	}
 }
 
+// copy at the end of the stream buffer as many bytes of data as it can hold
+// returns the count of bytes copied
+size_t stream_buf_write(stream_buf_t *sbuf, const char *data, size_t length)
+{
+	size_t avail = sbuf->capacity - sbuf->length;
+	if (length > avail)
+		length = avail;
+	memcpy(&sbuf->data[sbuf->length], data, length);
+	sbuf->length += length;
+	return length;
+}
+
 // removes the bytes at the beginning of the stream buffer
 void stream_buf_consume(stream_buf_t *sbuf, size_t size)
 {
-	if (size >= sbuf->length)
+	if (size >= sbuf->length) {
+		sbuf->consumed += sbuf->length;
 		sbuf->length = 0;
-	else {
+	} else {
+		sbuf->consumed += size;
 		sbuf->length -= size;
 		memmove(sbuf->data, &sbuf->data[size], sbuf->length);
 	}
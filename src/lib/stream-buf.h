@@ -32,6 +32,7 @@ struct stream_buf_s {
 	size_t length;
 	size_t capacity;
 	char *data;
+	size_t consumed;
 };
 
 // free the memory used by the stream buffer
@@ -56,6 +57,10 @@ extern void stream_buf_free(stream_buf_t *sbuf);
 // returns a negative on error, zero if nothing is read, or a positive if something was read
 extern int stream_buf_read_fd(stream_buf_t *sbuf, int fd);
 
+// copy at the end of the stream buffer as many bytes of data as it can hold
+// returns the count of bytes copied
+extern size_t stream_buf_write(stream_buf_t *sbuf, const char *data, size_t length);
+
 // removes the bytes at the beginning of the stream buffer
 extern void stream_buf_consume(stream_buf_t *sbuf, size_t size);
 
@@ -78,3 +83,9 @@ static inline bool stream_buf_is_full(stream_buf_t *sbuf)
 {
 	return sbuf->length == sbuf->capacity;
 }
+
+// offset in the stream of the byte at the given position of the buffer
+static inline size_t stream_buf_offset(stream_buf_t *sbuf, const char *at)
+{
+	return sbuf->consumed + (size_t)(at - sbuf->data);
+}
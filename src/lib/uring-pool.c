@@ -0,0 +1,756 @@
+/*
+ * Copyright (C) 2015-2021 IoT.bzh Company
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ *
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+*/
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#if defined(WITH_IO_URING)
+#include <linux/io_uring.h>
+#endif
+
+#include "uring-pool.h"
+
+#if defined(WITH_IO_URING)
+
+// maximum count of descriptors of a set
+#define URING_WATCH_FDS 4
+
+// entries of the submission queue, the completion queue having twice
+#define URING_ENTRIES 256
+
+// group of the ring of buffers
+#define URING_BGID 0
+
+// user data of the completions that are not reads of descriptors
+#define URING_WAKE 1
+#define URING_CANCEL 2
+
+typedef struct uring_fd_s uring_fd_t;
+
+// A read is submitted again after each completion, in the system call waiting the
+// next ones, rather than being multishot: the reads of paused sets stop by themselves.
+struct uring_fd_s {
+	uring_watch_t *watch;
+	int fd;
+	int tag;
+	// a read is submitted, or waits for a buffer, and isn't completed
+	bool reading;
+	// the end of file or an error was given
+	bool ended;
+	// the completion held while the set is paused
+	bool held;
+	int res;
+	unsigned flags;
+	// next descriptor waiting for a buffer
+	uring_fd_t *next;
+};
+
+struct uring_watch_s {
+	uring_pool_t *pool;
+	uring_watch_cb callback;
+	void *closure;
+	int nfds;
+	uring_fd_t fds[URING_WATCH_FDS];
+	// owning the descriptors
+	bool started;
+	// the following ones are only used by the thread
+	bool enabled;
+	bool closing;
+	// state and requests shared with the other threads, protected by the mutex of the pool
+	bool paused;
+	bool active;
+	bool queued;
+	bool enabling;
+	bool resuming;
+	bool released;
+	uring_watch_t *next;
+};
+
+struct uring_pool_s {
+	int ringfd;
+	int wakefd;
+	uint64_t wakeval;
+	// submission queue, the entries being prepared up to sqlocal
+	unsigned *sqhead;
+	unsigned *sqtail;
+	unsigned sqmask;
+	unsigned sqentries;
+	unsigned sqlocal;
+	struct io_uring_sqe *sqes;
+	// completion queue
+	unsigned *cqhead;
+	unsigned *cqtail;
+	unsigned cqmask;
+	struct io_uring_cqe *cqes;
+	// mappings of the queues
+	void *sqmap;
+	void *cqmap;
+	size_t sqmaplen;
+	size_t cqmaplen;
+	// ring of buffers given to the kernel and the buffers
+	struct io_uring_buf_ring *bufring;
+	size_t bufringlen;
+	char *bufs;
+	unsigned nbufs;
+	size_t bufsize;
+	uint16_t buftail;
+	// descriptors waiting for a buffer
+	uring_fd_t *starved;
+	// descriptors waiting for room in the submission queue
+	uring_fd_t *waiting;
+	// requests of the other threads
+	pthread_mutex_t mutex;
+	uring_watch_t *requests;
+	bool stopping;
+	bool running;
+	pthread_t thread;
+};
+
+/*************************************************************************/
+
+static int uring_setup(unsigned entries, struct io_uring_params *params)
+{
+	return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int uring_register(int ringfd, unsigned opcode, void *arg, unsigned nargs)
+{
+	return (int)syscall(__NR_io_uring_register, ringfd, opcode, arg, nargs);
+}
+
+// submit the prepared entries and wait for wait completions
+static int uring_enter(uring_pool_t *pool, unsigned wait)
+{
+	unsigned submit = pool->sqlocal - *pool->sqhead;
+
+	__atomic_store_n(pool->sqtail, pool->sqlocal, __ATOMIC_RELEASE);
+	return (int)syscall(__NR_io_uring_enter, pool->ringfd, submit, wait, wait ? IORING_ENTER_GETEVENTS : 0,
+			    NULL, 0);
+}
+
+// get a cleared submission entry, NULL when the queue can't be flushed
+static struct io_uring_sqe *uring_sqe(uring_pool_t *pool)
+{
+	struct io_uring_sqe *sqe;
+
+	if (pool->sqlocal - __atomic_load_n(pool->sqhead, __ATOMIC_ACQUIRE) == pool->sqentries) {
+		if (uring_enter(pool, 0) < 0
+		    || pool->sqlocal - __atomic_load_n(pool->sqhead, __ATOMIC_ACQUIRE) == pool->sqentries)
+			return NULL;
+	}
+	sqe = &pool->sqes[pool->sqlocal++ & pool->sqmask];
+	memset(sqe, 0, sizeof *sqe);
+	return sqe;
+}
+
+// give the buffer back to the kernel
+static void uring_recycle(uring_pool_t *pool, unsigned flags)
+{
+	struct io_uring_buf *buf;
+	unsigned bid;
+
+	if (!(flags & IORING_CQE_F_BUFFER))
+		return;
+	bid = flags >> IORING_CQE_BUFFER_SHIFT;
+	buf = &pool->bufring->bufs[pool->buftail & (pool->nbufs - 1)];
+	buf->addr = (uint64_t)(uintptr_t)&pool->bufs[(size_t)bid * pool->bufsize];
+	buf->len = (uint32_t)pool->bufsize;
+	buf->bid = (uint16_t)bid;
+	__atomic_store_n(&pool->bufring->tail, ++pool->buftail, __ATOMIC_RELEASE);
+}
+
+// read of the wake up counter
+static void uring_wait_wake(uring_pool_t *pool)
+{
+	struct io_uring_sqe *sqe = uring_sqe(pool);
+
+	if (sqe != NULL) {
+		sqe->opcode = IORING_OP_READ;
+		sqe->fd = pool->wakefd;
+		sqe->addr = (uint64_t)(uintptr_t)&pool->wakeval;
+		sqe->len = sizeof pool->wakeval;
+		sqe->user_data = URING_WAKE;
+	}
+}
+
+// read of the descriptor in a buffer of the ring, waiting a buffer when none is free
+static void uring_read(uring_pool_t *pool, uring_fd_t *ufd)
+{
+	struct io_uring_sqe *sqe = uring_sqe(pool);
+
+	ufd->reading = true;
+	if (sqe == NULL) {
+		ufd->next = pool->waiting;
+		pool->waiting = ufd;
+		return;
+	}
+	sqe->opcode = IORING_OP_READ;
+	sqe->fd = ufd->fd;
+	sqe->off = (uint64_t)-1;
+	sqe->len = (uint32_t)pool->bufsize;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = URING_BGID;
+	sqe->user_data = (uint64_t)(uintptr_t)ufd;
+}
+
+// cancel the submitted read of the descriptor
+static void uring_cancel(uring_pool_t *pool, uring_fd_t *ufd)
+{
+	struct io_uring_sqe *sqe = uring_sqe(pool);
+
+	if (sqe != NULL) {
+		sqe->opcode = IORING_OP_ASYNC_CANCEL;
+		sqe->fd = -1;
+		sqe->addr = (uint64_t)(uintptr_t)ufd;
+		sqe->user_data = URING_CANCEL;
+	}
+}
+
+// wake up the thread to handle the requests
+static void uring_wake(uring_pool_t *pool)
+{
+	uint64_t one = 1;
+
+	while (write(pool->wakefd, &one, sizeof one) < 0 && errno == EINTR)
+		;
+}
+
+/*************************************************************************/
+
+static void uring_watch_free(uring_watch_t *watch)
+{
+	int idx;
+
+	if (watch->started)
+		for (idx = 0; idx < watch->nfds; idx++)
+			close(watch->fds[idx].fd);
+	free(watch);
+}
+
+static bool uring_watch_dispatching(uring_watch_t *watch)
+{
+	bool dispatching;
+
+	pthread_mutex_lock(&watch->pool->mutex);
+	dispatching = !watch->released;
+	pthread_mutex_unlock(&watch->pool->mutex);
+	return dispatching;
+}
+
+// the set is paused by any thread, possibly by the callback
+static bool uring_watch_paused(uring_watch_t *watch)
+{
+	bool paused;
+
+	pthread_mutex_lock(&watch->pool->mutex);
+	paused = watch->paused;
+	pthread_mutex_unlock(&watch->pool->mutex);
+	return paused;
+}
+
+// the set is neither paused nor released
+static bool uring_watch_reading(uring_watch_t *watch)
+{
+	bool reading;
+
+	pthread_mutex_lock(&watch->pool->mutex);
+	reading = !watch->paused && !watch->released;
+	pthread_mutex_unlock(&watch->pool->mutex);
+	return reading;
+}
+
+// free the closing set once its reads completed
+static void uring_watch_reap(uring_watch_t *watch)
+{
+	int idx;
+
+	for (idx = 0; idx < watch->nfds; idx++)
+		if (watch->fds[idx].reading)
+			return;
+	uring_watch_free(watch);
+}
+
+// give the completed read to the callback then read again, unless paused or released by the callback
+static void uring_deliver(uring_pool_t *pool, uring_fd_t *ufd, int res, unsigned flags)
+{
+	uring_watch_t *watch = ufd->watch;
+	unsigned bid = flags >> IORING_CQE_BUFFER_SHIFT;
+
+	if (res > 0) {
+		watch->callback(watch, ufd->tag, &pool->bufs[(size_t)bid * pool->bufsize], (size_t)res,
+				watch->closure);
+		uring_recycle(pool, flags);
+		if (uring_watch_reading(watch))
+			uring_read(pool, ufd);
+	} else {
+		uring_recycle(pool, flags);
+		ufd->ended = true;
+		watch->callback(watch, ufd->tag, NULL, 0, watch->closure);
+	}
+}
+
+// a read of the descriptor completed
+static void uring_complete(uring_pool_t *pool, uring_fd_t *ufd, int res, unsigned flags)
+{
+	uring_watch_t *watch = ufd->watch;
+
+	ufd->reading = false;
+	if (watch->closing || !uring_watch_dispatching(watch)) {
+		uring_recycle(pool, flags);
+		if (watch->closing)
+			uring_watch_reap(watch);
+	} else if (res == -ENOBUFS) {
+		ufd->reading = true;
+		ufd->next = pool->starved;
+		pool->starved = ufd;
+	} else if (res == -EINTR || res == -EAGAIN)
+		uring_read(pool, ufd);
+	else if (uring_watch_paused(watch)) {
+		ufd->held = true;
+		ufd->res = res;
+		ufd->flags = flags;
+	} else
+		uring_deliver(pool, ufd, res, flags);
+}
+
+// submit again the reads of the list, those still lacking room in the submission queue waiting again
+static void uring_feed(uring_pool_t *pool, uring_fd_t **list)
+{
+	uring_fd_t *ufd, *fed = *list;
+
+	*list = NULL;
+	while (fed != NULL) {
+		ufd = fed;
+		fed = ufd->next;
+		uring_read(pool, ufd);
+	}
+}
+
+// remove the descriptor from the list, returns true when it was in
+static bool uring_unlist(uring_fd_t **list, uring_fd_t *ufd)
+{
+	uring_fd_t **prv;
+
+	for (prv = list; *prv != NULL && *prv != ufd; prv = &(*prv)->next)
+		;
+	if (*prv == NULL)
+		return false;
+	*prv = ufd->next;
+	return true;
+}
+
+// read the descriptors of the set that aren't read nor held, giving the held data first
+static void uring_watch_read(uring_pool_t *pool, uring_watch_t *watch)
+{
+	uring_fd_t *ufd;
+	int idx;
+
+	for (idx = 0; idx < watch->nfds && uring_watch_reading(watch); idx++) {
+		ufd = &watch->fds[idx];
+		if (ufd->held) {
+			ufd->held = false;
+			uring_deliver(pool, ufd, ufd->res, ufd->flags);
+		} else if (!ufd->reading && !ufd->ended)
+			uring_read(pool, ufd);
+	}
+}
+
+// stop the reads of the released set, freeing it once they completed
+static void uring_watch_close(uring_pool_t *pool, uring_watch_t *watch)
+{
+	uring_fd_t *ufd;
+	int idx;
+
+	watch->closing = true;
+	for (idx = 0; idx < watch->nfds; idx++) {
+		ufd = &watch->fds[idx];
+		if (ufd->held) {
+			ufd->held = false;
+			uring_recycle(pool, ufd->flags);
+		}
+		if (uring_unlist(&pool->starved, ufd) || uring_unlist(&pool->waiting, ufd))
+			ufd->reading = false;
+		if (ufd->reading)
+			uring_cancel(pool, ufd);
+	}
+	uring_watch_reap(watch);
+}
+
+// handle the requests of the other threads, returns true when stopping
+static bool uring_requests(uring_pool_t *pool)
+{
+	uring_watch_t *watch, *requests;
+	bool stopping, enabling, resuming, released;
+
+	pthread_mutex_lock(&pool->mutex);
+	requests = pool->requests;
+	pool->requests = NULL;
+	stopping = pool->stopping;
+	pthread_mutex_unlock(&pool->mutex);
+
+	while (requests != NULL) {
+		watch = requests;
+		pthread_mutex_lock(&pool->mutex);
+		requests = watch->next;
+		watch->queued = false;
+		enabling = watch->enabling;
+		resuming = watch->resuming;
+		released = watch->released;
+		if (resuming)
+			watch->paused = false;
+		watch->enabling = watch->resuming = false;
+		pthread_mutex_unlock(&pool->mutex);
+
+		if (released)
+			uring_watch_close(pool, watch);
+		else {
+			if (enabling)
+				watch->enabled = true;
+			if (watch->enabled)
+				uring_watch_read(pool, watch);
+		}
+	}
+	return stopping;
+}
+
+// queue the request of the set to the thread, the mutex of the pool being locked
+static void uring_watch_request(uring_watch_t *watch)
+{
+	if (!watch->queued) {
+		watch->queued = true;
+		watch->next = watch->pool->requests;
+		watch->pool->requests = watch;
+	}
+}
+
+static void *uring_pool_run(void *arg)
+{
+	uring_pool_t *pool = arg;
+	struct io_uring_cqe *cqe;
+	uint64_t data;
+	unsigned head, recycled;
+	int res, rc;
+
+	uring_wait_wake(pool);
+	for (;;) {
+		// one system call submits the reads and waits for their completions
+		rc = uring_enter(pool, 1);
+		if (rc < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+			break;
+
+		recycled = pool->buftail;
+		head = *pool->cqhead;
+		while (head != __atomic_load_n(pool->cqtail, __ATOMIC_ACQUIRE)) {
+			cqe = &pool->cqes[head & pool->cqmask];
+			data = cqe->user_data;
+			res = cqe->res;
+			rc = (int)cqe->flags;
+			__atomic_store_n(pool->cqhead, ++head, __ATOMIC_RELEASE);
+			if (data == URING_WAKE)
+				uring_wait_wake(pool);
+			else if (data != URING_CANCEL)
+				uring_complete(pool, (uring_fd_t *)(uintptr_t)data, res, (unsigned)rc);
+		}
+		if (recycled != pool->buftail)
+			uring_feed(pool, &pool->starved);
+		if (pool->waiting != NULL)
+			uring_feed(pool, &pool->waiting);
+		if (uring_requests(pool))
+			break;
+	}
+	return NULL;
+}
+
+/*************************************************************************/
+
+uring_pool_t *uring_pool_create(unsigned nbufs, size_t bufsize)
+{
+	struct io_uring_params params;
+	struct io_uring_buf_reg reg;
+	uring_pool_t *pool;
+	unsigned idx, *sqarray;
+	void *ring;
+
+	if (nbufs == 0 || nbufs > 32768 || (nbufs & (nbufs - 1)) != 0 || bufsize == 0 || bufsize > INT32_MAX) {
+		errno = EINVAL;
+		return NULL;
+	}
+	pool = calloc(1, sizeof *pool);
+	if (pool == NULL)
+		return NULL;
+	pool->wakefd = eventfd(0, EFD_CLOEXEC);
+	memset(&params, 0, sizeof params);
+	pool->ringfd = uring_setup(URING_ENTRIES, &params);
+	pthread_mutex_init(&pool->mutex, NULL);
+	pool->sqmap = pool->cqmap = pool->sqes = MAP_FAILED;
+	pool->bufring = MAP_FAILED;
+	if (pool->ringfd < 0 || pool->wakefd < 0)
+		goto error;
+
+	// map the queues, in a single mapping when the kernel allows it
+	pool->sqmaplen = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	pool->cqmaplen = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		if (pool->cqmaplen > pool->sqmaplen)
+			pool->sqmaplen = pool->cqmaplen;
+		pool->cqmaplen = 0;
+	}
+	pool->sqmap = mmap(NULL, pool->sqmaplen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, pool->ringfd,
+			   IORING_OFF_SQ_RING);
+	if (pool->sqmap == MAP_FAILED)
+		goto error;
+	pool->cqmap = pool->cqmaplen == 0 ? pool->sqmap :
+					    mmap(NULL, pool->cqmaplen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+						 pool->ringfd, IORING_OFF_CQ_RING);
+	pool->sqes = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+			  MAP_SHARED | MAP_POPULATE, pool->ringfd, IORING_OFF_SQES);
+	if (pool->cqmap == MAP_FAILED || pool->sqes == MAP_FAILED)
+		goto error;
+	pool->sqhead = (unsigned *)((char *)pool->sqmap + params.sq_off.head);
+	pool->sqtail = (unsigned *)((char *)pool->sqmap + params.sq_off.tail);
+	pool->sqmask = *(unsigned *)((char *)pool->sqmap + params.sq_off.ring_mask);
+	pool->sqentries = params.sq_entries;
+	pool->sqlocal = *pool->sqtail;
+	sqarray = (unsigned *)((char *)pool->sqmap + params.sq_off.array);
+	for (idx = 0; idx < params.sq_entries; idx++)
+		sqarray[idx] = idx;
+	pool->cqhead = (unsigned *)((char *)pool->cqmap + params.cq_off.head);
+	pool->cqtail = (unsigned *)((char *)pool->cqmap + params.cq_off.tail);
+	pool->cqmask = *(unsigned *)((char *)pool->cqmap + params.cq_off.ring_mask);
+	pool->cqes = (struct io_uring_cqe *)((char *)pool->cqmap + params.cq_off.cqes);
+
+	// register the ring of buffers (linux 5.19) and fill it
+	pool->bufringlen = nbufs * sizeof(struct io_uring_buf);
+	ring = mmap(NULL, pool->bufringlen, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	pool->bufring = ring;
+	pool->bufs = malloc(nbufs * bufsize);
+	if (ring == MAP_FAILED || pool->bufs == NULL)
+		goto error;
+	memset(&reg, 0, sizeof reg);
+	reg.ring_addr = (uint64_t)(uintptr_t)ring;
+	reg.ring_entries = nbufs;
+	reg.bgid = URING_BGID;
+	if (uring_register(pool->ringfd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+		goto error;
+	pool->nbufs = nbufs;
+	pool->bufsize = bufsize;
+	for (idx = 0; idx < nbufs; idx++)
+		uring_recycle(pool, IORING_CQE_F_BUFFER | idx << IORING_CQE_BUFFER_SHIFT);
+
+	errno = pthread_create(&pool->thread, NULL, uring_pool_run, pool);
+	if (errno != 0)
+		goto error;
+	pool->running = true;
+	return pool;
+
+error:
+	uring_pool_destroy(pool);
+	return NULL;
+}
+
+void uring_pool_destroy(uring_pool_t *pool)
+{
+	int error = errno;
+
+	if (pool->running) {
+		pthread_mutex_lock(&pool->mutex);
+		pool->stopping = true;
+		pthread_mutex_unlock(&pool->mutex);
+		uring_wake(pool);
+		pthread_join(pool->thread, NULL);
+	}
+	if (pool->sqes != MAP_FAILED)
+		munmap(pool->sqes, pool->sqentries * sizeof(struct io_uring_sqe));
+	if (pool->cqmap != MAP_FAILED && pool->cqmap != pool->sqmap)
+		munmap(pool->cqmap, pool->cqmaplen);
+	if (pool->sqmap != MAP_FAILED)
+		munmap(pool->sqmap, pool->sqmaplen);
+	if (pool->ringfd >= 0)
+		close(pool->ringfd);
+	if (pool->bufring != MAP_FAILED)
+		munmap(pool->bufring, pool->bufringlen);
+	free(pool->bufs);
+	if (pool->wakefd >= 0)
+		close(pool->wakefd);
+	pthread_mutex_destroy(&pool->mutex);
+	free(pool);
+	errno = error;
+}
+
+uring_watch_t *uring_watch_create(uring_pool_t *pool, uring_watch_cb callback, void *closure)
+{
+	uring_watch_t *watch = calloc(1, sizeof *watch);
+
+	if (watch != NULL) {
+		watch->pool = pool;
+		watch->callback = callback;
+		watch->closure = closure;
+	}
+	return watch;
+}
+
+int uring_watch_add(uring_watch_t *watch, int fd, int tag)
+{
+	int flags;
+
+	if (watch->nfds == URING_WATCH_FDS) {
+		errno = ENOSPC;
+		return -1;
+	}
+
+	// a read of a non blocking descriptor would complete with EAGAIN instead of waiting for data
+	flags = fcntl(fd, F_GETFL);
+	if (flags < 0 || ((flags & O_NONBLOCK) && fcntl(fd, F_SETFL, flags & ~O_NONBLOCK) < 0))
+		return -1;
+	watch->fds[watch->nfds].watch = watch;
+	watch->fds[watch->nfds].fd = fd;
+	watch->fds[watch->nfds++].tag = tag;
+	return 0;
+}
+
+void uring_watch_start(uring_watch_t *watch)
+{
+	watch->started = true;
+}
+
+void uring_watch_enable(uring_watch_t *watch)
+{
+	uring_pool_t *pool = watch->pool;
+
+	// once unlocked, the thread may free the set
+	pthread_mutex_lock(&pool->mutex);
+	watch->active = true;
+	watch->enabling = true;
+	uring_watch_request(watch);
+	pthread_mutex_unlock(&pool->mutex);
+	uring_wake(pool);
+}
+
+void uring_watch_pause(uring_watch_t *watch)
+{
+	uring_pool_t *pool = watch->pool;
+
+	// a resume not yet handled by the thread is cancelled
+	pthread_mutex_lock(&pool->mutex);
+	watch->paused = true;
+	watch->resuming = false;
+	pthread_mutex_unlock(&pool->mutex);
+}
+
+void uring_watch_resume(uring_watch_t *watch)
+{
+	uring_pool_t *pool = watch->pool;
+
+	pthread_mutex_lock(&pool->mutex);
+	watch->resuming = true;
+	uring_watch_request(watch);
+	pthread_mutex_unlock(&pool->mutex);
+	uring_wake(pool);
+}
+
+bool uring_watch_ended(uring_watch_t *watch)
+{
+	int idx;
+
+	for (idx = 0; idx < watch->nfds; idx++)
+		if (!watch->fds[idx].ended)
+			return false;
+	return true;
+}
+
+void uring_watch_release(uring_watch_t *watch)
+{
+	uring_pool_t *pool = watch->pool;
+	bool active;
+
+	// an active set is freed by the thread once its reads completed
+	pthread_mutex_lock(&pool->mutex);
+	active = watch->active;
+	if (active) {
+		watch->released = true;
+		uring_watch_request(watch);
+	}
+	pthread_mutex_unlock(&pool->mutex);
+	if (active)
+		uring_wake(pool);
+	else
+		uring_watch_free(watch);
+}
+
+#else /* !WITH_IO_URING */
+
+// built without io_uring, no pool can be created
+
+uring_pool_t *uring_pool_create(unsigned nbufs, size_t bufsize)
+{
+	errno = ENOSYS;
+	return NULL;
+}
+
+void uring_pool_destroy(uring_pool_t *pool)
+{
+}
+
+uring_watch_t *uring_watch_create(uring_pool_t *pool, uring_watch_cb callback, void *closure)
+{
+	return NULL;
+}
+
+int uring_watch_add(uring_watch_t *watch, int fd, int tag)
+{
+	errno = ENOSYS;
+	return -1;
+}
+
+void uring_watch_start(uring_watch_t *watch)
+{
+}
+
+void uring_watch_enable(uring_watch_t *watch)
+{
+}
+
+void uring_watch_pause(uring_watch_t *watch)
+{
+}
+
+void uring_watch_resume(uring_watch_t *watch)
+{
+}
+
+bool uring_watch_ended(uring_watch_t *watch)
+{
+	return true;
+}
+
+void uring_watch_release(uring_watch_t *watch)
+{
+}
+
+#endif
@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2015-2021 IoT.bzh Company
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ *
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdbool.h>
+
+// Thread reading sets of file descriptors with io_uring.
+// The reads of all the sets are submitted and reaped in batches by a single
+// system call, the kernel picking their buffers in a ring shared by the sets.
+// The callbacks run on the thread of the pool: the callbacks of a set never
+// run concurrently and keep the order of its input.
+
+typedef struct uring_pool_s uring_pool_t;
+typedef struct uring_watch_s uring_watch_t;
+
+// callback receiving the tag given at uring_watch_add and the data read from its fd,
+// only valid during the call, or an empty data once at the end of file or error of fd
+typedef void (*uring_watch_cb)(uring_watch_t *watch, int tag, const char *data, size_t length, void *closure);
+
+// create a pool of nbufs buffers (a power of 2) of bufsize bytes and start its thread
+// returns NULL with errno set when io_uring or its rings of buffers are not available
+extern uring_pool_t *uring_pool_create(unsigned nbufs, size_t bufsize);
+
+// stop the thread and free the pool, watches must have been released
+extern void uring_pool_destroy(uring_pool_t *pool);
+
+// create an empty set of descriptors
+// returns NULL when out of memory
+extern uring_watch_t *uring_watch_create(uring_pool_t *pool, uring_watch_cb callback, void *closure);
+
+// add fd to the set, it is closed with the set once started
+// returns 0 on success or -1 with errno set
+extern int uring_watch_add(uring_watch_t *watch, int fd, int tag);
+
+// the set then owns its descriptors
+extern void uring_watch_start(uring_watch_t *watch);
+
+// start reading the descriptors of the started set
+extern void uring_watch_enable(uring_watch_t *watch);
+
+// stop giving data to the callback of the set until resumed, from any thread
+// the reads completing meanwhile are held, at most one per descriptor
+extern void uring_watch_pause(uring_watch_t *watch);
+
+// give the held data and read again the descriptors of the paused set, from any thread
+extern void uring_watch_resume(uring_watch_t *watch);
+
+// true when all the descriptors of the set reached their end, called from a callback of the set
+extern bool uring_watch_ended(uring_watch_t *watch);
+
+// free the set, closing its descriptors when started, from any thread
+// no callback of the set is called after it returns, except the current one
+extern void uring_watch_release(uring_watch_t *watch);
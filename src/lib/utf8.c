@@ -0,0 +1,136 @@
+/*
+ * Copyright (C) 2015-2021 IoT.bzh Company
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ *
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+*/
+
+
+#include <stdint.h>
+#include <string.h>
+
+#include "utf8.h"
+
+// bytes of a word having their high bit set, for the ASCII fast path
+#define UTF8_HIGH_BITS UINT64_C(0x8080808080808080)
+
+// length of the valid sequence at s of n bytes,
+// or the negated length of its maximal invalid subpart
+static int utf8_sequence(const unsigned char *s, size_t n)
+{
+	unsigned c = s[0], lo = 0x80, hi = 0xBF;
+	int len, idx;
+
+	if (c < 0x80)
+		return 1;
+	if (c < 0xC2)
+		return -1;
+	if (c < 0xE0)
+		len = 2;
+	else if (c < 0xF0) {
+		len = 3;
+		lo = c == 0xE0 ? 0xA0 : 0x80; // overlong
+		hi = c == 0xED ? 0x9F : 0xBF; // surrogates
+	} else if (c < 0xF5) {
+		len = 4;
+		lo = c == 0xF0 ? 0x90 : 0x80; // overlong
+		hi = c == 0xF4 ? 0x8F : 0xBF; // above U+10FFFF
+	} else
+		return -1;
+	for (idx = 1; idx < len; idx++) {
+		if ((size_t)idx >= n || s[idx] < lo || s[idx] > hi)
+			return -idx;
+		lo = 0x80;
+		hi = 0xBF;
+	}
+	return len;
+}
+
+size_t utf8_valid(const char *data, size_t length)
+{
+	const unsigned char *s = (const unsigned char *)data;
+	size_t pos = 0;
+	uint64_t word;
+	int len;
+
+	while (pos < length) {
+		// ASCII text is checked 8 bytes at a time
+		while (pos + sizeof word <= length) {
+			memcpy(&word, &s[pos], sizeof word);
+			if (word & UTF8_HIGH_BITS)
+				break;
+			pos += sizeof word;
+		}
+		while (pos < length && s[pos] < 0x80)
+			pos++;
+		if (pos < length) {
+			len = utf8_sequence(&s[pos], length - pos);
+			if (len < 0)
+				return pos;
+			pos += (size_t)len;
+		}
+	}
+	return length;
+}
+
+size_t utf8_incomplete(const char *data, size_t length)
+{
+	const unsigned char *s = (const unsigned char *)data;
+	size_t count;
+
+	for (count = 1; count <= 3 && count <= length; count++) {
+		unsigned c = s[length - count];
+		if (c >= 0xC2 && c < 0xF5)
+			return utf8_sequence(&s[length - count], count) == -(int)count ? count : 0;
+		if (c < 0x80 || c > 0xBF)
+			return 0;
+	}
+	return 0;
+}
+
+size_t utf8_sanitize(const char *data, size_t length, int policy, char *buffer)
+{
+	static const char hex[] = "0123456789ABCDEF";
+	const unsigned char *s = (const unsigned char *)data;
+	size_t pos = 0, out = 0, valid;
+	int len;
+
+	while (pos < length) {
+		valid = utf8_valid((const char *)&s[pos], length - pos);
+		memcpy(&buffer[out], &s[pos], valid);
+		out += valid;
+		pos += valid;
+		if (pos == length)
+			break;
+		len = -utf8_sequence(&s[pos], length - pos);
+		if (policy == UTF8_ESCAPE) {
+			while (len-- > 0) {
+				buffer[out++] = '\\';
+				buffer[out++] = 'x';
+				buffer[out++] = hex[s[pos] >> 4];
+				buffer[out++] = hex[s[pos++] & 15];
+			}
+		} else {
+			buffer[out++] = (char)0xEF;
+			buffer[out++] = (char)0xBF;
+			buffer[out++] = (char)0xBD;
+			pos += (size_t)len;
+		}
+	}
+	return out;
+}
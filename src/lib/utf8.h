@@ -0,0 +1,50 @@
+/*
+ * Copyright (C) 2015-2021 IoT.bzh Company
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ *
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+*/
+
+
+#pragma once
+
+#include <stddef.h>
+
+// validation of UTF-8 text as defined by RFC 3629: overlong forms,
+// surrogates and code points above U+10FFFF are invalid
+
+// policies of utf8_sanitize for invalid bytes
+#define UTF8_REPLACE 1 // a maximal invalid subpart becomes U+FFFD
+#define UTF8_ESCAPE 2 // each invalid byte becomes the text \xHH
+
+// length of the sanitized text of length bytes in the worst case
+static inline size_t utf8_sanitized_length(size_t length)
+{
+	return 4 * length;
+}
+
+// get the offset of the first invalid byte of data, or length when it is valid
+extern size_t utf8_valid(const char *data, size_t length);
+
+// get the count of bytes (0 to 3) at the end of data that start a valid but truncated sequence
+extern size_t utf8_incomplete(const char *data, size_t length);
+
+// copy data to buffer, replacing invalid bytes according to the policy
+// the buffer must be able to hold utf8_sanitized_length(length) bytes
+// returns the length of the sanitized text
+extern size_t utf8_sanitize(const char *data, size_t length, int policy, char *buffer);
@@ -0,0 +1,118 @@
+/*
+ * Copyright (C) 2015-2021 IoT.bzh Company
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ *
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+*/
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "work-pool.h"
+
+typedef struct work_s {
+	struct work_s *next;
+	work_pool_cb work;
+	void *arg;
+} work_t;
+
+struct work_pool_s {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	work_t *head;
+	work_t **tail;
+	bool stopping;
+	int nthreads;
+	pthread_t threads[];
+};
+
+static void *work_pool_run(void *arg)
+{
+	work_pool_t *pool = arg;
+	work_t *work;
+
+	pthread_mutex_lock(&pool->mutex);
+	for (;;) {
+		while (pool->head == NULL && !pool->stopping)
+			pthread_cond_wait(&pool->cond, &pool->mutex);
+		work = pool->head;
+		if (work == NULL)
+			break;
+		pool->head = work->next;
+		if (pool->head == NULL)
+			pool->tail = &pool->head;
+		pthread_mutex_unlock(&pool->mutex);
+		work->work(work->arg);
+		free(work);
+		pthread_mutex_lock(&pool->mutex);
+	}
+	pthread_mutex_unlock(&pool->mutex);
+	return NULL;
+}
+
+work_pool_t *work_pool_create(int nthreads)
+{
+	work_pool_t *pool = calloc(1, sizeof *pool + (size_t)nthreads * sizeof(pthread_t));
+
+	if (pool != NULL) {
+		pthread_mutex_init(&pool->mutex, NULL);
+		pthread_cond_init(&pool->cond, NULL);
+		pool->tail = &pool->head;
+		for (pool->nthreads = 0; pool->nthreads < nthreads; pool->nthreads++)
+			if (pthread_create(&pool->threads[pool->nthreads], NULL, work_pool_run, pool) != 0)
+				break;
+		if (pool->nthreads == 0) {
+			work_pool_destroy(pool);
+			pool = NULL;
+		}
+	}
+	return pool;
+}
+
+int work_pool_post(work_pool_t *pool, work_pool_cb work, void *arg)
+{
+	work_t *item = malloc(sizeof *item);
+
+	if (item == NULL)
+		return -1;
+	item->next = NULL;
+	item->work = work;
+	item->arg = arg;
+	pthread_mutex_lock(&pool->mutex);
+	*pool->tail = item;
+	pool->tail = &item->next;
+	pthread_cond_signal(&pool->cond);
+	pthread_mutex_unlock(&pool->mutex);
+	return 0;
+}
+
+void work_pool_destroy(work_pool_t *pool)
+{
+	int idx;
+
+	pthread_mutex_lock(&pool->mutex);
+	pool->stopping = true;
+	pthread_cond_broadcast(&pool->cond);
+	pthread_mutex_unlock(&pool->mutex);
+	for (idx = 0; idx < pool->nthreads; idx++)
+		pthread_join(pool->threads[idx], NULL);
+	pthread_cond_destroy(&pool->cond);
+	pthread_mutex_destroy(&pool->mutex);
+	free(pool);
+}
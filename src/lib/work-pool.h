@@ -0,0 +1,39 @@
+/*
+ * Copyright (C) 2015-2021 IoT.bzh Company
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ *
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+*/
+
+#pragma once
+
+// Pool of threads processing posted works in the order of posting.
+
+typedef struct work_pool_s work_pool_t;
+
+typedef void (*work_pool_cb)(void *arg);
+
+// create a pool of nthreads threads
+extern work_pool_t *work_pool_create(int nthreads);
+
+// post a work to the pool
+// returns 0 on success or -1 when out of memory
+extern int work_pool_post(work_pool_t *pool, work_pool_cb work, void *arg);
+
+// stop the threads after pending works and free the pool
+extern void work_pool_destroy(work_pool_t *pool);
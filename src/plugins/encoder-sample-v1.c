@@ -0,0 +1,120 @@
+/*
+ * Copyright (C) 2021 "IoT.bzh"
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at https://opensource.org/licenses/MIT.
+ */
+
+#define _GNU_SOURCE
+
+#include "spawn-binding.h"
+
+#include <afb-helpers4/ctl-lib-plugin.h>
+#include <rp-utils/rp-jsonc.h>
+
+#include "lib/stream-buf.h"
+#include "lib/line-buf.h"
+
+#include "spawn-sandbox.h"
+#include "spawn-encoders.h"
+
+#include "spawn-subtask.h"
+
+/*
+ * demo custom plugin encoder of ABI version 1
+ * --------------------------------------------------------------
+ *  - stdout and stderr: one event per line
+ *  - termination: json event with the count of lines
+ *
+ *  - to activate it add to your command definition
+ *    'encoder':{"plugin": "encoder_sample_v1", output:'v1-lines'}
+ *
+ *  Note: the encoders of version 1 read their file descriptors themselves.
+ *  this sample keeps the layout of version 1 so that the binding checks it.
+ */
+CTL_PLUGIN_DECLARE("encoder_sample_v1", "Demo of encoders of ABI version 1");
+
+#define MY_V1_MAXLEN 512 // any line longer than this will be split
+
+// hold per taskId encoder context
+typedef struct {
+	stream_buf_t sout;
+	stream_buf_t serr;
+	int linecount;
+} MyV1CtxT;
+
+typedef struct {
+	MyV1CtxT *ctx;
+	taskIdT *task;
+	const char *stream;
+} MyV1TaskCtxT;
+
+static void on_line(void *closure, const char *line, size_t length)
+{
+	MyV1TaskCtxT *tc = closure;
+	json_object *object;
+
+	tc->ctx->linecount++;
+	rp_jsonc_pack(&object, "{so}", tc->stream, json_object_new_string_len(line, length));
+	spawnTaskPushEventJSON(tc->task, object);
+}
+
+/** instanciate data */
+static encoder_error_t my_v1_create(const encoder_generator_t *generator, json_object *options, void **data)
+{
+	MyV1CtxT *ctx = calloc(1, sizeof *ctx);
+	if (ctx == NULL)
+		return ENCODER_ERROR_OUT_OF_MEMORY;
+	if (stream_buf_init(&ctx->sout, MY_V1_MAXLEN) != NULL) {
+		if (stream_buf_init(&ctx->serr, MY_V1_MAXLEN) != NULL) {
+			*data = ctx;
+			return ENCODER_NO_ERROR;
+		}
+		stream_buf_clear(&ctx->sout);
+	}
+	free(ctx);
+	return ENCODER_ERROR_OUT_OF_MEMORY;
+}
+
+/** process input: version 1 reads the file descriptor */
+static encoder_error_t my_v1_read(void *data, taskIdT *taskId, int fd, bool error)
+{
+	MyV1TaskCtxT tc = { .ctx = data, .task = taskId, .stream = error ? "stderr" : "stdout" };
+	line_buf_read(error ? &tc.ctx->serr : &tc.ctx->sout, fd, on_line, &tc);
+	return ENCODER_NO_ERROR;
+}
+
+/** terminate processing */
+static encoder_error_t my_v1_end(void *data, taskIdT *taskId)
+{
+	json_object *object;
+	MyV1TaskCtxT tc = { .ctx = data, .task = taskId, .stream = "stderr" };
+	line_buf_end(&tc.ctx->serr, on_line, &tc);
+	tc.stream = "stdout";
+	line_buf_end(&tc.ctx->sout, on_line, &tc);
+	rp_jsonc_pack(&object, "{si}", "linecount", tc.ctx->linecount);
+	spawnTaskPushEventJSON(taskId, object);
+	return ENCODER_NO_ERROR;
+}
+
+static void my_v1_destroy(void *data)
+{
+	MyV1CtxT *ctx = data;
+	stream_buf_clear(&ctx->sout);
+	stream_buf_clear(&ctx->serr);
+	free(ctx);
+}
+
+// layout of the generators
+const int spawnEncodersABI = 1;
+
+// list custom encoders for registration
+encoder_generator_v1_t spawnEncoders[] = {
+	{ .uid = "v1-lines",
+	  .info = "One event per line, read by the encoder",
+	  .create = my_v1_create,
+	  .read = my_v1_read,
+	  .end = my_v1_end,
+	  .destroy = my_v1_destroy },
+	{ .uid = NULL } // terminator
+};
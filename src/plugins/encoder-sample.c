@@ -122,14 +122,17 @@ static encoder_error_t my_instanciate(const encoder_generator_t *generator, json
 	return rc;
 }
 
-/** process input */
-encoder_error_t my_read(void *data, taskIdT *taskId, int fd, bool error)
+/** process input read by the core in slices */
+encoder_error_t my_consume(void *data, taskIdT *taskId, const struct iovec *iov, int iovcnt, encoder_stream_t stream)
 {
 	MyTaskCtxT tc = { .ctx = data, .task = taskId };
-	if (error)
-		line_buf_read(&tc.ctx->serr, fd, on_err_line, &tc);
-	else
-		line_buf_read(&tc.ctx->sout, fd, on_out_line, &tc);
+	int idx;
+	for (idx = 0; idx < iovcnt; idx++) {
+		if (stream == ENCODER_STREAM_STDERR)
+			line_buf_write(&tc.ctx->serr, iov[idx].iov_base, iov[idx].iov_len, on_err_line, &tc);
+		else
+			line_buf_write(&tc.ctx->sout, iov[idx].iov_base, iov[idx].iov_len, on_out_line, &tc);
+	}
 	return ENCODER_NO_ERROR;
 }
 
@@ -157,6 +160,9 @@ static void my_destroy(void *data)
 	free(ctx);
 }
 
+// layout of the generators, the core also accepts plugins of version 1 reading their input
+const int spawnEncodersABI = ENCODER_ABI_VERSION;
+
 // list custom encoders for registration
 encoder_generator_t spawnEncoders[] = {
 	{ .uid = "my-custom-encoder",
@@ -164,8 +170,47 @@ encoder_generator_t spawnEncoders[] = {
 	  .check = my_check,
 	  .create = my_instanciate,
 	  .begin = NULL,
-	  .read = my_read,
 	  .end = my_end,
-	  .destroy = my_destroy },
+	  .destroy = my_destroy,
+	  .consume = my_consume },
+	{ .uid = NULL } // terminator
+};
+
+/*
+ * demo custom pipeline stage
+ * --------------------------------------------------------------
+ *  - records of stdout and stderr are numbered per stream
+ *
+ *  - to activate it, add it to a pipeline of your command definition
+ *    'encoder': ["lines", {"plugin": "MyEncoders", "stage": "my-numbered-lines"}, "batch"]
+ */
+
+/** instanciate data: the counters of stdout and stderr lines */
+static encoder_error_t my_stage_create(const encoder_stage_t *stage, json_object *options, void **data)
+{
+	*data = calloc(2, sizeof(int));
+	return *data == NULL ? ENCODER_ERROR_OUT_OF_MEMORY : ENCODER_NO_ERROR;
+}
+
+/** give an event for the record */
+static void my_stage_record(void *data, encoder_flow_t *flow, const char *record, size_t length, bool error)
+{
+	int *counters = data;
+	json_object *event;
+
+	rp_jsonc_pack(&event, "{si so}", "line", ++counters[error], error ? "stderr" : "stdout",
+		      json_object_new_string_len(record, length));
+	encoder_flow_event(flow, event);
+}
+
+// list custom stages for registration
+encoder_stage_t spawnEncoderStages[] = {
+	{ .uid = "my-numbered-lines",
+	  .info = "One event per record with its number",
+	  .input = ENCODER_ITEM_RECORDS,
+	  .output = ENCODER_ITEM_EVENTS,
+	  .create = my_stage_create,
+	  .record = my_stage_record,
+	  .destroy = free },
 	{ .uid = NULL } // terminator
 };
@@ -40,6 +40,8 @@
 /* plugins */
 static plugin_store_t plugins = PLUGIN_STORE_INITIAL;
 static const char plugin_encoders_symbol_name[] = "spawnEncoders";
+static const char plugin_stages_symbol_name[] = "spawnEncoderStages";
+static const char plugin_abi_symbol_name[] = "spawnEncodersABI";
 
 /*
 * predeclaration of the function that initialize the spawn binding
@@ -76,6 +78,7 @@ int afbBindingEntry(afb_api_t rootapi, afb_ctlid_t ctlid, afb_ctlarg_t ctlarg, v
 
 	/** called when shuting down */
 	case afb_ctlid_Exiting:
+		encoder_generator_factory_exit();
 		break;
 	}
 	return 0;
@@ -408,12 +411,33 @@ static int initialize_encoders_of_plugins(void *closure, const plugin_t *plugin)
 	const char *uid = plugin_name(plugin);
 
 	encoder_generator_t *encoders = plugin_get_object(plugin, plugin_encoders_symbol_name);
-	if (encoders == NULL) {
-		AFB_ERROR("initialize_encoders_of_plugins: object %s not found in plugin %s", plugin_encoders_symbol_name, uid);
+	encoder_stage_t *stages = plugin_get_object(plugin, plugin_stages_symbol_name);
+	const int *abi = plugin_get_object(plugin, plugin_abi_symbol_name);
+	if (encoders == NULL && stages == NULL) {
+		AFB_ERROR("initialize_encoders_of_plugins: objects %s and %s not found in plugin %s",
+			  plugin_encoders_symbol_name, plugin_stages_symbol_name, uid);
 		return -1;
 	}
 
-	err = encoder_generator_factory_add(uid, encoders);
+	// the layout of the generators can't be guessed from the array
+	if (abi == NULL) {
+		AFB_ERROR("initialize_encoders_of_plugins: object %s not found in plugin %s", plugin_abi_symbol_name, uid);
+		return -1;
+	}
+	if (*abi < 1 || *abi > ENCODER_ABI_VERSION) {
+		AFB_ERROR("initialize_encoders_of_plugins: unsupported version %d of plugin %s", *abi, uid);
+		return -1;
+	}
+
+	// plugins may only give stages of pipelines
+	if (encoders == NULL)
+		err = ENCODER_NO_ERROR;
+	else if (*abi == 1)
+		err = encoder_generator_factory_add_v1(uid, (const encoder_generator_v1_t *)encoders);
+	else
+		err = encoder_generator_factory_add(uid, encoders);
+	if (err == ENCODER_NO_ERROR && stages != NULL)
+		err = encoder_stage_factory_add(uid, stages);
 	if (err != ENCODER_NO_ERROR) {
 		AFB_ERROR("initialize_encoders_of_plugins: failed to add plugin %s to factory", uid);
 		return -1;
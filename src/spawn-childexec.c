@@ -24,6 +24,7 @@
 #define _GNU_SOURCE
 
 #include <errno.h>
+#include <unistd.h>
 #include <pthread.h>
 #include <fcntl.h>
 #include <seccomp.h> // high level api
@@ -50,6 +51,11 @@
 
 #include "spawn-subtask-internal.h"
 
+#include "lib/read-budget.h"
+#include "lib/fd-pool.h"
+#include "lib/uring-pool.h"
+#include "lib/block-pool.h"
+
 /************************************************************************/
 /* MANAGE TIMEOUTS */
 /************************************************************************/
@@ -135,7 +141,7 @@ void end_timeout_monitor(taskIdT *taskId)
 /*  */
 /************************************************************************/
 
-static void on_pipe(afb_evfd_t efd, int fd, uint32_t revents, taskIdT *taskId, int out)
+static void on_pipe(int fd, uint32_t revents, taskIdT *taskId, int out)
 {
 	// if taskId->pid == 0 then FMT_TASK_STOP was already called once
 	if (taskId->pid == 0)
@@ -145,25 +151,204 @@ static void on_pipe(afb_evfd_t efd, int fd, uint32_t revents, taskIdT *taskId, i
 		if (taskId->verbose > 2)
 			AFB_REQ_INFO(taskId->request, "uid=%s pid=%d [EPOLLIN std%s=%d]", taskId->uid, taskId->pid,
 				     out ? "out" : "err", fd);
+		read_budget_set((size_t)taskId->cmd->readbudget);
 		encoderRead(taskId->encoder, taskId, fd, !out);
+
+		// after its budget, the pipe yields to the other ready ones and is read again at next wakeup
+		// its hangup is only handled once it is drained, or once resumed when the encoder paused the task
+		if (read_budget_exhausted() || taskId->paused)
+			return;
 	}
 
 	// what ever stdout/err pipe hanghup 1st we close both event sources
 	if (revents & EPOLLHUP) {
-		spawnChildUpdateStatus(taskId);
+		// the other pipe may still hold output deferred by its budget, both are drained before the final status
+		read_budget_set(0);
+		encoderRead(taskId->encoder, taskId, taskId->outfd, false);
+		encoderRead(taskId->encoder, taskId, taskId->errfd, true);
+
+		// an encoder pausing the task to catch up reads the rest once it resumed it, the hangup being seen again
+		if (!taskId->paused)
+			spawnChildUpdateStatus(taskId);
 	}
 }
 
 static void on_pipe_out(afb_evfd_t efd, int fd, uint32_t revents, void *closure)
 {
 	taskIdT *taskId = closure;
-	on_pipe(efd, fd, revents, taskId, 1);
+	on_pipe(fd, revents, taskId, 1);
 }
 
 static void on_pipe_err(afb_evfd_t efd, int fd, uint32_t revents, void *closure)
 {
 	taskIdT *taskId = closure;
-	on_pipe(efd, fd, revents, taskId, 0);
+	on_pipe(fd, revents, taskId, 0);
+}
+
+/**
+* Watches the pipes of the task from the mainloop, the pipes being closed with the task
+*/
+static int watch_pipes(taskIdT *taskId)
+{
+	if (afb_evfd_create(&taskId->srcout, taskId->outfd, EPOLLIN | EPOLLHUP, on_pipe_out, taskId, 0, 0)
+	    || afb_evfd_create(&taskId->srcerr, taskId->errfd, EPOLLIN | EPOLLHUP, on_pipe_err, taskId, 0, 0))
+		return -1;
+	return 0;
+}
+
+static void unwatch_pipes(taskIdT *taskId)
+{
+	if (taskId->srcout) {
+		afb_evfd_unref(taskId->srcout);
+		taskId->srcout = NULL;
+	}
+	if (taskId->srcerr) {
+		afb_evfd_unref(taskId->srcerr);
+		taskId->srcerr = NULL;
+	}
+}
+
+/************************************************************************/
+/* PAUSE OF THE READING */
+/************************************************************************/
+
+/** pauses' access protection */
+static pthread_mutex_t pause_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+void spawnTaskPause(taskIdT *taskId)
+{
+	pthread_mutex_lock(&pause_mutex);
+	if (!taskId->paused) {
+		// the watchers are dropped, a level triggered pipe left unread would wake the loop again at once
+		// the reading loops of the calling thread stop at once, the data read being already consumed
+		taskId->paused = true;
+		read_budget_exhaust();
+		if (taskId->offload)
+			fd_watch_pause(taskId->offload);
+		else if (taskId->uring)
+			uring_watch_pause(taskId->uring);
+		else
+			unwatch_pipes(taskId);
+	}
+	pthread_mutex_unlock(&pause_mutex);
+}
+
+void spawnTaskResume(taskIdT *taskId)
+{
+	pthread_mutex_lock(&pause_mutex);
+	if (taskId->paused) {
+		taskId->paused = false;
+		if (taskId->offload)
+			fd_watch_resume(taskId->offload);
+		else if (taskId->uring)
+			uring_watch_resume(taskId->uring);
+		else if (watch_pipes(taskId) < 0)
+			AFB_REQ_ERROR(taskId->request, "uid='%s' can't watch the pipes again", taskId->uid);
+	}
+	pthread_mutex_unlock(&pause_mutex);
+}
+
+/************************************************************************/
+/* OFFLOADED ENCODING */
+/************************************************************************/
+
+/** pool of workers shared by the offloaded tasks */
+static fd_pool_t *offload_pool;
+static pthread_once_t offload_pool_once = PTHREAD_ONCE_INIT;
+
+static void offload_pool_init(void)
+{
+	long count = sysconf(_SC_NPROCESSORS_ONLN);
+	offload_pool = fd_pool_create(count < 1 ? 1 : count > MAX_ENCODER_WORKERS ? MAX_ENCODER_WORKERS : (int)count);
+}
+
+/** readiness of the pipes of an offloaded task, never concurrent for a same task */
+static void on_pipe_offloaded(fd_watch_t *watch, int fd, uint32_t revents, int out, void *closure)
+{
+	taskIdT *taskId = closure;
+	on_pipe(fd, revents, taskId, out);
+}
+
+/**
+* Watches the pipes of the task from the workers of the offload pool, the watch owning them on success
+*/
+static int make_offload_watch(taskIdT *taskId, int outfd, int errfd)
+{
+	fd_watch_t *watch;
+
+	pthread_once(&offload_pool_once, offload_pool_init);
+	if (offload_pool == NULL)
+		return -1;
+
+	watch = fd_watch_create(offload_pool, on_pipe_offloaded, taskId);
+	if (watch == NULL)
+		return -1;
+	if (fd_watch_add(watch, outfd, EPOLLIN | EPOLLHUP, 1) < 0 || fd_watch_add(watch, errfd, EPOLLIN | EPOLLHUP, 0) < 0
+	    || fd_watch_start(watch) < 0) {
+		fd_watch_release(watch);
+		return -1;
+	}
+	taskId->offload = watch;
+	return 0;
+}
+
+/************************************************************************/
+/* IO_URING ENGINE */
+/************************************************************************/
+
+/** thread reading the pipes of the tasks using io_uring */
+static uring_pool_t *uring_pool;
+static pthread_once_t uring_pool_once = PTHREAD_ONCE_INIT;
+
+static void uring_pool_init(void)
+{
+	uring_pool = uring_pool_create(URING_BUFFERS, BLOCK_POOL_SIZE);
+	if (uring_pool == NULL)
+		AFB_WARNING("io_uring engine unavailable (%s), reading the pipes as usual", strerror(errno));
+}
+
+/** data read from a pipe of the task by the io_uring thread, never concurrent for a same task */
+static void on_pipe_uring(uring_watch_t *watch, int out, const char *data, size_t length, void *closure)
+{
+	taskIdT *taskId = closure;
+	struct iovec iov;
+
+	// if taskId->pid == 0 then FMT_TASK_STOP was already called once
+	if (taskId->pid == 0)
+		return;
+
+	if (length > 0) {
+		iov.iov_base = (void *)data;
+		iov.iov_len = length;
+		encoderConsume(taskId->encoder, taskId, &iov, 1, !out);
+	} else if (uring_watch_ended(watch)) {
+		// both pipes are drained, the data of each being given in order
+		spawnChildUpdateStatus(taskId);
+	}
+}
+
+/**
+* Reads the pipes of the task from the io_uring thread, the watch owning them on success
+* returns 1 when the engine is not available, the pipes being then left to the caller
+*/
+static int make_uring_watch(taskIdT *taskId, int outfd, int errfd)
+{
+	uring_watch_t *watch;
+
+	pthread_once(&uring_pool_once, uring_pool_init);
+	if (uring_pool == NULL || !encoderConsumes(taskId->encoder))
+		return 1;
+
+	watch = uring_watch_create(uring_pool, on_pipe_uring, taskId);
+	if (watch == NULL)
+		return -1;
+	if (uring_watch_add(watch, outfd, 1) < 0 || uring_watch_add(watch, errfd, 0) < 0) {
+		uring_watch_release(watch);
+		return -1;
+	}
+	uring_watch_start(watch);
+	taskId->uring = watch;
+	return 0;
 }
 
 static void childDumpArgv(shellCmdT *cmd, const char **params)
@@ -241,8 +426,8 @@ static char *const *childBuildArgv(shellCmdT *cmd, json_object *argsJ, int verbo
 	return (char *const *)params;
 } // end childBuildArgv
 
-static int start_in_parent(afb_req_t request, shellCmdT *cmd, json_object *argsJ, int verbose, pid_t sonPid, int outfd,
-			   int errfd)
+static int start_in_parent(afb_req_t request, shellCmdT *cmd, json_object *argsJ, int verbose, taskFormatE format,
+			   pid_t sonPid, int outfd, int errfd)
 {
 	int err;
 	taskIdT *taskId;
@@ -252,11 +437,20 @@ static int start_in_parent(afb_req_t request, shellCmdT *cmd, json_object *argsJ
 	taskId->pid = sonPid;
 	taskId->cmd = cmd;
 	taskId->verbose = verbose;
+	taskId->format = format;
 	taskId->request = afb_req_addref(request); // save request for later logging and response
+	taskId->argsJ = json_object_get(argsJ); // arguments may tune the encoder
+	taskId->outfd = outfd;
+	taskId->errfd = errfd;
+	taskId->holds = 1; // released by the final response
 
 	if (asprintf(&taskId->uid, "%s/%s@%d", cmd->sandbox->uid, cmd->uid, taskId->pid) < 0)
 		goto InternalError;
 
+	// keep the last events for late subscribers
+	if (cmd->replay.lines > 0 && spawnTaskReplayInit(taskId) < 0)
+		goto InternalError;
+
 	if (verbose)
 		AFB_REQ_INFO(request, "[taskid-created] uid='%s' pid=%d (spawnTaskStart)", taskId->uid, sonPid);
 
@@ -283,11 +477,13 @@ static int start_in_parent(afb_req_t request, shellCmdT *cmd, json_object *argsJ
 	if (err)
 		goto InternalError;
 
-	// register stdout/err piped FD within mainloop
-	err = afb_evfd_create(&taskId->srcout, outfd, EPOLLIN | EPOLLHUP, on_pipe_out, taskId, 0, 1);
-	if (err)
-		goto InternalError;
-	err = afb_evfd_create(&taskId->srcerr, errfd, EPOLLIN | EPOLLHUP, on_pipe_err, taskId, 0, 1);
+	// register stdout/err piped FD within mainloop or, when offloaded, within the workers
+	// the io_uring engine falls back to them when unavailable or when the encoder only reads
+	err = cmd->uring ? make_uring_watch(taskId, outfd, errfd) : 1;
+	if (err > 0 && cmd->offload)
+		err = make_offload_watch(taskId, outfd, errfd);
+	if (err > 0)
+		err = watch_pipes(taskId);
 	if (err)
 		goto InternalError;
 
@@ -311,11 +507,16 @@ static int start_in_parent(afb_req_t request, shellCmdT *cmd, json_object *argsJ
 	if (cmd->timeout > 0)
 		make_timeout_monitor(taskId, cmd->timeout);
 
+	// workers start reading once the task is complete
+	if (taskId->offload)
+		fd_watch_enable(taskId->offload);
+	else if (taskId->uring)
+		uring_watch_enable(taskId->uring);
+
 	return 0;
 
 InternalError:
-	close(outfd);
-	close(errfd);
+	// pipes are closed with the task or, when offloaded or read by io_uring, with their watch
 	AFB_REQ_ERROR(request, "spawnTaskStart [Fail-to-launch] uid=%s cmd=%s pid=%d error=%s", cmd->uid, cmd->command,
 		      sonPid, strerror(errno));
 	spawnTaskReplyJSON(taskId, AFB_ERRNO_INTERNAL_ERROR, NULL);
@@ -482,7 +683,7 @@ static int start_in_child(shellCmdT *cmd, json_object *argsJ, int verbose, char
 	return 1;
 }
 
-int spawnTaskStart(afb_req_t request, shellCmdT *cmd, json_object *argsJ, int verbose)
+int spawnTaskStart(afb_req_t request, shellCmdT *cmd, json_object *argsJ, int verbose, taskFormatE format)
 {
 	pid_t sonPid = -1;
 	char *const *params = NULL;
@@ -547,7 +748,7 @@ int spawnTaskStart(afb_req_t request, shellCmdT *cmd, json_object *argsJ, int ve
 		// close unused pipes
 		close(stderrP[1]);
 		close(stdoutP[1]);
-		return start_in_parent(request, cmd, argsJ, verbose, sonPid, stdoutP[0], stderrP[0]);
+		return start_in_parent(request, cmd, argsJ, verbose, format, sonPid, stdoutP[0], stderrP[0]);
 	}
 
 OnErrorExit3:
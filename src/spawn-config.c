@@ -158,23 +158,37 @@ int spawn_config_read_one_command(sandBoxT *sandbox, shellCmdT *cmd, json_object
 {
 	int err = 0;
 	const char *privilege = NULL;
-	json_object *execJ = NULL, *encoderJ = NULL;
+	json_object *execJ = NULL, *encoderJ = NULL, *replayJ = NULL;
 
 	cmd->sandbox = sandbox;
 
 	// default verbose is sandbox->verbose
 	cmd->verbose = -1;
+	cmd->readbudget = READ_BUDGET_DEFAULT;
 
 	// parse shell command and lock format+exec object if defined
-	err = rp_jsonc_unpack(cmdJ, "{ss,s?s,s?i,s?i,s?s,s?o,s?o,s?o,s?o,s?b !}", "uid", &cmd->uid, "info", &cmd->info,
-			      "timeout", &cmd->timeout, "verbose", &cmd->verbose, "privilege", &privilege, "usage",
-			      &cmd->usageJ, "encoder", &encoderJ, "sample", &cmd->sampleJ, "exec", &execJ, "single",
-			      &cmd->single);
-	if (err) {
+	err = rp_jsonc_unpack(cmdJ, "{ss,s?s,s?i,s?i,s?s,s?o,s?o,s?o,s?o,s?b,s?i,s?b,s?b,s?o !}", "uid", &cmd->uid, "info",
+			      &cmd->info, "timeout", &cmd->timeout, "verbose", &cmd->verbose, "privilege", &privilege,
+			      "usage", &cmd->usageJ, "encoder", &encoderJ, "sample", &cmd->sampleJ, "exec", &execJ,
+			      "single", &cmd->single, "readbudget", &cmd->readbudget,
+			      "offload", &cmd->offload, "uring", &cmd->uring, "replay", &replayJ);
+	if (err || cmd->readbudget < 0) {
 		AFB_ERROR("[parsing-error] sandbox='%s' fail to parse cmd=%s", sandbox->uid,
 			  json_object_to_json_string(cmdJ));
 		goto OnErrorExit;
 	}
+	// replay of the last events to late subscribers
+	if (replayJ) {
+		cmd->replay.lines = REPLAY_LINES_DEFAULT;
+		cmd->replay.bytes = REPLAY_BYTES_DEFAULT;
+		err = rp_jsonc_unpack(replayJ, "{s?i,s?i,s?i !}", "lines", &cmd->replay.lines, "bytes",
+				      &cmd->replay.bytes, "time", &cmd->replay.time);
+		if (err || cmd->replay.lines < 1 || cmd->replay.bytes < 1 || cmd->replay.time < 0) {
+			AFB_ERROR("[parsing-error] sandbox='%s' cmd='%s' invalid replay=%s", sandbox->uid, cmd->uid,
+				  json_object_to_json_string(replayJ));
+			goto OnErrorExit;
+		}
+	}
 	// if verbose undefined
 	if (cmd->verbose < 0)
 		cmd->verbose = sandbox->verbose;
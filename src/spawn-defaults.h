@@ -32,6 +32,62 @@
 #define MAX_DOC_LINE_COUNT 128
 #endif
 
+#ifndef MAX_JSON_DOC_SIZE
+#define MAX_JSON_DOC_SIZE 65536
+#endif
+
+#ifndef MAX_JSON_WORKERS
+#define MAX_JSON_WORKERS 8
+#endif
+
+#ifndef MAX_ENCODER_WORKERS
+#define MAX_ENCODER_WORKERS 8
+#endif
+
+#ifndef MAX_EVENT_GROUPS
+#define MAX_EVENT_GROUPS 8
+#endif
+
+#ifndef REPLAY_LINES_DEFAULT
+#define REPLAY_LINES_DEFAULT 100
+#endif
+
+#ifndef REPLAY_BYTES_DEFAULT
+#define REPLAY_BYTES_DEFAULT 65536
+#endif
+
+#ifndef MAX_TABLE_FIELDS
+#define MAX_TABLE_FIELDS 256
+#endif
+
+#ifndef READ_BUDGET_DEFAULT
+#define READ_BUDGET_DEFAULT 65536
+#endif
+
+#ifndef MAX_READ_BLOCKS
+#define MAX_READ_BLOCKS 4
+#endif
+
+#ifndef URING_BUFFERS
+#define URING_BUFFERS 128
+#endif
+
+#ifndef DIFF_MAX_STATES
+#define DIFF_MAX_STATES 256
+#endif
+
+#ifndef LOG_MEMBER_INPUT
+#define LOG_MEMBER_INPUT 1048576
+#endif
+
+#ifndef LOG_MEMBER_DELAY
+#define LOG_MEMBER_DELAY 1
+#endif
+
+#ifndef MAX_PIPELINE_STAGES
+#define MAX_PIPELINE_STAGES 16
+#endif
+
 #ifndef CGROUPS_MOUNT_POINT
 #define CGROUPS_MOUNT_POINT "/sys/fs/cgroup"
 #endif
@@ -0,0 +1,520 @@
+/*
+ * Copyright (C) 2015-2021 IoT.bzh Company
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ *
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+*/
+
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include <time.h>
+
+#include <rp-utils/rp-jsonc.h>
+
+#include "spawn-defaults.h"
+#include "spawn-binding.h"
+#include "spawn-encoders-internal.h"
+#include "spawn-subtask.h"
+
+#include "lib/vfmt.h"
+#include "lib/stream-buf.h"
+#include "lib/line-buf.h"
+#include "lib/json-select.h"
+#include "lib/ddsketch.h"
+
+/***************************************************************************************/
+
+/** default relative accuracy of percentiles */
+#define AGG_ACCURACY 0.01
+
+/** default maximum count of bins of sketches */
+#define AGG_MAXBINS 2048
+
+/** maximum count of fields */
+#define AGG_MAX_FIELDS 64
+
+/** options of the aggregation encoder */
+typedef struct {
+	/** maximum length of lines */
+	int maxlen;
+	/** fields: column numbers or paths of JSON documents */
+	json_object *fields;
+	/** separator of columns, 0 for blanks */
+	char separator;
+	/** computed percentiles */
+	json_object *percentiles;
+	/** relative accuracy of percentiles */
+	double accuracy;
+	/** maximum count of bins of sketches */
+	int maxbins;
+	/** period of summaries in milliseconds, 0 for the end only */
+	int period;
+	/** periodic summaries only cover their period */
+	bool reset;
+} AggOptsT;
+
+/** statistics of a field */
+typedef struct {
+	/** name of the field in summaries */
+	char *name;
+	/** column number (from 1) or 0 for a path */
+	int column;
+	/** count of records without numeric value */
+	int64_t missing;
+	/** count, sum, min and max of values */
+	int64_t count;
+	double sum;
+	double min;
+	double max;
+	/** sketch of the values */
+	ddsketch_t sketch;
+} AggFieldT;
+
+/** context of the aggregation encoder */
+typedef struct {
+	/** options */
+	AggOptsT opts;
+	/** count of fields */
+	int nfields;
+	/** the fields */
+	AggFieldT fields[AGG_MAX_FIELDS];
+	/** highest column number */
+	int maxcol;
+	/** selection of the paths of JSON documents, NULL for columns */
+	json_select_t *select;
+	/** parser of documents */
+	json_tokener *tokener;
+	/** time of the last summary in milliseconds */
+	int64_t sent;
+	/** buffers of stdout and stderr */
+	stream_buf_t out, err;
+} AggCtxT;
+
+/** pair of encoder context and task for callbacks */
+typedef struct {
+	/** the encoder context */
+	AggCtxT *ctx;
+	/** the task */
+	taskIdT *task;
+} AggTaskCtxT;
+
+/***************************************************************************************/
+
+/** item of index of the fields, a single field not being in an array */
+static json_object *agg_field_item(json_object *fields, int index)
+{
+	return json_object_is_type(fields, json_type_array) ? json_object_array_get_idx(fields, index) : fields;
+}
+
+/** count of fields */
+static int agg_field_count(json_object *fields)
+{
+	return json_object_is_type(fields, json_type_array) ? (int)json_object_array_length(fields) : 1;
+}
+
+/** check the item of fields, a column number or a path */
+static bool agg_field_valid(json_object *item, bool *paths)
+{
+	if (json_object_is_type(item, json_type_int) && json_object_get_int(item) > 0) {
+		*paths = false;
+		return true;
+	}
+	if (json_object_is_type(item, json_type_string) && json_object_get_string_len(item) > 0) {
+		*paths = true;
+		return true;
+	}
+	return false;
+}
+
+static encoder_error_t agg_options(json_object *options, AggOptsT *opts)
+{
+	int err, idx, len;
+	const char *separator = NULL;
+	json_object *item;
+	bool paths = false, first;
+
+	opts->maxlen = 0;
+	opts->fields = NULL;
+	opts->separator = 0;
+	opts->percentiles = NULL;
+	opts->accuracy = AGG_ACCURACY;
+	opts->maxbins = AGG_MAXBINS;
+	opts->period = 0;
+	opts->reset = false;
+	if (options == NULL)
+		return ENCODER_ERROR_INVALID_OPTIONS;
+
+	err = rp_jsonc_unpack(options, "{so s?i s?s s?o s?F s?i s?i s?b}", "fields", &opts->fields, "maxlen",
+			      &opts->maxlen, "separator", &separator, "percentiles", &opts->percentiles, "accuracy",
+			      &opts->accuracy, "maxbins", &opts->maxbins, "period", &opts->period, "reset",
+			      &opts->reset);
+	if (err || opts->maxlen < 0 || opts->accuracy <= 0 || opts->accuracy >= 1 || opts->maxbins <= 0
+	    || opts->period < 0)
+		return ENCODER_ERROR_INVALID_OPTIONS;
+
+	if (separator != NULL) {
+		if (separator[0] == 0 || separator[1] != 0)
+			return ENCODER_ERROR_INVALID_OPTIONS;
+		opts->separator = separator[0];
+	}
+
+	// fields are all columns or all paths
+	len = agg_field_count(opts->fields);
+	if (len == 0 || len > AGG_MAX_FIELDS)
+		return ENCODER_ERROR_INVALID_OPTIONS;
+	for (idx = 0; idx < len; idx++) {
+		first = paths;
+		if (!agg_field_valid(agg_field_item(opts->fields, idx), &paths) || (idx > 0 && first != paths))
+			return ENCODER_ERROR_INVALID_OPTIONS;
+	}
+
+	// lines of JSON documents are longer
+	if (opts->maxlen == 0)
+		opts->maxlen = paths ? MAX_JSON_DOC_SIZE : MAX_DOC_LINE_SIZE;
+
+	if (opts->percentiles != NULL) {
+		if (!json_object_is_type(opts->percentiles, json_type_array))
+			return ENCODER_ERROR_INVALID_OPTIONS;
+		len = (int)json_object_array_length(opts->percentiles);
+		for (idx = 0; idx < len; idx++) {
+			item = json_object_array_get_idx(opts->percentiles, idx);
+			if ((!json_object_is_type(item, json_type_int) && !json_object_is_type(item, json_type_double))
+			    || json_object_get_double(item) < 0 || json_object_get_double(item) > 100)
+				return ENCODER_ERROR_INVALID_OPTIONS;
+		}
+	}
+	return ENCODER_NO_ERROR;
+}
+
+/** check options */
+encoder_error_t agg_check(json_object *options)
+{
+	AggOptsT opts;
+	return agg_options(options, &opts);
+}
+
+/** reset the statistics of the field */
+static void agg_field_reset(AggFieldT *field)
+{
+	field->missing = 0;
+	field->count = 0;
+	field->sum = 0;
+	field->min = 0;
+	field->max = 0;
+	ddsketch_reset(&field->sketch);
+}
+
+/** add the field of the item */
+static encoder_error_t agg_add_field(AggCtxT *ctx, json_object *item)
+{
+	AggFieldT *field = &ctx->fields[ctx->nfields];
+
+	if (json_object_is_type(item, json_type_int)) {
+		field->column = json_object_get_int(item);
+		if (asprintf(&field->name, "col%d", field->column) < 0)
+			return ENCODER_ERROR_OUT_OF_MEMORY;
+		if (field->column > ctx->maxcol)
+			ctx->maxcol = field->column;
+	} else {
+		field->name = strdup(json_object_get_string(item));
+		if (field->name == NULL)
+			return ENCODER_ERROR_OUT_OF_MEMORY;
+	}
+	ddsketch_init(&field->sketch, ctx->opts.accuracy, ctx->opts.maxbins);
+	ctx->nfields++;
+	if (field->column == 0 && json_select_add(ctx->select, field->name) < 0)
+		return ENCODER_ERROR_INVALID_OPTIONS;
+	return ENCODER_NO_ERROR;
+}
+
+/** instanciate data */
+encoder_error_t agg_instanciate(const encoder_generator_t *generator, json_object *options, void **data)
+{
+	AggCtxT *ctx;
+	encoder_error_t rc;
+	json_object *item;
+	int idx, len;
+
+	/* allocate */
+	ctx = calloc(1, sizeof *ctx);
+	if (ctx == NULL)
+		return ENCODER_ERROR_OUT_OF_MEMORY;
+
+	/* init */
+	rc = agg_options(options, &ctx->opts);
+	if (rc != ENCODER_NO_ERROR) {
+		free(ctx);
+		return rc;
+	}
+	json_object_get(ctx->opts.percentiles);
+
+	// paths of JSON documents are selected from their parsed tree
+	rc = ENCODER_ERROR_OUT_OF_MEMORY;
+	if (json_object_is_type(agg_field_item(ctx->opts.fields, 0), json_type_string)) {
+		ctx->select = json_select_create();
+		ctx->tokener = json_tokener_new();
+		if (ctx->select == NULL || ctx->tokener == NULL)
+			goto error;
+	}
+	len = agg_field_count(ctx->opts.fields);
+	for (idx = 0; idx < len; idx++) {
+		rc = agg_add_field(ctx, agg_field_item(ctx->opts.fields, idx));
+		if (rc != ENCODER_NO_ERROR)
+			goto error;
+	}
+	ctx->opts.fields = NULL;
+
+	rc = ENCODER_ERROR_OUT_OF_MEMORY;
+	if (stream_buf_init(&ctx->out, (size_t)ctx->opts.maxlen) != NULL) {
+		if (stream_buf_init(&ctx->err, (size_t)ctx->opts.maxlen) != NULL) {
+			*data = ctx;
+			return ENCODER_NO_ERROR;
+		}
+	}
+error:
+	agg_destroy(ctx);
+	return rc;
+}
+
+/** start processing */
+encoder_error_t agg_begin(void *data, taskIdT *task)
+{
+	AggCtxT *ctx = data;
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ctx->sent = (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+	return ENCODER_NO_ERROR;
+}
+
+/***************************************************************************************/
+
+/** add the value to the statistics of the field */
+static void agg_value(AggTaskCtxT *tc, AggFieldT *field, double value)
+{
+	if (field->count == 0 || value < field->min)
+		field->min = value;
+	if (field->count == 0 || value > field->max)
+		field->max = value;
+	field->count++;
+	field->sum += value;
+	if (ddsketch_add(&field->sketch, value) < 0)
+		vfmtcl((void *)spawnTaskLog, tc->task, AFB_SYSLOG_LEVEL_ERROR, "out of memory");
+}
+
+/** add the value of the text to the statistics of the field, end being the end of the value */
+static void agg_text(AggTaskCtxT *tc, AggFieldT *field, const char *text, const char *end)
+{
+	char *stop = NULL;
+	double value = text == end ? 0 : strtod(text, &stop);
+
+	// the whole text is the value, not a NaN
+	if (stop == end && !isnan(value))
+		agg_value(tc, field, value);
+	else
+		field->missing++;
+}
+
+/** aggregate the columns of the line */
+static void agg_columns(AggTaskCtxT *tc, const char *line, size_t length)
+{
+	AggCtxT *ctx = tc->ctx;
+	const char *end = &line[length], *scan = line, *start;
+	int col, idx;
+	AggFieldT *field;
+
+	for (col = 1; col <= ctx->maxcol; col++) {
+		// bounds of the column
+		if (ctx->opts.separator == 0) {
+			while (scan != end && isspace((unsigned char)*scan))
+				scan++;
+			start = scan;
+			while (scan != end && !isspace((unsigned char)*scan))
+				scan++;
+		} else {
+			start = scan;
+			while (scan != end && *scan != ctx->opts.separator)
+				scan++;
+		}
+		for (idx = 0; idx < ctx->nfields; idx++) {
+			field = &ctx->fields[idx];
+			if (field->column == col)
+				agg_text(tc, field, start, scan);
+		}
+		if (ctx->opts.separator != 0 && scan != end)
+			scan++;
+	}
+}
+
+/** aggregate the fields of the JSON document of the line */
+static void agg_document(AggTaskCtxT *tc, const char *line, size_t length)
+{
+	AggCtxT *ctx = tc->ctx;
+	json_object *doc, *selected = NULL, *value;
+	AggFieldT *field;
+	int idx;
+
+	json_tokener_reset(ctx->tokener);
+	doc = json_tokener_parse_ex(ctx->tokener, line, (int)length);
+	if (doc == NULL && json_tokener_get_error(ctx->tokener) == json_tokener_continue)
+		doc = json_tokener_parse_ex(ctx->tokener, "", 1); // terminates numbers
+	if (doc != NULL)
+		selected = json_select_object(ctx->select, doc);
+	for (idx = 0; idx < ctx->nfields; idx++) {
+		field = &ctx->fields[idx];
+		if (selected != NULL && json_object_object_get_ex(selected, field->name, &value)
+		    && (json_object_is_type(value, json_type_int) || json_object_is_type(value, json_type_double)))
+			agg_value(tc, field, json_object_get_double(value));
+		else
+			field->missing++;
+	}
+	json_object_put(selected);
+	json_object_put(doc);
+}
+
+static void agg_out_cb(void *closure, const char *line, size_t length)
+{
+	AggTaskCtxT *tc = closure;
+
+	if (tc->ctx->select != NULL)
+		agg_document(tc, line, length);
+	else
+		agg_columns(tc, line, length);
+}
+
+static void agg_err_cb(void *closure, const char *line, size_t length)
+{
+	AggTaskCtxT *tc = closure;
+	json_object *event;
+
+	rp_jsonc_pack(&event, "{so}", "stderr", json_object_new_string_len(line, (int)length));
+	spawnTaskPushEventJSON(tc->task, event);
+}
+
+/** statistics of the field */
+static json_object *agg_stats(AggCtxT *ctx, AggFieldT *field)
+{
+	json_object *stats, *item;
+	char key[32];
+	double p;
+	int idx, len;
+
+	rp_jsonc_pack(&stats, "{sI sI}", "count", field->count, "missing", field->missing);
+	if (stats == NULL || field->count == 0)
+		return stats;
+	json_object_object_add(stats, "sum", json_object_new_double(field->sum));
+	json_object_object_add(stats, "min", json_object_new_double(field->min));
+	json_object_object_add(stats, "max", json_object_new_double(field->max));
+	json_object_object_add(stats, "mean", json_object_new_double(field->sum / (double)field->count));
+
+	// the values of the sketch are clamped to the exact bounds
+	len = ctx->opts.percentiles == NULL ? 3 : (int)json_object_array_length(ctx->opts.percentiles);
+	for (idx = 0; idx < len; idx++) {
+		item = ctx->opts.percentiles == NULL ? NULL : json_object_array_get_idx(ctx->opts.percentiles, idx);
+		p = item != NULL ? json_object_get_double(item) : idx == 0 ? 50 : idx == 1 ? 90 : 99;
+		snprintf(key, sizeof key, "p%g", p);
+		p = ddsketch_quantile(&field->sketch, p / 100);
+		p = p < field->min ? field->min : p > field->max ? field->max : p;
+		json_object_object_add(stats, key, json_object_new_double(p));
+	}
+	return stats;
+}
+
+/** push the summary event of the fields, name being "agg" for periodic ones */
+static void agg_summary(AggTaskCtxT *tc, const char *name)
+{
+	AggCtxT *ctx = tc->ctx;
+	json_object *fields = json_object_new_object(), *event = NULL;
+	int idx;
+
+	if (fields != NULL) {
+		for (idx = 0; idx < ctx->nfields; idx++)
+			json_object_object_add(fields, ctx->fields[idx].name, agg_stats(ctx, &ctx->fields[idx]));
+		rp_jsonc_pack(&event, "{so}", name, fields);
+	}
+	if (event != NULL)
+		spawnTaskPushEventJSON(tc->task, event);
+	else
+		vfmtcl((void *)spawnTaskLog, tc->task, AFB_SYSLOG_LEVEL_ERROR, "out of memory");
+}
+
+/***************************************************************************************/
+
+/** process input read by the core, sending a summary when the period elapsed */
+encoder_error_t agg_consume(void *data, taskIdT *task, const struct iovec *iov, int iovcnt, encoder_stream_t stream)
+{
+	AggTaskCtxT tc = { .ctx = data, .task = task };
+	struct timespec now;
+	int64_t ms;
+	int idx;
+
+	if (stream == ENCODER_STREAM_STDERR) {
+		for (idx = 0; idx < iovcnt; idx++)
+			line_buf_write(&tc.ctx->err, iov[idx].iov_base, iov[idx].iov_len, agg_err_cb, &tc);
+		return ENCODER_NO_ERROR;
+	}
+	for (idx = 0; idx < iovcnt; idx++)
+		line_buf_write(&tc.ctx->out, iov[idx].iov_base, iov[idx].iov_len, agg_out_cb, &tc);
+	if (tc.ctx->opts.period > 0) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		ms = (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+		if (ms - tc.ctx->sent >= tc.ctx->opts.period) {
+			tc.ctx->sent = ms;
+			agg_summary(&tc, "agg");
+			if (tc.ctx->opts.reset)
+				for (idx = 0; idx < tc.ctx->nfields; idx++)
+					agg_field_reset(&tc.ctx->fields[idx]);
+		}
+	}
+	return ENCODER_NO_ERROR;
+}
+
+/** terminate processing */
+encoder_error_t agg_end(void *data, taskIdT *task)
+{
+	AggTaskCtxT tc = { .ctx = data, .task = task };
+	line_buf_end(&tc.ctx->err, agg_err_cb, &tc);
+	line_buf_end(&tc.ctx->out, agg_out_cb, &tc);
+	agg_summary(&tc, "summary");
+	return ENCODER_NO_ERROR;
+}
+
+/** destroy the encoder */
+void agg_destroy(void *data)
+{
+	AggCtxT *ctx = data;
+	int idx;
+
+	for (idx = 0; idx < ctx->nfields; idx++) {
+		free(ctx->fields[idx].name);
+		ddsketch_clear(&ctx->fields[idx].sketch);
+	}
+	json_select_free(ctx->select);
+	if (ctx->tokener != NULL)
+		json_tokener_free(ctx->tokener);
+	json_object_put(ctx->opts.percentiles);
+	stream_buf_clear(&ctx->out);
+	stream_buf_clear(&ctx->err);
+	free(ctx);
+}
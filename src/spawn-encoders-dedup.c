@@ -0,0 +1,414 @@
+/*
+ * Copyright (C) 2015-2021 IoT.bzh Company
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ *
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+*/
+
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <rp-utils/rp-jsonc.h>
+
+#include "spawn-defaults.h"
+#include "spawn-binding.h"
+#include "spawn-encoders-internal.h"
+#include "spawn-subtask.h"
+
+#include "lib/vfmt.h"
+#include "lib/stream-buf.h"
+#include "lib/line-buf.h"
+#include "lib/hash64.h"
+
+/***************************************************************************************/
+
+/** default window of suppression in milliseconds */
+#define DEDUP_WINDOW_MS 1000
+
+/** default count of slots of the table of lines */
+#define DEDUP_SLOTS 1024
+
+/** default count of lines of the summary */
+#define DEDUP_TOP 10
+
+/** count of slots probed for a line before evicting one */
+#define DEDUP_PROBES 8
+
+/** options of the dedup encoder */
+typedef struct {
+	/** maximum length of lines */
+	int maxlen;
+	/** window of suppression in milliseconds, 0 for consecutive lines only */
+	int window;
+	/** count of slots of the table, rounded to a power of 2 */
+	int slots;
+	/** count of most frequent lines sent at the end */
+	int top;
+} DedupOptsT;
+
+/** a distinct line seen */
+typedef struct DedupLineS {
+	/** text of the line, NULL when the slot is free */
+	char *text;
+	/** hash of the line and of its stream */
+	uint64_t hash;
+	/** time of the last event of the line in milliseconds */
+	int64_t sent;
+	/** occurrences not yet reported */
+	int64_t pending;
+	/** all occurrences */
+	int64_t total;
+	/** true for stderr */
+	bool error;
+	/** links of the lines with pending occurrences */
+	struct DedupLineS *next, *prev;
+} DedupLineT;
+
+/** context of the dedup encoder */
+typedef struct {
+	/** options */
+	DedupOptsT opts;
+	/** mask of the indexes of slots */
+	size_t mask;
+	/** the table of lines */
+	DedupLineT *lines;
+	/** last line of stdout and stderr in consecutive mode, NULL if none */
+	DedupLineT *last[2];
+	/** lines with pending occurrences */
+	DedupLineT *pending;
+	/** count of lines read */
+	int64_t count;
+	/** count of lines suppressed */
+	int64_t suppressed;
+	/** buffers of stdout and stderr */
+	stream_buf_t out, err;
+} DedupCtxT;
+
+/** pair of encoder context and task for callbacks */
+typedef struct {
+	/** the encoder context */
+	DedupCtxT *ctx;
+	/** the task */
+	taskIdT *task;
+	/** true for stderr */
+	bool error;
+	/** time of the read in milliseconds */
+	int64_t now;
+} DedupTaskCtxT;
+
+/***************************************************************************************/
+
+static encoder_error_t dedup_options(json_object *options, DedupOptsT *opts)
+{
+	int err;
+
+	opts->maxlen = MAX_DOC_LINE_SIZE;
+	opts->window = DEDUP_WINDOW_MS;
+	opts->slots = DEDUP_SLOTS;
+	opts->top = DEDUP_TOP;
+	if (options == NULL)
+		return ENCODER_NO_ERROR;
+
+	err = rp_jsonc_unpack(options, "{s?i s?i s?i s?i}", "maxlen", &opts->maxlen, "window", &opts->window, "slots",
+			      &opts->slots, "top", &opts->top);
+	if (err || opts->maxlen <= 0 || opts->window < 0 || opts->slots <= 0 || opts->slots > (1 << 20)
+	    || opts->top < 0)
+		return ENCODER_ERROR_INVALID_OPTIONS;
+	return ENCODER_NO_ERROR;
+}
+
+/** check options */
+encoder_error_t dedup_check(json_object *options)
+{
+	DedupOptsT opts;
+	return dedup_options(options, &opts);
+}
+
+/** instanciate data */
+encoder_error_t dedup_instanciate(const encoder_generator_t *generator, json_object *options, void **data)
+{
+	DedupCtxT *ctx;
+	encoder_error_t rc;
+	size_t slots;
+
+	/* allocate */
+	ctx = calloc(1, sizeof *ctx);
+	if (ctx == NULL)
+		return ENCODER_ERROR_OUT_OF_MEMORY;
+
+	/* init */
+	rc = dedup_options(options, &ctx->opts);
+	if (rc != ENCODER_NO_ERROR) {
+		free(ctx);
+		return rc;
+	}
+	for (slots = 1; slots < (size_t)ctx->opts.slots; slots <<= 1)
+		;
+	ctx->mask = slots - 1;
+
+	ctx->lines = calloc(slots, sizeof *ctx->lines);
+	if (ctx->lines != NULL) {
+		if (stream_buf_init(&ctx->out, (size_t)ctx->opts.maxlen) != NULL) {
+			if (stream_buf_init(&ctx->err, (size_t)ctx->opts.maxlen) != NULL) {
+				*data = ctx;
+				return ENCODER_NO_ERROR;
+			}
+		}
+	}
+	dedup_destroy(ctx);
+	return ENCODER_ERROR_OUT_OF_MEMORY;
+}
+
+/***************************************************************************************/
+
+/** current time in milliseconds */
+static int64_t dedup_now(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+/** push an event for the line, with the count of repeats when not zero */
+static void dedup_emit(DedupTaskCtxT *tc, const char *text, bool error, int64_t repeat)
+{
+	json_object *event;
+
+	rp_jsonc_pack(&event, "{ss so*}", error ? "stderr" : "stdout", text, "repeat",
+		      repeat ? json_object_new_int64(repeat) : NULL);
+	if (event != NULL)
+		spawnTaskPushEventJSON(tc->task, event);
+	else
+		vfmtcl((void *)spawnTaskLog, tc->task, AFB_SYSLOG_LEVEL_ERROR, "out of memory");
+}
+
+/** count an occurrence of the line not reported */
+static void dedup_pend(DedupCtxT *ctx, DedupLineT *line)
+{
+	if (line->pending++ == 0) {
+		line->prev = NULL;
+		line->next = ctx->pending;
+		if (ctx->pending != NULL)
+			ctx->pending->prev = line;
+		ctx->pending = line;
+	}
+}
+
+/** forget the pending occurrences of the line */
+static void dedup_unpend(DedupCtxT *ctx, DedupLineT *line)
+{
+	if (line->pending) {
+		line->pending = 0;
+		if (line->prev == NULL)
+			ctx->pending = line->next;
+		else
+			line->prev->next = line->next;
+		if (line->next != NULL)
+			line->next->prev = line->prev;
+	}
+}
+
+/** report the suppressed occurrences of the line */
+static void dedup_flush(DedupTaskCtxT *tc, DedupLineT *line)
+{
+	if (line->pending) {
+		dedup_emit(tc, line->text, line->error, line->pending);
+		dedup_unpend(tc->ctx, line);
+	}
+}
+
+/** report the suppressed occurrences of the lines whose window expired */
+static void dedup_expire(DedupTaskCtxT *tc)
+{
+	DedupCtxT *ctx = tc->ctx;
+	DedupLineT *line, *next;
+
+	for (line = ctx->pending; line != NULL; line = next) {
+		next = line->next;
+		if (tc->now - line->sent >= ctx->opts.window)
+			dedup_flush(tc, line);
+	}
+}
+
+/** find the slot of the line, evicting the least frequent line of the probed slots if needed */
+static DedupLineT *dedup_slot(DedupTaskCtxT *tc, uint64_t hash, const char *text, size_t length, bool *found)
+{
+	DedupCtxT *ctx = tc->ctx;
+	DedupLineT *line, *victim = NULL;
+	int probe;
+
+	for (probe = 0; probe < DEDUP_PROBES; probe++) {
+		line = &ctx->lines[(hash + (uint64_t)probe) & ctx->mask];
+		if (line->text == NULL) {
+			victim = line;
+			break;
+		}
+		if (line->hash == hash && line->error == tc->error && !strncmp(line->text, text, length)
+		    && line->text[length] == 0) {
+			*found = true;
+			return line;
+		}
+		if (victim == NULL || line->total < victim->total)
+			victim = line;
+	}
+
+	// the evicted line is forgotten after reporting its pending occurrences
+	*found = false;
+	if (victim->text != NULL) {
+		dedup_flush(tc, victim);
+		if (ctx->last[victim->error] == victim)
+			ctx->last[victim->error] = NULL;
+		free(victim->text);
+	}
+	memset(victim, 0, sizeof *victim);
+	victim->text = strndup(text, length);
+	if (victim->text == NULL)
+		return NULL;
+	victim->hash = hash;
+	victim->error = tc->error;
+	return victim;
+}
+
+static void dedup_line_cb(void *closure, const char *text, size_t length)
+{
+	DedupTaskCtxT *tc = closure;
+	DedupCtxT *ctx = tc->ctx;
+	DedupLineT *line, **last = &ctx->last[tc->error];
+	bool found, repeated;
+
+	ctx->count++;
+	line = dedup_slot(tc, hash64(text, length, tc->error), text, length, &found);
+	if (line == NULL) {
+		vfmtcl((void *)spawnTaskLog, tc->task, AFB_SYSLOG_LEVEL_ERROR, "out of memory");
+		return;
+	}
+	line->total++;
+
+	// in consecutive mode, a line is repeated when it is the last one of its stream
+	if (ctx->opts.window == 0) {
+		repeated = found && *last == line;
+		if (!repeated && *last != NULL)
+			dedup_flush(tc, *last);
+		*last = line;
+	} else
+		repeated = found && tc->now - line->sent < ctx->opts.window;
+
+	if (repeated) {
+		dedup_pend(ctx, line);
+		ctx->suppressed++;
+	} else if (line->pending) {
+		// the line reopens a window, its event also reports the suppressed occurrences
+		dedup_emit(tc, line->text, line->error, line->pending + 1);
+		dedup_unpend(ctx, line);
+	} else
+		dedup_emit(tc, line->text, line->error, 0);
+	if (!repeated)
+		line->sent = tc->now;
+}
+
+/** order of lines by decreasing count of occurrences */
+static int dedup_compare(const void *a, const void *b)
+{
+	const DedupLineT *la = *(const DedupLineT *const *)a, *lb = *(const DedupLineT *const *)b;
+	return la->total < lb->total ? 1 : la->total > lb->total ? -1 : 0;
+}
+
+/** push the summary event with the counts of lines and the most frequent ones */
+static void dedup_summary(DedupTaskCtxT *tc)
+{
+	DedupCtxT *ctx = tc->ctx;
+	DedupLineT **sorted;
+	json_object *top, *event;
+	size_t idx, count = 0;
+
+	if (ctx->opts.top == 0)
+		sorted = NULL, top = NULL;
+	else {
+		sorted = malloc((ctx->mask + 1) * sizeof *sorted);
+		top = json_object_new_array();
+	}
+	if (sorted != NULL && top != NULL) {
+		for (idx = 0; idx <= ctx->mask; idx++)
+			if (ctx->lines[idx].text != NULL && ctx->lines[idx].total > 1)
+				sorted[count++] = &ctx->lines[idx];
+		qsort(sorted, count, sizeof *sorted, dedup_compare);
+		for (idx = 0; idx < count && idx < (size_t)ctx->opts.top; idx++) {
+			rp_jsonc_pack(&event, "{ss sI}", sorted[idx]->error ? "stderr" : "stdout", sorted[idx]->text,
+				      "count", sorted[idx]->total);
+			json_object_array_add(top, event);
+		}
+	}
+	free(sorted);
+	rp_jsonc_pack(&event, "{so* sI sI}", "top", top, "lines", ctx->count, "suppressed", ctx->suppressed);
+	if (event != NULL)
+		spawnTaskPushEventJSON(tc->task, event);
+	else
+		vfmtcl((void *)spawnTaskLog, tc->task, AFB_SYSLOG_LEVEL_ERROR, "out of memory");
+}
+
+/***************************************************************************************/
+
+/** process input read by the core */
+encoder_error_t dedup_consume(void *data, taskIdT *task, const struct iovec *iov, int iovcnt, encoder_stream_t stream)
+{
+	DedupTaskCtxT tc = { .ctx = data, .task = task, .error = stream == ENCODER_STREAM_STDERR, .now = dedup_now() };
+	int idx;
+
+	// storms that stopped are reported before the lines that follow them
+	if (tc.ctx->opts.window != 0)
+		dedup_expire(&tc);
+	for (idx = 0; idx < iovcnt; idx++)
+		line_buf_write(tc.error ? &tc.ctx->err : &tc.ctx->out, iov[idx].iov_base, iov[idx].iov_len,
+			       dedup_line_cb, &tc);
+	return ENCODER_NO_ERROR;
+}
+
+/** terminate processing */
+encoder_error_t dedup_end(void *data, taskIdT *task)
+{
+	DedupTaskCtxT tc = { .ctx = data, .task = task, .now = dedup_now() };
+
+	tc.error = true;
+	line_buf_end(&tc.ctx->err, dedup_line_cb, &tc);
+	tc.error = false;
+	line_buf_end(&tc.ctx->out, dedup_line_cb, &tc);
+	while (tc.ctx->pending != NULL)
+		dedup_flush(&tc, tc.ctx->pending);
+	dedup_summary(&tc);
+	return ENCODER_NO_ERROR;
+}
+
+/** destroy the encoder */
+void dedup_destroy(void *data)
+{
+	DedupCtxT *ctx = data;
+	size_t idx;
+
+	if (ctx->lines != NULL) {
+		for (idx = 0; idx <= ctx->mask; idx++)
+			free(ctx->lines[idx].text);
+		free(ctx->lines);
+	}
+	stream_buf_clear(&ctx->out);
+	stream_buf_clear(&ctx->err);
+	free(ctx);
+}
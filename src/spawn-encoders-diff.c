@@ -0,0 +1,618 @@
+/*
+ * Copyright (C) 2015-2021 IoT.bzh Company
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ *
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+*/
+
+
+#define _GNU_SOURCE
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <uthash.h>
+#include <rp-utils/rp-jsonc.h>
+
+#include "spawn-defaults.h"
+#include "spawn-binding.h"
+#include "spawn-encoders-internal.h"
+#include "spawn-subtask.h"
+
+#include "lib/vfmt.h"
+#include "lib/stream-buf.h"
+#include "lib/line-buf.h"
+#include "lib/hash64.h"
+
+/***************************************************************************************/
+
+/** above this count of cells, changed blocks of lines aren't matched */
+#define DIFF_MAX_CELLS (1 << 20)
+
+/** options of the diff encoder */
+typedef struct {
+	/** maximum length of lines */
+	int maxlen;
+	/** maximum count of lines kept for comparison */
+	int maxline;
+	/** compare the fields of a JSON document instead of lines */
+	bool json;
+	/** maximum size of the JSON document */
+	int maxsize;
+} DiffOptsT;
+
+/** lines of an output with their hashes */
+typedef struct {
+	int count;
+	int alloc;
+	char **texts;
+	uint64_t *hashes;
+} DiffLinesT;
+
+/** output of the previous run of a command */
+typedef struct {
+	/** the command as "sandbox/command" */
+	char *key;
+	/** true once a run completed */
+	bool known;
+	/** true when the lines or the document are kept */
+	bool kept;
+	/** hash of the output */
+	uint64_t hash;
+	/** lines of the output */
+	DiffLinesT lines;
+	/** the document in JSON mode */
+	json_object *doc;
+	/** hash of the states */
+	UT_hash_handle hh;
+} DiffStateT;
+
+/** context of the diff encoder */
+typedef struct {
+	/** options */
+	DiffOptsT opts;
+	/** the command as "sandbox/command" */
+	char *key;
+	/** hash of stdout */
+	hash64_t hash;
+	/** lines of stdout */
+	DiffLinesT lines;
+	/** true when lines were too many or document too large */
+	bool overflowed;
+	/** buffers of stdout (line or document) and stderr */
+	stream_buf_t out, err;
+} DiffCtxT;
+
+/** pair of encoder context and task for callbacks */
+typedef struct {
+	/** the encoder context */
+	DiffCtxT *ctx;
+	/** the task */
+	taskIdT *task;
+} DiffTaskCtxT;
+
+/** outputs of the previous runs, from the least to the most recently used */
+static DiffStateT *diff_states = NULL;
+
+/** protection of diff_states */
+static pthread_mutex_t diff_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/***************************************************************************************/
+
+static encoder_error_t diff_options(json_object *options, DiffOptsT *opts)
+{
+	int err;
+
+	opts->maxlen = MAX_DOC_LINE_SIZE;
+	opts->maxline = MAX_DOC_LINE_COUNT;
+	opts->json = false;
+	opts->maxsize = MAX_JSON_DOC_SIZE;
+	if (options == NULL)
+		return ENCODER_NO_ERROR;
+
+	err = rp_jsonc_unpack(options, "{s?i s?i s?b s?i}", "maxlen", &opts->maxlen, "maxline", &opts->maxline, "json",
+			      &opts->json, "maxsize", &opts->maxsize);
+	if (err || opts->maxlen <= 0 || opts->maxline <= 0 || opts->maxsize <= 0)
+		return ENCODER_ERROR_INVALID_OPTIONS;
+	return ENCODER_NO_ERROR;
+}
+
+/** check options */
+encoder_error_t diff_check(json_object *options)
+{
+	DiffOptsT opts;
+	return diff_options(options, &opts);
+}
+
+static void diff_lines_clear(DiffLinesT *lines)
+{
+	int idx;
+
+	for (idx = 0; idx < lines->count; idx++)
+		free(lines->texts[idx]);
+	free(lines->texts);
+	free(lines->hashes);
+	memset(lines, 0, sizeof *lines);
+}
+
+/** add a copy of the line, returns false when out of memory */
+static bool diff_lines_add(DiffLinesT *lines, const char *line, size_t length)
+{
+	char **texts;
+	uint64_t *hashes;
+	int alloc;
+
+	if (lines->count == lines->alloc) {
+		alloc = lines->alloc ? 2 * lines->alloc : 32;
+		texts = realloc(lines->texts, (size_t)alloc * sizeof *texts);
+		if (texts == NULL)
+			return false;
+		lines->texts = texts;
+		hashes = realloc(lines->hashes, (size_t)alloc * sizeof *hashes);
+		if (hashes == NULL)
+			return false;
+		lines->hashes = hashes;
+		lines->alloc = alloc;
+	}
+	lines->texts[lines->count] = strndup(line, length);
+	if (lines->texts[lines->count] == NULL)
+		return false;
+	lines->hashes[lines->count++] = hash64(line, length, 0);
+	return true;
+}
+
+/** instanciate data */
+encoder_error_t diff_instanciate(const encoder_generator_t *generator, json_object *options, void **data)
+{
+	DiffCtxT *ctx;
+	encoder_error_t rc;
+
+	/* allocate */
+	ctx = calloc(1, sizeof *ctx);
+	if (ctx == NULL)
+		return ENCODER_ERROR_OUT_OF_MEMORY;
+
+	/* init */
+	rc = diff_options(options, &ctx->opts);
+	if (rc != ENCODER_NO_ERROR) {
+		free(ctx);
+		return rc;
+	}
+	hash64_init(&ctx->hash, 0);
+
+	if (stream_buf_init(&ctx->out, (size_t)(ctx->opts.json ? ctx->opts.maxsize : ctx->opts.maxlen)) != NULL) {
+		if (stream_buf_init(&ctx->err, (size_t)ctx->opts.maxlen) != NULL) {
+			*data = ctx;
+			return ENCODER_NO_ERROR;
+		}
+	}
+	diff_destroy(ctx);
+	return ENCODER_ERROR_OUT_OF_MEMORY;
+}
+
+/** records the command of the task */
+encoder_error_t diff_begin(void *data, taskIdT *task)
+{
+	DiffCtxT *ctx = data;
+	const char *uid = spawnTaskUid(task), *pid = strrchr(uid, '@'), *args;
+	json_object *argsJ = spawnTaskArgs(task);
+	int length = pid == NULL ? (int)strlen(uid) : (int)(pid - uid);
+
+	// runs of the command with other arguments have their own previous output
+	if (argsJ == NULL)
+		ctx->key = strndup(uid, (size_t)length);
+	else {
+		args = json_object_to_json_string_ext(argsJ, JSON_C_TO_STRING_PLAIN);
+		if (asprintf(&ctx->key, "%.*s#%016" PRIx64, length, uid, hash64(args, strlen(args), 0)) < 0)
+			ctx->key = NULL;
+	}
+	return ctx->key == NULL ? ENCODER_ERROR_OUT_OF_MEMORY : ENCODER_NO_ERROR;
+}
+
+/***************************************************************************************/
+
+/** push an event with the object of name and the hash */
+static void diff_emit(DiffTaskCtxT *tc, const char *name, json_object *object, uint64_t hash)
+{
+	char hex[17];
+	json_object *event;
+
+	snprintf(hex, sizeof hex, "%016" PRIx64, hash);
+	rp_jsonc_pack(&event, "{so ss}", name, object, "hash", hex);
+	if (event != NULL)
+		spawnTaskPushEventJSON(tc->task, event);
+	else
+		vfmtcl((void *)spawnTaskLog, tc->task, AFB_SYSLOG_LEVEL_ERROR, "out of memory");
+}
+
+static void diff_error(DiffTaskCtxT *tc, const char *message)
+{
+	json_object *event;
+
+	rp_jsonc_pack(&event, "{ss}", "json-error", message);
+	spawnTaskPushEventJSON(tc->task, event);
+}
+
+/** add to the array of name of changes an entry of 2 fields */
+static void diff_add(json_object *changes, const char *name, int line, const char *key1, const char *value1,
+		     const char *key2, const char *value2)
+{
+	json_object *array, *entry;
+
+	if (!json_object_object_get_ex(changes, name, &array)) {
+		array = json_object_new_array();
+		json_object_object_add(changes, name, array);
+	}
+	if (key2 == NULL)
+		rp_jsonc_pack(&entry, "{si ss}", "line", line, key1, value1);
+	else
+		rp_jsonc_pack(&entry, "{si ss ss}", "line", line, key1, value1, key2, value2);
+	json_object_array_add(array, entry);
+}
+
+/** add the changes of a block of removed lines and a block of added lines, paired as changed lines */
+static void diff_block(json_object *changes, const DiffLinesT *old, int iold, int nold, const DiffLinesT *new,
+		       int inew, int nnew)
+{
+	int idx, paired = nold < nnew ? nold : nnew;
+
+	for (idx = 0; idx < paired; idx++)
+		diff_add(changes, "changed", inew + idx + 1, "old", old->texts[iold + idx], "new",
+			 new->texts[inew + idx]);
+	for (; idx < nold; idx++)
+		diff_add(changes, "removed", iold + idx + 1, "text", old->texts[iold + idx], NULL, NULL);
+	for (idx = paired; idx < nnew; idx++)
+		diff_add(changes, "added", inew + idx + 1, "text", new->texts[inew + idx], NULL, NULL);
+}
+
+/** compute the changes of lines from old to new */
+static json_object *diff_lines(const DiffLinesT *old, const DiffLinesT *new)
+{
+	json_object *changes = json_object_new_object();
+	int start, nold, nnew, iold, inew, bold, bnew, width;
+	uint32_t *lcs;
+
+	// common head and tail
+	for (start = 0; start < old->count && start < new->count && old->hashes[start] == new->hashes[start]; start++)
+		;
+	nold = old->count - start;
+	nnew = new->count - start;
+	while (nold > 0 && nnew > 0 && old->hashes[start + nold - 1] == new->hashes[start + nnew - 1])
+		nold--, nnew--;
+
+	// longest common subsequence of the middle, lcs[i][j] for the lines from i and j
+	width = nnew + 1;
+	lcs = (size_t)(nold + 1) * (size_t)width > DIFF_MAX_CELLS
+		      ? NULL
+		      : calloc((size_t)(nold + 1) * (size_t)width, sizeof *lcs);
+	if (lcs == NULL) {
+		diff_block(changes, old, start, nold, new, start, nnew);
+		return changes;
+	}
+	for (iold = nold - 1; iold >= 0; iold--)
+		for (inew = nnew - 1; inew >= 0; inew--)
+			lcs[iold * width + inew] = old->hashes[start + iold] == new->hashes[start + inew]
+							   ? lcs[(iold + 1) * width + inew + 1] + 1
+						   : lcs[(iold + 1) * width + inew] > lcs[iold * width + inew + 1]
+							   ? lcs[(iold + 1) * width + inew]
+							   : lcs[iold * width + inew + 1];
+
+	// walk the common lines, reporting the blocks between them
+	for (iold = bold = 0, inew = bnew = 0; iold < nold || inew < nnew;) {
+		if (iold < nold && inew < nnew && old->hashes[start + iold] == new->hashes[start + inew]) {
+			diff_block(changes, old, start + bold, iold - bold, new, start + bnew, inew - bnew);
+			bold = ++iold;
+			bnew = ++inew;
+		} else if (inew == nnew || (iold < nold && lcs[(iold + 1) * width + inew] >= lcs[iold * width + inew + 1]))
+			iold++;
+		else
+			inew++;
+	}
+	diff_block(changes, old, start + bold, iold - bold, new, start + bnew, inew - bnew);
+	free(lcs);
+	return changes;
+}
+
+/** compute the changes of fields from old to new, recording them under the path */
+static void diff_fields(json_object *changed, json_object *removed, json_object *old, json_object *new,
+			const char *path)
+{
+	struct json_object_iterator it, end;
+	json_object *value;
+	const char *key;
+	char *subpath;
+
+	if (json_object_is_type(old, json_type_object) && json_object_is_type(new, json_type_object)) {
+		end = json_object_iter_end(old);
+		for (it = json_object_iter_begin(old); !json_object_iter_equal(&it, &end); json_object_iter_next(&it)) {
+			key = json_object_iter_peek_name(&it);
+			if (json_object_object_get_ex(new, key, NULL))
+				continue;
+			if (asprintf(&subpath, "%s%s%s", path, *path ? "." : "", key) >= 0) {
+				json_object_array_add(removed, json_object_new_string(subpath));
+				free(subpath);
+			}
+		}
+		json_object_object_foreach(new, nkey, nvalue) {
+			if (asprintf(&subpath, "%s%s%s", path, *path ? "." : "", nkey) < 0)
+				continue;
+			if (json_object_object_get_ex(old, nkey, &value))
+				diff_fields(changed, removed, value, nvalue, subpath);
+			else
+				json_object_object_add(changed, subpath, json_object_get(nvalue));
+			free(subpath);
+		}
+	} else if (!json_object_equal(old, new))
+		json_object_object_add(changed, path, json_object_get(new));
+}
+
+/** compute the changes of the document from old to new, NULL when none */
+static json_object *diff_doc(json_object *old, json_object *new)
+{
+	json_object *changes, *changed = json_object_new_object(), *removed = json_object_new_array();
+
+	diff_fields(changed, removed, old, new, "");
+	if (json_object_object_length(changed) == 0 && json_object_array_length(removed) == 0) {
+		json_object_put(changed);
+		json_object_put(removed);
+		return NULL;
+	}
+	if (json_object_array_length(removed) == 0) {
+		json_object_put(removed);
+		removed = NULL;
+	}
+	rp_jsonc_pack(&changes, "{so so*}", "changed", changed, "removed", removed);
+	return changes;
+}
+
+/** remove the state and free it */
+static void diff_state_free(DiffStateT *state)
+{
+	HASH_DELETE(hh, diff_states, state);
+	diff_lines_clear(&state->lines);
+	json_object_put(state->doc);
+	free(state->key);
+	free(state);
+}
+
+/** get the state of the command, creating it as needed in place of the least recently used beyond DIFF_MAX_STATES */
+static DiffStateT *diff_state(const char *key)
+{
+	DiffStateT *state;
+
+	HASH_FIND_STR(diff_states, key, state);
+	if (state != NULL) {
+		// the states are kept in their order of use
+		HASH_DELETE(hh, diff_states, state);
+		HASH_ADD_KEYPTR(hh, diff_states, state->key, strlen(state->key), state);
+		return state;
+	}
+	if (HASH_COUNT(diff_states) >= DIFF_MAX_STATES)
+		diff_state_free(diff_states);
+
+	state = calloc(1, sizeof *state);
+	if (state == NULL)
+		return NULL;
+	state->key = strdup(key);
+	if (state->key == NULL) {
+		free(state);
+		return NULL;
+	}
+	HASH_ADD_KEYPTR(hh, diff_states, state->key, strlen(state->key), state);
+	return state;
+}
+
+void diff_states_clear(void)
+{
+	DiffStateT *state, *next;
+
+	pthread_mutex_lock(&diff_mutex);
+	HASH_ITER(hh, diff_states, state, next)
+	{
+		diff_state_free(state);
+	}
+	pthread_mutex_unlock(&diff_mutex);
+}
+
+/** a JSON array of the lines */
+static json_object *diff_all_lines(const DiffLinesT *lines)
+{
+	json_object *array = json_object_new_array();
+	int idx;
+
+	for (idx = 0; idx < lines->count; idx++)
+		json_object_array_add(array, json_object_new_string(lines->texts[idx]));
+	return array;
+}
+
+/** parse the document of stdout */
+static json_object *diff_parse(DiffTaskCtxT *tc)
+{
+	stream_buf_t *sbuf = &tc->ctx->out;
+	enum json_tokener_error jerr;
+	json_object *doc;
+
+	if (tc->ctx->overflowed) {
+		diff_error(tc, "json document too large");
+		return NULL;
+	}
+	doc = json_tokener_parse_verbose(stream_buf_length(sbuf) ? stream_buf_data(sbuf) : "null", &jerr);
+	if (jerr != json_tokener_success) {
+		diff_error(tc, json_tokener_error_desc(jerr));
+		return NULL;
+	}
+	return doc;
+}
+
+/** compare the output with the output of the previous run and emit the differences */
+static void diff_compare(DiffTaskCtxT *tc)
+{
+	DiffCtxT *ctx = tc->ctx;
+	uint64_t hash = hash64_digest(&ctx->hash);
+	json_object *object = NULL, *doc = NULL;
+	const char *name = "diff";
+	DiffStateT *state;
+
+	if (ctx->opts.json) {
+		doc = diff_parse(tc);
+		if (doc == NULL && (ctx->overflowed || stream_buf_length(&ctx->out) > 0))
+			return;
+	}
+
+	pthread_mutex_lock(&diff_mutex);
+	state = diff_state(ctx->key);
+	if (state == NULL) {
+		pthread_mutex_unlock(&diff_mutex);
+		json_object_put(doc);
+		vfmtcl((void *)spawnTaskLog, tc->task, AFB_SYSLOG_LEVEL_ERROR, "out of memory");
+		return;
+	}
+	if (state->known && state->hash == hash) {
+		name = "unchanged";
+		object = json_object_new_boolean(true);
+	} else if (ctx->opts.json) {
+		// documents of same content differently written are unchanged
+		if (state->kept && json_object_is_type(state->doc, json_type_object)
+		    && json_object_is_type(doc, json_type_object)) {
+			object = diff_doc(state->doc, doc);
+			if (object == NULL) {
+				name = "unchanged";
+				object = json_object_new_boolean(true);
+			}
+		} else if (state->kept && json_object_equal(state->doc, doc)) {
+			name = "unchanged";
+			object = json_object_new_boolean(true);
+		}
+		json_object_put(state->doc);
+		state->doc = json_object_get(doc);
+		state->kept = true;
+	} else {
+		if (state->kept && !ctx->overflowed)
+			object = diff_lines(&state->lines, &ctx->lines);
+		diff_lines_clear(&state->lines);
+		state->kept = !ctx->overflowed;
+		if (state->kept) {
+			state->lines = ctx->lines;
+			memset(&ctx->lines, 0, sizeof ctx->lines);
+		}
+	}
+	state->known = true;
+	state->hash = hash;
+
+	// the first run, or a run whose lines can't be compared, sends the whole output
+	if (object == NULL) {
+		name = "stdout";
+		object = ctx->opts.json ? json_object_get(doc) : diff_all_lines(state->kept ? &state->lines : &ctx->lines);
+	}
+	pthread_mutex_unlock(&diff_mutex);
+	json_object_put(doc);
+	diff_emit(tc, name, object, hash);
+}
+
+/***************************************************************************************/
+
+static void diff_out_cb(void *closure, const char *line, size_t length)
+{
+	DiffTaskCtxT *tc = closure;
+	DiffCtxT *ctx = tc->ctx;
+
+	hash64_update(&ctx->hash, line, length);
+	hash64_update(&ctx->hash, "\n", 1);
+	if (ctx->lines.count == ctx->opts.maxline)
+		ctx->overflowed = true;
+	else if (!diff_lines_add(&ctx->lines, line, length)) {
+		ctx->overflowed = true;
+		vfmtcl((void *)spawnTaskLog, tc->task, AFB_SYSLOG_LEVEL_ERROR, "out of memory");
+	}
+}
+
+static void diff_err_cb(void *closure, const char *line, size_t length)
+{
+	DiffTaskCtxT *tc = closure;
+	json_object *event;
+
+	rp_jsonc_pack(&event, "{so}", "stderr", json_object_new_string_len(line, (int)length));
+	spawnTaskPushEventJSON(tc->task, event);
+}
+
+/** add bytes to the JSON document, hashing them */
+static void diff_write_doc(DiffCtxT *ctx, const char *data, size_t length)
+{
+	stream_buf_t *sbuf = &ctx->out;
+	size_t count;
+
+	while (length > 0) {
+		if (stream_buf_is_full(sbuf)) {
+			// the end of a too large document only counts in the hash
+			ctx->overflowed = true;
+			stream_buf_consume(sbuf, stream_buf_length(sbuf));
+		}
+		count = stream_buf_write(sbuf, data, length);
+		hash64_update(&ctx->hash, data, count);
+		data += count;
+		length -= count;
+	}
+}
+
+/** process input read by the core */
+encoder_error_t diff_consume(void *data, taskIdT *task, const struct iovec *iov, int iovcnt, encoder_stream_t stream)
+{
+	DiffTaskCtxT tc = { .ctx = data, .task = task };
+	int idx;
+
+	for (idx = 0; idx < iovcnt; idx++) {
+		if (stream == ENCODER_STREAM_STDERR)
+			line_buf_write(&tc.ctx->err, iov[idx].iov_base, iov[idx].iov_len, diff_err_cb, &tc);
+		else if (tc.ctx->opts.json)
+			diff_write_doc(tc.ctx, iov[idx].iov_base, iov[idx].iov_len);
+		else
+			line_buf_write(&tc.ctx->out, iov[idx].iov_base, iov[idx].iov_len, diff_out_cb, &tc);
+	}
+	return ENCODER_NO_ERROR;
+}
+
+/** terminate processing */
+encoder_error_t diff_end(void *data, taskIdT *task)
+{
+	DiffTaskCtxT tc = { .ctx = data, .task = task };
+	line_buf_end(&tc.ctx->err, diff_err_cb, &tc);
+	if (!tc.ctx->opts.json)
+		line_buf_end(&tc.ctx->out, diff_out_cb, &tc);
+	else if (stream_buf_length(&tc.ctx->out) < stream_buf_capacity(&tc.ctx->out))
+		tc.ctx->out.data[tc.ctx->out.length] = 0;
+	else
+		tc.ctx->overflowed = true;
+	if (tc.ctx->key != NULL)
+		diff_compare(&tc);
+	return ENCODER_NO_ERROR;
+}
+
+/** destroy the encoder */
+void diff_destroy(void *data)
+{
+	DiffCtxT *ctx = data;
+
+	diff_lines_clear(&ctx->lines);
+	stream_buf_clear(&ctx->out);
+	stream_buf_clear(&ctx->err);
+	free(ctx->key);
+	free(ctx);
+}
@@ -0,0 +1,144 @@
+/*
+ * Copyright (C) 2015-2021 IoT.bzh Company
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ *
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+ */
+
+#ifndef _SPAWN_ENCODERS_INTERNAL_INCLUDE_
+#define _SPAWN_ENCODERS_INTERNAL_INCLUDE_
+
+#include <stdio.h>
+
+#include "spawn-encoders.h"
+
+#include "lib/line-filter.h"
+#include "lib/record-frame.h"
+
+/***************************************************************************/
+/* spawn-encoders.c: helpers shared by the encoders */
+
+/** policies for texts that aren't valid UTF-8 */
+typedef enum {
+	/** texts are sent as read */
+	utf8_none,
+	/** invalid sequences are replaced by U+FFFD */
+	utf8_replace,
+	/** invalid bytes are written as \xHH */
+	utf8_escape,
+	/** invalid texts are sent base64 encoded in an object {"base64": ...} */
+	utf8_base64
+} Utf8PolicyT;
+
+extern bool utf8_policy(const char *name, Utf8PolicyT *policy);
+extern json_object *utf8_string(Utf8PolicyT policy, const char *text, size_t length);
+extern FILE *openexp(const char *filename, const char *mode, taskIdT *task);
+extern void log_writev(int fd, struct iovec *iov, int iovcnt);
+extern encoder_error_t text_filter_add(line_filter_t *filter, json_object *spec);
+extern encoder_error_t text_filter_create(json_object *spec, line_filter_t **filter, const char **args);
+extern encoder_error_t text_frame_create(json_object *spec, record_frame_t **frame);
+
+/***************************************************************************/
+/* spawn-encoders-table.c: parsing of tabular text */
+
+/** formats of the tabular text */
+typedef enum {
+	/** comma separated values */
+	table_csv,
+	/** tabulation separated values */
+	table_tsv,
+	/** logfmt lines of key=value pairs */
+	table_logfmt,
+	/** whitespace aligned columns */
+	table_columns
+} TableFormatT;
+
+extern encoder_error_t table_check(json_object *options);
+extern encoder_error_t table_instanciate(const encoder_generator_t *generator, json_object *options, void **data);
+extern encoder_error_t table_consume(void *data, taskIdT *task, const struct iovec *iov, int iovcnt,
+				     encoder_stream_t stream);
+extern encoder_error_t table_end(void *data, taskIdT *task);
+extern void table_destroy(void *data);
+
+/***************************************************************************/
+/* spawn-encoders-record.c: framing of length-prefixed binary records */
+
+/** framings of the records */
+typedef enum {
+	/** netstrings: <decimal length>:<payload>, */
+	record_netstring,
+	/** little-endian 32 bits length followed by the payload */
+	record_u32,
+	/** sequence of CBOR items */
+	record_cbor
+} RecordFramingT;
+
+extern encoder_error_t netstring_check(json_object *options);
+extern encoder_error_t u32_check(json_object *options);
+extern encoder_error_t cbor_check(json_object *options);
+extern encoder_error_t record_instanciate(const encoder_generator_t *generator, json_object *options, void **data);
+extern encoder_error_t record_consume(void *data, taskIdT *task, const struct iovec *iov, int iovcnt,
+				      encoder_stream_t stream);
+extern encoder_error_t record_end(void *data, taskIdT *task);
+extern void record_destroy(void *data);
+
+/***************************************************************************/
+/* spawn-encoders-diff.c: differences with the previous run of a command */
+
+extern encoder_error_t diff_check(json_object *options);
+extern encoder_error_t diff_instanciate(const encoder_generator_t *generator, json_object *options, void **data);
+extern encoder_error_t diff_begin(void *data, taskIdT *task);
+extern encoder_error_t diff_consume(void *data, taskIdT *task, const struct iovec *iov, int iovcnt,
+				    encoder_stream_t stream);
+extern encoder_error_t diff_end(void *data, taskIdT *task);
+extern void diff_destroy(void *data);
+extern void diff_states_clear(void);
+
+/***************************************************************************/
+/* spawn-encoders-dedup.c: suppression of repeated lines */
+
+extern encoder_error_t dedup_check(json_object *options);
+extern encoder_error_t dedup_instanciate(const encoder_generator_t *generator, json_object *options, void **data);
+extern encoder_error_t dedup_consume(void *data, taskIdT *task, const struct iovec *iov, int iovcnt,
+				     encoder_stream_t stream);
+extern encoder_error_t dedup_end(void *data, taskIdT *task);
+extern void dedup_destroy(void *data);
+
+/***************************************************************************/
+/* spawn-encoders-agg.c: statistics of numeric fields */
+
+extern encoder_error_t agg_check(json_object *options);
+extern encoder_error_t agg_instanciate(const encoder_generator_t *generator, json_object *options, void **data);
+extern encoder_error_t agg_begin(void *data, taskIdT *task);
+extern encoder_error_t agg_consume(void *data, taskIdT *task, const struct iovec *iov, int iovcnt,
+				   encoder_stream_t stream);
+extern encoder_error_t agg_end(void *data, taskIdT *task);
+extern void agg_destroy(void *data);
+
+/***************************************************************************/
+/* spawn-encoders-pipeline.c: chains of stages */
+
+extern encoder_error_t pipeline_check(json_object *options);
+extern encoder_error_t pipeline_instanciate(const encoder_generator_t *generator, json_object *options, void **data);
+extern encoder_error_t pipeline_begin(void *data, taskIdT *task);
+extern encoder_error_t pipeline_consume(void *data, taskIdT *task, const struct iovec *iov, int iovcnt,
+				        encoder_stream_t stream);
+extern encoder_error_t pipeline_end(void *data, taskIdT *task);
+extern void pipeline_destroy(void *data);
+
+#endif /* _SPAWN_ENCODERS_INTERNAL_INCLUDE_ */
@@ -0,0 +1,867 @@
+/*
+ * Copyright (C) 2015-2021 IoT.bzh Company
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ *
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+*/
+
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/uio.h>
+
+#include <rp-utils/rp-jsonc.h>
+
+#include "spawn-defaults.h"
+#include "spawn-binding.h"
+#include "spawn-encoders-internal.h"
+#include "spawn-subtask.h"
+
+#include "lib/vfmt.h"
+#include "lib/stream-buf.h"
+#include "lib/line-buf.h"
+
+/***************************************************************************************/
+
+/** default count of events of a batch */
+#define PIPELINE_BATCH_COUNT 10
+
+/** a stage of the pipeline with its options */
+typedef struct {
+	/** the stage */
+	const encoder_stage_t *stage;
+	/** its options, NULL for implicit stages */
+	json_object *options;
+} PipeStageT;
+
+/** the chain of stages */
+typedef struct {
+	/** count of stages */
+	int count;
+	/** the stages, the first reading bytes and the last giving events */
+	PipeStageT stages[MAX_PIPELINE_STAGES];
+} PipeSpecT;
+
+/** context of the pipeline encoder */
+typedef struct {
+	/** the chain of stages */
+	PipeSpecT spec;
+	/** data of the stages */
+	void *data[MAX_PIPELINE_STAGES];
+	/** separator ending the records in the output and its length */
+	const char *sep;
+	size_t seplen;
+} PipeCtxT;
+
+/** the flow of items of a task through the pipeline */
+struct encoder_flow {
+	/** the encoder context */
+	PipeCtxT *ctx;
+	/** the task */
+	taskIdT *task;
+	/** index of the stage giving the items */
+	int index;
+};
+
+/** holding hat of the stages of a plugin */
+typedef struct stage_factory {
+	struct stage_factory *next;
+	const encoder_stage_t *stages;
+	const char *uid;
+} stage_factory_t;
+
+// registry of the stages of the plugins
+static stage_factory_t *first_stage_factory = NULL;
+
+/***************************************************************************************/
+
+void encoder_flow_record(encoder_flow_t *flow, const char *record, size_t length, bool error)
+{
+	encoder_flow_t next = { .ctx = flow->ctx, .task = flow->task, .index = flow->index + 1 };
+	const encoder_stage_t *stage = flow->ctx->spec.stages[next.index].stage;
+
+	// the chain always ends with a stage giving events
+	stage->record(flow->ctx->data[next.index], &next, record, length, error);
+}
+
+void encoder_flow_event(encoder_flow_t *flow, json_object *event)
+{
+	encoder_flow_t next = { .ctx = flow->ctx, .task = flow->task, .index = flow->index + 1 };
+
+	if (event == NULL)
+		vfmtcl((void *)spawnTaskLog, flow->task, AFB_SYSLOG_LEVEL_ERROR, "out of memory");
+	else if (next.index == flow->ctx->spec.count)
+		spawnTaskPushEventJSON(flow->task, event);
+	else
+		flow->ctx->spec.stages[next.index].stage->event(flow->ctx->data[next.index], &next, event);
+}
+
+taskIdT *encoder_flow_task(encoder_flow_t *flow)
+{
+	return flow->task;
+}
+
+/***************************************************************************************/
+/* stage 'lines': splits the bytes in lines or records */
+
+/** context of the stage 'lines' */
+typedef struct {
+	/** maximum length of records */
+	int maxlen;
+	/** framing of records, NULL for lines */
+	record_frame_t *frame;
+	/** buffers of stdout and stderr */
+	stream_buf_t out, err;
+} PipeLinesCtxT;
+
+/** pair of flow and stream for callbacks */
+typedef struct {
+	/** the flow */
+	encoder_flow_t *flow;
+	/** true for stderr */
+	bool error;
+} PipeLinesTaskT;
+
+static encoder_error_t lines_options(json_object *options, int *maxlen, record_frame_t **frame)
+{
+	json_object *record = NULL;
+
+	*maxlen = MAX_DOC_LINE_SIZE;
+	*frame = NULL;
+	if (options == NULL)
+		return ENCODER_NO_ERROR;
+	if (rp_jsonc_unpack(options, "{s?i s?o}", "maxlen", maxlen, "record", &record) || *maxlen <= 0)
+		return ENCODER_ERROR_INVALID_OPTIONS;
+	return record == NULL ? ENCODER_NO_ERROR : text_frame_create(record, frame);
+}
+
+static encoder_error_t lines_check(json_object *options)
+{
+	record_frame_t *frame;
+	int maxlen;
+	encoder_error_t rc = lines_options(options, &maxlen, &frame);
+	record_frame_free(frame);
+	return rc;
+}
+
+static void lines_destroy(void *data)
+{
+	PipeLinesCtxT *ctx = data;
+	record_frame_free(ctx->frame);
+	stream_buf_clear(&ctx->out);
+	stream_buf_clear(&ctx->err);
+	free(ctx);
+}
+
+static encoder_error_t lines_create(const encoder_stage_t *stage, json_object *options, void **data)
+{
+	PipeLinesCtxT *ctx;
+	encoder_error_t rc;
+
+	ctx = calloc(1, sizeof *ctx);
+	if (ctx == NULL)
+		return ENCODER_ERROR_OUT_OF_MEMORY;
+	rc = lines_options(options, &ctx->maxlen, &ctx->frame);
+	if (rc == ENCODER_NO_ERROR) {
+		if (stream_buf_init(&ctx->out, (size_t)ctx->maxlen) != NULL
+		    && stream_buf_init(&ctx->err, (size_t)ctx->maxlen) != NULL) {
+			*data = ctx;
+			return ENCODER_NO_ERROR;
+		}
+		rc = ENCODER_ERROR_OUT_OF_MEMORY;
+	}
+	lines_destroy(ctx);
+	return rc;
+}
+
+static encoder_error_t lines_begin(void *data, encoder_flow_t *flow)
+{
+	PipeLinesCtxT *ctx = data;
+	const char *delim;
+	size_t length;
+
+	// records started by a pattern keep the newline, only trimmed from their last line
+	delim = ctx->frame == NULL ? NULL : record_frame_delimiter(ctx->frame, &length);
+	if (delim != NULL) {
+		flow->ctx->sep = delim;
+		flow->ctx->seplen = length;
+	}
+	return ENCODER_NO_ERROR;
+}
+
+static void lines_cb(void *closure, const char *line, size_t length)
+{
+	PipeLinesTaskT *lt = closure;
+	encoder_flow_record(lt->flow, line, length, lt->error);
+}
+
+static encoder_error_t lines_consume(void *data, encoder_flow_t *flow, const struct iovec *iov, int iovcnt,
+				     encoder_stream_t stream)
+{
+	PipeLinesCtxT *ctx = data;
+	PipeLinesTaskT lt = { .flow = flow, .error = stream == ENCODER_STREAM_STDERR };
+	stream_buf_t *sbuf = lt.error ? &ctx->err : &ctx->out;
+	int idx;
+
+	for (idx = 0; idx < iovcnt; idx++) {
+		if (ctx->frame != NULL)
+			record_frame_write(ctx->frame, sbuf, iov[idx].iov_base, iov[idx].iov_len, lines_cb, &lt);
+		else
+			line_buf_write(sbuf, iov[idx].iov_base, iov[idx].iov_len, lines_cb, &lt);
+	}
+	return ENCODER_NO_ERROR;
+}
+
+static void lines_end(void *data, encoder_flow_t *flow)
+{
+	PipeLinesCtxT *ctx = data;
+	PipeLinesTaskT lt = { .flow = flow, .error = true };
+
+	if (ctx->frame != NULL)
+		record_frame_end(ctx->frame, &ctx->err, lines_cb, &lt);
+	else
+		line_buf_end(&ctx->err, lines_cb, &lt);
+	lt.error = false;
+	if (ctx->frame != NULL)
+		record_frame_end(ctx->frame, &ctx->out, lines_cb, &lt);
+	else
+		line_buf_end(&ctx->out, lines_cb, &lt);
+}
+
+/***************************************************************************************/
+/* stage 'text': gives records as strings */
+
+static encoder_error_t text_stage_options(json_object *options, Utf8PolicyT *policy)
+{
+	const char *utf8 = NULL;
+
+	if (options != NULL && rp_jsonc_unpack(options, "{s?s}", "utf8", &utf8))
+		return ENCODER_ERROR_INVALID_OPTIONS;
+	return utf8_policy(utf8, policy) ? ENCODER_NO_ERROR : ENCODER_ERROR_INVALID_OPTIONS;
+}
+
+static encoder_error_t text_stage_check(json_object *options)
+{
+	Utf8PolicyT policy;
+	return text_stage_options(options, &policy);
+}
+
+static encoder_error_t text_stage_create(const encoder_stage_t *stage, json_object *options, void **data)
+{
+	Utf8PolicyT *policy;
+	encoder_error_t rc;
+
+	policy = malloc(sizeof *policy);
+	if (policy == NULL)
+		return ENCODER_ERROR_OUT_OF_MEMORY;
+	rc = text_stage_options(options, policy);
+	if (rc != ENCODER_NO_ERROR)
+		free(policy);
+	else
+		*data = policy;
+	return rc;
+}
+
+static void text_stage_record(void *data, encoder_flow_t *flow, const char *record, size_t length, bool error)
+{
+	json_object *event;
+	rp_jsonc_pack(&event, "{so}", error ? "stderr" : "stdout", utf8_string(*(Utf8PolicyT *)data, record, length));
+	encoder_flow_event(flow, event);
+}
+
+/***************************************************************************************/
+/* stage 'filter': drops records not matching patterns */
+
+/** context of the stage 'filter' */
+typedef struct {
+	/** the filter */
+	line_filter_t *filter;
+	/** name of the argument of the requests adding patterns */
+	const char *args;
+} PipeFilterCtxT;
+
+static encoder_error_t filter_check(json_object *options)
+{
+	line_filter_t *filter;
+	const char *args;
+	encoder_error_t rc = text_filter_create(options, &filter, &args);
+	if (rc == ENCODER_NO_ERROR)
+		line_filter_free(filter);
+	return rc;
+}
+
+static encoder_error_t filter_create(const encoder_stage_t *stage, json_object *options, void **data)
+{
+	PipeFilterCtxT *ctx;
+	encoder_error_t rc;
+
+	ctx = calloc(1, sizeof *ctx);
+	if (ctx == NULL)
+		return ENCODER_ERROR_OUT_OF_MEMORY;
+	rc = text_filter_create(options, &ctx->filter, &ctx->args);
+	if (rc != ENCODER_NO_ERROR)
+		free(ctx);
+	else
+		*data = ctx;
+	return rc;
+}
+
+/** add the patterns of the request */
+static encoder_error_t filter_begin(void *data, encoder_flow_t *flow)
+{
+	PipeFilterCtxT *ctx = data;
+	taskIdT *task = encoder_flow_task(flow);
+	json_object *spec;
+	encoder_error_t rc;
+
+	if (ctx->args == NULL || !json_object_object_get_ex(spawnTaskArgs(task), ctx->args, &spec))
+		return ENCODER_NO_ERROR;
+
+	rc = text_filter_add(ctx->filter, spec);
+	if (rc == ENCODER_NO_ERROR && line_filter_compile(ctx->filter) < 0)
+		rc = ENCODER_ERROR_OUT_OF_MEMORY;
+	if (rc != ENCODER_NO_ERROR)
+		vfmtcl((void *)spawnTaskLog, task, AFB_SYSLOG_LEVEL_ERROR, "invalid filter in argument %s", ctx->args);
+	return rc;
+}
+
+static void filter_record(void *data, encoder_flow_t *flow, const char *record, size_t length, bool error)
+{
+	PipeFilterCtxT *ctx = data;
+	if (line_filter_match(ctx->filter, record, length))
+		encoder_flow_record(flow, record, length, error);
+}
+
+static void filter_destroy(void *data)
+{
+	PipeFilterCtxT *ctx = data;
+	line_filter_free(ctx->filter);
+	free(ctx);
+}
+
+/***************************************************************************************/
+/* stage 'tee': appends records to files and gives them unchanged */
+
+/** context of the stage 'tee' */
+typedef struct {
+	/** file names of stdout and stderr, NULL for the ones of the server */
+	const char *sout, *serr;
+	/** the opened files */
+	FILE *fout, *ferr;
+} PipeTeeCtxT;
+
+static encoder_error_t tee_options(json_object *options, PipeTeeCtxT *ctx)
+{
+	if (options != NULL && rp_jsonc_unpack(options, "{s?s s?s}", "stdout", &ctx->sout, "stderr", &ctx->serr))
+		return ENCODER_ERROR_INVALID_OPTIONS;
+	return ENCODER_NO_ERROR;
+}
+
+static encoder_error_t tee_check(json_object *options)
+{
+	PipeTeeCtxT ctx = { .sout = NULL };
+	return tee_options(options, &ctx);
+}
+
+static encoder_error_t tee_create(const encoder_stage_t *stage, json_object *options, void **data)
+{
+	PipeTeeCtxT *ctx;
+	encoder_error_t rc;
+
+	ctx = calloc(1, sizeof *ctx);
+	if (ctx == NULL)
+		return ENCODER_ERROR_OUT_OF_MEMORY;
+	rc = tee_options(options, ctx);
+	if (rc != ENCODER_NO_ERROR)
+		free(ctx);
+	else
+		*data = ctx;
+	return rc;
+}
+
+static encoder_error_t tee_begin(void *data, encoder_flow_t *flow)
+{
+	PipeTeeCtxT *ctx = data;
+	taskIdT *task = encoder_flow_task(flow);
+
+	ctx->fout = ctx->sout == NULL ? stdout : openexp(ctx->sout, "a", task);
+	if (ctx->fout != NULL) {
+		ctx->ferr = ctx->serr == NULL ? stderr : openexp(ctx->serr, "a", task);
+		if (ctx->ferr != NULL)
+			return ENCODER_NO_ERROR;
+		if (ctx->sout != NULL)
+			fclose(ctx->fout);
+		ctx->fout = NULL;
+	}
+	return ENCODER_ERROR_SYSTEM;
+}
+
+static void tee_record(void *data, encoder_flow_t *flow, const char *record, size_t length, bool error)
+{
+	PipeTeeCtxT *ctx = data;
+	FILE *file = error ? ctx->ferr : ctx->fout;
+	struct iovec iov[2] = { { .iov_base = (void *)record, .iov_len = length },
+				{ .iov_base = (void *)flow->ctx->sep, .iov_len = flow->ctx->seplen } };
+
+	// the record and its separator are appended at once, as the members of 'log'
+	fflush(file);
+	flock(fileno(file), LOCK_EX);
+	log_writev(fileno(file), iov, 2);
+	flock(fileno(file), LOCK_UN);
+	encoder_flow_record(flow, record, length, error);
+}
+
+static void tee_end(void *data, encoder_flow_t *flow)
+{
+	PipeTeeCtxT *ctx = data;
+	if (ctx->ferr != NULL && ctx->ferr != stderr)
+		fclose(ctx->ferr);
+	if (ctx->fout != NULL && ctx->fout != stdout)
+		fclose(ctx->fout);
+	ctx->fout = ctx->ferr = NULL;
+}
+
+/***************************************************************************************/
+/* stage 'json': parses records of stdout as JSON documents */
+
+/** context of the stage 'json' */
+typedef struct {
+	/** policy of stderr texts */
+	Utf8PolicyT utf8;
+	/** the parser */
+	json_tokener *tokener;
+} PipeJsonCtxT;
+
+static encoder_error_t json_stage_check(json_object *options)
+{
+	Utf8PolicyT policy;
+	return text_stage_options(options, &policy);
+}
+
+static encoder_error_t json_stage_create(const encoder_stage_t *stage, json_object *options, void **data)
+{
+	PipeJsonCtxT *ctx;
+	encoder_error_t rc;
+
+	ctx = calloc(1, sizeof *ctx);
+	if (ctx == NULL)
+		return ENCODER_ERROR_OUT_OF_MEMORY;
+	rc = text_stage_options(options, &ctx->utf8);
+	if (rc == ENCODER_NO_ERROR) {
+		ctx->tokener = json_tokener_new();
+		if (ctx->tokener != NULL) {
+			*data = ctx;
+			return ENCODER_NO_ERROR;
+		}
+		rc = ENCODER_ERROR_OUT_OF_MEMORY;
+	}
+	free(ctx);
+	return rc;
+}
+
+static void json_stage_record(void *data, encoder_flow_t *flow, const char *record, size_t length, bool error)
+{
+	PipeJsonCtxT *ctx = data;
+	json_object *object, *event;
+
+	if (error) {
+		rp_jsonc_pack(&event, "{so}", "stderr", utf8_string(ctx->utf8, record, length));
+		encoder_flow_event(flow, event);
+		return;
+	}
+	if (length == 0)
+		return;
+
+	// the record is parsed in place
+	json_tokener_reset(ctx->tokener);
+	object = json_tokener_parse_ex(ctx->tokener, record, (int)length);
+	if (object == NULL && json_tokener_get_error(ctx->tokener) == json_tokener_continue)
+		object = json_tokener_parse_ex(ctx->tokener, "", 1); // terminates numbers
+	if (object != NULL)
+		rp_jsonc_pack(&event, "{so}", "stdout", object);
+	else
+		rp_jsonc_pack(&event, "{ss}", "json-error",
+			      json_tokener_error_desc(json_tokener_get_error(ctx->tokener)));
+	encoder_flow_event(flow, event);
+}
+
+static void json_stage_destroy(void *data)
+{
+	PipeJsonCtxT *ctx = data;
+	json_tokener_free(ctx->tokener);
+	free(ctx);
+}
+
+/***************************************************************************************/
+/* stage 'batch': groups events */
+
+/** context of the stage 'batch' */
+typedef struct {
+	/** count of events of a batch */
+	int count;
+	/** the pending batch, NULL if none */
+	json_object *array;
+} PipeBatchCtxT;
+
+static encoder_error_t batch_options(json_object *options, int *count)
+{
+	*count = PIPELINE_BATCH_COUNT;
+	if (options != NULL && (rp_jsonc_unpack(options, "{s?i}", "count", count) || *count < 1))
+		return ENCODER_ERROR_INVALID_OPTIONS;
+	return ENCODER_NO_ERROR;
+}
+
+static encoder_error_t batch_check(json_object *options)
+{
+	int count;
+	return batch_options(options, &count);
+}
+
+static encoder_error_t batch_create(const encoder_stage_t *stage, json_object *options, void **data)
+{
+	PipeBatchCtxT *ctx;
+	encoder_error_t rc;
+
+	ctx = calloc(1, sizeof *ctx);
+	if (ctx == NULL)
+		return ENCODER_ERROR_OUT_OF_MEMORY;
+	rc = batch_options(options, &ctx->count);
+	if (rc != ENCODER_NO_ERROR)
+		free(ctx);
+	else
+		*data = ctx;
+	return rc;
+}
+
+/** give the pending batch */
+static void batch_flush(PipeBatchCtxT *ctx, encoder_flow_t *flow)
+{
+	json_object *event;
+
+	if (ctx->array != NULL) {
+		rp_jsonc_pack(&event, "{so}", "batch", ctx->array);
+		ctx->array = NULL;
+		encoder_flow_event(flow, event);
+	}
+}
+
+static void batch_event(void *data, encoder_flow_t *flow, json_object *event)
+{
+	PipeBatchCtxT *ctx = data;
+
+	if (ctx->array == NULL) {
+		ctx->array = json_object_new_array();
+		if (ctx->array == NULL) {
+			json_object_put(event);
+			vfmtcl((void *)spawnTaskLog, encoder_flow_task(flow), AFB_SYSLOG_LEVEL_ERROR, "out of memory");
+			return;
+		}
+	}
+	json_object_array_add(ctx->array, event);
+	if (json_object_array_length(ctx->array) == (size_t)ctx->count)
+		batch_flush(ctx, flow);
+}
+
+static void batch_end(void *data, encoder_flow_t *flow)
+{
+	batch_flush(data, flow);
+}
+
+static void batch_destroy(void *data)
+{
+	PipeBatchCtxT *ctx = data;
+	json_object_put(ctx->array);
+	free(ctx);
+}
+
+/***************************************************************************************/
+
+// Builtin stages. Note that 'lines' and 'text' are the implicit stages of pipeline_adapt
+static const encoder_stage_t pipelineBuiltin[] = {
+	{ .uid = "lines",
+	  .info = "records of lines or of the framing 'record'",
+	  .input = ENCODER_ITEM_BYTES,
+	  .output = ENCODER_ITEM_RECORDS,
+	  .check = lines_check,
+	  .create = lines_create,
+	  .begin = lines_begin,
+	  .consume = lines_consume,
+	  .end = lines_end,
+	  .destroy = lines_destroy },
+	{ .uid = "text",
+	  .info = "one event per record",
+	  .input = ENCODER_ITEM_RECORDS,
+	  .output = ENCODER_ITEM_EVENTS,
+	  .check = text_stage_check,
+	  .create = text_stage_create,
+	  .record = text_stage_record,
+	  .destroy = free },
+	{ .uid = "filter",
+	  .info = "records matching patterns",
+	  .input = ENCODER_ITEM_RECORDS,
+	  .output = ENCODER_ITEM_RECORDS,
+	  .check = filter_check,
+	  .create = filter_create,
+	  .begin = filter_begin,
+	  .record = filter_record,
+	  .destroy = filter_destroy },
+	{ .uid = "tee",
+	  .info = "records appended to files",
+	  .input = ENCODER_ITEM_RECORDS,
+	  .output = ENCODER_ITEM_RECORDS,
+	  .check = tee_check,
+	  .create = tee_create,
+	  .begin = tee_begin,
+	  .record = tee_record,
+	  .end = tee_end,
+	  .destroy = free },
+	{ .uid = "json",
+	  .info = "one event per JSON record",
+	  .input = ENCODER_ITEM_RECORDS,
+	  .output = ENCODER_ITEM_EVENTS,
+	  .check = json_stage_check,
+	  .create = json_stage_create,
+	  .record = json_stage_record,
+	  .destroy = json_stage_destroy },
+	{ .uid = "batch",
+	  .info = "one event per 'count' events",
+	  .input = ENCODER_ITEM_EVENTS,
+	  .output = ENCODER_ITEM_EVENTS,
+	  .check = batch_check,
+	  .create = batch_create,
+	  .event = batch_event,
+	  .end = batch_end,
+	  .destroy = batch_destroy },
+	{ .uid = NULL } // must be null terminated
+};
+
+/***************************************************************************************/
+
+encoder_error_t encoder_stage_factory_add(const char *uid, const encoder_stage_t *stages)
+{
+	stage_factory_t *factory, **ptrfac;
+
+	factory = calloc(1, sizeof *factory);
+	if (factory == NULL)
+		return ENCODER_ERROR_OUT_OF_MEMORY;
+	factory->stages = stages;
+	factory->uid = uid;
+
+	// link it at latest position
+	ptrfac = &first_stage_factory;
+	while (*ptrfac != NULL)
+		ptrfac = &(*ptrfac)->next;
+	*ptrfac = factory;
+	return ENCODER_NO_ERROR;
+}
+
+/** search the stage of the plugin, builtin stages when pluginuid is NULL */
+static encoder_error_t pipeline_stage_search(const char *pluginuid, const char *stageuid,
+					     const encoder_stage_t **stage)
+{
+	const stage_factory_t *factory;
+	const encoder_stage_t *itstage = pipelineBuiltin;
+
+	if (pluginuid != NULL) {
+		factory = first_stage_factory;
+		while (factory && (factory->uid == NULL || strcasecmp(factory->uid, pluginuid)))
+			factory = factory->next;
+		if (factory == NULL)
+			return ENCODER_ERROR_PLUGIN_NOT_FOUND;
+		itstage = factory->stages;
+	}
+	while (itstage->uid != NULL && strcasecmp(itstage->uid, stageuid))
+		itstage++;
+	if (itstage->uid == NULL)
+		return ENCODER_ERROR_ENCODER_NOT_FOUND;
+
+	// the stage must process its input and can't give bytes
+	if (itstage->output == ENCODER_ITEM_BYTES
+	    || (itstage->input == ENCODER_ITEM_BYTES && itstage->consume == NULL)
+	    || (itstage->input == ENCODER_ITEM_RECORDS && itstage->record == NULL)
+	    || (itstage->input == ENCODER_ITEM_EVENTS && itstage->event == NULL))
+		return ENCODER_ERROR_INVALID_ENCODER;
+	*stage = itstage;
+	return ENCODER_NO_ERROR;
+}
+
+/** append a stage to the chain */
+static encoder_error_t pipeline_append(PipeSpecT *spec, const encoder_stage_t *stage, json_object *options)
+{
+	if (spec->count == MAX_PIPELINE_STAGES)
+		return ENCODER_ERROR_INVALID_SPECIFIER;
+	spec->stages[spec->count].stage = stage;
+	spec->stages[spec->count++].options = options;
+	return ENCODER_NO_ERROR;
+}
+
+/** append the implicit stages giving the items of kind input: 'lines' for records, 'text' for events */
+static encoder_error_t pipeline_adapt(PipeSpecT *spec, encoder_item_t input)
+{
+	encoder_item_t output = spec->count == 0 ? ENCODER_ITEM_BYTES : spec->stages[spec->count - 1].stage->output;
+	encoder_error_t rc = ENCODER_NO_ERROR;
+
+	if (output == ENCODER_ITEM_BYTES && input != ENCODER_ITEM_BYTES) {
+		rc = pipeline_append(spec, &pipelineBuiltin[0], NULL);
+		output = ENCODER_ITEM_RECORDS;
+	}
+	if (rc == ENCODER_NO_ERROR && output == ENCODER_ITEM_RECORDS && input == ENCODER_ITEM_EVENTS) {
+		rc = pipeline_append(spec, &pipelineBuiltin[1], NULL);
+		output = ENCODER_ITEM_EVENTS;
+	}
+	if (rc == ENCODER_NO_ERROR && output != input)
+		rc = ENCODER_ERROR_INVALID_SPECIFIER;
+	return rc;
+}
+
+/** build the chain of stages of the options */
+static encoder_error_t pipeline_spec(json_object *options, PipeSpecT *spec)
+{
+	const char *pluginuid, *stageuid;
+	const encoder_stage_t *stage;
+	json_object *item, *opts;
+	encoder_error_t rc;
+	size_t idx, count;
+
+	if (!json_object_is_type(options, json_type_array))
+		return ENCODER_ERROR_INVALID_OPTIONS;
+
+	spec->count = 0;
+	count = json_object_array_length(options);
+	for (idx = 0; idx < count; idx++) {
+		// a stage is a name or an object {"plugin", "stage", "opts"}
+		item = json_object_array_get_idx(options, idx);
+		pluginuid = NULL;
+		opts = NULL;
+		if (json_object_is_type(item, json_type_string))
+			stageuid = json_object_get_string(item);
+		else if (rp_jsonc_unpack(item, "{s?s,ss,s?o !}", "plugin", &pluginuid, "stage", &stageuid, "opts", &opts))
+			return ENCODER_ERROR_INVALID_SPECIFIER;
+
+		rc = pipeline_stage_search(pluginuid, stageuid, &stage);
+		if (rc == ENCODER_NO_ERROR)
+			rc = pipeline_adapt(spec, stage->input);
+		if (rc == ENCODER_NO_ERROR)
+			rc = pipeline_append(spec, stage, opts);
+		if (rc != ENCODER_NO_ERROR)
+			return rc;
+	}
+	return pipeline_adapt(spec, ENCODER_ITEM_EVENTS);
+}
+
+/** check options */
+encoder_error_t pipeline_check(json_object *options)
+{
+	PipeSpecT spec;
+	encoder_error_t rc;
+	int idx;
+
+	rc = pipeline_spec(options, &spec);
+	for (idx = 0; rc == ENCODER_NO_ERROR && idx < spec.count; idx++)
+		if (spec.stages[idx].stage->check != NULL)
+			rc = spec.stages[idx].stage->check(spec.stages[idx].options);
+	return rc;
+}
+
+/** instanciate data */
+encoder_error_t pipeline_instanciate(const encoder_generator_t *generator, json_object *options, void **data)
+{
+	const PipeStageT *ps;
+	PipeCtxT *ctx;
+	encoder_error_t rc;
+	int idx;
+
+	/* allocate */
+	ctx = calloc(1, sizeof *ctx);
+	if (ctx == NULL)
+		return ENCODER_ERROR_OUT_OF_MEMORY;
+
+	/* init, records being lines unless the stage 'lines' frames them */
+	ctx->sep = "\n";
+	ctx->seplen = 1;
+	rc = pipeline_spec(options, &ctx->spec);
+	for (idx = 0; rc == ENCODER_NO_ERROR && idx < ctx->spec.count; idx++) {
+		ps = &ctx->spec.stages[idx];
+		if (ps->stage->create != NULL)
+			rc = ps->stage->create(ps->stage, ps->options, &ctx->data[idx]);
+	}
+	if (rc == ENCODER_NO_ERROR) {
+		*data = ctx;
+		return ENCODER_NO_ERROR;
+	}
+
+	// only the created stages are destroyed
+	ctx->spec.count = idx - 1;
+	pipeline_destroy(ctx);
+	return rc;
+}
+
+/** begin processing */
+encoder_error_t pipeline_begin(void *data, taskIdT *task)
+{
+	encoder_flow_t flow = { .ctx = data, .task = task };
+	const encoder_stage_t *stage;
+	encoder_error_t rc = ENCODER_NO_ERROR;
+
+	for (flow.index = 0; rc == ENCODER_NO_ERROR && flow.index < flow.ctx->spec.count; flow.index++) {
+		stage = flow.ctx->spec.stages[flow.index].stage;
+		if (stage->begin != NULL)
+			rc = stage->begin(flow.ctx->data[flow.index], &flow);
+	}
+	return rc;
+}
+
+/** process input read by the core */
+encoder_error_t pipeline_consume(void *data, taskIdT *task, const struct iovec *iov, int iovcnt,
+				 encoder_stream_t stream)
+{
+	encoder_flow_t flow = { .ctx = data, .task = task, .index = 0 };
+	return flow.ctx->spec.stages[0].stage->consume(flow.ctx->data[0], &flow, iov, iovcnt, stream);
+}
+
+/** terminate processing, each stage flushing its items to the next one before it ends */
+encoder_error_t pipeline_end(void *data, taskIdT *task)
+{
+	encoder_flow_t flow = { .ctx = data, .task = task };
+	const encoder_stage_t *stage;
+
+	for (flow.index = 0; flow.index < flow.ctx->spec.count; flow.index++) {
+		stage = flow.ctx->spec.stages[flow.index].stage;
+		if (stage->end != NULL)
+			stage->end(flow.ctx->data[flow.index], &flow);
+	}
+	return ENCODER_NO_ERROR;
+}
+
+/** destroy the encoder */
+void pipeline_destroy(void *data)
+{
+	PipeCtxT *ctx = data;
+	const encoder_stage_t *stage;
+	int idx;
+
+	for (idx = 0; idx < ctx->spec.count; idx++) {
+		stage = ctx->spec.stages[idx].stage;
+		if (stage->destroy != NULL)
+			stage->destroy(ctx->data[idx]);
+	}
+	free(ctx);
+}
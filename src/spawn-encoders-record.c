@@ -0,0 +1,416 @@
+/*
+ * Copyright (C) 2015-2021 IoT.bzh Company
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ *
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+*/
+
+
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include <rp-utils/rp-jsonc.h>
+
+#include "spawn-defaults.h"
+#include "spawn-binding.h"
+#include "spawn-encoders-internal.h"
+#include "spawn-subtask.h"
+
+#include "lib/vfmt.h"
+#include "lib/stream-buf.h"
+#include "lib/line-buf.h"
+#include "lib/base64.h"
+#include "lib/cbor.h"
+
+/***************************************************************************************/
+
+/** maximum count of digits of the length of netstrings */
+#define NETSTRING_DIGITS 10
+
+/** representation of the payloads of records */
+typedef enum {
+	/** decoded JSON (CBOR items, or parsed JSON text for other framings) */
+	record_json,
+	/** afb data of type bytearray */
+	record_bytes,
+	/** base64 string */
+	record_base64,
+	/** raw string */
+	record_text
+} RecordEncodingT;
+
+/** options of record encoders */
+typedef struct {
+	/** framing of the records */
+	RecordFramingT framing;
+	/** representation of the payloads */
+	RecordEncodingT encoding;
+	/** maximum size of payloads */
+	int maxsize;
+	/** maximum length of stderr lines */
+	int maxlen;
+} RecordOptsT;
+
+/** context of record encoders */
+typedef struct {
+	/** options */
+	RecordOptsT opts;
+	/** count of bytes of an oversized record remaining to skip */
+	size_t skip;
+	/** true when framing was lost, the remaining output is dropped */
+	bool broken;
+	/** parser of JSON payloads */
+	json_tokener *tokener;
+	/** record buffer */
+	stream_buf_t out;
+	/** line buffer of stderr */
+	stream_buf_t err;
+} RecordCtxT;
+
+/** pair of encoder context and task for callbacks */
+typedef struct {
+	/** the encoder context */
+	RecordCtxT *ctx;
+	/** the task */
+	taskIdT *task;
+} RecordTaskCtxT;
+
+/***************************************************************************************/
+
+static encoder_error_t record_options(json_object *options, RecordFramingT framing, RecordOptsT *opts)
+{
+	int err;
+	const char *encoding = NULL;
+
+	opts->framing = framing;
+	opts->encoding = framing == record_cbor ? record_json : record_bytes;
+	opts->maxsize = MAX_JSON_DOC_SIZE;
+	opts->maxlen = MAX_DOC_LINE_SIZE;
+	if (options == NULL)
+		return ENCODER_NO_ERROR;
+
+	err = rp_jsonc_unpack(options, "{s?s s?i s?i}", "encoding", &encoding, "maxsize", &opts->maxsize, "maxlen",
+			      &opts->maxlen);
+	if (err || opts->maxsize <= 0 || opts->maxlen <= 0)
+		return ENCODER_ERROR_INVALID_OPTIONS;
+
+	if (encoding == NULL)
+		;
+	else if (!strcasecmp(encoding, "json"))
+		opts->encoding = record_json;
+	else if (!strcasecmp(encoding, "bytes"))
+		opts->encoding = record_bytes;
+	else if (!strcasecmp(encoding, "base64"))
+		opts->encoding = record_base64;
+	else if (!strcasecmp(encoding, "text") && framing != record_cbor)
+		opts->encoding = record_text;
+	else
+		return ENCODER_ERROR_INVALID_OPTIONS;
+	return ENCODER_NO_ERROR;
+}
+
+/** check options of the netstring framing */
+encoder_error_t netstring_check(json_object *options)
+{
+	RecordOptsT opts;
+	return record_options(options, record_netstring, &opts);
+}
+
+/** check options of the u32 framing */
+encoder_error_t u32_check(json_object *options)
+{
+	RecordOptsT opts;
+	return record_options(options, record_u32, &opts);
+}
+
+/** check options of the CBOR framing */
+encoder_error_t cbor_check(json_object *options)
+{
+	RecordOptsT opts;
+	return record_options(options, record_cbor, &opts);
+}
+
+/** instanciate data */
+encoder_error_t record_instanciate(const encoder_generator_t *generator, json_object *options, void **data)
+{
+	RecordCtxT *ctx;
+	encoder_error_t rc;
+	size_t capacity;
+
+	/* allocate */
+	ctx = calloc(1, sizeof *ctx);
+	if (ctx == NULL)
+		return ENCODER_ERROR_OUT_OF_MEMORY;
+
+	/* init */
+	rc = record_options(options, (RecordFramingT)(intptr_t)generator->tuning, &ctx->opts);
+	if (rc != ENCODER_NO_ERROR) {
+		free(ctx);
+		return rc;
+	}
+
+	// the buffer holds any accepted record with its framing
+	capacity = (size_t)ctx->opts.maxsize;
+	if (ctx->opts.framing == record_u32)
+		capacity += 4;
+	else if (ctx->opts.framing == record_netstring)
+		capacity += NETSTRING_DIGITS + 2;
+
+	rc = ENCODER_ERROR_OUT_OF_MEMORY;
+	if (ctx->opts.encoding == record_json && ctx->opts.framing != record_cbor) {
+		ctx->tokener = json_tokener_new();
+		if (ctx->tokener == NULL)
+			goto error;
+	}
+	if (stream_buf_init(&ctx->out, capacity) != NULL) {
+		if (stream_buf_init(&ctx->err, (size_t)ctx->opts.maxlen) != NULL) {
+			*data = ctx;
+			return ENCODER_NO_ERROR;
+		}
+	}
+error:
+	record_destroy(ctx);
+	return rc;
+}
+
+/***************************************************************************************/
+
+/** push an event with the object of name and its optional afb data */
+static void record_emit(RecordTaskCtxT *tc, const char *name, json_object *object, afb_data_t bytes)
+{
+	json_object *event = json_object_new_object();
+	if (event != NULL) {
+		if (json_object_object_add(event, name, object) == 0) {
+			spawnTaskPushEventData(tc->task, event, bytes != NULL, &bytes);
+			return;
+		}
+		json_object_put(event);
+	}
+	json_object_put(object);
+	if (bytes != NULL)
+		afb_data_unref(bytes);
+	vfmtcl((void *)spawnTaskLog, tc->task, AFB_SYSLOG_LEVEL_ERROR, "out of memory");
+}
+
+static void record_error(RecordTaskCtxT *tc, const char *message)
+{
+	record_emit(tc, "record-error", json_object_new_string(message), NULL);
+}
+
+/** parse a JSON payload */
+static json_object *record_parse(RecordCtxT *ctx, const char *data, size_t size)
+{
+	json_tokener *tokener = ctx->tokener;
+	json_object *object;
+
+	json_tokener_reset(tokener);
+	object = json_tokener_parse_ex(tokener, data, (int)size);
+	if (object == NULL && json_tokener_get_error(tokener) == json_tokener_continue)
+		object = json_tokener_parse_ex(tokener, "", 1); // terminates numbers
+	return object;
+}
+
+/** send the payload of a record */
+static void record_payload(RecordTaskCtxT *tc, const char *data, size_t size)
+{
+	RecordCtxT *ctx = tc->ctx;
+	afb_data_t bytes = NULL;
+	json_object *value;
+	char *text;
+
+	switch (ctx->opts.encoding) {
+	case record_json:
+		if (ctx->opts.framing == record_cbor) {
+			value = cbor_to_json((const unsigned char *)data, size);
+			break;
+		}
+		value = record_parse(ctx, data, size);
+		if (value == NULL && json_tokener_get_error(ctx->tokener) != json_tokener_success) {
+			record_error(tc, json_tokener_error_desc(json_tokener_get_error(ctx->tokener)));
+			return;
+		}
+		break;
+	case record_bytes:
+		// the payload is forwarded untouched, the event tells its size
+		if (afb_create_data_copy(&bytes, AFB_PREDEFINED_TYPE_BYTEARRAY, data, size) < 0) {
+			vfmtcl((void *)spawnTaskLog, tc->task, AFB_SYSLOG_LEVEL_ERROR, "out of memory");
+			return;
+		}
+		value = json_object_new_int64((int64_t)size);
+		break;
+	case record_base64:
+		text = malloc(base64_encoded_length(size) + 1);
+		if (text == NULL) {
+			vfmtcl((void *)spawnTaskLog, tc->task, AFB_SYSLOG_LEVEL_ERROR, "out of memory");
+			return;
+		}
+		value = json_object_new_string_len(text, (int)base64_encode(data, size, text));
+		free(text);
+		break;
+	default:
+		value = json_object_new_string_len(data, (int)size);
+		break;
+	}
+	record_emit(tc, "stdout", value, bytes);
+}
+
+/** get in hsize and size the framing of the record at data
+ * returns 1 when the header is complete, 0 when more data are needed or -1 when invalid */
+static int record_header(RecordCtxT *ctx, const unsigned char *data, size_t length, size_t *hsize, size_t *size)
+{
+	size_t idx, value;
+	int rc;
+
+	switch (ctx->opts.framing) {
+	case record_u32:
+		if (length < 4)
+			return 0;
+		*hsize = 4;
+		*size = (size_t)data[0] | ((size_t)data[1] << 8) | ((size_t)data[2] << 16) | ((size_t)data[3] << 24);
+		return 1;
+	case record_netstring:
+		// <decimal length>:<payload>, the trailing comma is counted in the size
+		for (idx = 0, value = 0; idx < length && data[idx] != ':'; idx++) {
+			if (idx == NETSTRING_DIGITS || data[idx] < '0' || data[idx] > '9' || (idx == 1 && data[0] == '0'))
+				return -1;
+			value = 10 * value + (size_t)(data[idx] - '0');
+		}
+		if (idx == length)
+			return 0;
+		if (idx == 0)
+			return -1;
+		*hsize = idx + 1;
+		*size = value + 1;
+		return 1;
+	default:
+		rc = cbor_item_size(data, length, size);
+		*hsize = 0;
+		return rc;
+	}
+}
+
+/** process the records of the buffer */
+static void record_process(RecordTaskCtxT *tc)
+{
+	RecordCtxT *ctx = tc->ctx;
+	stream_buf_t *sbuf = &ctx->out;
+	const unsigned char *data = (const unsigned char *)stream_buf_data(sbuf);
+	size_t length = stream_buf_length(sbuf), pos = 0, hsize, size, payload;
+	int rc;
+
+	while (pos < length && !ctx->broken) {
+		if (ctx->skip > 0) {
+			size = ctx->skip < length - pos ? ctx->skip : length - pos;
+			ctx->skip -= size;
+			pos += size;
+			continue;
+		}
+		rc = record_header(ctx, &data[pos], length - pos, &hsize, &size);
+		if (rc == 0 && stream_buf_is_full(sbuf) && pos == 0) {
+			// only a CBOR item has no header telling its size
+			record_error(tc, "record too large");
+			ctx->broken = true;
+		} else if (rc < 0) {
+			record_error(tc, "invalid record framing");
+			ctx->broken = true;
+		} else if (rc == 0)
+			break;
+		else {
+			payload = ctx->opts.framing == record_netstring ? size - 1 : size;
+			if (payload > (size_t)ctx->opts.maxsize) {
+				record_error(tc, "record too large");
+				ctx->skip = hsize + size;
+				continue;
+			}
+			if (hsize + size > length - pos)
+				break;
+			if (ctx->opts.framing == record_netstring && data[pos + hsize + payload] != ',') {
+				record_error(tc, "invalid record framing");
+				ctx->broken = true;
+				break;
+			}
+			record_payload(tc, (const char *)&data[pos + hsize], payload);
+			pos += hsize + size;
+		}
+	}
+	stream_buf_consume(sbuf, ctx->broken ? length : pos);
+}
+
+static void record_err_cb(void *closure, const char *line, size_t length)
+{
+	record_emit(closure, "stderr", json_object_new_string_len(line, (int)length), NULL);
+}
+
+/** add the bytes to the buffer of records, the buffer holding the largest record */
+static void record_write(RecordTaskCtxT *tc, const char *data, size_t length)
+{
+	size_t count;
+
+	// once broken, the framing is lost and the output is dropped
+	while (length > 0 && !tc->ctx->broken) {
+		count = stream_buf_write(&tc->ctx->out, data, length);
+		if (count == 0)
+			return;
+		data += count;
+		length -= count;
+		record_process(tc);
+	}
+}
+
+/** process input read by the core */
+encoder_error_t record_consume(void *data, taskIdT *task, const struct iovec *iov, int iovcnt, encoder_stream_t stream)
+{
+	RecordTaskCtxT tc = { .ctx = data, .task = task };
+	int idx;
+
+	for (idx = 0; idx < iovcnt; idx++) {
+		if (stream == ENCODER_STREAM_STDERR)
+			line_buf_write(&tc.ctx->err, iov[idx].iov_base, iov[idx].iov_len, record_err_cb, &tc);
+		else
+			record_write(&tc, iov[idx].iov_base, iov[idx].iov_len);
+	}
+	return ENCODER_NO_ERROR;
+}
+
+/** terminate processing */
+encoder_error_t record_end(void *data, taskIdT *task)
+{
+	RecordTaskCtxT tc = { .ctx = data, .task = task };
+	line_buf_end(&tc.ctx->err, record_err_cb, &tc);
+	if (!tc.ctx->broken && (tc.ctx->skip > 0 || stream_buf_length(&tc.ctx->out) > 0))
+		record_error(&tc, "truncated record");
+	stream_buf_consume(&tc.ctx->out, stream_buf_length(&tc.ctx->out));
+	return ENCODER_NO_ERROR;
+}
+
+/** destroy the encoder */
+void record_destroy(void *data)
+{
+	RecordCtxT *ctx = data;
+
+	if (ctx->tokener != NULL)
+		json_tokener_free(ctx->tokener);
+	stream_buf_clear(&ctx->out);
+	stream_buf_clear(&ctx->err);
+	free(ctx);
+}
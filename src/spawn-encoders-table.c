@@ -0,0 +1,679 @@
+/*
+ * Copyright (C) 2015-2021 IoT.bzh Company
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ *
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+*/
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <rp-utils/rp-jsonc.h>
+
+#include "spawn-defaults.h"
+#include "spawn-binding.h"
+#include "spawn-encoders-internal.h"
+#include "spawn-subtask.h"
+
+#include "lib/vfmt.h"
+#include "lib/stream-buf.h"
+#include "lib/line-buf.h"
+
+/***************************************************************************************/
+
+/** interpretation of the first line */
+typedef enum {
+	/** header if none of its fields is empty or typed */
+	header_auto,
+	/** the first line is a header */
+	header_yes,
+	/** no header */
+	header_no
+} TableHeaderT;
+
+/** type of the values of a column, decided at its first non empty value */
+typedef enum {
+	type_unknown,
+	type_string,
+	type_integer,
+	type_double,
+	type_boolean
+} TableTypeT;
+
+/** options of table encoders */
+typedef struct {
+	/** maximum length of lines */
+	int maxlen;
+	/** separator of fields (csv and tsv) */
+	char separator;
+	/** header of the table */
+	TableHeaderT header;
+	/** explicit names of the columns */
+	json_object *columns;
+	/** detect types of values */
+	bool typed;
+	/** count of records per event */
+	int batch;
+	/** emit arrays per column instead of records */
+	bool columnar;
+} TableOptsT;
+
+/** a column */
+typedef struct {
+	/** name of the column */
+	char *name;
+	/** type of its values */
+	TableTypeT type;
+	/** values of the pending columnar batch */
+	json_object *values;
+} TableColT;
+
+/** a field of a line, nul terminated in the scratch buffer */
+typedef struct {
+	char *value;
+	size_t length;
+} TableFieldT;
+
+/** context of table encoders */
+typedef struct {
+	/** format of the input */
+	TableFormatT format;
+	/** options */
+	TableOptsT opts;
+	/** true when first line was processed */
+	bool started;
+	/** count of columns */
+	int ncols;
+	/** allocated count of columns */
+	int acols;
+	/** the columns */
+	TableColT *cols;
+	/** count of records pending */
+	int count;
+	/** pending records when not columnar */
+	json_object *rows;
+	/** work buffer for splitting lines */
+	char *scratch;
+	/** fields of the line being processed */
+	TableFieldT fields[MAX_TABLE_FIELDS];
+	/** line buffers */
+	stream_buf_t out, err;
+} TableCtxT;
+
+/** pair of encoder context and task for callbacks */
+typedef struct {
+	/** the encoder context */
+	TableCtxT *ctx;
+	/** the task */
+	taskIdT *task;
+} TableTaskCtxT;
+
+/***************************************************************************************/
+
+static encoder_error_t table_options(json_object *options, TableOptsT *opts)
+{
+	int err, idx, len;
+	json_object *header = NULL;
+	const char *separator = NULL;
+
+	opts->maxlen = MAX_DOC_LINE_SIZE;
+	opts->separator = 0;
+	opts->header = header_auto;
+	opts->columns = NULL;
+	opts->typed = true;
+	opts->batch = 1;
+	opts->columnar = false;
+	if (options == NULL)
+		return ENCODER_NO_ERROR;
+
+	err = rp_jsonc_unpack(options, "{s?i s?s s?o s?o s?b s?i s?b}", "maxlen", &opts->maxlen, "separator",
+			      &separator, "header", &header, "columns", &opts->columns, "typed", &opts->typed, "batch",
+			      &opts->batch, "columnar", &opts->columnar);
+	if (err || opts->maxlen <= 0 || opts->batch <= 0)
+		return ENCODER_ERROR_INVALID_OPTIONS;
+
+	if (separator != NULL) {
+		if (separator[0] == 0 || separator[1] != 0 || separator[0] == '"')
+			return ENCODER_ERROR_INVALID_OPTIONS;
+		opts->separator = separator[0];
+	}
+
+	if (opts->columns != NULL) {
+		if (!json_object_is_type(opts->columns, json_type_array))
+			return ENCODER_ERROR_INVALID_OPTIONS;
+		len = (int)json_object_array_length(opts->columns);
+		if (len == 0 || len > MAX_TABLE_FIELDS)
+			return ENCODER_ERROR_INVALID_OPTIONS;
+		for (idx = 0; idx < len; idx++)
+			if (!json_object_is_type(json_object_array_get_idx(opts->columns, idx), json_type_string))
+				return ENCODER_ERROR_INVALID_OPTIONS;
+		opts->header = header_no;
+	}
+
+	if (header != NULL) {
+		if (json_object_is_type(header, json_type_boolean))
+			opts->header = json_object_get_boolean(header) ? header_yes : header_no;
+		else if (json_object_is_type(header, json_type_string) && !strcmp(json_object_get_string(header), "auto"))
+			opts->header = header_auto;
+		else
+			return ENCODER_ERROR_INVALID_OPTIONS;
+	}
+	return ENCODER_NO_ERROR;
+}
+
+/** check options */
+encoder_error_t table_check(json_object *options)
+{
+	TableOptsT opts;
+	return table_options(options, &opts);
+}
+
+/** add a column of name */
+static TableColT *table_add_column(TableCtxT *ctx, const char *name)
+{
+	TableColT *cols, *col;
+	int acols;
+
+	if (ctx->ncols == MAX_TABLE_FIELDS)
+		return NULL;
+
+	if (ctx->ncols == ctx->acols) {
+		acols = ctx->acols ? 2 * ctx->acols : 16;
+		cols = realloc(ctx->cols, (size_t)acols * sizeof *cols);
+		if (cols == NULL)
+			return NULL;
+		ctx->cols = cols;
+		ctx->acols = acols;
+	}
+	col = &ctx->cols[ctx->ncols];
+	col->name = strdup(name);
+	if (col->name == NULL)
+		return NULL;
+	col->type = ctx->opts.typed ? type_unknown : type_string;
+	col->values = NULL;
+	ctx->ncols++;
+	return col;
+}
+
+/** get the column of index, creating anonymous columns as needed */
+static TableColT *table_column_at(TableCtxT *ctx, int index)
+{
+	char name[16];
+
+	while (ctx->ncols <= index) {
+		snprintf(name, sizeof name, "col%d", ctx->ncols + 1);
+		if (table_add_column(ctx, name) == NULL)
+			return NULL;
+	}
+	return &ctx->cols[index];
+}
+
+/** get the column of name, creating it as needed */
+static TableColT *table_column_named(TableCtxT *ctx, const char *name)
+{
+	int idx;
+
+	for (idx = 0; idx < ctx->ncols; idx++)
+		if (!strcmp(ctx->cols[idx].name, name))
+			return &ctx->cols[idx];
+	return table_add_column(ctx, name);
+}
+
+/** instanciate data */
+encoder_error_t table_instanciate(const encoder_generator_t *generator, json_object *options, void **data)
+{
+	TableCtxT *ctx;
+	encoder_error_t rc;
+	int idx, len;
+
+	/* allocate */
+	ctx = calloc(1, sizeof *ctx);
+	if (ctx == NULL)
+		return ENCODER_ERROR_OUT_OF_MEMORY;
+
+	/* init */
+	ctx->format = (TableFormatT)(intptr_t)generator->tuning;
+	rc = table_options(options, &ctx->opts);
+	if (rc != ENCODER_NO_ERROR) {
+		free(ctx);
+		return rc;
+	}
+	if (ctx->opts.separator == 0)
+		ctx->opts.separator = ctx->format == table_tsv ? '\t' : ',';
+
+	rc = ENCODER_ERROR_OUT_OF_MEMORY;
+	len = ctx->opts.columns == NULL ? 0 : (int)json_object_array_length(ctx->opts.columns);
+	for (idx = 0; idx < len; idx++)
+		if (table_add_column(ctx, json_object_get_string(json_object_array_get_idx(ctx->opts.columns, idx)))
+		    == NULL)
+			goto error;
+	ctx->opts.columns = NULL;
+
+	ctx->scratch = malloc((size_t)ctx->opts.maxlen + 1);
+	if (ctx->scratch != NULL) {
+		if (stream_buf_init(&ctx->out, (size_t)ctx->opts.maxlen) != NULL) {
+			if (stream_buf_init(&ctx->err, (size_t)ctx->opts.maxlen) != NULL) {
+				*data = ctx;
+				return ENCODER_NO_ERROR;
+			}
+			stream_buf_clear(&ctx->out);
+		}
+	}
+error:
+	table_destroy(ctx);
+	return rc;
+}
+
+/***************************************************************************************/
+
+/** split separated values, with quoting when quoted is true */
+static int table_split_separated(char *read, char separator, bool quoted, TableFieldT *fields)
+{
+	char *write = read, *start, c;
+	int count = 0;
+
+	for (;;) {
+		start = write;
+		if (quoted && *read == '"') {
+			for (read++; *read;) {
+				if (*read != '"')
+					*write++ = *read++;
+				else if (read[1] == '"') {
+					*write++ = '"';
+					read += 2;
+				} else {
+					read++;
+					break;
+				}
+			}
+		}
+		while (*read && *read != separator)
+			*write++ = *read++;
+		c = *read;
+		*write = 0;
+		fields[count].value = start;
+		fields[count].length = (size_t)(write - start);
+		if (!c || ++count == MAX_TABLE_FIELDS)
+			return count + !c;
+		write++;
+		read++;
+	}
+}
+
+/** split whitespace aligned columns, the last of ncols columns gets the end of the line */
+static int table_split_columns(char *read, int ncols, TableFieldT *fields)
+{
+	char *start, c;
+	int count = 0;
+
+	for (;;) {
+		while (*read == ' ' || *read == '\t')
+			read++;
+		if (!*read || count == MAX_TABLE_FIELDS)
+			return count;
+		start = read;
+		if (count + 1 == ncols) {
+			read += strlen(read);
+			while (read[-1] == ' ' || read[-1] == '\t')
+				read--;
+		} else {
+			while (*read && *read != ' ' && *read != '\t')
+				read++;
+		}
+		c = *read;
+		*read = 0;
+		fields[count].value = start;
+		fields[count++].length = (size_t)(read - start);
+		if (!c)
+			return count;
+		read++;
+	}
+}
+
+/** split logfmt pairs, keys go to even fields and values to odd ones (NULL for bare keys) */
+static int table_split_logfmt(char *read, TableFieldT *fields)
+{
+	char *write, *start, c;
+	int count = 0;
+
+	for (;;) {
+		while (*read == ' ' || *read == '\t')
+			read++;
+		if (!*read || count + 2 > MAX_TABLE_FIELDS)
+			return count;
+
+		/* the key */
+		start = read;
+		while (*read && *read != '=' && *read != ' ' && *read != '\t')
+			read++;
+		fields[count].value = start;
+		fields[count].length = (size_t)(read - start);
+		if (*read != '=') {
+			fields[count + 1].value = NULL;
+			fields[count + 1].length = 0;
+			count += 2;
+			if (*read)
+				*read++ = 0;
+			continue;
+		}
+		*read++ = 0;
+
+		/* the value */
+		start = write = read;
+		if (*read == '"') {
+			for (read++; *read && *read != '"'; read++) {
+				if (*read == '\\' && read[1]) {
+					read++;
+					*write++ = *read == 'n' ? '\n' : *read == 't' ? '\t' : *read;
+				} else
+					*write++ = *read;
+			}
+			if (*read)
+				read++;
+		}
+		while (*read && *read != ' ' && *read != '\t')
+			*write++ = *read++;
+		c = *read;
+		*write = 0;
+		fields[count + 1].value = start;
+		fields[count + 1].length = (size_t)(write - start);
+		count += 2;
+		if (!c)
+			return count;
+		read++;
+	}
+}
+
+/***************************************************************************************/
+
+/** detect the type of a nul terminated value */
+static TableTypeT table_detect(const char *value)
+{
+	char *end;
+
+	if (!strcmp(value, "true") || !strcmp(value, "false"))
+		return type_boolean;
+	if ((*value < '0' || *value > '9') && *value != '-' && *value != '+' && *value != '.')
+		return type_string;
+	errno = 0;
+	strtoll(value, &end, 10);
+	if (!*end && !errno)
+		return type_integer;
+	strtod(value, &end);
+	return *end ? type_string : type_double;
+}
+
+/** create the json value of a field of the column */
+static json_object *table_value(TableColT *col, const TableFieldT *field)
+{
+	char *end;
+	long long ival;
+	double dval;
+
+	if (field->length == 0)
+		return col->type == type_string ? json_object_new_string("") : NULL;
+	if (col->type == type_unknown)
+		col->type = table_detect(field->value);
+
+	switch (col->type) {
+	case type_integer:
+		errno = 0;
+		ival = strtoll(field->value, &end, 10);
+		if (!*end && !errno)
+			return json_object_new_int64((int64_t)ival);
+		/*@fallthrough@*/
+	case type_double:
+		dval = strtod(field->value, &end);
+		if (!*end)
+			return json_object_new_double(dval);
+		break;
+	case type_boolean:
+		if (!strcmp(field->value, "true"))
+			return json_object_new_boolean(1);
+		if (!strcmp(field->value, "false"))
+			return json_object_new_boolean(0);
+		break;
+	default:
+		break;
+	}
+	return json_object_new_string_len(field->value, (int)field->length);
+}
+
+/** create an array for count values */
+static json_object *table_new_array(int count)
+{
+// json-c version >= 0.15
+#if JSON_C_VERSION_NUM >= 0x000f00
+	return json_object_new_array_ext(count);
+#else
+	return json_object_new_array();
+#endif
+}
+
+/** push an event with the object of name */
+static void table_emit(TableTaskCtxT *tc, const char *name, json_object *object, int count)
+{
+	json_object *event;
+
+	if (count)
+		rp_jsonc_pack(&event, "{so si}", name, object, "count", count);
+	else
+		rp_jsonc_pack(&event, "{so}", name, object);
+	if (event != NULL)
+		spawnTaskPushEventJSON(tc->task, event);
+	else
+		vfmtcl((void *)spawnTaskLog, tc->task, AFB_SYSLOG_LEVEL_ERROR, "out of memory");
+}
+
+/** emit pending records */
+static void table_flush(TableTaskCtxT *tc)
+{
+	TableCtxT *ctx = tc->ctx;
+	json_object *object;
+	TableColT *col;
+	int idx;
+
+	if (ctx->count == 0)
+		return;
+
+	if (!ctx->opts.columnar) {
+		object = ctx->rows;
+		ctx->rows = NULL;
+	} else {
+		object = json_object_new_object();
+		for (idx = 0; idx < ctx->ncols; idx++) {
+			col = &ctx->cols[idx];
+			if (col->values != NULL) {
+				if ((int)json_object_array_length(col->values) < ctx->count)
+					json_object_array_put_idx(col->values, (size_t)ctx->count - 1, NULL);
+				json_object_object_add(object, col->name, col->values);
+				col->values = NULL;
+			}
+		}
+	}
+	table_emit(tc, "stdout", object, ctx->count);
+	ctx->count = 0;
+}
+
+/** set the value of the column in the current record */
+static void table_put(TableCtxT *ctx, json_object *record, TableColT *col, json_object *value)
+{
+	if (record != NULL)
+		json_object_object_add(record, col->name, value);
+	else {
+		if (col->values == NULL)
+			col->values = table_new_array(ctx->opts.batch);
+		json_object_array_put_idx(col->values, (size_t)ctx->count, value);
+	}
+}
+
+/** build the record of the fields of the current line */
+static void table_record(TableTaskCtxT *tc, int count)
+{
+	TableCtxT *ctx = tc->ctx;
+	json_object *record, *value;
+	TableFieldT *field;
+	TableColT *col;
+	int idx, step;
+
+	record = ctx->opts.columnar ? NULL : json_object_new_object();
+	step = ctx->format == table_logfmt ? 2 : 1;
+	for (idx = 0; idx < count; idx += step) {
+		field = &ctx->fields[idx];
+		if (step == 1)
+			col = table_column_at(ctx, idx);
+		else if (field->length == 0)
+			continue;
+		else
+			col = table_column_named(ctx, field->value);
+		if (col == NULL)
+			break;
+		if (step == 1)
+			value = table_value(col, field);
+		else if (field[1].value != NULL)
+			value = table_value(col, &field[1]);
+		else
+			value = json_object_new_boolean(1);
+		table_put(ctx, record, col, value);
+	}
+
+	if (record == NULL)
+		ctx->count++;
+	else if (ctx->opts.batch == 1)
+		table_emit(tc, "stdout", record, 0);
+	else {
+		if (ctx->rows == NULL)
+			ctx->rows = table_new_array(ctx->opts.batch);
+		json_object_array_add(ctx->rows, record);
+		ctx->count++;
+	}
+	if (ctx->count >= ctx->opts.batch)
+		table_flush(tc);
+}
+
+/** check if fields look like a header: no empty and no typed field */
+static bool table_is_header(TableFieldT *fields, int count)
+{
+	int idx;
+
+	for (idx = 0; idx < count; idx++)
+		if (fields[idx].length == 0 || table_detect(fields[idx].value) != type_string)
+			return false;
+	return count > 0;
+}
+
+/** set the names of the columns from the header fields */
+static void table_header(TableCtxT *ctx, int count)
+{
+	int idx;
+
+	if (ctx->ncols != 0)
+		return; /* explicit names take precedence */
+	for (idx = 0; idx < count; idx++)
+		if (table_add_column(ctx, ctx->fields[idx].value) == NULL)
+			break;
+}
+
+static void table_out_cb(void *closure, const char *line, size_t length)
+{
+	TableTaskCtxT *tc = closure;
+	TableCtxT *ctx = tc->ctx;
+	int count;
+
+	memcpy(ctx->scratch, line, length);
+	ctx->scratch[length] = 0;
+
+	switch (ctx->format) {
+	case table_logfmt:
+		count = table_split_logfmt(ctx->scratch, ctx->fields);
+		break;
+	case table_columns:
+		count = table_split_columns(ctx->scratch, ctx->started || ctx->opts.header == header_no ? ctx->ncols : 0,
+					    ctx->fields);
+		break;
+	default:
+		count = length == 0 ? 0 : table_split_separated(ctx->scratch, ctx->opts.separator,
+								  ctx->format == table_csv, ctx->fields);
+		break;
+	}
+	if (count == 0)
+		return;
+
+	if (!ctx->started) {
+		ctx->started = true;
+		if (ctx->format != table_logfmt
+		    && (ctx->opts.header == header_yes
+			|| (ctx->opts.header == header_auto && table_is_header(ctx->fields, count)))) {
+			table_header(ctx, count);
+			return;
+		}
+	}
+	table_record(tc, count);
+}
+
+static void table_err_cb(void *closure, const char *line, size_t length)
+{
+	table_emit(closure, "stderr", json_object_new_string_len(line, (int)length), 0);
+}
+
+/** process input read by the core */
+encoder_error_t table_consume(void *data, taskIdT *task, const struct iovec *iov, int iovcnt, encoder_stream_t stream)
+{
+	TableTaskCtxT tc = { .ctx = data, .task = task };
+	int idx;
+
+	for (idx = 0; idx < iovcnt; idx++) {
+		if (stream == ENCODER_STREAM_STDERR)
+			line_buf_write(&tc.ctx->err, iov[idx].iov_base, iov[idx].iov_len, table_err_cb, &tc);
+		else
+			line_buf_write(&tc.ctx->out, iov[idx].iov_base, iov[idx].iov_len, table_out_cb, &tc);
+	}
+	return ENCODER_NO_ERROR;
+}
+
+/** terminate processing */
+encoder_error_t table_end(void *data, taskIdT *task)
+{
+	TableTaskCtxT tc = { .ctx = data, .task = task };
+	line_buf_end(&tc.ctx->err, table_err_cb, &tc);
+	line_buf_end(&tc.ctx->out, table_out_cb, &tc);
+	table_flush(&tc);
+	return ENCODER_NO_ERROR;
+}
+
+/** destroy the encoder */
+void table_destroy(void *data)
+{
+	TableCtxT *ctx = data;
+	int idx;
+
+	for (idx = 0; idx < ctx->ncols; idx++) {
+		free(ctx->cols[idx].name);
+		json_object_put(ctx->cols[idx].values);
+	}
+	free(ctx->cols);
+	json_object_put(ctx->rows);
+	stream_buf_clear(&ctx->out);
+	stream_buf_clear(&ctx->err);
+	free(ctx->scratch);
+	free(ctx);
+}
@@ -24,9 +24,12 @@
 
 #include <assert.h>
 #include <stdio.h>
+#include <pthread.h>
 #include <errno.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
+#include <sys/file.h>
 
 #include <rp-utils/rp-jsonc.h>
 #include <afb-helpers4/afb-data-utils.h>
@@ -35,6 +38,7 @@
 #include "spawn-binding.h"
 #include "spawn-sandbox.h"
 #include "spawn-encoders.h"
+#include "spawn-encoders-internal.h"
 #include "spawn-subtask.h"
 #include "spawn-expand.h"
 
@@ -42,6 +46,17 @@
 #include "lib/stream-buf.h"
 #include "lib/line-buf.h"
 #include "lib/jsonc-buf.h"
+#include "lib/compress-buf.h"
+#include "lib/base64.h"
+#include "lib/utf8.h"
+#include "lib/ring-buf.h"
+#include "lib/line-filter.h"
+#include "lib/record-frame.h"
+#include "lib/json-scan.h"
+#include "lib/json-select.h"
+#include "lib/work-pool.h"
+#include "lib/block-pool.h"
+#include "lib/read-budget.h"
 
 /***************************************************************************************/
 
@@ -55,32 +70,151 @@ struct encoder {
 static void drop_fd(int fd)
 {
 	char block[4096];
-	while (read(fd, block, sizeof block) == (ssize_t)(sizeof block))
-		;
+	while (!read_budget_exhausted() && read(fd, block, sizeof block) == (ssize_t)(sizeof block))
+		read_budget_spend(sizeof block);
+}
+
+/***************************************************************************************/
+
+/** get the policy of name (NULL for the default), returns false when invalid */
+bool utf8_policy(const char *name, Utf8PolicyT *policy)
+{
+	if (name == NULL || !strcasecmp(name, "replace"))
+		*policy = utf8_replace;
+	else if (!strcasecmp(name, "escape"))
+		*policy = utf8_escape;
+	else if (!strcasecmp(name, "base64"))
+		*policy = utf8_base64;
+	else if (!strcasecmp(name, "none"))
+		*policy = utf8_none;
+	else
+		return false;
+	return true;
+}
+
+/** create the JSON value of the text, applying the policy when it isn't valid UTF-8 */
+json_object *utf8_string(Utf8PolicyT policy, const char *text, size_t length)
+{
+	json_object *value;
+	char *buffer;
+
+	// valid texts, the common case, are only scanned
+	if (policy == utf8_none || utf8_valid(text, length) == length)
+		return json_object_new_string_len(text, (int)length);
+
+	if (policy == utf8_base64) {
+		buffer = malloc(base64_encoded_length(length) + 1);
+		if (buffer == NULL)
+			return NULL;
+		base64_encode(text, length, buffer);
+		rp_jsonc_pack(&value, "{ss}", "base64", buffer);
+	} else {
+		buffer = malloc(utf8_sanitized_length(length));
+		if (buffer == NULL)
+			return NULL;
+		length = utf8_sanitize(text, length, policy == utf8_escape ? UTF8_ESCAPE : UTF8_REPLACE, buffer);
+		value = json_object_new_string_len(buffer, (int)length);
+	}
+	free(buffer);
+	return value;
+}
+
+/***************************************************************************************/
+
+/** metadata of the events of a task */
+typedef struct {
+	/** time of the current read, CLOCK_MONOTONIC in nanoseconds */
+	int64_t ts;
+	/** sequence number of the next event, shared by stdout and stderr */
+	int64_t seq;
+} EventMetaT;
+
+/** record the time of the read */
+static void meta_stamp(EventMetaT *meta)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	meta->ts = (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/** add the metadata to the event, the offset in the stream when not negative */
+static void meta_add(EventMetaT *meta, json_object *event, int64_t offset)
+{
+	// keys are constant and new, json-c needn't copy nor search them
+	json_object_object_add_ex(event, "ts", json_object_new_int64(meta->ts),
+				  JSON_C_OBJECT_ADD_KEY_IS_NEW | JSON_C_OBJECT_KEY_IS_CONSTANT);
+	json_object_object_add_ex(event, "seq", json_object_new_int64(meta->seq++),
+				  JSON_C_OBJECT_ADD_KEY_IS_NEW | JSON_C_OBJECT_KEY_IS_CONSTANT);
+	if (offset >= 0)
+		json_object_object_add_ex(event, "offset", json_object_new_int64(offset),
+					  JSON_C_OBJECT_ADD_KEY_IS_NEW | JSON_C_OBJECT_KEY_IS_CONSTANT);
 }
 
 /***************************************************************************************/
 
+/** compressed member being made, appended at once to its file when complete */
+typedef struct {
+	/** the compressed bytes */
+	stream_buf_t buf;
+	/** count of the uncompressed bytes of the member */
+	size_t input;
+	/** CLOCK_MONOTONIC second of its first bytes */
+	time_t start;
+	/** true when bytes were lost for lack of memory */
+	bool failed;
+} LogMemberT;
+
 // hold per taskId encoder context
 typedef struct {
 	const char *sout;
 	const char *serr;
 	FILE *fout;
 	FILE *ferr;
+	/** compression of the files */
+	compress_method_t compress;
+	/** compression level */
+	int level;
+	/** compressor of stdout */
+	compress_buf_t *cout;
+	/** compressor of stderr */
+	compress_buf_t *cerr;
+	/** compressed member of stdout */
+	LogMemberT mout;
+	/** compressed member of stderr */
+	LogMemberT merr;
 } LogCtxT;
 
+/** read the options */
+static encoder_error_t log_options(json_object *options, LogCtxT *ctx)
+{
+	const char *compress = NULL;
+
+	ctx->compress = compress_none;
+	ctx->level = COMPRESS_BUF_LEVEL_DEFAULT;
+	if (options == NULL)
+		return ENCODER_NO_ERROR;
+	if (rp_jsonc_unpack(options, "{s?s s?s s?s s?i}", "stdout", &ctx->sout, "stderr", &ctx->serr, "compress",
+			    &compress, "level", &ctx->level))
+		return ENCODER_ERROR_INVALID_OPTIONS;
+	if (compress != NULL && compress_buf_method(compress, &ctx->compress) < 0)
+		return ENCODER_ERROR_INVALID_OPTIONS;
+	if (!compress_buf_check_level(ctx->compress, ctx->level))
+		return ENCODER_ERROR_INVALID_OPTIONS;
+	return ENCODER_NO_ERROR;
+}
+
 /** check options */
 static encoder_error_t log_check(json_object *options)
 {
-	const char *fileout, *fileerr;
-	int err = options == NULL ? 0 : rp_jsonc_unpack(options, "{s?s s?s}", "stdout", &fileout, "stderr", &fileerr);
-	return err ? ENCODER_ERROR_INVALID_OPTIONS : ENCODER_NO_ERROR;
+	LogCtxT ctx = { .sout = NULL };
+	return log_options(options, &ctx);
 }
 
 /** instanciate data */
 static encoder_error_t log_instanciate(const encoder_generator_t *generator, json_object *options, void **data)
 {
 	LogCtxT *ctx;
+	encoder_error_t rc;
 
 	/* allocate */
 	ctx = calloc(1, sizeof *ctx);
@@ -88,16 +222,31 @@ static encoder_error_t log_instanciate(const encoder_generator_t *generator, jso
 		return ENCODER_ERROR_OUT_OF_MEMORY;
 
 	/* init */
-	if (options == NULL || 0 == rp_jsonc_unpack(options, "{s?s s?s}", "stdout", &ctx->sout, "stderr", &ctx->serr)) {
+	rc = log_options(options, ctx);
+	if (rc == ENCODER_NO_ERROR && ctx->compress != compress_none) {
+		// the server's stdout and stderr are never compressed
+		if (ctx->sout != NULL && stream_buf_init(&ctx->mout.buf, BLOCK_POOL_SIZE) != NULL)
+			ctx->cout = compress_buf_create(ctx->compress, ctx->level);
+		if (ctx->serr != NULL && stream_buf_init(&ctx->merr.buf, BLOCK_POOL_SIZE) != NULL)
+			ctx->cerr = compress_buf_create(ctx->compress, ctx->level);
+		if ((ctx->sout != NULL && ctx->cout == NULL) || (ctx->serr != NULL && ctx->cerr == NULL)) {
+			compress_buf_free(ctx->cout);
+			compress_buf_free(ctx->cerr);
+			stream_buf_clear(&ctx->mout.buf);
+			stream_buf_clear(&ctx->merr.buf);
+			rc = ENCODER_ERROR_OUT_OF_MEMORY;
+		}
+	}
+	if (rc == ENCODER_NO_ERROR) {
 		*data = ctx;
 		return ENCODER_NO_ERROR;
 	}
 	free(ctx);
-	return ENCODER_ERROR_INVALID_OPTIONS;
+	return rc;
 }
 
 /** open a file */
-static FILE *openexp(const char *filename, const char *mode, taskIdT *task)
+FILE *openexp(const char *filename, const char *mode, taskIdT *task)
 {
 	char *path = utilsExpandKeyTask(filename, task);
 	FILE *file = fopen(path, mode);
@@ -123,21 +272,103 @@ encoder_error_t log_begin(void *data, taskIdT *task)
 	return ENCODER_ERROR_SYSTEM;
 }
 
-/** process input */
-encoder_error_t log_read(void *data, taskIdT *taskId, int fd, bool error)
+/** add compressed bytes to the member, its buffer growing up to the size of a complete member */
+static void log_member_cb(void *closure, const char *data, size_t length)
+{
+	LogMemberT *member = closure;
+	size_t grow = length > member->buf.capacity ? length : member->buf.capacity;
+
+	if (member->failed || stream_buf_ensure(&member->buf, grow) == NULL)
+		member->failed = true;
+	else {
+		memcpy(&member->buf.data[member->buf.length], data, length);
+		member->buf.length += length;
+	}
+}
+
+/** write all the slices to the file descriptor */
+void log_writev(int fd, struct iovec *iov, int iovcnt)
+{
+	ssize_t sts;
+
+	while (iovcnt > 0) {
+		sts = writev(fd, iov, iovcnt);
+		if (sts < 0) {
+			if (errno == EINTR)
+				continue;
+			return;
+		}
+		// skip the written slices and the written part of the next one
+		for (; iovcnt > 0 && (size_t)sts >= iov->iov_len; iov++, iovcnt--)
+			sts -= (ssize_t)iov->iov_len;
+		if (iovcnt > 0) {
+			iov->iov_base = (char *)iov->iov_base + sts;
+			iov->iov_len -= (size_t)sts;
+		}
+	}
+}
+
+/** CLOCK_MONOTONIC time in seconds */
+static time_t log_now(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec;
+}
+
+/** complete the member and append it to the file, the runs sharing the file being serialised */
+static void log_member_append(compress_buf_t *cbuf, LogMemberT *member, FILE *file, taskIdT *taskId)
+{
+	struct iovec iov;
+
+	if (compress_buf_end(cbuf, log_member_cb, member) < 0 || member->failed)
+		vfmtcl((void *)spawnTaskLog, taskId, AFB_SYSLOG_LEVEL_ERROR, "out of memory");
+	else {
+		iov.iov_base = member->buf.data;
+		iov.iov_len = member->buf.length;
+		flock(fileno(file), LOCK_EX);
+		log_writev(fileno(file), &iov, 1);
+		flock(fileno(file), LOCK_UN);
+	}
+	member->buf.length = 0;
+	member->input = 0;
+	member->failed = false;
+}
+
+/** process input read by the core */
+encoder_error_t log_consume(void *data, taskIdT *taskId, const struct iovec *iov, int iovcnt, encoder_stream_t stream)
 {
-	char buffer[4096];
 	LogCtxT *ctx = data;
+	bool error = stream == ENCODER_STREAM_STDERR;
 	FILE *file = error ? ctx->ferr : ctx->fout;
+	compress_buf_t *cbuf = error ? ctx->cerr : ctx->cout;
+	LogMemberT *member = error ? &ctx->merr : &ctx->mout;
+	struct iovec slices[MAX_READ_BLOCKS];
+	int idx;
+
+	// uncompressed blocks are written at once without going through stdio
+	if (cbuf == NULL && iovcnt <= MAX_READ_BLOCKS) {
+		memcpy(slices, iov, (size_t)iovcnt * sizeof *iov);
+		fflush(file);
+		log_writev(fileno(file), slices, iovcnt);
+		return ENCODER_NO_ERROR;
+	}
+	if (cbuf == NULL) {
+		for (idx = 0; idx < iovcnt; idx++)
+			fwrite(iov[idx].iov_base, 1, iov[idx].iov_len, file);
+		return ENCODER_NO_ERROR;
+	}
 
-	for (;;) {
-		// read
-		ssize_t sts = read(fd, buffer, sizeof buffer);
-		if (sts > 0)
-			fwrite(buffer, 1, (size_t)sts, file);
-		else if (sts == 0 || errno != EINTR)
-			break;
+	if (member->input == 0)
+		member->start = log_now();
+	for (idx = 0; idx < iovcnt; idx++) {
+		compress_buf_process(cbuf, iov[idx].iov_base, iov[idx].iov_len, false, log_member_cb, member);
+		member->input += iov[idx].iov_len;
 	}
+
+	// the members are bounded in size and in age, so that the file follows the run
+	if (member->input >= LOG_MEMBER_INPUT || log_now() - member->start >= LOG_MEMBER_DELAY)
+		log_member_append(cbuf, member, file, taskId);
 	return ENCODER_NO_ERROR;
 }
 
@@ -145,6 +376,11 @@ encoder_error_t log_read(void *data, taskIdT *taskId, int fd, bool error)
 encoder_error_t log_end(void *data, taskIdT *taskId)
 {
 	LogCtxT *ctx = data;
+	// the last members of the run hold what remains of its output
+	if (ctx->cerr != NULL && ctx->merr.input != 0)
+		log_member_append(ctx->cerr, &ctx->merr, ctx->ferr, taskId);
+	if (ctx->cout != NULL && ctx->mout.input != 0)
+		log_member_append(ctx->cout, &ctx->mout, ctx->fout, taskId);
 	if (ctx->ferr != stderr)
 		fclose(ctx->ferr);
 	if (ctx->fout != stdout)
@@ -156,6 +392,10 @@ encoder_error_t log_end(void *data, taskIdT *taskId)
 static void log_destroy(void *data)
 {
 	LogCtxT *ctx = data;
+	compress_buf_free(ctx->cout);
+	compress_buf_free(ctx->cerr);
+	stream_buf_clear(&ctx->mout.buf);
+	stream_buf_clear(&ctx->merr.buf);
 	free(ctx);
 }
 
@@ -170,9 +410,59 @@ typedef enum {
 	/** send lines as events, line by line */
 	mode_text_line,
 	/** send text blob as the reply at the end */
-	mode_text_raw
+	mode_text_raw,
+	/** send blobs of text as events when read */
+	mode_text_chunk,
+	/** send a uniform sample of lines as event at the end */
+	mode_text_sample
 } TextModeT;
 
+/** definition of the encodings of raw data */
+typedef enum {
+	/** raw data as a JSON string */
+	encoding_text,
+	/** raw data as a JSON string encoded in base64 */
+	encoding_base64,
+	/** raw data as byte array data following the JSON object */
+	encoding_bytes
+} TextEncodingT;
+
+/** definition of the part of the output that is kept */
+typedef enum {
+	/** keep the first lines or bytes */
+	keep_head,
+	/** keep the last lines or bytes */
+	keep_tail,
+	/** keep the first and the last lines or bytes */
+	keep_head_tail
+} TextKeepT;
+
+/** options of text encoders */
+typedef struct {
+	/** the maximum count of lines to hold */
+	int maxline;
+	/** the maximum length of lines or of raw data */
+	int maxlen;
+	/** part of the output kept */
+	TextKeepT keep;
+	/** encoding of raw data */
+	TextEncodingT encoding;
+	/** compression of raw data */
+	compress_method_t compress;
+	/** compression level */
+	int level;
+	/** specification of the line filter */
+	json_object *filter;
+	/** specification of the record framing */
+	json_object *record;
+	/** add time, sequence and offset to events */
+	bool metadata;
+	/** stdout and stderr are sampled separately */
+	bool stratified;
+	/** policy for invalid UTF-8 texts */
+	Utf8PolicyT utf8;
+} TextOptsT;
+
 /** definition of a stream for output and error */
 typedef struct {
 	/** json object data */
@@ -181,18 +471,46 @@ typedef struct {
 	stream_buf_t buf;
 	/** if overflow is detected */
 	bool overflowed;
+	/** compressor of raw data if any */
+	compress_buf_t *compress;
+	/** last lines when the tail is kept */
+	line_ring_t lines;
+	/** last bytes when the tail of raw data is kept */
+	byte_ring_t bytes;
+	/** sample of the lines */
+	line_sample_t sample;
+	/** count of lines read */
+	int64_t count;
+	/** raw data are base64 encoded as read */
+	bool streamed;
+	/** count of raw bytes encoded and its maximum */
+	size_t rawlen, rawmax;
+	/** state of the encoding of raw data */
+	base64_stream_t b64;
 } TextBufT;
 
 /** context of a text encoder */
 typedef struct {
 	/** the mode */
 	TextModeT mode;
-	/** the maximum count of lines to hold */
-	int maxline;
+	/** the options */
+	TextOptsT opts;
+	/** count of lines or bytes of the head */
+	int headmax;
+	/** count of lines or bytes of the tail */
+	int tailmax;
+	/** filter of the lines if any */
+	line_filter_t *filter;
+	/** name of the argument holding filter patterns of requests */
+	const char *filterargs;
+	/** framing of records if not split in lines */
+	record_frame_t *frame;
 	/** for holding output */
 	TextBufT out;
 	/** for holding errors */
 	TextBufT err;
+	/** metadata of events */
+	EventMetaT meta;
 } TextCtxT;
 
 /** pair of encoder context and task for callbacks */
@@ -205,26 +523,273 @@ typedef struct {
 	TextBufT *buf;
 } TextTaskCtxT;
 
-/** check options */
-static encoder_error_t text_check(json_object *options)
+/** read the options, raw data options are only accepted for raw modes */
+static encoder_error_t text_options(json_object *options, bool raw, TextOptsT *opts)
 {
-	int maxline, maxlen, err;
-
+	int err;
+	const char *keep = NULL, *encoding = NULL, *compress = NULL, *utf8 = NULL;
+
+	opts->maxline = MAX_DOC_LINE_COUNT;
+	opts->maxlen = MAX_DOC_LINE_SIZE;
+	opts->keep = keep_head;
+	opts->encoding = encoding_text;
+	opts->compress = compress_none;
+	opts->level = COMPRESS_BUF_LEVEL_DEFAULT;
+	opts->filter = NULL;
+	opts->record = NULL;
+	opts->metadata = false;
+	opts->stratified = true;
+	opts->utf8 = utf8_replace;
 	if (options == NULL)
 		return ENCODER_NO_ERROR;
 
-	err = rp_jsonc_unpack(options, "{s?i s?i}", "maxline", &maxline, "maxlen", &maxlen);
-	if (err || maxlen <= 0 || maxline <= 0)
+	err = rp_jsonc_unpack(options, "{s?i s?i s?s s?s s?s s?i s?o s?o s?b s?b s?s}", "maxline", &opts->maxline,
+			      "maxlen", &opts->maxlen, "keep", &keep, "encoding", &encoding, "compress", &compress,
+			      "level", &opts->level, "filter", &opts->filter, "record", &opts->record, "metadata",
+			      &opts->metadata, "stratified", &opts->stratified, "utf8", &utf8);
+	if (err || opts->maxlen <= 0 || opts->maxline <= 0 || !utf8_policy(utf8, &opts->utf8))
+		return ENCODER_ERROR_INVALID_OPTIONS;
+
+	// only lines are framed, filtered, stamped or sampled
+	if ((opts->filter != NULL || opts->record != NULL || opts->metadata || !opts->stratified) && raw)
+		return ENCODER_ERROR_INVALID_OPTIONS;
+
+	// kept part
+	if (keep == NULL || !strcasecmp(keep, "head"))
+		opts->keep = keep_head;
+	else if (!strcasecmp(keep, "tail"))
+		opts->keep = keep_tail;
+	else if (!strcasecmp(keep, "head+tail"))
+		opts->keep = keep_head_tail;
+	else
+		return ENCODER_ERROR_INVALID_OPTIONS;
+
+	// only raw data are compressed or encoded, lines being JSON strings
+	if (!raw && (encoding != NULL || compress != NULL || opts->level != COMPRESS_BUF_LEVEL_DEFAULT))
+		return ENCODER_ERROR_INVALID_OPTIONS;
+	if (!raw)
+		return ENCODER_NO_ERROR;
+
+	// compression
+	if (compress != NULL && compress_buf_method(compress, &opts->compress) < 0)
+		return ENCODER_ERROR_INVALID_OPTIONS;
+	if (!compress_buf_check_level(opts->compress, opts->level))
+		return ENCODER_ERROR_INVALID_OPTIONS;
+
+	// the tail of a compressed stream can't be decoded
+	if (opts->compress != compress_none && opts->keep != keep_head)
+		return ENCODER_ERROR_INVALID_OPTIONS;
+
+	// encoding, compressed data can't be a text
+	if (encoding == NULL)
+		opts->encoding = opts->compress == compress_none ? encoding_text : encoding_base64;
+	else if (!strcasecmp(encoding, "text") && opts->compress == compress_none)
+		opts->encoding = encoding_text;
+	else if (!strcasecmp(encoding, "base64"))
+		opts->encoding = encoding_base64;
+	else if (!strcasecmp(encoding, "bytes"))
+		opts->encoding = encoding_bytes;
+	else
+		return ENCODER_ERROR_INVALID_OPTIONS;
+	return ENCODER_NO_ERROR;
+}
+
+/** add to the filter the patterns of the specification */
+encoder_error_t text_filter_add(line_filter_t *filter, json_object *spec)
+{
+	static const struct {
+		const char *key;
+		int kind;
+		bool regex;
+	} lists[] = { { "include", LINE_FILTER_INCLUDE, false },
+		      { "exclude", LINE_FILTER_EXCLUDE, false },
+		      { "include-regex", LINE_FILTER_INCLUDE, true },
+		      { "exclude-regex", LINE_FILTER_EXCLUDE, true } };
+	json_object *list, *item;
+	size_t idx, count;
+	unsigned ilist;
+	int err;
+
+	if (!json_object_is_type(spec, json_type_object))
 		return ENCODER_ERROR_INVALID_OPTIONS;
 
+	for (ilist = 0; ilist < sizeof lists / sizeof *lists; ilist++) {
+		if (!json_object_object_get_ex(spec, lists[ilist].key, &list))
+			continue;
+		count = json_object_is_type(list, json_type_array) ? json_object_array_length(list) : 1;
+		for (idx = 0; idx < count; idx++) {
+			item = json_object_is_type(list, json_type_array) ? json_object_array_get_idx(list, idx) : list;
+			if (!json_object_is_type(item, json_type_string))
+				return ENCODER_ERROR_INVALID_OPTIONS;
+			err = lists[ilist].regex ?
+				      line_filter_add_regex(filter, lists[ilist].kind, json_object_get_string(item)) :
+				      line_filter_add_literal(filter, lists[ilist].kind, json_object_get_string(item));
+			if (err)
+				return ENCODER_ERROR_INVALID_OPTIONS;
+		}
+	}
+	return ENCODER_NO_ERROR;
+}
+
+/** create the filter of the specification */
+encoder_error_t text_filter_create(json_object *spec, line_filter_t **filter, const char **args)
+{
+	encoder_error_t rc;
+	int icase = 0;
+	line_filter_t *lf;
+
+	*args = NULL;
+	if (rp_jsonc_unpack(spec, "{s?b s?s}", "icase", &icase, "args", args))
+		return ENCODER_ERROR_INVALID_OPTIONS;
+
+	lf = line_filter_create(icase ? LINE_FILTER_ICASE : 0);
+	if (lf == NULL)
+		return ENCODER_ERROR_OUT_OF_MEMORY;
+	rc = text_filter_add(lf, spec);
+	if (rc == ENCODER_NO_ERROR && line_filter_compile(lf) < 0)
+		rc = ENCODER_ERROR_OUT_OF_MEMORY;
+	if (rc != ENCODER_NO_ERROR)
+		line_filter_free(lf);
+	else
+		*filter = lf;
+	return rc;
+}
+
+/** create the record framing of the specification */
+encoder_error_t text_frame_create(json_object *spec, record_frame_t **frame)
+{
+	json_object *delimiter = NULL;
+	const char *start = NULL;
+	int icase = 0;
+
+	if (rp_jsonc_unpack(spec, "{s?o s?s s?b}", "delimiter", &delimiter, "start", &start, "icase", &icase))
+		return ENCODER_ERROR_INVALID_OPTIONS;
+
+	// records are either delimited or started by a pattern
+	if ((delimiter == NULL) == (start == NULL))
+		return ENCODER_ERROR_INVALID_OPTIONS;
+	if (delimiter != NULL) {
+		if (!json_object_is_type(delimiter, json_type_string))
+			return ENCODER_ERROR_INVALID_OPTIONS;
+		*frame = record_frame_create_delimiter(json_object_get_string(delimiter),
+						       (size_t)json_object_get_string_len(delimiter));
+	} else
+		*frame = record_frame_create_start(start, icase ? RECORD_FRAME_ICASE : 0);
+	return *frame == NULL ? ENCODER_ERROR_INVALID_OPTIONS : ENCODER_NO_ERROR;
+}
+
+/** check options of line modes, metadata being only accepted when events are sent per line */
+static encoder_error_t text_check_lines(json_object *options, TextModeT mode)
+{
+	TextOptsT opts;
+	line_filter_t *filter;
+	record_frame_t *frame;
+	const char *args;
+	encoder_error_t rc = text_options(options, false, &opts);
+
+	if (rc == ENCODER_NO_ERROR && opts.metadata && mode != mode_text_line)
+		rc = ENCODER_ERROR_INVALID_OPTIONS;
+	if (rc == ENCODER_NO_ERROR && !opts.stratified && mode != mode_text_sample)
+		rc = ENCODER_ERROR_INVALID_OPTIONS;
+	if (rc == ENCODER_NO_ERROR && opts.filter != NULL) {
+		rc = text_filter_create(opts.filter, &filter, &args);
+		if (rc == ENCODER_NO_ERROR)
+			line_filter_free(filter);
+	}
+	if (rc == ENCODER_NO_ERROR && opts.record != NULL) {
+		rc = text_frame_create(opts.record, &frame);
+		if (rc == ENCODER_NO_ERROR)
+			record_frame_free(frame);
+	}
+	return rc;
+}
+
+/** check options */
+static encoder_error_t text_check(json_object *options)
+{
+	return text_check_lines(options, mode_text_event);
+}
+
+/** check options of the line mode */
+static encoder_error_t line_check(json_object *options)
+{
+	return text_check_lines(options, mode_text_line);
+}
+
+/** check options of the sample mode */
+static encoder_error_t sample_check(json_object *options)
+{
+	return text_check_lines(options, mode_text_sample);
+}
+
+/** check options of raw modes */
+static encoder_error_t raw_check(json_object *options)
+{
+	TextOptsT opts;
+	return text_options(options, true, &opts);
+}
+
+/** release a buffer */
+static void text_buf_clear(TextBufT *tbuf)
+{
+	json_object_put(tbuf->data);
+	stream_buf_clear(&tbuf->buf);
+	compress_buf_free(tbuf->compress);
+	line_ring_clear(&tbuf->lines);
+	byte_ring_clear(&tbuf->bytes);
+	line_sample_clear(&tbuf->sample);
+}
+
+/** initialize a buffer */
+static encoder_error_t text_buf_init(TextCtxT *ctx, TextBufT *tbuf)
+{
+	bool raw = ctx->mode == mode_text_raw;
+	size_t size = raw && ctx->opts.keep == keep_head_tail ? (size_t)ctx->headmax : (size_t)ctx->opts.maxlen;
+
+	// without tail, base64 raw data are encoded as read so that they aren't copied at the end
+	tbuf->streamed = raw && ctx->opts.encoding == encoding_base64 && ctx->opts.keep == keep_head;
+	if (tbuf->streamed) {
+		tbuf->rawlen = 0;
+		tbuf->rawmax = size;
+		base64_stream_init(&tbuf->b64);
+		size = base64_encoded_length(size);
+	}
+	if (stream_buf_init(&tbuf->buf, size) == NULL)
+		return ENCODER_ERROR_OUT_OF_MEMORY;
+	if (ctx->opts.compress != compress_none) {
+		tbuf->compress = compress_buf_create(ctx->opts.compress, ctx->opts.level);
+		if (tbuf->compress == NULL)
+			goto error;
+	}
+	// without strata, the lines of stderr are sampled with the ones of stdout
+	if (ctx->mode == mode_text_sample && (ctx->opts.stratified || tbuf == &ctx->out)) {
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (line_sample_init(&tbuf->sample, (size_t)ctx->opts.maxline, (size_t)ctx->opts.maxlen,
+				     (uint64_t)now.tv_nsec ^ (uint64_t)(uintptr_t)tbuf)
+		    == NULL)
+			goto error;
+	}
+	if (ctx->tailmax > 0) {
+		if (raw) {
+			if (byte_ring_init(&tbuf->bytes, (size_t)ctx->tailmax) == NULL)
+				goto error;
+		} else {
+			if (line_ring_init(&tbuf->lines, (size_t)ctx->tailmax, (size_t)ctx->opts.maxlen) == NULL)
+				goto error;
+		}
+	}
 	return ENCODER_NO_ERROR;
+error:
+	text_buf_clear(tbuf);
+	return ENCODER_ERROR_OUT_OF_MEMORY;
 }
 
 /** instanciate data */
 static encoder_error_t text_instanciate(const encoder_generator_t *generator, json_object *options, void **data)
 {
 	TextCtxT *ctx;
-	int maxlen, err;
+	encoder_error_t rc;
 
 	/* allocate */
 	ctx = calloc(1, sizeof *ctx);
@@ -232,37 +797,116 @@ static encoder_error_t text_instanciate(const encoder_generator_t *generator, js
 		return ENCODER_ERROR_OUT_OF_MEMORY;
 
 	/* init */
-	maxlen = MAX_DOC_LINE_SIZE;
-	ctx->maxline = MAX_DOC_LINE_COUNT;
 	ctx->mode = (TextModeT)(intptr_t)generator->tuning;
-	if (options != NULL) {
-		err = rp_jsonc_unpack(options, "{s?i s?i}", "maxline", &ctx->maxline, "maxlen", &maxlen);
-		if (err || maxlen <= 0 || ctx->maxline <= 0) {
-			free(ctx);
-			return ENCODER_ERROR_INVALID_OPTIONS;
-		}
-	}
-	if (stream_buf_init(&ctx->out.buf, maxlen) != NULL) {
-		if (stream_buf_init(&ctx->err.buf, maxlen) != NULL) {
-			*data = ctx;
-			return ENCODER_NO_ERROR;
+	rc = text_options(options, ctx->mode == mode_text_raw || ctx->mode == mode_text_chunk, &ctx->opts);
+	if (rc == ENCODER_NO_ERROR) {
+		// the tail applies to lines of TEXT and SYNC or to bytes of RAW
+		int max = ctx->mode == mode_text_raw ? ctx->opts.maxlen : ctx->opts.maxline;
+		if (ctx->mode == mode_text_line || ctx->mode == mode_text_chunk || ctx->mode == mode_text_sample)
+			ctx->opts.keep = keep_head;
+		ctx->tailmax = ctx->opts.keep == keep_tail ? max : ctx->opts.keep == keep_head_tail ? max / 2 : 0;
+		ctx->headmax = max - ctx->tailmax;
+		// only events of lines carry metadata, only samples are stratified
+		if ((ctx->opts.metadata && ctx->mode != mode_text_line)
+		    || (!ctx->opts.stratified && ctx->mode != mode_text_sample))
+			rc = ENCODER_ERROR_INVALID_OPTIONS;
+		else if (ctx->opts.filter != NULL)
+			rc = text_filter_create(ctx->opts.filter, &ctx->filter, &ctx->filterargs);
+		if (rc == ENCODER_NO_ERROR && ctx->opts.record != NULL)
+			rc = text_frame_create(ctx->opts.record, &ctx->frame);
+		if (rc == ENCODER_NO_ERROR) {
+			rc = text_buf_init(ctx, &ctx->out);
+			if (rc == ENCODER_NO_ERROR) {
+				rc = text_buf_init(ctx, &ctx->err);
+				if (rc == ENCODER_NO_ERROR) {
+					*data = ctx;
+					return ENCODER_NO_ERROR;
+				}
+				text_buf_clear(&ctx->out);
+			}
 		}
-		stream_buf_clear(&ctx->out.buf);
+		record_frame_free(ctx->frame);
+		line_filter_free(ctx->filter);
 	}
 	free(ctx);
-	return ENCODER_ERROR_OUT_OF_MEMORY;
+	return rc;
+}
+
+/** start processing, adding the filter patterns of the request */
+static encoder_error_t text_begin(void *data, taskIdT *task)
+{
+	TextCtxT *ctx = data;
+	json_object *spec;
+	encoder_error_t rc;
+
+	if (ctx->filterargs == NULL || !json_object_object_get_ex(spawnTaskArgs(task), ctx->filterargs, &spec))
+		return ENCODER_NO_ERROR;
+
+	rc = text_filter_add(ctx->filter, spec);
+	if (rc == ENCODER_NO_ERROR && line_filter_compile(ctx->filter) < 0)
+		rc = ENCODER_ERROR_OUT_OF_MEMORY;
+	if (rc != ENCODER_NO_ERROR)
+		vfmtcl((void *)spawnTaskLog, task, AFB_SYSLOG_LEVEL_ERROR, "invalid filter in argument %s",
+		       ctx->filterargs);
+	return rc;
+}
+
+/** get the array of lines of the buffer, creating it if needed */
+static json_object *text_lines(TextTaskCtxT *ctx)
+{
+	json_object *array = ctx->buf->data;
+	if (array == NULL) {
+// json-c version >= 0.15
+#if JSON_C_VERSION_NUM >= 0x000f00
+		ctx->buf->data = array = json_object_new_array_ext(ctx->ctx->opts.maxline + 1);
+#else
+		ctx->buf->data = array = json_object_new_array();
+#endif
+	}
+	return array;
+}
+
+/** count of lines in the array of lines */
+static int text_lines_count(TextTaskCtxT *ctx)
+{
+	return ctx->buf->data == NULL ? 0 : (int)json_object_array_length(ctx->buf->data);
 }
 
 /** encode one line */
 static void text_line_cb(void *closure, const char *line, size_t length)
 {
 	TextTaskCtxT *ctx = closure;
-	json_object *object = json_object_new_string_len(line, length);
+	json_object *object;
+
+	// all the lines are counted in sample mode
+	if (ctx->ctx->mode == mode_text_sample)
+		ctx->buf->count++;
+
+	// lines rejected by the filter are dropped before any allocation
+	if (ctx->ctx->filter != NULL && !line_filter_match(ctx->ctx->filter, line, length))
+		return;
+
+	// sampled lines are only copied in their reservoir
+	if (ctx->ctx->mode == mode_text_sample) {
+		line_sample_push(ctx->ctx->opts.stratified ? &ctx->buf->sample : &ctx->ctx->out.sample, line, length,
+				 ctx->buf == &ctx->ctx->err);
+		return;
+	}
+
+	// after the head, lines go to the ring of the tail without allocation
+	if (ctx->ctx->opts.keep != keep_head && text_lines_count(ctx) >= ctx->ctx->headmax) {
+		line_ring_push(&ctx->buf->lines, line, length);
+		return;
+	}
+
+	object = utf8_string(ctx->ctx->opts.utf8, line, length);
 	if (ctx->ctx->mode == mode_text_line) {
 		json_object *event = json_object_new_object();
 		if (event != NULL) {
 			const char *name = ctx->buf == &ctx->ctx->err ? "stderr" : "stdout";
 			if (json_object_object_add(event, name, object) == 0) {
+				if (ctx->ctx->opts.metadata)
+					meta_add(&ctx->ctx->meta, event, (int64_t)stream_buf_offset(&ctx->buf->buf, line));
 				spawnTaskPushEventJSON(ctx->task, event);
 				return;
 			}
@@ -276,19 +920,14 @@ static void text_line_cb(void *closure, const char *line, size_t length)
 	else {
 		json_object *array = ctx->buf->data;
 		if (array == NULL) {
-// json-c version >= 0.15
-#if JSON_C_VERSION_NUM >= 0x000f00
-			ctx->buf->data = array = json_object_new_array_ext(ctx->ctx->maxline + 1);
-#else
-			ctx->buf->data = array = json_object_new_array();
-#endif
+			array = text_lines(ctx);
 			if (array == NULL) {
 				json_object_put(object);
 				vfmtcl((void *)spawnTaskLog, ctx->task, AFB_SYSLOG_LEVEL_ERROR, "out of memory");
 				return;
 			}
 		} else {
-			int len = ctx->ctx->maxline - (int)json_object_array_length(array);
+			int len = ctx->ctx->opts.maxline - (int)json_object_array_length(array);
 			if (len <= 0) {
 				ctx->buf->overflowed = true;
 				json_object_put(object);
@@ -301,30 +940,309 @@ static void text_line_cb(void *closure, const char *line, size_t length)
 	}
 }
 
-/** process text input */
-encoder_error_t text_read(void *data, taskIdT *task, int fd, bool error)
+/** add one line of the tail */
+static void text_tail_cb(void *closure, const char *line, size_t length)
+{
+	TextTaskCtxT *ctx = closure;
+	json_object *array = text_lines(ctx);
+	json_object *object = utf8_string(ctx->ctx->opts.utf8, line, length);
+	if (array == NULL || object == NULL) {
+		json_object_put(object);
+		vfmtcl((void *)spawnTaskLog, ctx->task, AFB_SYSLOG_LEVEL_ERROR, "out of memory");
+	} else
+		json_object_array_add(array, object);
+}
+
+/** append the lines of the tail, after a marker if lines were skipped */
+static void text_end_tail(TextTaskCtxT *ctx)
+{
+	TextBufT *tbuf = ctx->buf;
+	if (tbuf->lines.dropped) {
+		tbuf->overflowed = true;
+		text_tail_cb(ctx, "...", 3);
+	}
+	line_ring_iter(&tbuf->lines, text_tail_cb, ctx);
+}
+
+/** add one line of the sample to the lines of its stream */
+static void text_sample_cb(void *closure, const char *line, size_t length, int tag)
+{
+	TextTaskCtxT *ctx = closure;
+	ctx->buf = tag ? &ctx->ctx->err : &ctx->ctx->out;
+	text_tail_cb(ctx, line, length);
+}
+
+/** append the lines of the samples */
+static void text_end_sample(TextTaskCtxT *ctx)
+{
+	line_sample_iter(&ctx->ctx->out.sample, text_sample_cb, ctx);
+	if (ctx->ctx->opts.stratified)
+		line_sample_iter(&ctx->ctx->err.sample, text_sample_cb, ctx);
+}
+
+/** JSON value of the count of bytes read */
+static json_object *text_bytes(TextBufT *tbuf)
+{
+	return json_object_new_int64((int64_t)(tbuf->buf.consumed + stream_buf_length(&tbuf->buf)));
+}
+
+/** JSON value of the count of skipped lines or bytes, NULL if none */
+static json_object *text_skipped(TextCtxT *ctx, TextBufT *tbuf)
+{
+	size_t skipped = ctx->mode == mode_text_raw ? tbuf->bytes.dropped : tbuf->lines.dropped;
+	return skipped ? json_object_new_int64((int64_t)skipped) : NULL;
+}
+
+/** create the JSON value of raw data, for bytes encoding, its afb data is stored in bytes */
+static json_object *text_raw_value(TextCtxT *ctx, const char *data, size_t length, afb_data_t *bytes)
+{
+	char *text;
+	json_object *value;
+
+	switch (ctx->opts.encoding) {
+	case encoding_bytes:
+		if (afb_create_data_copy(bytes, AFB_PREDEFINED_TYPE_BYTEARRAY, data, length) < 0)
+			return NULL;
+		return json_object_new_int64((int64_t)length);
+	case encoding_base64:
+		text = malloc(base64_encoded_length(length) + 1);
+		if (text == NULL)
+			return NULL;
+		length = base64_encode(data, length, text);
+		value = json_object_new_string_len(text, (int)length);
+		free(text);
+		return value;
+	default:
+		return utf8_string(ctx->opts.utf8, data, length);
+	}
+}
+
+/** encode raw bytes in the buffer of raw data, bounded by the maximum of raw bytes */
+static void text_raw_encode(TextBufT *tbuf, const char *data, size_t length)
+{
+	size_t avail = tbuf->rawmax - tbuf->rawlen;
+	if (length > avail) {
+		tbuf->overflowed = true;
+		length = avail;
+	}
+	tbuf->rawlen += length;
+	tbuf->buf.length += base64_encode_stream(&tbuf->b64, data, length, &tbuf->buf.data[tbuf->buf.length]);
+}
+
+/** add compressed bytes to the buffer of raw data, bounded by its capacity */
+static void text_raw_compressed_cb(void *closure, const char *data, size_t length)
+{
+	TextBufT *tbuf = closure;
+	size_t avail = stream_buf_capacity(&tbuf->buf) - stream_buf_length(&tbuf->buf);
+	if (tbuf->streamed) {
+		text_raw_encode(tbuf, data, length);
+		return;
+	}
+	if (length > avail) {
+		tbuf->overflowed = true;
+		length = avail;
+	}
+	memcpy(&tbuf->buf.data[tbuf->buf.length], data, length);
+	tbuf->buf.length += length;
+}
+
+/** add compressed bytes to the buffer of chunk data, growing it as needed */
+static void text_chunk_compressed_cb(void *closure, const char *data, size_t length)
+{
+	TextBufT *tbuf = closure;
+	if (stream_buf_ensure(&tbuf->buf, length) == NULL)
+		tbuf->overflowed = true;
+	else {
+		memcpy(&tbuf->buf.data[tbuf->buf.length], data, length);
+		tbuf->buf.length += length;
+	}
+}
+
+/** send the content of the chunk buffer as an event and reset it, last when no more data will come */
+static void text_chunk_emit(TextCtxT *ctx, taskIdT *task, TextBufT *tbuf, bool last)
+{
+	afb_data_t bytes = NULL;
+	json_object *object, *value;
+	size_t length = stream_buf_length(&tbuf->buf);
+
+	// a character cut at the end of the chunk is sent with the next one
+	if (!last && ctx->opts.encoding == encoding_text && ctx->opts.utf8 != utf8_none)
+		length -= utf8_incomplete(stream_buf_data(&tbuf->buf), length);
+	if (length == 0)
+		return;
+	value = text_raw_value(ctx, stream_buf_data(&tbuf->buf), length, &bytes);
+	stream_buf_consume(&tbuf->buf, length);
+	if (value == NULL) {
+		vfmtcl((void *)spawnTaskLog, task, AFB_SYSLOG_LEVEL_ERROR, "out of memory");
+		return;
+	}
+	rp_jsonc_pack(&object, "{so}", tbuf == &ctx->err ? "stderr" : "stdout", value);
+	spawnTaskPushEventData(task, object, bytes != NULL, &bytes);
+}
+
+/** process text input read by the core, the output after an overflow being dropped */
+encoder_error_t text_consume(void *data, taskIdT *task, const struct iovec *iov, int iovcnt, encoder_stream_t stream)
+{
+	TextTaskCtxT ctx = { .ctx = data, .task = task };
+	int idx;
+
+	ctx.buf = stream == ENCODER_STREAM_STDERR ? &ctx.ctx->err : &ctx.ctx->out;
+	if (ctx.ctx->opts.metadata)
+		meta_stamp(&ctx.ctx->meta);
+	for (idx = 0; idx < iovcnt && !ctx.buf->overflowed; idx++) {
+		if (ctx.ctx->frame != NULL)
+			record_frame_write(ctx.ctx->frame, &ctx.buf->buf, iov[idx].iov_base, iov[idx].iov_len,
+					   text_line_cb, &ctx);
+		else
+			line_buf_write(&ctx.buf->buf, iov[idx].iov_base, iov[idx].iov_len, text_line_cb, &ctx);
+	}
+	return ENCODER_NO_ERROR;
+}
+
+/** add raw bytes to the kept data: head, then tail, the output after an overflow being dropped */
+static void text_raw_write(TextCtxT *ctx, TextBufT *tbuf, const char *data, size_t length)
+{
+	size_t count;
+
+	if (tbuf->overflowed)
+		return;
+	if (tbuf->compress != NULL)
+		compress_buf_process(tbuf->compress, data, length, false, text_raw_compressed_cb, tbuf);
+	else if (tbuf->streamed)
+		text_raw_encode(tbuf, data, length);
+	else {
+		count = ctx->opts.keep != keep_tail ? stream_buf_write(&tbuf->buf, data, length) : 0;
+		if (count == length)
+			return;
+		if (ctx->opts.keep != keep_head)
+			byte_ring_write(&tbuf->bytes, &data[count], length - count);
+		else
+			tbuf->overflowed = true;
+	}
+}
+
+/** process raw input read by the core */
+encoder_error_t text_consume_raw(void *data, taskIdT *task, const struct iovec *iov, int iovcnt,
+				 encoder_stream_t stream)
+{
+	TextCtxT *ctx = data;
+	TextBufT *tbuf = stream == ENCODER_STREAM_STDERR ? &ctx->err : &ctx->out;
+	int idx;
+
+	for (idx = 0; idx < iovcnt; idx++)
+		text_raw_write(ctx, tbuf, iov[idx].iov_base, iov[idx].iov_len);
+	return ENCODER_NO_ERROR;
+}
+
+/** add raw bytes to the chunk buffer, sending it each time it is full */
+static void text_chunk_write(TextCtxT *ctx, taskIdT *task, TextBufT *tbuf, const char *data, size_t length)
+{
+	size_t count;
+
+	while (length > 0) {
+		count = stream_buf_write(&tbuf->buf, data, length);
+		data += count;
+		length -= count;
+
+		// a buffer too small for a cut character is sent as is
+		if (length > 0)
+			text_chunk_emit(ctx, task, tbuf, count == 0);
+	}
+}
+
+/** process raw input read by the core, by chunks */
+encoder_error_t text_consume_chunk(void *data, taskIdT *task, const struct iovec *iov, int iovcnt,
+				   encoder_stream_t stream)
 {
-	TextTaskCtxT ctx = { .ctx = data, .task = task };
-	ctx.buf = error ? &ctx.ctx->err : &ctx.ctx->out;
-	if (ctx.buf->overflowed)
-		drop_fd(fd);
-	else
-		line_buf_read(&ctx.buf->buf, fd, text_line_cb, &ctx);
+	TextCtxT *ctx = data;
+	TextBufT *tbuf = stream == ENCODER_STREAM_STDERR ? &ctx->err : &ctx->out;
+	int idx;
+
+	for (idx = 0; idx < iovcnt; idx++) {
+		if (tbuf->compress != NULL)
+			compress_buf_process(tbuf->compress, iov[idx].iov_base, iov[idx].iov_len, false,
+					     text_chunk_compressed_cb, tbuf);
+		else
+			text_chunk_write(ctx, task, tbuf, iov[idx].iov_base, iov[idx].iov_len);
+	}
+
+	// the compressed chunk is flushed so that clients can decode it on arrival
+	if (tbuf->compress != NULL)
+		compress_buf_process(tbuf->compress, NULL, 0, true, text_chunk_compressed_cb, tbuf);
+	text_chunk_emit(ctx, task, tbuf, false);
 	return ENCODER_NO_ERROR;
 }
 
-/** process raw input */
-encoder_error_t text_read_raw(void *data, taskIdT *task, int fd, bool error)
+/** terminate processing of chunks */
+static void text_end_chunk(TextCtxT *ctx, taskIdT *task, TextBufT *tbuf)
 {
-	TextCtxT *ctx = data;
-	TextBufT *tbuf = error ? &ctx->err : &ctx->out;
-	if (!stream_buf_is_full(&tbuf->buf))
-		stream_buf_read_fd(&tbuf->buf, fd);
-	else {
+	if (tbuf->compress != NULL)
+		compress_buf_end(tbuf->compress, text_chunk_compressed_cb, tbuf);
+	text_chunk_emit(ctx, task, tbuf, true);
+}
+
+/** name of the encoding reported in replies, NULL for text */
+static const char *text_encoding_name(TextEncodingT encoding)
+{
+	switch (encoding) {
+	case encoding_base64:
+		return "base64";
+	case encoding_bytes:
+		return "bytes";
+	default:
+		return NULL;
+	}
+}
+
+/** append the bytes of the tail to the raw data */
+static void text_end_raw_tail(TextBufT *tbuf)
+{
+	if (tbuf->bytes.dropped)
 		tbuf->overflowed = true;
-		drop_fd(fd);
+	if (stream_buf_ensure(&tbuf->buf, tbuf->bytes.length) != NULL)
+		tbuf->buf.length += byte_ring_copy(&tbuf->bytes, &tbuf->buf.data[tbuf->buf.length]);
+}
+
+/** JSON value of the raw data of the buffer, for bytes encoding, its afb data is stored in bytes */
+static json_object *text_raw_data(TextCtxT *ctx, TextBufT *tbuf, afb_data_t *bytes)
+{
+	if (!tbuf->streamed)
+		return text_raw_value(ctx, stream_buf_data(&tbuf->buf), stream_buf_length(&tbuf->buf), bytes);
+	tbuf->buf.length += base64_encode_stream_end(&tbuf->b64, &tbuf->buf.data[tbuf->buf.length]);
+	return json_object_new_string_len(stream_buf_data(&tbuf->buf), (int)stream_buf_length(&tbuf->buf));
+}
+
+/** terminate processing of raw data */
+static void text_end_raw(TextCtxT *ctx, taskIdT *task)
+{
+	unsigned ndata = 0;
+	afb_data_t bytes[2] = { NULL, NULL };
+	json_object *object;
+
+	if (ctx->out.compress != NULL)
+		compress_buf_end(ctx->out.compress, text_raw_compressed_cb, &ctx->out);
+	if (ctx->err.compress != NULL)
+		compress_buf_end(ctx->err.compress, text_raw_compressed_cb, &ctx->err);
+	if (ctx->opts.keep != keep_head) {
+		text_end_raw_tail(&ctx->out);
+		text_end_raw_tail(&ctx->err);
 	}
-	return ENCODER_NO_ERROR;
+
+	ctx->out.data = text_raw_data(ctx, &ctx->out, &bytes[0]);
+	ctx->err.data = text_raw_data(ctx, &ctx->err, &bytes[1]);
+	if (bytes[0] != NULL)
+		ndata++;
+	if (bytes[1] != NULL)
+		bytes[ndata++] = bytes[1];
+
+	rp_jsonc_pack(&object, "{so* so* so* so* so* so* ss* ss*}", "stdout", ctx->out.data, "stderr", ctx->err.data,
+		      "stdout-overflow", ctx->out.overflowed ? json_object_new_boolean(1) : NULL, "stderr-overflow",
+		      ctx->err.overflowed ? json_object_new_boolean(1) : NULL, "stdout-skipped",
+		      text_skipped(ctx, &ctx->out), "stderr-skipped", text_skipped(ctx, &ctx->err), "compress",
+		      ctx->opts.compress == compress_none ? NULL : compress_buf_method_name(ctx->opts.compress),
+		      "encoding", text_encoding_name(ctx->opts.encoding));
+	ctx->out.data = ctx->err.data = NULL;
+	spawnTaskReplyData(task, 0, object, ndata, bytes);
 }
 
 /** terminate processing */
@@ -333,32 +1251,60 @@ encoder_error_t text_end(void *data, taskIdT *task)
 	json_object *object;
 	TextCtxT *ctx = data;
 
-	if (ctx->mode == mode_text_raw) {
-		ctx->out.data =
-			json_object_new_string_len(stream_buf_data(&ctx->out.buf), stream_buf_length(&ctx->out.buf));
-		ctx->err.data =
-			json_object_new_string_len(stream_buf_data(&ctx->err.buf), stream_buf_length(&ctx->err.buf));
-	} else {
-		TextTaskCtxT tactx = { .ctx = ctx, .task = task };
-		tactx.buf = &ctx->err;
+	switch (ctx->mode) {
+	case mode_text_chunk:
+		text_end_chunk(ctx, task, &ctx->err);
+		text_end_chunk(ctx, task, &ctx->out);
+		return ENCODER_NO_ERROR;
+	case mode_text_raw:
+		text_end_raw(ctx, task);
+		return ENCODER_NO_ERROR;
+	default:
+		break;
+	}
+
+	TextTaskCtxT tactx = { .ctx = ctx, .task = task };
+	tactx.buf = &ctx->err;
+	if (ctx->frame != NULL)
+		record_frame_end(ctx->frame, &ctx->err.buf, text_line_cb, &tactx);
+	else
 		line_buf_end(&ctx->err.buf, text_line_cb, &tactx);
-		tactx.buf = &ctx->out;
+	tactx.buf = &ctx->out;
+	if (ctx->frame != NULL)
+		record_frame_end(ctx->frame, &ctx->out.buf, text_line_cb, &tactx);
+	else
 		line_buf_end(&ctx->out.buf, text_line_cb, &tactx);
+	if (ctx->opts.keep != keep_head) {
+		tactx.buf = &ctx->err;
+		text_end_tail(&tactx);
+		tactx.buf = &ctx->out;
+		text_end_tail(&tactx);
 	}
+	if (ctx->mode == mode_text_sample)
+		text_end_sample(&tactx);
+
 	switch (ctx->mode) {
-	case mode_text_raw:
 	case mode_text_sync:
 	case mode_text_event:
-		rp_jsonc_pack(&object, "{so* so* so* so*}", "stdout", ctx->out.data, "stderr", ctx->err.data,
+		rp_jsonc_pack(&object, "{so* so* so* so* so* so*}", "stdout", ctx->out.data, "stderr", ctx->err.data,
 			      "stdout-overflow", ctx->out.overflowed ? json_object_new_boolean(1) : NULL,
-			      "stderr-overflow", ctx->err.overflowed ? json_object_new_boolean(1) : NULL);
+			      "stderr-overflow", ctx->err.overflowed ? json_object_new_boolean(1) : NULL,
+			      "stdout-skipped", text_skipped(ctx, &ctx->out), "stderr-skipped",
+			      text_skipped(ctx, &ctx->err));
 		ctx->out.data = ctx->err.data = NULL;
 		if (ctx->mode == mode_text_event)
 			spawnTaskPushEventJSON(task, object);
 		else
 			spawnTaskReplyJSON(task, 0, object);
 		break;
-	case mode_text_line:
+	case mode_text_sample:
+		rp_jsonc_pack(&object, "{so* so* sI sI so so}", "stdout", ctx->out.data, "stderr", ctx->err.data,
+			      "stdout-lines", ctx->out.count, "stderr-lines", ctx->err.count, "stdout-bytes",
+			      text_bytes(&ctx->out), "stderr-bytes", text_bytes(&ctx->err));
+		ctx->out.data = ctx->err.data = NULL;
+		spawnTaskPushEventJSON(task, object);
+		break;
+	default:
 		break;
 	}
 
@@ -369,23 +1315,99 @@ encoder_error_t text_end(void *data, taskIdT *task)
 static void text_destroy(void *data)
 {
 	TextCtxT *ctx = data;
-	json_object_put(ctx->out.data);
-	json_object_put(ctx->err.data);
-	stream_buf_clear(&ctx->out.buf);
-	stream_buf_clear(&ctx->err.buf);
+	text_buf_clear(&ctx->out);
+	text_buf_clear(&ctx->err);
+	line_filter_free(ctx->filter);
+	record_frame_free(ctx->frame);
 	free(ctx);
 }
 
 /***************************************************************************************/
 
+/** options of json encoders */
+typedef struct {
+	/** maximum length of error lines */
+	int maxlen;
+	/** maximum depth of documents */
+	int maxdepth;
+	/** forward the documents without parsing */
+	bool passthrough;
+	/** emit the elements of top level arrays */
+	bool explode;
+	/** count of batches of lines decoded in parallel */
+	int workers;
+	/** maximum size of forwarded documents */
+	int maxsize;
+	/** selectors of fields */
+	json_object *select;
+	/** add time, sequence and offset to events */
+	bool metadata;
+	/** policy for stderr lines that aren't valid UTF-8 */
+	Utf8PolicyT utf8;
+} JsonOptsT;
+
 /** conjson of a json encoder */
 typedef struct {
+	/** options */
+	JsonOptsT opts;
 	/** tokenizer */
 	json_tokener *tokener;
 	/** buffer for errors */
 	stream_buf_t buf;
+	/** scanner of forwarded documents */
+	json_scan_t scan;
+	/** buffer of forwarded documents */
+	stream_buf_t doc;
+	/** documents are delimited by the scanner */
+	bool scanning;
+	/** skipping to the end of line after an error */
+	bool skipping;
+	/** selection of fields if any */
+	json_select_t *select;
+	/** buffer of selected fields of forwarded documents */
+	stream_buf_t fields;
+	/** protection of the batches decoded in parallel */
+	pthread_mutex_t mutex;
+	/** reading paused until a pending batch is done */
+	bool paused;
+	/** pending batches in order */
+	struct json_batch_s *head, **tail;
+	/** count of pending batches */
+	int inflight;
+	/** a thread is emitting the events of batches */
+	bool emitting;
+	/** metadata of events */
+	EventMetaT meta;
 } JsonCtxT;
 
+/** batch of lines decoded by a worker */
+typedef struct json_batch_s {
+	/** next batch in order */
+	struct json_batch_s *next;
+	/** the encoder context */
+	JsonCtxT *ctx;
+	/** the task */
+	taskIdT *task;
+	/** true when decoded */
+	bool done;
+	/** the decoded events */
+	json_object *events;
+	/** length of the text */
+	size_t length;
+	/** the lines */
+	char text[];
+} JsonBatchT;
+
+/** pool of workers shared by the tasks */
+static work_pool_t *json_pool;
+static pthread_once_t json_pool_once = PTHREAD_ONCE_INIT;
+
+static void json_pool_init(void)
+{
+	long count = sysconf(_SC_NPROCESSORS_ONLN);
+	json_pool = work_pool_create(count < 1 ? 1 : count > MAX_JSON_WORKERS ? MAX_JSON_WORKERS : (int)count);
+}
+
 /** pair of encoder conjson and task for callbacks */
 typedef struct {
 	/** the encoder conjson */
@@ -394,28 +1416,85 @@ typedef struct {
 	taskIdT *task;
 } JsonTaskCtxT;
 
-/** check options */
-static encoder_error_t json_check(json_object *options)
+/** read the options */
+static encoder_error_t json_options(json_object *options, JsonOptsT *opts)
 {
 	int err;
-	int maxlen = MAX_DOC_LINE_SIZE;
-	int maxdepth = JSON_TOKENER_DEFAULT_DEPTH;
-
+	const char *utf8 = NULL;
+
+	opts->maxlen = MAX_DOC_LINE_SIZE;
+	opts->maxdepth = JSON_TOKENER_DEFAULT_DEPTH;
+	opts->passthrough = false;
+	opts->explode = false;
+	opts->workers = 0;
+	opts->maxsize = MAX_JSON_DOC_SIZE;
+	opts->select = NULL;
+	opts->metadata = false;
+	opts->utf8 = utf8_replace;
 	if (options == NULL)
 		return ENCODER_NO_ERROR;
 
-	err = rp_jsonc_unpack(options, "{s?i s?i}", "maxlen", &maxlen, "maxdepth", &maxdepth);
-	if (err || maxlen <= 0 || maxdepth <= 0)
+	err = rp_jsonc_unpack(options, "{s?i s?i s?b s?b s?i s?o s?i s?b s?s}", "maxlen", &opts->maxlen, "maxdepth",
+			      &opts->maxdepth, "passthrough", &opts->passthrough, "explode-array", &opts->explode,
+			      "maxsize", &opts->maxsize, "select", &opts->select, "workers", &opts->workers, "metadata",
+			      &opts->metadata, "utf8", &utf8);
+	if (err || opts->maxlen <= 0 || opts->maxdepth <= 0 || opts->maxsize <= 0 || opts->workers < 0
+	    || !utf8_policy(utf8, &opts->utf8))
 		return ENCODER_ERROR_INVALID_OPTIONS;
+	// workers decode lines that are not scanned, their events are sent late by other threads
+	if (opts->workers > 0 && (opts->passthrough || opts->explode || opts->metadata))
+		return ENCODER_ERROR_INVALID_OPTIONS;
+	if ((opts->passthrough || opts->explode) && opts->maxdepth > JSON_SCAN_MAX_DEPTH)
+		return ENCODER_ERROR_INVALID_OPTIONS;
+
+	return ENCODER_NO_ERROR;
+}
+
+/** compile the selectors, a string or an array of strings */
+static encoder_error_t json_select_build(json_object *spec, json_select_t **select)
+{
+	json_select_t *sel;
+	json_object *item;
+	size_t idx, count;
 
+	sel = json_select_create();
+	if (sel == NULL)
+		return ENCODER_ERROR_OUT_OF_MEMORY;
+	count = json_object_is_type(spec, json_type_array) ? json_object_array_length(spec) : 1;
+	for (idx = 0; idx < count; idx++) {
+		item = json_object_is_type(spec, json_type_array) ? json_object_array_get_idx(spec, idx) : spec;
+		if (!json_object_is_type(item, json_type_string)
+		    || json_select_add(sel, json_object_get_string(item)) < 0) {
+			json_select_free(sel);
+			return ENCODER_ERROR_INVALID_OPTIONS;
+		}
+	}
+	*select = sel;
 	return ENCODER_NO_ERROR;
 }
 
+/** check options */
+static encoder_error_t json_check(json_object *options)
+{
+	JsonOptsT opts;
+	json_select_t *select;
+	encoder_error_t rc = json_options(options, &opts);
+
+	if (rc == ENCODER_NO_ERROR && opts.select != NULL) {
+		rc = json_select_build(opts.select, &select);
+		if (rc == ENCODER_NO_ERROR)
+			json_select_free(select);
+	}
+	return rc;
+}
+
+static void json_destroy(void *data);
+
 /** instanciate data */
 static encoder_error_t json_instanciate(const encoder_generator_t *generator, json_object *options, void **data)
 {
 	JsonCtxT *ctx;
-	int maxlen, maxdepth, err;
+	encoder_error_t rc;
 
 	/* allocate */
 	ctx = calloc(1, sizeof *ctx);
@@ -423,33 +1502,56 @@ static encoder_error_t json_instanciate(const encoder_generator_t *generator, js
 		return ENCODER_ERROR_OUT_OF_MEMORY;
 
 	/* init */
-	maxlen = MAX_DOC_LINE_SIZE;
-	maxdepth = JSON_TOKENER_DEFAULT_DEPTH;
-	if (options != NULL) {
-		err = rp_jsonc_unpack(options, "{s?i s?i}", "maxlen", &maxlen, "maxdepth", &maxdepth);
-		if (err || maxlen <= 0 || maxdepth <= 0) {
-			free(ctx);
-			return ENCODER_ERROR_INVALID_OPTIONS;
-		}
+	rc = json_options(options, &ctx->opts);
+	if (rc == ENCODER_NO_ERROR && ctx->opts.select != NULL)
+		rc = json_select_build(ctx->opts.select, &ctx->select);
+	if (rc != ENCODER_NO_ERROR) {
+		free(ctx);
+		return rc;
 	}
-	if (stream_buf_init(&ctx->buf, maxlen) != NULL) {
-		ctx->tokener = json_tokener_new_ex(maxdepth);
-		if (ctx->tokener != NULL) {
-			*data = ctx;
-			return ENCODER_NO_ERROR;
-		}
-		stream_buf_clear(&ctx->buf);
+
+	/* documents are parsed unless passed through, exploded arrays are split by the scanner */
+	ctx->scanning = ctx->opts.passthrough || ctx->opts.explode;
+	if (ctx->opts.workers > 0) {
+		pthread_once(&json_pool_once, json_pool_init);
+		pthread_mutex_init(&ctx->mutex, NULL);
+		ctx->tail = &ctx->head;
 	}
-	free(ctx);
+	if (stream_buf_init(&ctx->buf, (size_t)ctx->opts.maxlen) == NULL)
+		goto error;
+	if (!ctx->opts.passthrough) {
+		ctx->tokener = json_tokener_new_ex(ctx->opts.maxdepth);
+		if (ctx->tokener == NULL)
+			goto error;
+	}
+	if (ctx->opts.workers > 0 && stream_buf_init(&ctx->doc, (size_t)ctx->opts.maxsize) == NULL)
+		goto error;
+	if (ctx->scanning) {
+		json_scan_init(&ctx->scan, ctx->opts.maxdepth);
+		json_scan_split(&ctx->scan, ctx->opts.explode);
+		if (stream_buf_init(&ctx->doc, (size_t)ctx->opts.maxsize) == NULL)
+			goto error;
+		if (ctx->opts.passthrough && ctx->select != NULL
+		    && stream_buf_init(&ctx->fields, MAX_DOC_LINE_SIZE) == NULL)
+			goto error;
+	}
+	*data = ctx;
+	return ENCODER_NO_ERROR;
+
+error:
+	json_destroy(ctx);
 	return ENCODER_ERROR_OUT_OF_MEMORY;
 }
 
-static void json_emit(void *closure, json_object *object, const char *name)
+/** push an event with the object of name, offset in the stream when not negative is part of metadata */
+static void json_emit_at(void *closure, json_object *object, const char *name, int64_t offset)
 {
 	JsonTaskCtxT *ctx = closure;
 	json_object *event = json_object_new_object();
 	if (event != NULL) {
 		if (json_object_object_add(event, name, object) == 0) {
+			if (ctx->ctx->opts.metadata)
+				meta_add(&ctx->ctx->meta, event, offset);
 			spawnTaskPushEventJSON(ctx->task, event);
 			return;
 		}
@@ -459,10 +1561,29 @@ static void json_emit(void *closure, json_object *object, const char *name)
 	vfmtcl((void *)spawnTaskLog, ctx->task, AFB_SYSLOG_LEVEL_ERROR, "out of memory");
 }
 
-static void json_push_cb(void *closure, json_object *object)
+static void json_emit(void *closure, json_object *object, const char *name)
+{
+	json_emit_at(closure, object, name, -1);
+}
+
+/** push a document at offset in the stream (when not negative) */
+static void json_push_at(void *closure, json_object *object, int64_t offset)
 {
+	JsonTaskCtxT *ctx = closure;
+	json_object *selected;
+
+	if (object != NULL && ctx->ctx->select != NULL) {
+		selected = json_select_object(ctx->ctx->select, object);
+		json_object_put(object);
+		object = selected;
+	}
 	if (object != NULL)
-		json_emit(closure, object, "stdout");
+		json_emit_at(closure, object, "stdout", offset);
+}
+
+static void json_push_cb(void *closure, json_object *object)
+{
+	json_push_at(closure, object, -1);
 }
 
 static void json_err_cb(void *closure, const char *message)
@@ -472,17 +1593,339 @@ static void json_err_cb(void *closure, const char *message)
 
 static void json_line_cb(void *closure, const char *line, size_t length)
 {
-	json_emit(closure, json_object_new_string_len(line, length), "stderr");
+	JsonTaskCtxT *ctx = closure;
+	json_emit_at(closure, utf8_string(ctx->ctx->opts.utf8, line, length), "stderr",
+		     (int64_t)stream_buf_offset(&ctx->ctx->buf, line));
 }
 
-/** process json input */
-encoder_error_t json_read(void *data, taskIdT *task, int fd, bool error)
+/** parse a scanned document */
+static void json_pass_parse(JsonTaskCtxT *ctx, const char *doc, size_t length)
 {
-	JsonTaskCtxT ctx = { .ctx = data, .task = task };
-	if (error)
-		line_buf_read(&ctx.ctx->buf, fd, json_line_cb, &ctx);
+	json_tokener *tokener = ctx->ctx->tokener;
+	json_object *object;
+
+	json_tokener_reset(tokener);
+	object = json_tokener_parse_ex(tokener, doc, (int)length);
+	if (object == NULL && json_tokener_get_error(tokener) == json_tokener_continue)
+		object = json_tokener_parse_ex(tokener, "", 1); // terminates numbers
+	if (object != NULL)
+		json_push_at(ctx, object, (int64_t)stream_buf_offset(&ctx->ctx->doc, doc));
 	else
-		jsonc_buf_read(ctx.ctx->tokener, fd, json_push_cb, &ctx, json_err_cb);
+		json_err_cb(ctx, json_tokener_error_desc(json_tokener_get_error(tokener)));
+}
+
+/** forward a scanned document */
+static void json_pass_emit(JsonTaskCtxT *ctx, const char *doc, size_t length)
+{
+	const char *base = doc;
+	json_object *meta = NULL;
+
+	if (!ctx->ctx->opts.passthrough) {
+		json_pass_parse(ctx, doc, length);
+		return;
+	}
+	if (ctx->ctx->select != NULL) {
+		// selected fields are extracted from the text, skipping the other values
+		switch (json_select_text(ctx->ctx->select, doc, length, &ctx->ctx->fields)) {
+		case JSON_SELECT_DROP:
+			return;
+		case JSON_SELECT_FIELDS:
+			doc = stream_buf_data(&ctx->ctx->fields);
+			length = stream_buf_length(&ctx->ctx->fields);
+			break;
+		case JSON_SELECT_WHOLE:
+			break;
+		default:
+			vfmtcl((void *)spawnTaskLog, ctx->task, AFB_SYSLOG_LEVEL_ERROR, "out of memory");
+			return;
+		}
+	}
+	if (ctx->ctx->opts.metadata) {
+		meta = json_object_new_object();
+		if (meta != NULL)
+			meta_add(&ctx->ctx->meta, meta, (int64_t)stream_buf_offset(&ctx->ctx->doc, base));
+	}
+	spawnTaskPushEventRaw(ctx->task, meta, "stdout", doc, length);
+	json_object_put(meta);
+}
+
+/** scan the documents of the buffer from offset */
+static void json_pass_process(JsonTaskCtxT *ctx, size_t offset)
+{
+	stream_buf_t *sbuf = &ctx->ctx->doc;
+	char *data = stream_buf_data(sbuf), *eol;
+	size_t base = 0, pos = offset, last = stream_buf_length(sbuf), count;
+	int rc;
+
+	while (pos < last) {
+		// resynchronize at the next line after an error
+		if (ctx->ctx->skipping) {
+			eol = memchr(&data[pos], '\n', last - pos);
+			pos = base = eol == NULL ? last : (size_t)(eol - data) + 1;
+			ctx->ctx->skipping = eol == NULL;
+			continue;
+		}
+		rc = json_scan(&ctx->ctx->scan, &data[pos], last - pos, &count);
+		if (ctx->ctx->scan.begun)
+			base = pos + ctx->ctx->scan.begin;
+		pos += count;
+		if (rc == JSON_SCAN_DONE) {
+			json_pass_emit(ctx, &data[base], pos - base);
+			base = pos;
+		} else if (rc == JSON_SCAN_ERROR) {
+			json_err_cb(ctx, "invalid json");
+			json_scan_reset(&ctx->ctx->scan);
+			ctx->ctx->skipping = true;
+			base = pos;
+		}
+	}
+	// spaces and separators between documents are dropped
+	if (json_scan_idle(&ctx->ctx->scan))
+		base = pos;
+	stream_buf_consume(sbuf, base);
+}
+
+/** add bytes to the documents and forward the complete ones */
+static void json_pass_write(JsonTaskCtxT *ctx, const char *data, size_t length)
+{
+	stream_buf_t *sbuf = &ctx->ctx->doc;
+	size_t offset, count;
+
+	while (length > 0) {
+		offset = stream_buf_length(sbuf);
+		if (stream_buf_is_full(sbuf)) {
+			json_err_cb(ctx, "json document too large");
+			json_scan_reset(&ctx->ctx->scan);
+			stream_buf_consume(sbuf, offset);
+			ctx->ctx->skipping = true;
+			offset = 0;
+		}
+		count = stream_buf_write(sbuf, data, length);
+		data += count;
+		length -= count;
+		json_pass_process(ctx, offset);
+	}
+}
+
+/** forward the pending document at end */
+static void json_pass_end(JsonTaskCtxT *ctx)
+{
+	stream_buf_t *sbuf = &ctx->ctx->doc;
+	int rc = json_scan_end(&ctx->ctx->scan);
+	if (rc == JSON_SCAN_DONE)
+		json_pass_emit(ctx, stream_buf_data(sbuf), stream_buf_length(sbuf));
+	else if (rc == JSON_SCAN_ERROR)
+		json_err_cb(ctx, "truncated json");
+	json_scan_reset(&ctx->ctx->scan);
+	stream_buf_consume(sbuf, stream_buf_length(sbuf));
+}
+
+/** add an event to the batch */
+static void json_batch_add(JsonBatchT *batch, json_object *object, const char *name)
+{
+	json_object *event = json_object_new_object();
+	if (event != NULL) {
+		if (json_object_object_add(event, name, object) == 0) {
+			json_object_array_add(batch->events, event);
+			return;
+		}
+		json_object_put(event);
+	}
+	json_object_put(object);
+}
+
+/** emit the events of the decoded batches in order */
+static void json_batch_done(JsonBatchT *batch)
+{
+	JsonCtxT *ctx = batch->ctx;
+	taskIdT *task = batch->task;
+	size_t idx, count;
+	int emitted = 0;
+
+	pthread_mutex_lock(&ctx->mutex);
+	batch->done = true;
+	if (!ctx->emitting) {
+		ctx->emitting = true;
+		while (ctx->head != NULL && ctx->head->done) {
+			batch = ctx->head;
+			ctx->head = batch->next;
+			if (ctx->head == NULL)
+				ctx->tail = &ctx->head;
+			pthread_mutex_unlock(&ctx->mutex);
+			count = batch->events == NULL ? 0 : json_object_array_length(batch->events);
+			for (idx = 0; idx < count; idx++)
+				spawnTaskPushEventJSON(batch->task,
+						       json_object_get(json_object_array_get_idx(batch->events, idx)));
+			json_object_put(batch->events);
+			free(batch);
+			pthread_mutex_lock(&ctx->mutex);
+			ctx->inflight--;
+			emitted++;
+
+			// a batch slot is free again
+			if (ctx->paused) {
+				ctx->paused = false;
+				spawnTaskResume(task);
+			}
+		}
+		ctx->emitting = false;
+	}
+	pthread_mutex_unlock(&ctx->mutex);
+
+	// the last release may end the task and destroy the encoder
+	while (emitted-- > 0)
+		spawnTaskRelease(task);
+}
+
+/** decode the lines of a batch, in a worker thread */
+static void json_batch_work(void *arg)
+{
+	JsonBatchT *batch = arg;
+	json_tokener *tokener = json_tokener_new_ex(batch->ctx->opts.maxdepth);
+	enum json_tokener_error jerr;
+	char *line, *eol, *end = &batch->text[batch->length];
+	json_object *object, *selected;
+	size_t length;
+
+	batch->events = json_object_new_array();
+	for (line = batch->text; tokener != NULL && batch->events != NULL && line < end; line = eol + 1) {
+		eol = memchr(line, '\n', (size_t)(end - line));
+		if (eol == NULL)
+			eol = end;
+		length = (size_t)(eol - line);
+		if (strspn(line, " \t\r") >= length)
+			continue;
+		json_tokener_reset(tokener);
+		object = json_tokener_parse_ex(tokener, line, (int)length);
+		if (object == NULL && json_tokener_get_error(tokener) == json_tokener_continue)
+			object = json_tokener_parse_ex(tokener, "", 1); // terminates numbers
+		jerr = json_tokener_get_error(tokener);
+		if (jerr != json_tokener_success)
+			json_batch_add(batch, json_object_new_string(json_tokener_error_desc(jerr)), "json-error");
+		else if (object != NULL) {
+			if (batch->ctx->select != NULL) {
+				selected = json_select_object(batch->ctx->select, object);
+				json_object_put(object);
+				object = selected;
+			}
+			if (object != NULL)
+				json_batch_add(batch, object, "stdout");
+		}
+	}
+	if (tokener != NULL)
+		json_tokener_free(tokener);
+	json_batch_done(batch);
+}
+
+/** post the complete lines (or all the data at end) to the workers */
+static void json_batch_post(JsonTaskCtxT *ctx, bool all)
+{
+	JsonCtxT *jctx = ctx->ctx;
+	stream_buf_t *sbuf = &jctx->doc;
+	char *data = stream_buf_data(sbuf), *eol;
+	size_t length = stream_buf_length(sbuf);
+	JsonBatchT *batch;
+
+	if (!all) {
+		eol = length == 0 ? NULL : memrchr(data, '\n', length);
+		length = eol == NULL ? 0 : (size_t)(eol - data) + 1;
+	}
+	if (length == 0)
+		return;
+
+	batch = malloc(sizeof *batch + length + 1);
+	if (batch == NULL) {
+		vfmtcl((void *)spawnTaskLog, ctx->task, AFB_SYSLOG_LEVEL_ERROR, "out of memory");
+		stream_buf_consume(sbuf, length);
+		return;
+	}
+	batch->next = NULL;
+	batch->ctx = jctx;
+	batch->task = ctx->task;
+	batch->done = false;
+	batch->events = NULL;
+	batch->length = length;
+	memcpy(batch->text, data, length);
+	batch->text[length] = 0;
+	stream_buf_consume(sbuf, length);
+
+	// the task lasts until the events of the batch are pushed
+	spawnTaskHold(ctx->task);
+	pthread_mutex_lock(&jctx->mutex);
+	jctx->inflight++;
+	*jctx->tail = batch;
+	jctx->tail = &batch->next;
+	pthread_mutex_unlock(&jctx->mutex);
+
+	if (json_pool == NULL || work_pool_post(json_pool, json_batch_work, batch) < 0)
+		json_batch_work(batch);
+}
+
+/** check if too many batches are pending, then pausing the reading of the task */
+static bool json_batch_full(JsonTaskCtxT *ctx)
+{
+	JsonCtxT *jctx = ctx->ctx;
+	bool full;
+
+	pthread_mutex_lock(&jctx->mutex);
+	full = jctx->inflight >= 2 * jctx->opts.workers;
+	if (full && !jctx->paused) {
+		jctx->paused = true;
+		spawnTaskPause(ctx->task);
+	}
+	pthread_mutex_unlock(&jctx->mutex);
+	return full;
+}
+
+/** add bytes to the lines and post the complete ones to workers */
+static void json_batch_write(JsonTaskCtxT *ctx, const char *data, size_t length)
+{
+	stream_buf_t *sbuf = &ctx->ctx->doc;
+	size_t count;
+	char *eol;
+
+	while (length > 0) {
+		if (stream_buf_is_full(sbuf)) {
+			json_err_cb(ctx, "json document too large");
+			stream_buf_consume(sbuf, stream_buf_length(sbuf));
+			ctx->ctx->skipping = true;
+		}
+		count = stream_buf_write(sbuf, data, length);
+		data += count;
+		length -= count;
+		if (ctx->ctx->skipping) {
+			eol = memchr(stream_buf_data(sbuf), '\n', stream_buf_length(sbuf));
+			ctx->ctx->skipping = eol == NULL;
+			stream_buf_consume(sbuf, eol == NULL ? stream_buf_length(sbuf) :
+							       (size_t)(eol - stream_buf_data(sbuf)) + 1);
+		}
+		json_batch_post(ctx, false);
+	}
+}
+
+/** process json input read by the core */
+encoder_error_t json_consume(void *data, taskIdT *task, const struct iovec *iov, int iovcnt, encoder_stream_t stream)
+{
+	JsonTaskCtxT ctx = { .ctx = data, .task = task };
+	int idx;
+
+	if (ctx.ctx->opts.metadata)
+		meta_stamp(&ctx.ctx->meta);
+	for (idx = 0; idx < iovcnt; idx++) {
+		if (stream == ENCODER_STREAM_STDERR)
+			line_buf_write(&ctx.ctx->buf, iov[idx].iov_base, iov[idx].iov_len, json_line_cb, &ctx);
+		else if (ctx.ctx->scanning)
+			json_pass_write(&ctx, iov[idx].iov_base, iov[idx].iov_len);
+		else if (ctx.ctx->opts.workers > 0)
+			json_batch_write(&ctx, iov[idx].iov_base, iov[idx].iov_len);
+		else
+			jsonc_buf_process(ctx.ctx->tokener, iov[idx].iov_base, iov[idx].iov_len, json_push_cb, &ctx,
+					  json_err_cb);
+	}
+
+	// back pressure: the next output is left in the pipe until a worker is done
+	if (stream == ENCODER_STREAM_STDOUT && !ctx.ctx->scanning && ctx.ctx->opts.workers > 0)
+		json_batch_full(&ctx);
 	return ENCODER_NO_ERROR;
 }
 
@@ -491,7 +1934,14 @@ encoder_error_t json_end(void *data, taskIdT *task)
 {
 	JsonTaskCtxT ctx = { .ctx = data, .task = task };
 	line_buf_end(&ctx.ctx->buf, json_line_cb, &ctx);
-	jsonc_buf_end(ctx.ctx->tokener, json_push_cb, &ctx, json_err_cb);
+	if (ctx.ctx->scanning)
+		json_pass_end(&ctx);
+	else if (ctx.ctx->opts.workers > 0) {
+		// the pending batches hold the task, delaying its final status
+		if (!ctx.ctx->skipping)
+			json_batch_post(&ctx, true);
+	} else
+		jsonc_buf_end(ctx.ctx->tokener, json_push_cb, &ctx, json_err_cb);
 	return ENCODER_NO_ERROR;
 }
 
@@ -499,8 +1949,14 @@ encoder_error_t json_end(void *data, taskIdT *task)
 static void json_destroy(void *data)
 {
 	JsonCtxT *ctx = data;
-	json_tokener_free(ctx->tokener);
+	if (ctx->opts.workers > 0)
+		pthread_mutex_destroy(&ctx->mutex);
+	if (ctx->tokener != NULL)
+		json_tokener_free(ctx->tokener);
 	stream_buf_clear(&ctx->buf);
+	stream_buf_clear(&ctx->doc);
+	stream_buf_clear(&ctx->fields);
+	json_select_free(ctx->select);
 	free(ctx);
 }
 
@@ -523,8 +1979,8 @@ static /*const */ encoder_generator_t encoderBuiltin[] = {
 	  .info = "unique event at closure with all outputs",
 	  .check = text_check,
 	  .create = text_instanciate,
-	  .begin = NULL,
-	  .read = text_read,
+	  .begin = text_begin,
+	  .consume = text_consume,
 	  .end = text_end,
 	  .destroy = text_destroy,
 	  .synchronous = 0,
@@ -533,47 +1989,160 @@ static /*const */ encoder_generator_t encoderBuiltin[] = {
 	  .info = "return json data at cmd end",
 	  .check = text_check,
 	  .create = text_instanciate,
-	  .begin = NULL,
-	  .read = text_read,
+	  .begin = text_begin,
+	  .consume = text_consume,
 	  .end = text_end,
 	  .destroy = text_destroy,
 	  .synchronous = 1,
 	  .tuning = (void *)(intptr_t)mode_text_sync },
 	{ .uid = "LINE",
 	  .info = "one event per line",
-	  .check = text_check,
+	  .check = line_check,
 	  .create = text_instanciate,
-	  .begin = NULL,
-	  .read = text_read,
+	  .begin = text_begin,
+	  .consume = text_consume,
 	  .end = text_end,
 	  .destroy = text_destroy,
 	  .tuning = (void *)(intptr_t)mode_text_line },
+	{ .uid = "SAMPLE",
+	  .info = "unique event at closure with a uniform sample of lines",
+	  .check = sample_check,
+	  .create = text_instanciate,
+	  .begin = text_begin,
+	  .consume = text_consume,
+	  .end = text_end,
+	  .destroy = text_destroy,
+	  .tuning = (void *)(intptr_t)mode_text_sample },
 	{ .uid = "RAW",
 	  .info = "return raw data at cmd end",
-	  .check = text_check,
+	  .check = raw_check,
 	  .create = text_instanciate,
 	  .begin = NULL,
-	  .read = text_read_raw,
+	  .consume = text_consume_raw,
 	  .end = text_end,
 	  .destroy = text_destroy,
 	  .synchronous = 1,
 	  .tuning = (void *)(intptr_t)mode_text_raw },
+	{ .uid = "CHUNK",
+	  .info = "one event per block of raw data",
+	  .check = raw_check,
+	  .create = text_instanciate,
+	  .begin = NULL,
+	  .consume = text_consume_chunk,
+	  .end = text_end,
+	  .destroy = text_destroy,
+	  .tuning = (void *)(intptr_t)mode_text_chunk },
 	{ .uid = "JSON",
 	  .info = "one event per json blob",
 	  .check = json_check,
 	  .create = json_instanciate,
 	  .begin = NULL,
-	  .read = json_read,
+	  .consume = json_consume,
 	  .end = json_end,
 	  .destroy = json_destroy },
+	{ .uid = "CSV",
+	  .info = "one event per record of comma separated values",
+	  .check = table_check,
+	  .create = table_instanciate,
+	  .begin = NULL,
+	  .consume = table_consume,
+	  .end = table_end,
+	  .destroy = table_destroy,
+	  .tuning = (void *)(intptr_t)table_csv },
+	{ .uid = "TSV",
+	  .info = "one event per record of tabulation separated values",
+	  .check = table_check,
+	  .create = table_instanciate,
+	  .begin = NULL,
+	  .consume = table_consume,
+	  .end = table_end,
+	  .destroy = table_destroy,
+	  .tuning = (void *)(intptr_t)table_tsv },
+	{ .uid = "LOGFMT",
+	  .info = "one event per line of key=value pairs",
+	  .check = table_check,
+	  .create = table_instanciate,
+	  .begin = NULL,
+	  .consume = table_consume,
+	  .end = table_end,
+	  .destroy = table_destroy,
+	  .tuning = (void *)(intptr_t)table_logfmt },
+	{ .uid = "COLUMNS",
+	  .info = "one event per line of whitespace aligned columns",
+	  .check = table_check,
+	  .create = table_instanciate,
+	  .begin = NULL,
+	  .consume = table_consume,
+	  .end = table_end,
+	  .destroy = table_destroy,
+	  .tuning = (void *)(intptr_t)table_columns },
+	{ .uid = "NETSTRING",
+	  .info = "one event per netstring record",
+	  .check = netstring_check,
+	  .create = record_instanciate,
+	  .begin = NULL,
+	  .consume = record_consume,
+	  .end = record_end,
+	  .destroy = record_destroy,
+	  .tuning = (void *)(intptr_t)record_netstring },
+	{ .uid = "U32",
+	  .info = "one event per record prefixed by its little-endian 32 bits length",
+	  .check = u32_check,
+	  .create = record_instanciate,
+	  .begin = NULL,
+	  .consume = record_consume,
+	  .end = record_end,
+	  .destroy = record_destroy,
+	  .tuning = (void *)(intptr_t)record_u32 },
+	{ .uid = "CBOR",
+	  .info = "one event per CBOR item",
+	  .check = cbor_check,
+	  .create = record_instanciate,
+	  .begin = NULL,
+	  .consume = record_consume,
+	  .end = record_end,
+	  .destroy = record_destroy,
+	  .tuning = (void *)(intptr_t)record_cbor },
+	{ .uid = "DIFF",
+	  .info = "one event at closure with the changes from the previous run",
+	  .check = diff_check,
+	  .create = diff_instanciate,
+	  .begin = diff_begin,
+	  .consume = diff_consume,
+	  .end = diff_end,
+	  .destroy = diff_destroy },
+	{ .uid = "DEDUP",
+	  .info = "one event per line, repeated lines being counted",
+	  .check = dedup_check,
+	  .create = dedup_instanciate,
+	  .begin = NULL,
+	  .consume = dedup_consume,
+	  .end = dedup_end,
+	  .destroy = dedup_destroy },
+	{ .uid = "AGG",
+	  .info = "events of statistics of numeric fields",
+	  .check = agg_check,
+	  .create = agg_instanciate,
+	  .begin = agg_begin,
+	  .consume = agg_consume,
+	  .end = agg_end,
+	  .destroy = agg_destroy },
+	{ .uid = "PIPELINE",
+	  .info = "events of a chain of stages",
+	  .check = pipeline_check,
+	  .create = pipeline_instanciate,
+	  .begin = pipeline_begin,
+	  .consume = pipeline_consume,
+	  .end = pipeline_end,
+	  .destroy = pipeline_destroy },
 	{ .uid = "LOG",
 	  .info = "keep stdout/stderr on server",
 	  .check = log_check,
 	  .create = log_instanciate,
 	  .begin = log_begin,
-	  .read = log_read,
 	  .end = log_end,
-	  .destroy = log_destroy },
+	  .destroy = log_destroy,
+	  .consume = log_consume },
 	{ .uid = NULL } // must be null terminated
 };
 
@@ -635,12 +2204,46 @@ encoder_error_t encoder_generator_factory_add(const char *uid, const encoder_gen
 	return ENCODER_NO_ERROR;
 }
 
+// add a plugin encoder of ABI version 1, whose generators are the prefix of the current ones
+encoder_error_t encoder_generator_factory_add_v1(const char *uid, const encoder_generator_v1_t *generators)
+{
+	encoder_generator_t *copy;
+	size_t idx, count;
+
+	for (count = 0; generators[count].uid != NULL; count++)
+		;
+
+	// the copy of the generators gets the zeroed fields of the current version
+	copy = calloc(count + 1, sizeof *copy);
+	if (copy == NULL)
+		return ENCODER_ERROR_OUT_OF_MEMORY;
+	for (idx = 0; idx < count; idx++) {
+		copy[idx].uid = generators[idx].uid;
+		copy[idx].info = generators[idx].info;
+		copy[idx].synchronous = generators[idx].synchronous;
+		copy[idx].tuning = generators[idx].tuning;
+		copy[idx].check = generators[idx].check;
+		copy[idx].create = generators[idx].create;
+		copy[idx].begin = generators[idx].begin;
+		copy[idx].read = generators[idx].read;
+		copy[idx].end = generators[idx].end;
+		copy[idx].destroy = generators[idx].destroy;
+	}
+	return encoder_generator_factory_add(uid, copy);
+}
+
 // register callback and use it to register core encoders
 encoder_error_t encoder_generator_factory_init(void)
 {
 	return encoder_generator_factory_add(BUILTIN_FACTORY_NAME, encoderBuiltin);
 }
 
+// release the outputs kept between runs
+void encoder_generator_factory_exit(void)
+{
+	diff_states_clear();
+}
+
 // search the encoder in the registry
 encoder_error_t encoder_generator_search(const char *pluginuid, const char *encoderuid,
 					 const encoder_generator_t **generator)
@@ -681,7 +2284,7 @@ encoder_error_t encoder_generator_get(const char *pluginuid, const char *encoder
 		return ege;
 
 	// every encoder should define its formating callback
-	if (gener->read == NULL)
+	if (gener->read == NULL && gener->consume == NULL)
 		return ENCODER_ERROR_INVALID_ENCODER;
 
 	*generator = gener;
@@ -700,6 +2303,10 @@ encoder_error_t encoder_generator_get_JSON(json_object *specifier, const encoder
 		if (json_object_is_type(specifier, json_type_string)) {
 			// encoder is a string
 			encoderuid = json_object_get_string(specifier);
+		} else if (json_object_is_type(specifier, json_type_array)) {
+			// encoder is a chain of stages
+			encoderuid = "PIPELINE";
+			*options = specifier;
 		} else {
 			// encoder is a complex object with options
 			err = rp_jsonc_unpack(specifier, "{s?s,ss,s?o !}", "plugin", &pluginuid, "output", &encoderuid,
@@ -764,22 +2371,99 @@ int encoderStart(encoder_t *encoder, taskIdT *taskId)
 }
 
 /**
-* closes the encoder
+* closes the encoder, its output may be pushed later by other threads holding the task
 */
 void encoderClose(encoder_t *encoder, taskIdT *taskId)
 {
 	if (encoder->generator->end)
 		encoder->generator->end(encoder->data, taskId);
+}
+
+/**
+* ends the events of the encoder once its output is pushed
+*/
+void encoderFinish(encoder_t *encoder, taskIdT *taskId)
+{
 	if (!encoder->generator->synchronous)
 		spawnTaskPushFinalStatus(taskId, NULL);
 }
 
+/**
+* read the input in pooled blocks and give it to the encoder
+*/
+static encoder_error_t encoder_consume(encoder_t *encoder, taskIdT *taskId, int fd, encoder_stream_t stream)
+{
+	struct iovec blocks[MAX_READ_BLOCKS], slices[MAX_READ_BLOCKS];
+	encoder_error_t rc = ENCODER_NO_ERROR;
+	int idx, count;
+	size_t rest;
+	ssize_t sts;
+
+	for (count = 0; count < MAX_READ_BLOCKS; count++) {
+		blocks[count].iov_base = block_pool_get();
+		if (blocks[count].iov_base == NULL)
+			break;
+		blocks[count].iov_len = BLOCK_POOL_SIZE;
+	}
+	if (count == 0) {
+		vfmtcl((void *)spawnTaskLog, taskId, AFB_SYSLOG_LEVEL_ERROR, "out of memory");
+		drop_fd(fd);
+		return ENCODER_ERROR_OUT_OF_MEMORY;
+	}
+
+	// one system call fills all the blocks
+	while (!read_budget_exhausted()) {
+		sts = readv(fd, blocks, count);
+		if (sts <= 0) {
+			if (sts == 0 || errno != EINTR)
+				break;
+			continue;
+		}
+		for (idx = 0, rest = (size_t)sts; rest > 0; idx++) {
+			slices[idx].iov_base = blocks[idx].iov_base;
+			slices[idx].iov_len = rest < BLOCK_POOL_SIZE ? rest : BLOCK_POOL_SIZE;
+			rest -= slices[idx].iov_len;
+		}
+		read_budget_spend((size_t)sts);
+		rc = encoder->generator->consume(encoder->data, taskId, slices, idx, stream);
+
+		// a pipe gives all its available bytes, a short read drained it
+		// the next bytes wake the loop again, sparing the read failing with EAGAIN
+		// an encoder pausing the task exhausts the budget, stopping the loop
+		if (rc != ENCODER_NO_ERROR || (size_t)sts < (size_t)count * BLOCK_POOL_SIZE)
+			break;
+	}
+
+	for (idx = 0; idx < count; idx++)
+		block_pool_put(blocks[idx].iov_base);
+	return rc;
+}
+
 /**
 * process input
 */
 int encoderRead(encoder_t *encoder, taskIdT *taskId, int fd, bool error)
 {
+	if (encoder->generator->consume)
+		return encoder_consume(encoder, taskId, fd, error ? ENCODER_STREAM_STDERR : ENCODER_STREAM_STDOUT);
 	if (encoder->generator->read)
 		return encoder->generator->read(encoder->data, taskId, fd, error);
 	return 0;
 }
+
+/**
+* process input already read, for the encoders consuming it
+*/
+int encoderConsume(encoder_t *encoder, taskIdT *taskId, const struct iovec *iov, int iovcnt, bool error)
+{
+	return encoder->generator->consume(encoder->data, taskId, iov, iovcnt,
+					   error ? ENCODER_STREAM_STDERR : ENCODER_STREAM_STDOUT);
+}
+
+/**
+* tells if the encoder can process input read by others
+*/
+bool encoderConsumes(encoder_t *encoder)
+{
+	return encoder->generator->consume != NULL;
+}
@@ -23,6 +23,7 @@
 #define _SPAWN_ENCODER_S_INCLUDE_
 
 #include <stdbool.h>
+#include <sys/uio.h>
 #include <json-c/json.h>
 #include "spawn-binding.h"
 
@@ -49,9 +50,29 @@ extern const char *encoder_error_text(encoder_error_t code);
 
 /***************************************************************************/
 
+/**
+* version of the layout of encoder_generator_t
+* plugins must export it as 'const int spawnEncodersABI = ENCODER_ABI_VERSION;'
+* plugins of version 1 export 'const int spawnEncodersABI = 1;' and an array of encoder_generator_v1_t
+* plugins not exporting it are rejected, the size of their generators being unknown
+*/
+#define ENCODER_ABI_VERSION 2
+
+/***************************************************************************/
+
 typedef struct encoder encoder_t;
 typedef struct encoder_generator encoder_generator_t;
 
+/**
+* streams of the output of the command given to 'consume'
+*/
+typedef enum encoder_stream {
+	/** standard output of the command */
+	ENCODER_STREAM_STDOUT = 0,
+	/** standard error of the command */
+	ENCODER_STREAM_STDERR = 1,
+} encoder_stream_t;
+
 /***************************************************************************/
 
 struct encoder_generator {
@@ -88,8 +109,122 @@ struct encoder_generator {
 
 	/** destroy data */
 	void (*destroy)(void *data);
+
+	/**
+	* process input read by the core, replaces 'read' when not NULL (version 2)
+	* the slices are only valid during the call
+	*/
+	encoder_error_t (*consume)(void *data, taskIdT *taskId, const struct iovec *iov, int iovcnt,
+				   encoder_stream_t stream);
+};
+
+/**
+* layout of the generators of version 1, the prefix of encoder_generator_t
+*/
+typedef struct encoder_generator_v1 {
+	const char *uid;
+	const char *info;
+	int synchronous;
+	const void *tuning;
+	encoder_error_t (*check)(json_object *options);
+	encoder_error_t (*create)(const encoder_generator_t *generator, json_object *options, void **data);
+	encoder_error_t (*begin)(void *data, taskIdT *taskId);
+	encoder_error_t (*read)(void *data, taskIdT *taskId, int fd, bool error);
+	encoder_error_t (*end)(void *data, taskIdT *taskId);
+	void (*destroy)(void *data);
+} encoder_generator_v1_t;
+
+/***************************************************************************/
+
+/**
+* kinds of the items flowing between the stages of a pipeline
+*/
+typedef enum encoder_item {
+	/** bytes read from the output of the command, only consumed by the first stage */
+	ENCODER_ITEM_BYTES = 0,
+	/** records (lines or framed records) of stdout or stderr */
+	ENCODER_ITEM_RECORDS = 1,
+	/** JSON objects, the last stage pushes them as events */
+	ENCODER_ITEM_EVENTS = 2,
+} encoder_item_t;
+
+typedef struct encoder_flow encoder_flow_t;
+typedef struct encoder_stage encoder_stage_t;
+
+/**
+* A stage of an encoder pipeline, receiving items of its input kind
+* and giving items of its output kind to the next stage through the flow
+*/
+struct encoder_stage {
+	/** identifier of the stage */
+	const char *uid;
+
+	/** some text for documentation */
+	const char *info;
+
+	/** kind of the received items */
+	encoder_item_t input;
+
+	/** kind of the given items, never ENCODER_ITEM_BYTES */
+	encoder_item_t output;
+
+	/** check options */
+	encoder_error_t (*check)(json_object *options);
+
+	/** instanciate data */
+	encoder_error_t (*create)(const encoder_stage_t *stage, json_object *options, void **data);
+
+	/** begin processing */
+	encoder_error_t (*begin)(void *data, encoder_flow_t *flow);
+
+	/** process input bytes read by the core, only valid during the call (input ENCODER_ITEM_BYTES) */
+	encoder_error_t (*consume)(void *data, encoder_flow_t *flow, const struct iovec *iov, int iovcnt,
+				   encoder_stream_t stream);
+
+	/** process a record, only valid during the call (input ENCODER_ITEM_RECORDS) */
+	void (*record)(void *data, encoder_flow_t *flow, const char *record, size_t length, bool error);
+
+	/** process an event, the stage owns it (input ENCODER_ITEM_EVENTS) */
+	void (*event)(void *data, encoder_flow_t *flow, json_object *event);
+
+	/** terminate processing, flushing the pending items */
+	void (*end)(void *data, encoder_flow_t *flow);
+
+	/** destroy data */
+	void (*destroy)(void *data);
 };
 
+/**
+* Give a record to the next stage of the flow, the record isn't copied
+* @param flow the flow of the calling stage
+* @param record the record
+* @param length the length of the record
+* @param error true for records of stderr
+*/
+extern void encoder_flow_record(encoder_flow_t *flow, const char *record, size_t length, bool error);
+
+/**
+* Give an event to the next stage of the flow or push it after the last stage
+* @param flow the flow of the calling stage
+* @param event the event, given to the next stage
+*/
+extern void encoder_flow_event(encoder_flow_t *flow, json_object *event);
+
+/**
+* Get the task of the flow
+* @param flow the flow of the calling stage
+* @return the task
+*/
+extern taskIdT *encoder_flow_task(encoder_flow_t *flow);
+
+/**
+* Adds an array of pipeline stages under the given uid
+* @param uid the pluginuid
+* @param stages an array of stages terminated with an item of NULL uid
+* @return the error code, ENCODER_NO_ERROR if there is no error
+*/
+extern encoder_error_t encoder_stage_factory_add(const char *uid, const encoder_stage_t *stages);
+
 /***************************************************************************/
 
 /**
@@ -98,6 +233,11 @@ struct encoder_generator {
 */
 extern encoder_error_t encoder_generator_factory_init(void);
 
+/**
+* Release the outputs that the encoders keep between runs
+*/
+extern void encoder_generator_factory_exit(void);
+
 /**
 * Adds an array of generators under the given uid
 * @param uid the pluginuid
@@ -106,6 +246,14 @@ extern encoder_error_t encoder_generator_factory_init(void);
 */
 extern encoder_error_t encoder_generator_factory_add(const char *uid, const encoder_generator_t *generators);
 
+/**
+* Adds an array of generators of ABI version 1 under the given uid
+* @param uid the pluginuid
+* @param generators an array of generators of version 1 terminated with an item of NULL uid
+* @return the error code, ENCODER_NO_ERROR if there is no error
+*/
+extern encoder_error_t encoder_generator_factory_add_v1(const char *uid, const encoder_generator_v1_t *generators);
+
 /***************************************************************************/
 
 /**
@@ -173,6 +321,9 @@ extern void encoder_destroy(encoder_t *encoder);
 
 int encoderStart(encoder_t *encoder, taskIdT *taskId);
 void encoderClose(encoder_t *encoder, taskIdT *taskId);
+void encoderFinish(encoder_t *encoder, taskIdT *taskId);
 int encoderRead(encoder_t *encoder, taskIdT *taskId, int fd, bool error);
+int encoderConsume(encoder_t *encoder, taskIdT *taskId, const struct iovec *iov, int iovcnt, bool error);
+bool encoderConsumes(encoder_t *encoder);
 
 #endif /* _SPAWN_ENCODER_S_INCLUDE_ */
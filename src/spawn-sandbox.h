@@ -166,6 +166,25 @@ struct shellCmdS {
 	/** timeout in seconds */
 	int timeout;
 
+	/** bytes read from a pipe at each wakeup, 0 for no limit */
+	int readbudget;
+
+	/** flag if output is encoded by the offload workers */
+	int offload;
+
+	/** flag if output is read by the io_uring thread */
+	int uring;
+
+	/** last events replayed to late subscribers, disabled when lines is 0 */
+	struct {
+		/** count of events kept */
+		int lines;
+		/** total length of the events kept */
+		int bytes;
+		/** age in seconds of the events kept, 0 for no limit */
+		int time;
+	} replay;
+
 	/** intrinsec verbosity of the command */
 	int verbose;
 
@@ -27,6 +27,14 @@
 #include <uthash.h>
 #include <afb/afb-binding.h>
 
+#include "spawn-subtask.h"
+#include "lib/fd-pool.h"
+#include "lib/uring-pool.h"
+#include "lib/ring-buf.h"
+
+/** group of the clients subscribed to a task with a same filter */
+typedef struct eventGroupS eventGroupT;
+
 /**
 * Structure holding data of a command execution
 */
@@ -43,30 +51,63 @@ struct taskIdS {
 	/** verbosity of the task */
 	int verbose;
 
+	/** format of the events */
+	taskFormatE format;
+
 	/** flag if replied */
 	bool replied;
 
 	/** flag if timeout expired */
 	bool expired;
 
+	/** pipe from task stdout */
+	int outfd;
+
+	/** pipe from task stderr */
+	int errfd;
+
 	/** event handlers for pipe from task stdout */
 	afb_evfd_t srcout;
 
 	/** event handlers for pipe from task stderr */
 	afb_evfd_t srcerr;
 
+	/** pipes watched by the offload workers instead of srcout/srcerr */
+	fd_watch_t *offload;
+
+	/** pipes read by the io_uring thread instead of srcout/srcerr */
+	uring_watch_t *uring;
+
+	/** reading of the pipes paused by the encoder */
+	bool paused;
+
+	/** count of holds delaying the end of the task, one until its final response */
+	int holds;
+
 	/** encoder */
 	encoder_t *encoder;
 
 	/** timeout management data */
 	struct timeout_data *timeout;
 
+	/** arguments of the request */
+	json_object *argsJ;
+
 	/** request attached to the task */
 	afb_req_t request;
 
 	/** event attached to the task */
 	afb_event_t event;
 
+	/** events of the clients subscribed with a filter */
+	eventGroupT *groups;
+
+	/** last events replayed to late subscribers or NULL */
+	text_ring_t *replay;
+
+	/** replay's access protection, held while an event is kept or the kept ones are copied */
+	pthread_mutex_t replaymutex;
+
 	/** status */
 	json_object *statusJ;
 
@@ -83,4 +124,7 @@ extern taskIdT *globtids;
 /** globtids' access protection */
 extern pthread_rwlock_t globtidsem;
 
+/** allocates the replay of the events of the task for its command */
+extern int spawnTaskReplayInit(taskIdT *taskId);
+
 #endif /* _SPAWN_SUBTASK_INTERNAL_INCLUDE_ */
@@ -24,9 +24,12 @@
 #define _GNU_SOURCE
 
 #include <stdio.h>
+#include <string.h>
 #include <assert.h>
 #include <pthread.h>
 #include <signal.h>
+#include <time.h>
+#include <unistd.h>
 #include <sys/wait.h>
 
 #include "spawn-binding.h"
@@ -40,6 +43,10 @@
 #include "spawn-sandbox.h"
 #include "spawn-subtask.h"
 #include "spawn-subtask-internal.h"
+#include "spawn-encoders-internal.h"
+
+#include "lib/cbor.h"
+#include "lib/ring-buf.h"
 
 const nsKeyEnumT shSignals[] = {
 	{ "SIGTERM", SIGTERM },
@@ -70,6 +77,16 @@ void spawnTaskLog(taskIdT *taskId, int lvl, const char *fmt, va_list args)
 		afb_req_vverbose(taskId->request, lvl, NULL, 0, NULL, fmt, args);
 }
 
+json_object *spawnTaskArgs(taskIdT *taskId)
+{
+	return taskId->argsJ;
+}
+
+const char *spawnTaskUid(taskIdT *taskId)
+{
+	return taskId->uid;
+}
+
 static json_object *objmixin(json_object *dest, json_object *mixed)
 {
 	if (mixed != NULL) {
@@ -82,19 +99,714 @@ static json_object *objmixin(json_object *dest, json_object *mixed)
 	return dest;
 }
 
-static void send_task_event(taskIdT *taskId, json_object *object)
+/************************************************************************/
+/* SUBSCRIBER GROUPS */
+/************************************************************************/
+
+/** bits of the types of events */
+#define EVENT_TYPE_INITIAL 1
+#define EVENT_TYPE_DATA 2
+#define EVENT_TYPE_FINAL 4
+
+static const nsKeyEnumT eventTypes[] = {
+	{ "initial-event", EVENT_TYPE_INITIAL },
+	{ "data", EVENT_TYPE_DATA },
+	{ "final-event", EVENT_TYPE_FINAL },
+
+	{ NULL } // terminator
+};
+
+/** bits of the streams of the output */
+#define EVENT_STREAM_STDOUT 1
+#define EVENT_STREAM_STDERR 2
+
+/** what the filters look at in an event */
+typedef struct {
+	/** type of the event, one of EVENT_TYPE_... */
+	int type;
+	/** bits of the streams of the members of the event, 0 when it holds no output */
+	int streams;
+	/** true for the data events derived from the output without holding it ('batch', 'diff', 'agg'...) */
+	bool derived;
+	/** the event object or NULL when given as JSON text */
+	json_object *object;
+	/** its only output part when not an array or NULL */
+	json_object *value;
+	/** the output when given as JSON text */
+	const char *json;
+	/** length of json */
+	size_t length;
+} eventViewT;
+
+/** the events of the groups keeping an event */
+typedef struct {
+	/** count of the groups keeping the whole event */
+	int count;
+	/** their events */
+	afb_event_t events[MAX_EVENT_GROUPS];
+	/** count of the groups keeping a part of the event */
+	int nparts;
+	/** their events */
+	afb_event_t pevents[MAX_EVENT_GROUPS];
+	/** their parts of the event */
+	json_object *parts[MAX_EVENT_GROUPS];
+} eventSelectT;
+
+/** group of the clients subscribed to a task with a same filter */
+struct eventGroupS {
+	/** next group of the task */
+	eventGroupT *next;
+	/** the filter as given, identifying the group */
+	char *spec;
+	/** event of the group, named as the event of the task */
+	afb_event_t event;
+	/** 0 for both streams, else EVENT_STREAM_STDOUT or EVENT_STREAM_STDERR */
+	int stream;
+	/** mask of the types of events kept */
+	int types;
+	/** patterns searched in the output or NULL */
+	line_filter_t *match;
+	/** one data event out of sample is kept */
+	int sample;
+	/** count of data events kept by the other criteria */
+	unsigned seen;
+};
+
+/** groups' access protection */
+static pthread_mutex_t groups_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void group_free(eventGroupT *group)
+{
+	if (group->match)
+		line_filter_free(group->match);
+	if (group->event)
+		afb_event_unref(group->event);
+	free(group->spec);
+	free(group);
+}
+
+/** reads the criteria of the filter specification into the group */
+static int group_parse(eventGroupT *group, json_object *filterJ)
+{
+	const char *stream = NULL, *args = NULL;
+	json_object *typesJ = NULL, *matchJ = NULL, *item;
+	size_t idx, count;
+	int type;
+
+	group->sample = 1;
+	if (rp_jsonc_unpack(filterJ, "{s?s s?o s?o s?i !}", "stream", &stream, "events", &typesJ, "match", &matchJ,
+			    "sample", &group->sample)
+	    || group->sample < 1)
+		return -1;
+
+	if (stream == NULL)
+		group->stream = 0;
+	else if (!strcasecmp(stream, "stdout"))
+		group->stream = EVENT_STREAM_STDOUT;
+	else if (!strcasecmp(stream, "stderr"))
+		group->stream = EVENT_STREAM_STDERR;
+	else
+		return -1;
+
+	if (typesJ == NULL)
+		group->types = EVENT_TYPE_INITIAL | EVENT_TYPE_DATA | EVENT_TYPE_FINAL;
+	else {
+		count = json_object_is_type(typesJ, json_type_array) ? json_object_array_length(typesJ) : 1;
+		for (idx = 0; idx < count; idx++) {
+			item = json_object_is_type(typesJ, json_type_array) ? json_object_array_get_idx(typesJ, idx) : typesJ;
+			if (!json_object_is_type(item, json_type_string))
+				return -1;
+			type = enumMapValue(eventTypes, json_object_get_string(item));
+			if (type < 0)
+				return -1;
+			group->types |= type;
+		}
+	}
+
+	// the patterns are those of the filter of the text encoders
+	if (matchJ != NULL && (text_filter_create(matchJ, &group->match, &args) != ENCODER_NO_ERROR || args != NULL))
+		return -1;
+	return 0;
+}
+
+/** check the filter specification, returns 0 when valid */
+static int group_check(json_object *filterJ)
+{
+	int err;
+	eventGroupT *group = calloc(1, sizeof *group);
+
+	if (group == NULL)
+		return -1;
+	err = group_parse(group, filterJ);
+	group_free(group);
+	return err;
+}
+
+/** bit of the stream of the member of key ('stdout', 'stdout-lines'...), 0 when not about output */
+static int key_stream(const char *key)
+{
+	int stream;
+
+	if (!strncmp(key, "stdout", 6))
+		stream = EVENT_STREAM_STDOUT;
+	else if (!strncmp(key, "stderr", 6))
+		stream = EVENT_STREAM_STDERR;
+	else
+		return 0;
+	return key[6] == 0 || key[6] == '-' ? stream : 0;
+}
+
+/** check if the patterns of the group are found in the value, strings being matched without quotes */
+static bool group_match(eventGroupT *group, json_object *value)
+{
+	const char *text;
+
+	if (json_object_is_type(value, json_type_string))
+		return line_filter_match(group->match, json_object_get_string(value),
+					 (size_t)json_object_get_string_len(value));
+	text = json_object_to_json_string_ext(value, JSON_C_TO_STRING_PLAIN);
+	return line_filter_match(group->match, text, strlen(text));
+}
+
+/** check if the patterns of the group are found in a member of the derived event other than its envelope */
+static bool group_match_derived(eventGroupT *group, json_object *object)
+{
+	json_object_object_foreach(object, key, value) {
+		if (strcmp(key, "type") && strcmp(key, "pid") && group_match(group, value))
+			return true;
+	}
+	return false;
+}
+
+/** the members of the event kept by the group: the object itself when all, NULL when none, a new object else */
+static json_object *group_filter(eventGroupT *group, json_object *object)
+{
+	json_object *part, *array, *item;
+	bool parts = false, kept = false, whole = true;
+	size_t idx, count;
+	int stream;
+
+	part = json_object_new_object();
+	if (part == NULL)
+		return NULL;
+	json_object_object_foreach(object, key, value) {
+		stream = key_stream(key);
+		if (stream != 0 && group->stream != 0 && stream != group->stream) {
+			parts |= key[6] == 0;
+			whole = false;
+			continue;
+		}
+		if (stream == 0 || key[6] != 0 || group->match == NULL)
+			item = json_object_get(value);
+		else if (json_object_is_type(value, json_type_array)) {
+			// arrays of lines keep their matching lines
+			count = json_object_array_length(value);
+			array = json_object_new_array();
+			for (idx = 0; array != NULL && idx < count; idx++) {
+				item = json_object_array_get_idx(value, idx);
+				if (group_match(group, item))
+					json_object_array_add(array, json_object_get(item));
+			}
+			if (array != NULL && json_object_array_length(array) < count)
+				whole = false;
+			item = array;
+		} else
+			item = group_match(group, value) ? json_object_get(value) : NULL;
+
+		if (stream != 0 && key[6] == 0) {
+			parts = true;
+			if (item == NULL
+			    || (group->match != NULL && json_object_is_type(item, json_type_array)
+				&& !json_object_array_length(item))) {
+				json_object_put(item);
+				whole = false;
+				continue;
+			}
+		}
+		kept |= stream != 0;
+		json_object_object_add(part, key, item);
+	}
+
+	// an event holding output parts is dropped when none is kept, a summary when none of its streams is
+	if (parts ? json_object_object_get_ex(part, "stdout", NULL) || json_object_object_get_ex(part, "stderr", NULL)
+		  : kept) {
+		if (!whole)
+			return part;
+		json_object_put(part);
+		return object;
+	}
+	json_object_put(part);
+	return NULL;
+}
+
+/** check if the group keeps the event, setting part to what it keeps of it when not the whole event */
+static bool group_keeps(eventGroupT *group, const eventViewT *view, json_object **part)
+{
+	json_object *kept;
+
+	*part = NULL;
+	if (!(group->types & view->type))
+		return false;
+
+	// events not holding output are only filtered by their type
+	if (view->streams != 0) {
+		if (group->stream != 0 && !(view->streams & group->stream))
+			return false;
+		if (view->object == NULL) {
+			if (group->match != NULL && !line_filter_match(group->match, view->json, view->length))
+				return false;
+		} else if (view->derived) {
+			if (group->match != NULL && !group_match_derived(group, view->object))
+				return false;
+		} else if (view->value != NULL) {
+			if (group->match != NULL && !group_match(group, view->value))
+				return false;
+		} else if (group->match != NULL || (group->stream != 0 && view->streams != group->stream)) {
+			kept = group_filter(group, view->object);
+			if (kept == NULL)
+				return false;
+			if (kept != view->object)
+				*part = kept;
+		}
+	}
+	if (view->type != EVENT_TYPE_DATA || group->seen++ % (unsigned)group->sample == 0)
+		return true;
+	json_object_put(*part);
+	*part = NULL;
+	return false;
+}
+
+/** view of the event object of the given type */
+static void view_object(eventViewT *view, int type, json_object *object)
+{
+	int stream, parts = 0;
+
+	view->type = type;
+	view->streams = 0;
+	view->derived = false;
+	view->object = object;
+	view->value = NULL;
+	view->json = NULL;
+	view->length = 0;
+	if (type != EVENT_TYPE_DATA)
+		return;
+
+	// each member is classified by its key, the output being in 'stdout' and 'stderr'
+	json_object_object_foreach(object, key, value) {
+		stream = key_stream(key);
+		view->streams |= stream;
+		if (stream != 0 && key[6] == 0 && parts++ == 0 && !json_object_is_type(value, json_type_array))
+			view->value = value;
+	}
+	if (parts != 1 || view->streams == (EVENT_STREAM_STDOUT | EVENT_STREAM_STDERR))
+		view->value = NULL;
+
+	// the encoders make the other data events from stdout
+	if (view->streams == 0) {
+		view->streams = EVENT_STREAM_STDOUT;
+		view->derived = true;
+	}
+}
+
+/** selects the groups keeping the event */
+static void groups_select(taskIdT *taskId, const eventViewT *view, eventSelectT *select)
+{
+	eventGroupT *group;
+	json_object *part;
+
+	select->count = select->nparts = 0;
+
+	// tasks without filtered subscribers don't pay for the lock
+	if (taskId->groups == NULL)
+		return;
+
+	pthread_mutex_lock(&groups_mutex);
+	for (group = taskId->groups; group != NULL; group = group->next)
+		if (group_keeps(group, view, &part)) {
+			if (part == NULL)
+				select->events[select->count++] = group->event;
+			else {
+				select->pevents[select->nparts] = group->event;
+				select->parts[select->nparts++] = part;
+			}
+		}
+	pthread_mutex_unlock(&groups_mutex);
+}
+
+/** subscribes the client to the events of the task kept by the filter, instead of its other subscriptions */
+static int groups_subscribe(afb_req_t request, taskIdT *taskId, json_object *filterJ)
+{
+	eventGroupT *group, *found = NULL, **prev;
+	const char *spec = NULL;
+	int count = 0, err;
+
+	if (filterJ != NULL)
+		spec = json_object_to_json_string_ext(filterJ, JSON_C_TO_STRING_PLAIN);
+
+	pthread_mutex_lock(&groups_mutex);
+	for (prev = &taskId->groups; (group = *prev) != NULL; prev = &group->next, count++) {
+		if (spec != NULL && !strcmp(group->spec, spec))
+			found = group;
+		else
+			afb_req_unsubscribe(request, group->event);
+	}
+	if (spec == NULL) {
+		pthread_mutex_unlock(&groups_mutex);
+		return afb_req_subscribe(request, taskId->event);
+	}
+
+	// the group of the filter is created by its first subscriber
+	if (found == NULL) {
+		if (count >= MAX_EVENT_GROUPS) {
+			AFB_REQ_ERROR(request, "uid='%s' too many subscription filters", taskId->uid);
+			goto OnErrorExit;
+		}
+		found = calloc(1, sizeof *found);
+		if (found == NULL)
+			goto OnErrorExit;
+		found->spec = strdup(spec);
+		if (found->spec == NULL || group_parse(found, filterJ)
+		    || afb_api_new_event(afb_req_get_api(taskId->request), taskId->cmd->apiverb, &found->event) < 0) {
+			group_free(found);
+			goto OnErrorExit;
+		}
+		*prev = found;
+	}
+	err = afb_req_subscribe(request, found->event);
+	pthread_mutex_unlock(&groups_mutex);
+	if (!err)
+		afb_req_unsubscribe(request, taskId->event);
+	return err;
+
+OnErrorExit:
+	pthread_mutex_unlock(&groups_mutex);
+	return -1;
+}
+
+/** unsubscribes the client from all the events of the task */
+static int groups_unsubscribe(afb_req_t request, taskIdT *taskId)
+{
+	eventGroupT *group;
+
+	pthread_mutex_lock(&groups_mutex);
+	for (group = taskId->groups; group != NULL; group = group->next)
+		afb_req_unsubscribe(request, group->event);
+	pthread_mutex_unlock(&groups_mutex);
+	return afb_req_unsubscribe(request, taskId->event);
+}
+
+static void groups_free(taskIdT *taskId)
 {
-	afb_data_t data = afb_data_json_c_hold(object);
-	int count = afb_event_push(taskId->event, 1, &data);
+	eventGroupT *group;
+
+	pthread_mutex_lock(&groups_mutex);
+	while ((group = taskId->groups) != NULL) {
+		taskId->groups = group->next;
+		group_free(group);
+	}
+	pthread_mutex_unlock(&groups_mutex);
+}
+
+/************************************************************************/
+/* REPLAY TO LATE SUBSCRIBERS */
+/************************************************************************/
+
+/** CLOCK_MONOTONIC time in nanoseconds */
+static uint64_t replay_now(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000 + (uint64_t)now.tv_nsec;
+}
+
+int spawnTaskReplayInit(taskIdT *taskId)
+{
+	shellCmdT *cmd = taskId->cmd;
+
+	taskId->replay = malloc(sizeof *taskId->replay);
+	if (taskId->replay == NULL)
+		return -1;
+	pthread_mutex_init(&taskId->replaymutex, NULL);
+	if (text_ring_init(taskId->replay, (size_t)cmd->replay.lines, (size_t)cmd->replay.bytes,
+			   (uint64_t)cmd->replay.time * 1000000000)
+	    == NULL) {
+		pthread_mutex_destroy(&taskId->replaymutex);
+		free(taskId->replay);
+		taskId->replay = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+/** locks the replay of the task from the selection of the groups to the push of the event */
+static void replay_lock(taskIdT *taskId)
+{
+	if (taskId->replay != NULL)
+		pthread_mutex_lock(&taskId->replaymutex);
+}
+
+static void replay_unlock(taskIdT *taskId)
+{
+	if (taskId->replay != NULL)
+		pthread_mutex_unlock(&taskId->replaymutex);
+}
+
+/** closure of replay_add */
+typedef struct {
+	json_object *events;
+	json_tokener *tokener;
+	/** criteria of the filter of the subscriber or NULL */
+	eventGroupT *group;
+} replayAddT;
+
+static void replay_add(void *closure, const char *text, size_t length)
+{
+	replayAddT *add = closure;
+	json_object *event, *typeJ, *part;
+	eventViewT view;
+	int type;
+
+	json_tokener_reset(add->tokener);
+	event = json_tokener_parse_ex(add->tokener, text, (int)length);
+	if (event == NULL)
+		return;
+
+	// filtered subscribers get the kept events as they would have got them
+	if (add->group != NULL) {
+		type = json_object_object_get_ex(event, "type", &typeJ)
+			       ? enumMapValue(eventTypes, json_object_get_string(typeJ))
+			       : -1;
+		if (type < 0) {
+			json_object_put(event);
+			return;
+		}
+		view_object(&view, type, event);
+		if (!group_keeps(add->group, &view, &part)) {
+			json_object_put(event);
+			return;
+		}
+		if (part != NULL) {
+			json_object_put(event);
+			event = part;
+		}
+	}
+	json_object_array_add(add->events, event);
+}
+
+/** subscribes the client to the events of the task kept by the filter, returning those kept until then */
+static int replay_subscribe(afb_req_t request, taskIdT *taskId, json_object *filterJ, json_object **eventsJ)
+{
+	replayAddT add = { .group = NULL };
+	int err;
+
+	// the kept events are filtered by a group of their own, not counting in the sampling of the shared one
+	if (filterJ != NULL) {
+		add.group = calloc(1, sizeof *add.group);
+		if (add.group == NULL || group_parse(add.group, filterJ)) {
+			if (add.group != NULL)
+				group_free(add.group);
+			return -1;
+		}
+	}
+
+	// the senders hold the lock from the selection to the push: the events kept until now are replayed, the next
+	// ones are received by the client
+	pthread_mutex_lock(&taskId->replaymutex);
+	err = groups_subscribe(request, taskId, filterJ);
+	if (!err) {
+		add.events = json_object_new_array();
+		add.tokener = json_tokener_new();
+		if (add.tokener != NULL) {
+			text_ring_iter(taskId->replay, replay_now(), replay_add, &add);
+			json_tokener_free(add.tokener);
+		}
+		*eventsJ = add.events;
+	}
+	pthread_mutex_unlock(&taskId->replaymutex);
+	if (add.group != NULL)
+		group_free(add.group);
+	return err;
+}
+
+/************************************************************************/
+/*  */
+/************************************************************************/
+
+static afb_data_t event_data(taskIdT *taskId, json_object *object);
+
+/**
+ * pushes the event of the given JSON text to the subscribers of the task and of the selected groups,
+ * the caller holding the lock of the replay so that a late subscriber gets it either replayed or live
+ */
+static void push_task_event(taskIdT *taskId, const char *text, size_t length, eventSelectT *select, unsigned nparams,
+			    afb_data_t const params[])
+{
+	int idx, err, count = 0;
+	unsigned iparam;
+	afb_data_t pparams[nparams];
+
+	// events with attached data aren't kept, their text lacking the data
+	if (taskId->replay != NULL && text != NULL) {
+		err = text_ring_push(taskId->replay, replay_now(), text, length);
+		if (err < 0)
+			AFB_REQ_ERROR(taskId->request, "uid='%s' can't keep the event for replay", taskId->uid);
+	}
+
+	// each push consumes a reference of the data
+	for (idx = 0; idx < select->count; idx++) {
+		for (iparam = 0; iparam < nparams; iparam++)
+			afb_data_addref(params[iparam]);
+		count += afb_event_push(select->events[idx], nparams, params) > 0;
+	}
+
+	// the groups keeping a part of the event get it with the attached data
+	for (idx = 0; idx < select->nparts; idx++) {
+		pparams[0] = event_data(taskId, select->parts[idx]);
+		for (iparam = 1; iparam < nparams; iparam++)
+			pparams[iparam] = afb_data_addref(params[iparam]);
+		count += afb_event_push(select->pevents[idx], nparams, pparams) > 0;
+	}
+	count += afb_event_push(taskId->event, nparams, params) > 0;
 	if (!count && taskId->verbose > 4)
 		AFB_REQ_NOTICE(taskId->request, "uid='%s' no client listening", taskId->uid);
 }
 
-void spawnTaskPushEventJSON(taskIdT *taskId, json_object *object)
+/** converts CBOR data to JSON-C for clients that didn't opt in */
+static int cbor_to_json_c(void *closure, afb_data_t from, afb_type_t type, afb_data_t *to)
+{
+	json_object *object = cbor_to_json(afb_data_ro_pointer(from), afb_data_size(from));
+	*to = afb_data_json_c_hold(object);
+	return *to == NULL ? AFB_ERRNO_OUT_OF_MEMORY : 0;
+}
+
+/** the type of CBOR data */
+static afb_type_t cbor_type = NULL;
+
+static void register_cbor_type(void)
+{
+	if (afb_type_lookup(&cbor_type, "application/cbor") < 0) {
+		if (afb_type_register(&cbor_type, "application/cbor", Afb_Type_Flags_Shareable | Afb_Type_Flags_Streamable)
+		    < 0)
+			cbor_type = NULL;
+		else
+			afb_type_add_converter(cbor_type, AFB_PREDEFINED_TYPE_JSON_C, cbor_to_json_c, NULL);
+	}
+}
+
+/** the event data of the object for the format of the task */
+static afb_data_t event_data(taskIdT *taskId, json_object *object)
+{
+	static pthread_once_t once = PTHREAD_ONCE_INIT;
+	unsigned char *buffer;
+	afb_data_t data;
+	size_t size;
+
+	if (taskId->format == SPAWN_FORMAT_CBOR) {
+		pthread_once(&once, register_cbor_type);
+		size = cbor_from_json(object, NULL, 0);
+		if (cbor_type != NULL && afb_create_data_alloc(&data, cbor_type, (void **)&buffer, size) >= 0) {
+			cbor_from_json(object, buffer, size);
+			json_object_put(object);
+			return data;
+		}
+		AFB_REQ_ERROR(taskId->request, "uid='%s' can't create CBOR event data", taskId->uid);
+	}
+	return afb_data_json_c_hold(object);
+}
+
+static void send_task_event(taskIdT *taskId, int type, json_object *object, unsigned ndata, afb_data_t const data[])
+{
+	unsigned idx;
+	afb_data_t params[1 + ndata];
+	eventSelectT select;
+	eventViewT view;
+	const char *text = NULL;
+	size_t length = 0;
+	bool keep = taskId->replay != NULL && ndata == 0;
+
+	// the groups and the replay look at the object before its conversion
+	replay_lock(taskId);
+	view_object(&view, type, object);
+	groups_select(taskId, &view, &select);
+	if (keep) {
+		text = json_object_to_json_string_ext(object, JSON_C_TO_STRING_PLAIN);
+		length = strlen(text);
+		json_object_get(object);
+	}
+
+	params[0] = event_data(taskId, object);
+	for (idx = 0; idx < ndata; idx++)
+		params[idx + 1] = data[idx];
+	push_task_event(taskId, text, length, &select, 1 + ndata, params);
+	replay_unlock(taskId);
+	if (keep)
+		json_object_put(object);
+}
+
+void spawnTaskPushEventData(taskIdT *taskId, json_object *object, unsigned ndata, afb_data_t const data[])
 {
 	json_object *event;
 	rp_jsonc_pack(&event, "{ss si}", "type", "data", "pid", taskId->pid);
-	send_task_event(taskId, objmixin(event, object));
+	send_task_event(taskId, EVENT_TYPE_DATA, objmixin(event, object), ndata, data);
+}
+
+void spawnTaskPushEventJSON(taskIdT *taskId, json_object *object)
+{
+	spawnTaskPushEventData(taskId, object, 0, NULL);
+}
+
+/** the envelope of the raw events: pid, members of extra, comma when any, name of the text */
+#define RAW_EVENT_PREFIX "{\"type\":\"data\",\"pid\":%d,%.*s%s\"%s\":"
+
+void spawnTaskPushEventRaw(taskIdT *taskId, json_object *extra, const char *name, const char *json, size_t length)
+{
+	char *buffer;
+	const char *members = "{}";
+	afb_data_t data;
+	json_object *object, *value;
+	eventSelectT select;
+	eventViewT view;
+	int plen, mlen;
+
+	// CBOR events are encoded from the parsed value
+	if (taskId->format == SPAWN_FORMAT_CBOR) {
+		buffer = strndup(json, length);
+		value = buffer == NULL ? NULL : json_tokener_parse(buffer);
+		free(buffer);
+		rp_jsonc_pack(&object, "{so*}", name, value);
+		if (extra != NULL)
+			rp_jsonc_object_merge(object, extra, rp_jsonc_merge_option_replace);
+		spawnTaskPushEventJSON(taskId, object);
+		return;
+	}
+
+	// the envelope of spawnTaskPushEventData and the members of extra are written around the text
+	if (extra != NULL)
+		members = json_object_to_json_string_ext(extra, JSON_C_TO_STRING_PLAIN);
+	mlen = (int)strlen(members) - 2;
+	plen = snprintf(NULL, 0, RAW_EVENT_PREFIX, taskId->pid, mlen, &members[1], mlen ? "," : "", name);
+	if (plen < 0
+	    || afb_create_data_alloc(&data, AFB_PREDEFINED_TYPE_JSON, (void **)&buffer, (size_t)plen + length + 2) < 0) {
+		AFB_REQ_ERROR(taskId->request, "uid='%s' can't create event data", taskId->uid);
+		return;
+	}
+	snprintf(buffer, (size_t)plen + 1, RAW_EVENT_PREFIX, taskId->pid, mlen, &members[1], mlen ? "," : "", name);
+	memcpy(&buffer[plen], json, length);
+	buffer[(size_t)plen + length] = '}';
+	buffer[(size_t)plen + length + 1] = 0;
+
+	// the text is the output of the stream of name, derived events being made from stdout
+	view.type = EVENT_TYPE_DATA;
+	view.streams = key_stream(name) ?: EVENT_STREAM_STDOUT;
+	view.derived = false;
+	view.object = NULL;
+	view.value = NULL;
+	view.json = json;
+	view.length = length;
+	replay_lock(taskId);
+	groups_select(taskId, &view, &select);
+	push_task_event(taskId, buffer, (size_t)plen + length + 1, &select, 1, &data);
+	replay_unlock(taskId);
 }
 
 void spawnTaskPushInitialStatus(taskIdT *taskId, json_object *object)
@@ -103,7 +815,7 @@ void spawnTaskPushInitialStatus(taskIdT *taskId, json_object *object)
 	rp_jsonc_pack(&event, "{ss ss ss ss si}", "type", "initial-event", "api",
 		      afb_req_get_called_api(taskId->request), "sandbox", taskId->cmd->sandbox->uid, "command",
 		      taskId->cmd->uid, "pid", taskId->pid);
-	send_task_event(taskId, objmixin(event, object));
+	send_task_event(taskId, EVENT_TYPE_INITIAL, objmixin(event, object), 0, NULL);
 }
 
 void spawnTaskPushFinalStatus(taskIdT *taskId, json_object *object)
@@ -111,16 +823,18 @@ void spawnTaskPushFinalStatus(taskIdT *taskId, json_object *object)
 	json_object *event;
 	rp_jsonc_pack(&event, "{ss si so*}", "type", "final-event", "pid", taskId->pid, "status", taskId->statusJ);
 	taskId->statusJ = NULL;
-	send_task_event(taskId, objmixin(event, object));
+	send_task_event(taskId, EVENT_TYPE_FINAL, objmixin(event, object), 0, NULL);
 }
 
-void spawnTaskReplyJSON(taskIdT *taskId, int status, json_object *object)
+void spawnTaskReplyData(taskIdT *taskId, int status, json_object *object, unsigned ndata, afb_data_t const data[])
 {
 	if (taskId->replied) {
 		AFB_REQ_NOTICE(taskId->request, "uid='%s' already replied", taskId->uid);
 		json_object_put(object);
+		afb_data_array_unref(ndata, data);
 	} else {
-		afb_data_t data;
+		unsigned idx;
+		afb_data_t params[1 + ndata];
 		json_object *reply;
 
 		rp_jsonc_pack(&reply, "{ss ss ss si so*}", "api", afb_req_get_called_api(taskId->request), "sandbox",
@@ -128,12 +842,19 @@ void spawnTaskReplyJSON(taskIdT *taskId, int status, json_object *object)
 			      taskId->statusJ);
 		taskId->statusJ = NULL;
 
-		data = afb_data_json_c_hold(objmixin(reply, object));
-		afb_req_reply(taskId->request, status, 1, &data);
+		params[0] = afb_data_json_c_hold(objmixin(reply, object));
+		for (idx = 0; idx < ndata; idx++)
+			params[idx + 1] = data[idx];
+		afb_req_reply(taskId->request, status, 1 + ndata, params);
 		taskId->replied = true;
 	}
 }
 
+void spawnTaskReplyJSON(taskIdT *taskId, int status, json_object *object)
+{
+	spawnTaskReplyData(taskId, status, object, 0, NULL);
+}
+
 extern void end_timeout_monitor(taskIdT *taskId);
 
 void spawnFreeTaskId(taskIdT *taskId)
@@ -163,6 +884,23 @@ void spawnFreeTaskId(taskIdT *taskId)
 		afb_evfd_unref(taskId->srcout);
 	if (taskId->srcerr)
 		afb_evfd_unref(taskId->srcerr);
+	if (taskId->offload)
+		fd_watch_release(taskId->offload);
+	else if (taskId->uring)
+		uring_watch_release(taskId->uring);
+	else {
+		close(taskId->outfd);
+		close(taskId->errfd);
+	}
+
+	// release the events of the filtered subscribers
+	groups_free(taskId);
+
+	if (taskId->replay) {
+		text_ring_clear(taskId->replay);
+		free(taskId->replay);
+		pthread_mutex_destroy(&taskId->replaymutex);
+	}
 
 	// TimerEvtStop stop+free timer handle
 	end_timeout_monitor(taskId);
@@ -170,6 +908,8 @@ void spawnFreeTaskId(taskIdT *taskId)
 	if (taskId->request)
 		afb_req_unref(taskId->request);
 
+	json_object_put(taskId->argsJ);
+
 	if (taskId->uid)
 		free(taskId->uid);
 
@@ -178,14 +918,20 @@ void spawnFreeTaskId(taskIdT *taskId)
 	free(taskId);
 }
 
-static void taskPushFinalResponse(taskIdT *taskId)
+/** holds' access protection */
+static pthread_mutex_t holds_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+void spawnTaskHold(taskIdT *taskId)
 {
-	// try to read any remaining data before building exit status
-	if (taskId->verbose > 2)
-		AFB_REQ_INFO(taskId->request, "taskPushFinalResponse: uid=%s pid=%d [step-1: collect remaining data]",
-			     taskId->uid, taskId->pid);
+	pthread_mutex_lock(&holds_mutex);
+	taskId->holds++;
+	pthread_mutex_unlock(&holds_mutex);
+}
 
-	encoderClose(taskId->encoder, taskId);
+/** sends the final status of the task once its encoder is done, and frees it */
+static void taskEnd(taskIdT *taskId)
+{
+	encoderFinish(taskId->encoder, taskId);
 
 	if (taskId->verbose > 2)
 		AFB_REQ_INFO(taskId->request, "taskPushFinalResponse: uid=%s pid=%d [step-2: collect child status=%s]",
@@ -197,9 +943,35 @@ static void taskPushFinalResponse(taskIdT *taskId)
 	spawnFreeTaskId(taskId);
 }
 
-static int taskCtrlOne(afb_req_t request, taskIdT *taskId, taskActionE action, int signal, json_object **responseJ)
+void spawnTaskRelease(taskIdT *taskId)
+{
+	int holds;
+
+	pthread_mutex_lock(&holds_mutex);
+	holds = --taskId->holds;
+	pthread_mutex_unlock(&holds_mutex);
+	if (holds == 0)
+		taskEnd(taskId);
+}
+
+static void taskPushFinalResponse(taskIdT *taskId)
+{
+	// try to read any remaining data before building exit status
+	if (taskId->verbose > 2)
+		AFB_REQ_INFO(taskId->request, "taskPushFinalResponse: uid=%s pid=%d [step-1: collect remaining data]",
+			     taskId->uid, taskId->pid);
+
+	// the pipes are drained, the task may yet outlive them while its encoder holds it
+	spawnTaskPause(taskId);
+	encoderClose(taskId->encoder, taskId);
+	spawnTaskRelease(taskId);
+}
+
+static int taskCtrlOne(afb_req_t request, taskIdT *taskId, taskActionE action, int signal, json_object *filterJ,
+		       json_object **responseJ)
 {
 	int err;
+	json_object *replayJ;
 
 	if (taskId->verbose > 1)
 		AFB_REQ_INFO(request, "taskCtrlOne: sandbox=%s cmd=%s pid=%d action=%d", taskId->cmd->sandbox->uid,
@@ -210,12 +982,20 @@ static int taskCtrlOne(afb_req_t request, taskIdT *taskId, taskActionE action, i
 			kill(-taskId->pid, signal);
 		break;
 	case SPAWN_ACTION_SUBSCRIBE:
-		err = afb_req_subscribe(request, taskId->event);
+		// late subscribers get the kept events in the reply
+		if (taskId->replay) {
+			err = replay_subscribe(request, taskId, filterJ, &replayJ);
+			if (err)
+				goto OnErrorExit;
+			rp_jsonc_pack(responseJ, "{ss so}", "uid", taskId->uid, "replay", replayJ);
+			return 0;
+		}
+		err = groups_subscribe(request, taskId, filterJ);
 		if (err)
 			goto OnErrorExit;
 		break;
 	case SPAWN_ACTION_UNSUBSCRIBE:
-		err = afb_req_unsubscribe(request, taskId->event);
+		err = groups_unsubscribe(request, taskId);
 		if (err)
 			goto OnErrorExit;
 		break;
@@ -240,16 +1020,23 @@ static int spawnTaskControl(afb_req_t request, shellCmdT *cmd, taskActionE actio
 	int taskPid = 0;
 	int signal = SIGINT;
 	json_object *signalJ = NULL;
+	json_object *filterJ = NULL;
 
 	// if not argument kill all task attache to this cmd->cli
 	if (argsJ) {
-		err = rp_jsonc_unpack(argsJ, "{s?i s?o !}", "pid", &taskPid, "signal", &signalJ);
-		if (err || (!taskPid && !signalJ)) {
+		err = rp_jsonc_unpack(argsJ, "{s?i s?o s?o !}", "pid", &taskPid, "signal", &signalJ, "filter", &filterJ);
+		if (err || (!taskPid && !signalJ && !filterJ)) {
 			afb_req_reply(request, AFB_ERRNO_INVALID_REQUEST, 0, NULL);
 			return 1;
 		}
 	}
 
+	// only subscriptions are filtered
+	if (filterJ && (action != SPAWN_ACTION_SUBSCRIBE || group_check(filterJ))) {
+		afb_req_reply_string(request, AFB_ERRNO_INVALID_REQUEST, "invalid filter");
+		return 1;
+	}
+
 	if (signalJ) {
 		if (json_object_is_type(signalJ, json_type_int)) {
 			signal = json_object_get_int(signalJ);
@@ -272,7 +1059,7 @@ static int spawnTaskControl(afb_req_t request, shellCmdT *cmd, taskActionE actio
 			goto InternalError;
 		HASH_ITER(tidsHash, cmd->tids, taskId, tidNext)
 		{
-			err = taskCtrlOne(request, taskId, action, signal, &statusJ);
+			err = taskCtrlOne(request, taskId, action, signal, filterJ, &statusJ);
 			if (!err) {
 				json_object_array_add(responseJ, statusJ);
 			}
@@ -285,12 +1072,13 @@ static int spawnTaskControl(afb_req_t request, shellCmdT *cmd, taskActionE actio
 			goto InternalError;
 		HASH_FIND(tidsHash, cmd->tids, &taskPid, sizeof(int), taskId);
 		pthread_rwlock_unlock(&cmd->sem);
-		if (taskId) {
-			taskCtrlOne(request, taskId, action, signal, &responseJ);
-		} else {
+		if (!taskId) {
 			afb_req_reply_string(request, AFB_ERRNO_INVALID_REQUEST, "invalid pid");
 			return 1;
 		}
+		err = taskCtrlOne(request, taskId, action, signal, filterJ, &responseJ);
+		if (err)
+			goto InternalError;
 	}
 	data = afb_data_json_c_hold(responseJ);
 	afb_req_reply(request, 0, 1, &data);
@@ -306,21 +1094,29 @@ void spawnTaskVerb(afb_req_t request, shellCmdT *cmd, json_object *queryJ)
 	assert(cmd);
 	const char *action = "start";
 	json_object *argsJ = NULL;
+	const char *format = NULL;
+	taskFormatE taskFormat = SPAWN_FORMAT_JSON;
 	int err, verbose = -1;
 
 	// if not a valid formating then everything is args and action==start
 	if (queryJ) {
-		err = rp_jsonc_unpack(queryJ, "{s?s s?o s?i !}", "action", &action, "args", &argsJ, "verbose",
-				      &verbose);
+		err = rp_jsonc_unpack(queryJ, "{s?s s?o s?i s?s !}", "action", &action, "args", &argsJ, "verbose",
+				      &verbose, "format", &format);
 		if (err)
 			argsJ = queryJ;
+		else if (format != NULL && !strcasecmp(format, "cbor"))
+			taskFormat = SPAWN_FORMAT_CBOR;
+		else if (format != NULL && strcasecmp(format, "json")) {
+			afb_req_reply_string(request, AFB_ERRNO_INVALID_REQUEST, "invalid format");
+			return;
+		}
 	}
 	// default is not null but cmd->verbose and query can not set verbosity to more than 4
 	if (verbose < 0 || verbose > 4)
 		verbose = cmd->sandbox->verbose;
 
 	if (!strcasecmp(action, "start")) {
-		err = spawnTaskStart(request, cmd, argsJ, verbose);
+		err = spawnTaskStart(request, cmd, argsJ, verbose, taskFormat);
 		if (err)
 			goto OnErrorExit;
 
@@ -27,19 +27,49 @@
 #include <stdarg.h>
 #include "spawn-binding.h"
 
+/** format of the events of a task */
+typedef enum {
+	SPAWN_FORMAT_JSON,
+	SPAWN_FORMAT_CBOR,
+} taskFormatE;
+
 // spawn-subtask.c
 void spawnTaskVerb(afb_req_t request, shellCmdT *cmd, json_object *queryJ);
 void spawnChildUpdateStatus(taskIdT *taskId);
 void spawnFreeTaskId(taskIdT *taskId);
 
 // spawn-childexec.c
-int spawnTaskStart(afb_req_t request, shellCmdT *cmd, json_object *argsJ, int verbose);
+int spawnTaskStart(afb_req_t request, shellCmdT *cmd, json_object *argsJ, int verbose, taskFormatE format);
+
+// stop reading the output of the task until resumed, called while reading it
+void spawnTaskPause(taskIdT *taskId);
+// read the output of the paused task again, from any thread
+void spawnTaskResume(taskIdT *taskId);
 
 //
 void spawnTaskPushInitialStatus(taskIdT *taskId, json_object *object);
 void spawnTaskPushFinalStatus(taskIdT *taskId, json_object *object);
 void spawnTaskPushEventJSON(taskIdT *taskId, json_object *object);
 void spawnTaskReplyJSON(taskIdT *taskId, int status, json_object *object);
+
+// same as above but the data are appended after the JSON object (ownership of the data is transfered)
+void spawnTaskPushEventData(taskIdT *taskId, json_object *object, unsigned ndata, afb_data_t const data[]);
+void spawnTaskReplyData(taskIdT *taskId, int status, json_object *object, unsigned ndata, afb_data_t const data[]);
+
+// push an event whose field of name is the given valid JSON text, without parsing it
+// the members of the object extra (if not NULL) are added to the event
+void spawnTaskPushEventRaw(taskIdT *taskId, json_object *extra, const char *name, const char *json, size_t length);
 void spawnTaskLog(taskIdT *taskId, int lvl, const char *fmt, va_list args);
 
+// delay the final status and the release of the task until the matching spawnTaskRelease,
+// for output still encoded by other threads, from any thread
+void spawnTaskHold(taskIdT *taskId);
+void spawnTaskRelease(taskIdT *taskId);
+
+// arguments of the request that started the task (or NULL)
+json_object *spawnTaskArgs(taskIdT *taskId);
+
+// uid of the task as "sandbox/command@pid"
+const char *spawnTaskUid(taskIdT *taskId);
+
 #endif /* _SPAWN_SUBTASK_INCLUDE_ */
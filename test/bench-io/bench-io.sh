@@ -0,0 +1,65 @@
+#!/bin/bash
+#
+# I/O benchmark of the binder reading chatty children
+#
+# usage: bench-io.sh [children [lines [encoder...]]]
+#
+# For each encoder (default: log log-uring line line-uring), starts the given count of children
+# printing lines one write at a time and reports the system calls per second (counted by perf)
+# and the CPU time of the binder while they run. The -uring commands read the pipes with the
+# io_uring engine, the others with the afb_evfd of the binder event loop.
+
+HERE=$(dirname $0)
+BINDER=$(which afb-binder)
+CLIENT=$(which afb-client)
+SPAWN=$HERE/../../build/src/afb-spawn.so
+PORT=7947
+CHILDREN=${1:-100}
+LINES=${2:-20000}
+shift $(($# < 2 ? $# : 2))
+ENCODERS=${*:-log log-uring line line-uring}
+DURATION=5
+HZ=$(getconf CLK_TCK)
+
+if ! which perf > /dev/null 2>&1; then
+	echo "perf is required to count the system calls"
+	exit 1
+fi
+
+# CPU time of the process in ticks
+cputime() {
+	awk '{print $14 + $15}' /proc/$1/stat
+}
+
+LINES=$LINES $BINDER --binding $SPAWN:$HERE/bench-io.json -p $PORT --trap-faults=off >& /dev/null &
+BPID=$!
+
+trap "kill $BPID" EXIT
+
+sleep 1
+
+# perf follows the threads existing when it attaches, a first run of each encoder starts them
+for encoder in $ENCODERS
+do
+	echo "bench $encoder {\"action\":\"start\"}" | $CLIENT --sync localhost:$PORT/api > /dev/null 2>&1
+done
+sleep $DURATION
+
+printf "%-10s %10s %10s %10s\n" encoder children syscalls/s cpu%
+for encoder in $ENCODERS
+do
+	for ((i = 0; i < CHILDREN; i++)); do echo "bench $encoder {\"action\":\"start\"}"; done \
+		| $CLIENT --sync localhost:$PORT/api > /dev/null 2>&1 &
+	CPID=$!
+	START=$(cputime $BPID)
+	SYSCALLS=$(perf stat -x, -e raw_syscalls:sys_enter -p $BPID -- sleep $DURATION 2>&1 | awk -F, '/sys_enter/ {print $1}')
+	STOP=$(cputime $BPID)
+	wait $CPID
+	printf "%-10s %10d %10d %10d\n" $encoder $CHILDREN $((SYSCALLS / DURATION)) $(((STOP - START) * 100 / (HZ * DURATION)))
+
+	# let the children end before the next encoder
+	sleep $DURATION
+done
+
+kill $BPID
+trap "" EXIT
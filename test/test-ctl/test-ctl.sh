@@ -10,6 +10,7 @@ BOUT=$HERE/test-ctl.binder.result
 COUT=$HERE/test-ctl.client.result
 BREF=$HERE/test-ctl.binder.reference
 CREF=$HERE/test-ctl.client.reference
+SOUT=$HERE/test-ctl.stream.result
 
 PLUG=$BUILD/test-ctl-plug.so
 PLUGC=$HERE/test-ctl-plug.c
@@ -26,12 +27,36 @@ BPID=$!
 trap "kill $BPID 2>/dev/null" EXIT
 
 sleep 0.25
+
+# a client subscribes while the output streams, it must get each line once, replayed or live
+$CLIENT --sync --echo --human localhost:$PORT/api >& /dev/null << EOC &
+ctl streamed {"action":"start"}
+ctl wait {"action":"start"}
+ctl wait {"action":"start"}
+ctl wait {"action":"start"}
+EOC
+SPID=$!
+sleep 0.5
+$CLIENT --sync --echo --human localhost:$PORT/api >& $SOUT << EOC
+ctl streamed {"action":"subscribe"}
+ctl wait {"action":"start"}
+ctl wait {"action":"start"}
+EOC
+wait $SPID
+
 $CLIENT --sync --echo --human localhost:$PORT/api >& $COUT << EOC
 ctl ping true
 ctl call true
 ctl subcall true
 ctl distro {"action":"start"}
 ctl sync {"action":"start"}
+ctl filtered {"action":"start"}
+ctl filtered {"action":"subscribe","args":{"filter":{"stream":"stdout","events":["data","final-event"],"match":{"include":"error"}}}}
+ctl wait {"action":"start"}
+ctl replayed {"action":"start"}
+ctl wait {"action":"start"}
+ctl replayed {"action":"subscribe"}
+ctl wait {"action":"start"}
 ctl exit true
 EOC
 
@@ -39,14 +64,17 @@ kill $BPID
 trap "" EXIT
 
 sed -i '/"pid"/s/: *[0-9]*/:/' $COUT
+sed -i 's/@[0-9]*"/@"/' $COUT
+
+STREAM=$(sed -n 's/^ *"\([0-9]*\)",\?$/\1/p' $SOUT)
 
-if cmp --silent $BOUT $BREF && cmp --silent $COUT $CREF
+if cmp --silent $BOUT $BREF && cmp --silent $COUT $CREF && test "$STREAM" = "$(seq 1 30)"
 then
 	echo "ok - test ctl"
 else
 	echo "not ok - test ctl"
 	echo "  ---"
-	{ diff $BOUT $BREF ; diff $COUT $CREF ; } |
+	{ diff $BOUT $BREF ; diff $COUT $CREF ; diff <(echo "$STREAM") <(seq 1 30) ; } |
 	sed 's/^/  /'
 	echo "  ..."
 fi
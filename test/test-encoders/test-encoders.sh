@@ -10,10 +10,12 @@ COUT=$HERE/test-encoders.client.result
 BREF=$HERE/test-encoders.binder.reference
 CREF=$HERE/test-encoders.client.reference
 
-DIRTOLIST=$HERE $BINDER --binding $SPAWN:$HERE/test-encoders.json -p $PORT --trap-faults=off >& $BOUT &
+STATE=$(mktemp -d)
+
+DIRTOLIST=$HERE STATE=$STATE $BINDER --binding $SPAWN:$HERE/test-encoders.json -p $PORT --trap-faults=off >& $BOUT &
 BPID=$!
 
-trap "kill $BPID" EXIT
+trap "kill $BPID; rm -rf $STATE" EXIT
 
 sleep 1
 $CLIENT --sync --echo --human localhost:$PORT/api >& $COUT << EOC
@@ -32,9 +34,66 @@ encoders json {"action":"start"}
 encoders wait {"action":"start"}
 encoders log {"action":"start"}
 encoders wait {"action":"start"}
+encoders csv {"action":"start"}
+encoders wait {"action":"start"}
+encoders tsv {"action":"start"}
+encoders wait {"action":"start"}
+encoders logfmt {"action":"start"}
+encoders wait {"action":"start"}
+encoders columns {"action":"start"}
+encoders wait {"action":"start"}
+encoders netstring {"action":"start"}
+encoders wait {"action":"start"}
+encoders u32 {"action":"start"}
+encoders wait {"action":"start"}
+encoders cbor {"action":"start"}
+encoders wait {"action":"start"}
+encoders cbor-large {"action":"start"}
+encoders wait {"action":"start"}
+encoders diff {"action":"start"}
+encoders wait {"action":"start"}
+encoders diff {"action":"start"}
+encoders wait {"action":"start"}
+encoders diff {"action":"start"}
+encoders wait {"action":"start"}
+encoders diff-json {"action":"start"}
+encoders wait {"action":"start"}
+encoders diff-json {"action":"start"}
+encoders wait {"action":"start"}
+encoders diff-json {"action":"start"}
+encoders wait {"action":"start"}
+encoders dedup {"action":"start"}
+encoders wait {"action":"start"}
+encoders dedup-window {"action":"start"}
+encoders wait {"action":"start"}
+encoders agg {"action":"start"}
+encoders wait {"action":"start"}
+encoders agg-json {"action":"start"}
+encoders wait {"action":"start"}
+encoders sample {"action":"start"}
+encoders wait {"action":"start"}
+encoders pipeline {"action":"start"}
+encoders wait {"action":"start"}
+encoders pipeline-json {"action":"start"}
+encoders wait {"action":"start"}
+encoders v1 {"action":"start"}
+encoders wait {"action":"start"}
+encoders raw-gzip {"action":"start"}
+encoders wait {"action":"start"}
+encoders chunk-gzip {"action":"start"}
+encoders wait {"action":"start"}
+encoders log-gzip {"action":"start"}
+encoders wait {"action":"start"}
+encoders log-gunzip {"action":"start"}
+encoders wait {"action":"start"}
+encoders tee-delim {"action":"start"}
+encoders wait {"action":"start"}
+encoders tee-cat {"action":"start"}
+encoders wait {"action":"start"}
 EOC
 
 kill $BPID
+rm -rf $STATE
 trap "" EXIT
 
 sed -i '/"pid"/s/: *[0-9]*/:/' $COUT